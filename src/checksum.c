@@ -0,0 +1,687 @@
+/* checksum.c - Creation and verification of checksum files.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "gpa.h"
+#include "checksum.h"
+
+#ifndef O_BINARY
+#ifdef _O_BINARY
+#define O_BINARY	_O_BINARY
+#else
+#define O_BINARY	0
+#endif
+#endif
+
+/* The files are read in chunks of this size.  Large reads keep the
+   number of system calls low; the hash functions are the bottleneck
+   anyway.  */
+#define HASH_BUFFER_SIZE (1024 * 1024)
+
+/* The names of the checksum files in order of preference.  */
+static const struct
+{
+  const char *name;
+  GChecksumType type;
+} checksum_files[] =
+  {
+    { "sha512sum.txt", G_CHECKSUM_SHA512 },
+    { "sha256sum.txt", G_CHECKSUM_SHA256 }
+  };
+
+
+/* The parsed content of a checksum file.  */
+struct manifest_s
+{
+  GChecksumType type;
+  /* The file names in the order of the checksum file.  */
+  GPtrArray *names;
+  /* Mapping the file names to the hex encoded checksums.  */
+  GHashTable *digests;
+};
+typedef struct manifest_s *manifest_t;
+
+
+/* One file to hash.  */
+struct checksum_item_s
+{
+  struct checksum_job_s *job;
+  char *filename;
+  GChecksumType type;
+  /* The expected checksum or NULL if there is none.  Only used for
+     verification.  */
+  char *expected;
+  /* The computed checksum.  */
+  char *digest;
+  gpa_checksum_status_t status;
+};
+typedef struct checksum_item_s *checksum_item_t;
+
+
+struct checksum_job_s
+{
+  int verify;
+  GThreadPool *pool;
+  GPtrArray *items;
+  unsigned int done;
+  unsigned int nbad;
+  gpg_error_t err;
+  GpaChecksumFileFunc file_cb;
+  GpaChecksumDoneFunc done_cb;
+  gpointer data;
+};
+typedef struct checksum_job_s *checksum_job_t;
+
+
+
+const char *
+gpa_checksum_status_string (gpa_checksum_status_t status)
+{
+  switch (status)
+    {
+    case GPA_CHECKSUM_CREATED: return "CREATED";
+    case GPA_CHECKSUM_OK:      return "OK";
+    case GPA_CHECKSUM_BAD:     return "BAD";
+    case GPA_CHECKSUM_MISSING: return "MISSING";
+    case GPA_CHECKSUM_NOENTRY: return "NOENTRY";
+    }
+  return "?";
+}
+
+
+/* Return the name of the checksum file for TYPE.  */
+static const char *
+checksum_file_name (GChecksumType type)
+{
+  int i;
+
+  for (i = 0; i < DIM (checksum_files); i++)
+    if (checksum_files[i].type == type)
+      return checksum_files[i].name;
+  return NULL;
+}
+
+
+/* Return true if NAME is the name of a checksum file.  The type is
+   then stored at R_TYPE.  */
+static int
+is_checksum_file (const char *name, GChecksumType *r_type)
+{
+  int i;
+
+  for (i = 0; i < DIM (checksum_files); i++)
+    if (! strcmp (name, checksum_files[i].name))
+      {
+        if (r_type)
+          *r_type = checksum_files[i].type;
+        return 1;
+      }
+  return 0;
+}
+
+
+static void
+manifest_free (manifest_t manifest)
+{
+  if (! manifest)
+    return;
+  g_ptr_array_free (manifest->names, TRUE);
+  g_hash_table_destroy (manifest->digests);
+  g_free (manifest);
+}
+
+
+static manifest_t
+manifest_new (GChecksumType type)
+{
+  manifest_t manifest = g_malloc0 (sizeof (*manifest));
+
+  manifest->type = type;
+  manifest->names = g_ptr_array_new_with_free_func (g_free);
+  manifest->digests = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             NULL, g_free);
+  return manifest;
+}
+
+
+/* Set the checksum of NAME in MANIFEST to DIGEST.  */
+static void
+manifest_set (manifest_t manifest, const char *name, const char *digest)
+{
+  char *key;
+
+  if (! g_hash_table_lookup_extended (manifest->digests, name,
+                                      (gpointer *) &key, NULL))
+    {
+      key = g_strdup (name);
+      g_ptr_array_add (manifest->names, key);
+    }
+  g_hash_table_insert (manifest->digests, key, g_ascii_strdown (digest, -1));
+}
+
+
+/* Read the checksum file FNAME of TYPE.  Returns NULL and sets
+   R_ERR if the file can't be read; if it does not exist R_ERR is not
+   changed.  Lines which are not in the format of the sha256sum tool
+   are ignored.  */
+static manifest_t
+manifest_read (const char *fname, GChecksumType type, gpg_error_t *r_err)
+{
+  manifest_t manifest;
+  GError *error = NULL;
+  char *buffer;
+  char **lines;
+  int i;
+  size_t digestlen = 2 * g_checksum_type_get_length (type);
+
+  if (! g_file_get_contents (fname, &buffer, NULL, &error))
+    {
+      if (! g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+          g_debug ("error reading `%s': %s", fname, error->message);
+          *r_err = gpg_error (GPG_ERR_GENERAL);
+        }
+      g_error_free (error);
+      return NULL;
+    }
+
+  manifest = manifest_new (type);
+  lines = g_strsplit (buffer, "\n", -1);
+  g_free (buffer);
+  for (i = 0; lines[i]; i++)
+    {
+      char *line = lines[i];
+      size_t len = strlen (line);
+
+      if (len && line[len - 1] == '\r')
+        line[--len] = 0;
+      /* A line consists of the checksum, a space, a space or an
+         asterisk for binary mode and the file name.  */
+      if (len < digestlen + 3 || line[digestlen] != ' '
+          || (line[digestlen + 1] != ' ' && line[digestlen + 1] != '*'))
+        continue;
+      line[digestlen] = 0;
+      if (strspn (line, "0123456789abcdefABCDEF") != digestlen)
+        continue;
+      manifest_set (manifest, line + digestlen + 2, line);
+    }
+  g_strfreev (lines);
+
+  return manifest;
+}
+
+
+/* Write MANIFEST to the file FNAME.  */
+static gpg_error_t
+manifest_write (manifest_t manifest, const char *fname)
+{
+  GString *string = g_string_new (NULL);
+  GError *error = NULL;
+  gboolean okay;
+  int i;
+
+  for (i = 0; i < manifest->names->len; i++)
+    {
+      const char *name = g_ptr_array_index (manifest->names, i);
+
+      g_string_append_printf (string, "%s  %s\n",
+                              (char *) g_hash_table_lookup
+                              (manifest->digests, name), name);
+    }
+
+  okay = g_file_set_contents (fname, string->str, string->len, &error);
+  g_string_free (string, TRUE);
+  if (! okay)
+    {
+      g_debug ("error writing `%s': %s", fname, error->message);
+      g_error_free (error);
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+  return 0;
+}
+
+
+
+static void
+item_free (checksum_item_t item)
+{
+  g_free (item->filename);
+  g_free (item->expected);
+  g_free (item->digest);
+  g_free (item);
+}
+
+
+/* Add the file FILENAME to JOB unless it is already part of it.
+   SEEN holds the names of all files added so far.  */
+static void
+add_item (checksum_job_t job, GHashTable *seen, const char *filename,
+          GChecksumType type, const char *expected)
+{
+  checksum_item_t item;
+
+  if (g_hash_table_lookup (seen, filename))
+    return;
+
+  item = g_malloc0 (sizeof (*item));
+  item->job = job;
+  item->filename = g_strdup (filename);
+  item->type = type;
+  item->expected = expected ? g_ascii_strdown (expected, -1) : NULL;
+  g_ptr_array_add (job->items, item);
+  g_hash_table_insert (seen, item->filename, item);
+}
+
+
+/* Compute the checksum of the file of ITEM and store it as hex
+   string.  Returns false if the file can't be read.  */
+static int
+hash_file (checksum_item_t item)
+{
+  GChecksum *checksum;
+  char *buffer;
+  int fd;
+  ssize_t nread;
+
+  fd = g_open (item->filename, O_RDONLY | O_BINARY, 0);
+  if (fd < 0)
+    return 0;
+
+  checksum = g_checksum_new (item->type);
+  buffer = g_malloc (HASH_BUFFER_SIZE);
+  do
+    {
+      do
+        nread = read (fd, buffer, HASH_BUFFER_SIZE);
+      while (nread < 0 && errno == EINTR);
+      if (nread > 0)
+        g_checksum_update (checksum, (guchar *) buffer, nread);
+    }
+  while (nread > 0);
+  g_free (buffer);
+  close (fd);
+
+  if (! nread)
+    item->digest = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return ! nread;
+}
+
+
+static void finish_job (checksum_job_t job);
+
+/* Report the result of ITEM.  Called from the main loop.  */
+static gboolean
+item_done_cb (gpointer data)
+{
+  checksum_item_t item = data;
+  checksum_job_t job = item->job;
+
+  job->done++;
+  if (item->status != GPA_CHECKSUM_CREATED && item->status != GPA_CHECKSUM_OK)
+    job->nbad++;
+  if (job->file_cb)
+    job->file_cb (item->filename, item->status, job->done, job->items->len,
+                  job->data);
+  if (job->done == job->items->len)
+    finish_job (job);
+
+  return FALSE;
+}
+
+
+/* The function run by the threads of the pool for each item.  */
+static void
+hash_item (gpointer data, gpointer user_data)
+{
+  checksum_item_t item = data;
+  checksum_job_t job = user_data;
+
+  if (job->verify && ! item->expected)
+    item->status = GPA_CHECKSUM_NOENTRY;
+  else if (! hash_file (item))
+    item->status = GPA_CHECKSUM_MISSING;
+  else if (! job->verify)
+    item->status = GPA_CHECKSUM_CREATED;
+  else if (! strcmp (item->digest, item->expected))
+    item->status = GPA_CHECKSUM_OK;
+  else
+    item->status = GPA_CHECKSUM_BAD;
+
+  g_idle_add (item_done_cb, item);
+}
+
+
+/* Write the checksums of all created items of JOB to the checksum
+   files of their directories.  Existing entries for other files are
+   kept.  */
+static gpg_error_t
+write_manifests (checksum_job_t job)
+{
+  gpg_error_t err = 0;
+  GHashTable *manifests;
+  GHashTableIter iter;
+  gpointer key, value;
+  int i;
+
+  manifests = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                     (GDestroyNotify) manifest_free);
+  for (i = 0; i < job->items->len; i++)
+    {
+      checksum_item_t item = g_ptr_array_index (job->items, i);
+      manifest_t manifest;
+      char *dirname;
+      char *fname;
+      char *basename;
+
+      if (item->status != GPA_CHECKSUM_CREATED)
+        continue;
+
+      dirname = g_path_get_dirname (item->filename);
+      fname = g_build_filename (dirname, checksum_file_name (item->type),
+                                NULL);
+      g_free (dirname);
+      manifest = g_hash_table_lookup (manifests, fname);
+      if (! manifest)
+        {
+          manifest = manifest_read (fname, item->type, &err);
+          if (! manifest)
+            manifest = manifest_new (item->type);
+          g_hash_table_insert (manifests, fname, manifest);
+        }
+      else
+        g_free (fname);
+
+      basename = g_path_get_basename (item->filename);
+      manifest_set (manifest, basename, item->digest);
+      g_free (basename);
+    }
+
+  g_hash_table_iter_init (&iter, manifests);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      gpg_error_t err2 = manifest_write (value, key);
+      if (err2 && ! err)
+        err = err2;
+    }
+  g_hash_table_destroy (manifests);
+
+  return err;
+}
+
+
+static void
+finish_job (checksum_job_t job)
+{
+  if (job->pool)
+    g_thread_pool_free (job->pool, FALSE, TRUE);
+
+  if (! job->verify)
+    {
+      gpg_error_t err = write_manifests (job);
+      if (err && ! job->err)
+        job->err = err;
+    }
+
+  if (job->done_cb)
+    job->done_cb (job->err, job->nbad, job->data);
+
+  g_ptr_array_free (job->items, TRUE);
+  g_free (job);
+}
+
+
+static gboolean
+finish_empty_job_cb (gpointer data)
+{
+  finish_job (data);
+  return FALSE;
+}
+
+
+/* Start hashing the items of JOB.  */
+static void
+run_job (checksum_job_t job)
+{
+  GError *error = NULL;
+  int i;
+
+  if (! job->items->len)
+    {
+      if (! job->err)
+        job->err = gpg_error (GPG_ERR_NO_DATA);
+      g_idle_add (finish_empty_job_cb, job);
+      return;
+    }
+
+  job->pool = g_thread_pool_new (hash_item, job,
+                                 MIN (g_get_num_processors (),
+                                      job->items->len),
+                                 FALSE, &error);
+  if (! job->pool)
+    {
+      /* Without threads the files are hashed one after the other
+         before returning.  */
+      g_debug ("error creating thread pool: %s", error->message);
+      g_error_free (error);
+      for (i = 0; i < job->items->len; i++)
+        hash_item (g_ptr_array_index (job->items, i), job);
+      return;
+    }
+
+  for (i = 0; i < job->items->len; i++)
+    g_thread_pool_push (job->pool, g_ptr_array_index (job->items, i), NULL);
+}
+
+
+static checksum_job_t
+job_new (int verify, GpaChecksumFileFunc file_cb,
+         GpaChecksumDoneFunc done_cb, gpointer data)
+{
+  checksum_job_t job = g_malloc0 (sizeof (*job));
+
+  job->verify = verify;
+  job->items = g_ptr_array_new_with_free_func ((GDestroyNotify) item_free);
+  job->file_cb = file_cb;
+  job->done_cb = done_cb;
+  job->data = data;
+  return job;
+}
+
+
+
+void
+gpa_checksum_create (GList *filenames, GChecksumType type,
+                     GpaChecksumFileFunc file_cb,
+                     GpaChecksumDoneFunc done_cb, gpointer data)
+{
+  checksum_job_t job;
+  GHashTable *seen;
+  GList *cur;
+
+  g_return_if_fail (checksum_file_name (type));
+
+  job = job_new (0, file_cb, done_cb, data);
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (cur = filenames; cur; cur = g_list_next (cur))
+    {
+      const char *filename = cur->data;
+      GDir *dir;
+      const char *name;
+
+      if (! g_file_test (filename, G_FILE_TEST_IS_DIR))
+        {
+          char *basename = g_path_get_basename (filename);
+          if (! is_checksum_file (basename, NULL))
+            add_item (job, seen, filename, type, NULL);
+          g_free (basename);
+          continue;
+        }
+
+      dir = g_dir_open (filename, 0, NULL);
+      if (! dir)
+        {
+          add_item (job, seen, filename, type, NULL);
+          continue;
+        }
+      while ((name = g_dir_read_name (dir)))
+        {
+          char *fname = g_build_filename (filename, name, NULL);
+
+          if (! is_checksum_file (name, NULL)
+              && g_file_test (fname, G_FILE_TEST_IS_REGULAR))
+            add_item (job, seen, fname, type, NULL);
+          g_free (fname);
+        }
+      g_dir_close (dir);
+    }
+  g_hash_table_destroy (seen);
+
+  run_job (job);
+}
+
+
+/* Return the manifest FNAME of TYPE from the cache MANIFESTS, reading
+   it if necessary.  */
+static manifest_t
+get_manifest (GHashTable *manifests, const char *fname, GChecksumType type,
+              gpg_error_t *r_err)
+{
+  manifest_t manifest;
+
+  if (g_hash_table_lookup_extended (manifests, fname, NULL,
+                                    (gpointer *) &manifest))
+    return manifest;
+
+  manifest = manifest_read (fname, type, r_err);
+  g_hash_table_insert (manifests, g_strdup (fname), manifest);
+  return manifest;
+}
+
+
+/* Add all files listed in MANIFEST of the directory DIRNAME.  */
+static void
+add_manifest_items (checksum_job_t job, GHashTable *seen,
+                    const char *dirname, manifest_t manifest)
+{
+  int i;
+
+  for (i = 0; i < manifest->names->len; i++)
+    {
+      const char *name = g_ptr_array_index (manifest->names, i);
+      char *fname = g_build_filename (dirname, name, NULL);
+
+      add_item (job, seen, fname, manifest->type,
+                g_hash_table_lookup (manifest->digests, name));
+      g_free (fname);
+    }
+}
+
+
+void
+gpa_checksum_verify (GList *filenames,
+                     GpaChecksumFileFunc file_cb,
+                     GpaChecksumDoneFunc done_cb, gpointer data)
+{
+  checksum_job_t job = job_new (1, file_cb, done_cb, data);
+  GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+  GHashTable *manifests;
+  GList *cur;
+
+  manifests = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                     (GDestroyNotify) manifest_free);
+
+  for (cur = filenames; cur; cur = g_list_next (cur))
+    {
+      const char *filename = cur->data;
+      char *dirname;
+      char *basename;
+      GChecksumType type;
+      manifest_t manifest = NULL;
+      int i;
+
+      if (g_file_test (filename, G_FILE_TEST_IS_DIR))
+        {
+          /* Verify all files listed in the checksum files of the
+             directory.  */
+          int found = 0;
+
+          for (i = 0; i < DIM (checksum_files); i++)
+            {
+              char *fname = g_build_filename (filename,
+                                              checksum_files[i].name, NULL);
+              manifest = get_manifest (manifests, fname,
+                                       checksum_files[i].type, &job->err);
+              g_free (fname);
+              if (manifest)
+                {
+                  add_manifest_items (job, seen, filename, manifest);
+                  found = 1;
+                }
+            }
+          if (! found)
+            add_item (job, seen, filename, G_CHECKSUM_SHA256, NULL);
+          continue;
+        }
+
+      dirname = g_path_get_dirname (filename);
+      basename = g_path_get_basename (filename);
+      if (is_checksum_file (basename, &type))
+        {
+          manifest = get_manifest (manifests, filename, type, &job->err);
+          if (manifest)
+            add_manifest_items (job, seen, dirname, manifest);
+          else
+            add_item (job, seen, filename, type, NULL);
+        }
+      else
+        {
+          /* Look up the file in the checksum files of its
+             directory.  */
+          const char *expected = NULL;
+
+          for (i = 0; ! expected && i < DIM (checksum_files); i++)
+            {
+              char *fname = g_build_filename (dirname,
+                                              checksum_files[i].name, NULL);
+              manifest = get_manifest (manifests, fname,
+                                       checksum_files[i].type, &job->err);
+              g_free (fname);
+              if (manifest)
+                expected = g_hash_table_lookup (manifest->digests, basename);
+            }
+          add_item (job, seen, filename,
+                    expected ? manifest->type : G_CHECKSUM_SHA256, expected);
+        }
+      g_free (dirname);
+      g_free (basename);
+    }
+  g_hash_table_destroy (manifests);
+  g_hash_table_destroy (seen);
+
+  run_job (job);
+}
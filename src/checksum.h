@@ -0,0 +1,73 @@
+/* checksum.h - Creation and verification of checksum files.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+/* The checksums are stored in files named "sha256sum.txt" or
+   "sha512sum.txt" in the directory of the files, using the format of
+   the sha256sum tool.  The files are hashed by a pool of threads;
+   the callbacks are always called from the main loop.  */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <glib.h>
+#include <gpg-error.h>
+
+/* The result for one file.  */
+typedef enum
+  {
+    GPA_CHECKSUM_CREATED,   /* The checksum has been computed.  */
+    GPA_CHECKSUM_OK,        /* The file matches its checksum.  */
+    GPA_CHECKSUM_BAD,       /* The file does not match its checksum.  */
+    GPA_CHECKSUM_MISSING,   /* The file can't be read.  */
+    GPA_CHECKSUM_NOENTRY    /* No checksum is known for the file.  */
+  } gpa_checksum_status_t;
+
+/* Called for each file with its STATUS; DONE of TOTAL files have
+   been processed.  */
+typedef void (*GpaChecksumFileFunc) (const char *filename,
+                                     gpa_checksum_status_t status,
+                                     unsigned int done, unsigned int total,
+                                     gpointer data);
+
+/* Called when all files have been processed.  ERR is set if a
+   checksum file could not be read or written; NBAD is the number of
+   files not having the status CREATED or OK.  */
+typedef void (*GpaChecksumDoneFunc) (gpg_error_t err, unsigned int nbad,
+                                     gpointer data);
+
+
+/* Return a string describing STATUS for use in status lines.  */
+const char *gpa_checksum_status_string (gpa_checksum_status_t status);
+
+/* Compute the checksums of the files FILENAMES using TYPE, which
+   must be G_CHECKSUM_SHA256 or G_CHECKSUM_SHA512, and write them to
+   the checksum files of their directories.  For a directory all
+   regular files in it are used.  */
+void gpa_checksum_create (GList *filenames, GChecksumType type,
+                          GpaChecksumFileFunc file_cb,
+                          GpaChecksumDoneFunc done_cb, gpointer data);
+
+/* Verify the files FILENAMES.  For a checksum file all files listed
+   in it are verified, for a directory all files listed in its
+   checksum files and for any other file the entry in the checksum
+   file of its directory.  */
+void gpa_checksum_verify (GList *filenames,
+                          GpaChecksumFileFunc file_cb,
+                          GpaChecksumDoneFunc done_cb, gpointer data);
+
+#endif /* CHECKSUM_H */
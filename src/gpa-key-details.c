@@ -610,6 +610,30 @@ build_tofu_page (GpaKeyDetails *kdt, gpgme_key_t key)
 }
 
 
+/* Called when the secret keytable has been filled to update the
+   parts of the details which depend on the secret key.  */
+static void
+secret_ready_cb (gpointer data)
+{
+  GpaKeyDetails *kdt = data;
+
+  if (!kdt->current_key)
+    return;
+  details_page_fill_key (kdt, kdt->current_key);
+  if (kdt->subkeys_list)
+    gpa_subkey_list_set_key (kdt->subkeys_list, kdt->current_key);
+}
+
+
+/* Signal handler for the "destroy" signal.  */
+static void
+destroy_cb (GtkWidget *widget, gpointer param)
+{
+  gpa_keytable_cancel_ready (gpa_keytable_get_secret_instance (),
+                             secret_ready_cb, widget);
+}
+
+
 /* Signal handler for the "changed_ui_mode" signal.  */
 static void
 ui_mode_changed (GpaOptions *options, gpointer param)
@@ -647,6 +671,8 @@ construct_main_widget (GpaKeyDetails *kdt)
   g_signal_connect (G_OBJECT (gpa_options_get_instance ()),
 		    "changed_ui_mode",
                     G_CALLBACK (ui_mode_changed), kdt);
+  g_signal_connect (G_OBJECT (kdt), "destroy",
+                    G_CALLBACK (destroy_cb), NULL);
 }
 
 
@@ -796,6 +822,8 @@ gpa_key_details_update (GtkWidget *keydetails, gpgme_key_t key, int keycount)
       gpgme_key_unref (kdt->current_key);
       kdt->current_key = NULL;
     }
+  gpa_keytable_cancel_ready (gpa_keytable_get_secret_instance (),
+                             secret_ready_cb, kdt);
 
   if (key && keycount == 1)
     {
@@ -816,6 +844,12 @@ gpa_key_details_update (GtkWidget *keydetails, gpgme_key_t key, int keycount)
           build_signatures_page (kdt, key);
           build_subkeys_page (kdt, key);
         }
+
+      /* Whether the key has a secret part is not known before the
+         secret keytable has been filled.  */
+      if (!gpa_keytable_get_secret_instance ()->initialized)
+        gpa_keytable_when_ready (gpa_keytable_get_secret_instance (),
+                                 secret_ready_cb, kdt);
     }
   else
     {
@@ -63,6 +63,12 @@ gboolean debug_edit_fsm;
 /* True if verbose messages are requested.  */
 gboolean verbose;
 
+/* True if a snapshot of the key listing shall be used at startup.  */
+gboolean keylist_cache;
+
+/* True if only the UI server runs, without GTK and any windows.  */
+gboolean headless;
+
 /* Local variables.  */
 typedef struct
 {
@@ -85,6 +91,9 @@ static gpa_args_t args;
 
 static GtkApplication *gpa_application;
 
+/* The main loop used instead of GPA_APPLICATION in headless mode.  */
+static GMainLoop *headless_loop;
+
 /* The copyright notice.  */
 static const char *copyright =
 "Copyright (C) 2000-2002 Miguel Coca, G-N-U GmbH, Intevation GmbH.\n"
@@ -120,8 +129,12 @@ static GOptionEntry option_entries[] =
       N_("Open the settings dialog"), NULL },
     { "daemon", 'd', 0, G_OPTION_ARG_NONE, &args.start_only_server,
       N_("Only start the UI server"), NULL },
+    { "headless", 0, 0, G_OPTION_ARG_NONE, &headless,
+      N_("Only start the UI server, without a display"), NULL },
     { "disable-x509", 0, 0, G_OPTION_ARG_NONE, &args.disable_x509,
       N_("Disable support for X.509"), NULL },
+    { "keylist-cache", 0, 0, G_OPTION_ARG_NONE, &keylist_cache,
+      N_("Show cached keys until the keyring has been listed"), NULL },
     { "options", 'o', 0, G_OPTION_ARG_FILENAME, &args.options_filename,
       N_("Read options from file"), "FILE" },
     { "no-remote", 0, 0, G_OPTION_ARG_NONE, &args.no_remote,
@@ -474,6 +487,17 @@ GtkApplication *get_gpa_application()
   return gpa_application;
 }
 
+
+/* Terminate the main loop.  */
+void
+gpa_quit (void)
+{
+  if (headless_loop)
+    g_main_loop_quit (headless_loop);
+  else
+    g_application_quit (G_APPLICATION (gpa_application));
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -481,6 +505,7 @@ main (int argc, char *argv[])
   GOptionContext *context;
   char *configname = NULL;
   char *keyservers_configname = NULL;
+  int server_started = 0;
   int status;
 
   /* Under W32 logging is disabled by default to prevent MS Windows NT
@@ -501,7 +526,8 @@ main (int argc, char *argv[])
   g_option_context_set_translation_domain (context, PACKAGE);
 #endif
   g_option_context_add_main_entries (context, option_entries, PACKAGE);
-  g_option_context_add_group (context, gtk_get_option_group (TRUE));
+  /* GTK is initialized below unless we are headless.  */
+  g_option_context_add_group (context, gtk_get_option_group (FALSE));
 
   if (! g_option_context_parse (context, &argc, &argv, &err))
     {
@@ -530,22 +556,38 @@ main (int argc, char *argv[])
                          | G_LOG_LEVEL_INFO, dummy_log_func, NULL);
     }
 
-  gtk_init (&argc, &argv);
+  /* In headless mode neither GTK nor the application are set up.
+     The UI server commands which need windows are refused then, and
+     so are files and windows requested on the command line.  */
+  if (headless && (optind < argc
+                   || args.start_key_manager || args.start_file_manager
+                   || args.start_clipboard || args.start_settings
+                   || args.start_card_manager))
+    {
+      fprintf (stderr, "gpa: no windows or files with --headless\n");
+      return 1;
+    }
+  if (headless)
+    args.start_only_server = TRUE;
+  else
+    {
+      gtk_init (&argc, &argv);
 #ifdef G_OS_WIN32
-  gtk_settings_set_string_property(gtk_settings_get_default(),
-                                   "gtk-theme-name",
-                                   "MS-Windows",
-                                   "XProperty");
+      gtk_settings_set_string_property(gtk_settings_get_default(),
+                                       "gtk-theme-name",
+                                       "MS-Windows",
+                                       "XProperty");
 #endif
 
-  gpa_application = gtk_application_new ("org.gnupg.gpa", 0);
+      gpa_application = gtk_application_new ("org.gnupg.gpa", 0);
 
-  /* Default icon for all windows.  */
-  gtk_window_set_default_icon_from_file (GPA_DATADIR "/gpa.png", &err);
-  if (err)
-    g_error_free (err);
+      /* Default icon for all windows.  */
+      gtk_window_set_default_icon_from_file (GPA_DATADIR "/gpa.png", &err);
+      if (err)
+        g_error_free (err);
 
-  gpa_register_stock_items ();
+      gpa_register_stock_items ();
+    }
 
 #ifdef IS_DEVELOPMENT_VERSION
   fprintf (stderr, "NOTE: This is a development version!\n");
@@ -612,7 +654,8 @@ main (int argc, char *argv[])
   cms_hack = !args.disable_x509;
 
   /* Start the default component.  */
-  if (!args.start_key_manager
+  if (!headless
+      && !args.start_key_manager
       && !args.start_file_manager
       && !args.start_clipboard
       && !args.start_settings
@@ -633,7 +676,7 @@ main (int argc, char *argv[])
   switch (gpa_check_server ())
     {
     case 0: /* No running server on the expected socket.  Start one.  */
-      gpa_start_server ();
+      server_started = !gpa_start_server ();
       break;
     case 1: /* An old instance or a differen UI server is already running.
                Do not start a server.  */
@@ -648,6 +691,13 @@ main (int argc, char *argv[])
       break;
     }
 
+  /* Without the server a headless instance has nothing to do.  */
+  if (headless && !server_started)
+    {
+      fprintf (stderr, "gpa: can't start the UI server\n");
+      return 1;
+    }
+
   /* Locate the list of keyservers.  */
   keyservers_configname = g_build_filename (gnupg_homedir, "keyservers", NULL);
 
@@ -673,6 +723,15 @@ main (int argc, char *argv[])
   start_data.argc = argc;
   start_data.start_only_server = args.start_only_server;
 
+  if (headless)
+    {
+      headless_loop = g_main_loop_new (NULL, FALSE);
+      g_main_loop_run (headless_loop);
+      g_main_loop_unref (headless_loop);
+      headless_loop = NULL;
+      return 0;
+    }
+
   g_signal_connect (gpa_application, "activate", G_CALLBACK(activate), &start_data);
 
   status = g_application_run (G_APPLICATION (gpa_application), start_data.argc, start_data.argv);
@@ -63,6 +63,8 @@ extern gboolean cms_hack;
 extern gboolean disable_ticker;
 extern gboolean debug_edit_fsm;
 extern gboolean verbose;
+extern gboolean keylist_cache;
+extern gboolean headless;
 
 /* Show the keyring editor dialog.  */
 void gpa_open_key_manager (GSimpleAction *simple, GVariant *parameter, gpointer user_data);
@@ -106,7 +108,7 @@ static const GActionEntry gpa_preferences_menu_g_action_entries[] =
 typedef void (*GPADefaultKeyChanged) (gpointer user_data);
 
 void gpa_run_server_continuation (assuan_context_t ctx, gpg_error_t err);
-void gpa_start_server (void);
+int  gpa_start_server (void);
 void gpa_stop_server (void);
 int  gpa_check_server (void);
 gpg_error_t gpa_send_to_server (const char *cmd);
@@ -122,6 +124,7 @@ gpa_filewatch_id_t gpa_add_filewatch (const char *filename,
                                       void *cb_data);
 
 GtkApplication *get_gpa_application();
+void gpa_quit (void);
 
 /*-- utils.c --*/
 /* We are so used to these function thus provide them.  */
@@ -31,6 +31,14 @@
 static void gpa_context_init (GpaContext *context);
 static void gpa_context_class_init (GpaContextClass *klass);
 static void gpa_context_finalize (GObject *object);
+static GObject *gpa_context_constructor
+	(GType type, guint n_construct_properties,
+	 GObjectConstructParam *construct_properties);
+static void gpa_context_set_property (GObject *object, guint prop_id,
+                                      const GValue *value,
+                                      GParamSpec *pspec);
+static void gpa_context_get_property (GObject *object, guint prop_id,
+                                      GValue *value, GParamSpec *pspec);
 
 
 /* Default signal handlers */
@@ -70,9 +78,30 @@ enum
   LAST_SIGNAL
 };
 
+/* Properties */
+enum
+{
+  PROP_0,
+  PROP_PROTOCOL
+};
+
 static GObjectClass *parent_class = NULL;
 static guint signals [LAST_SIGNAL] = { 0 };
 
+/* The maximum number of unused gpgme contexts kept per protocol.  */
+#define MAX_POOLED_CONTEXTS 8
+
+/* Unused gpgme contexts of the OpenPGP and the CMS protocol which
+   are handed out to new GpaContext objects.  A pooled CMS context
+   keeps its connection to gpgsm.  */
+static GSList *context_pool[2];
+static guint context_pool_size[2];
+
+/* The number of operations finished by all contexts and their total
+   duration in microseconds.  */
+static unsigned long total_count;
+static guint64 total_usec;
+
 GType
 gpa_context_get_type (void)
 {
@@ -108,7 +137,10 @@ gpa_context_class_init (GpaContextClass *klass)
 
   parent_class = g_type_class_peek_parent (klass);
 
+  object_class->constructor = gpa_context_constructor;
   object_class->finalize = gpa_context_finalize;
+  object_class->set_property = gpa_context_set_property;
+  object_class->get_property = gpa_context_get_property;
 
   klass->start = gpa_context_start;
   klass->done = gpa_context_done;
@@ -161,25 +193,163 @@ gpa_context_class_init (GpaContextClass *klass)
                         g_cclosure_marshal_VOID__INT,
                         G_TYPE_NONE, 2,
 			G_TYPE_INT);
+
+  /* Properties */
+  g_object_class_install_property
+    (object_class, PROP_PROTOCOL,
+     g_param_spec_int
+     ("protocol", "Protocol",
+      "The gpgme protocol the context is used for.",
+      GPGME_PROTOCOL_OpenPGP, GPGME_PROTOCOL_UNKNOWN, GPGME_PROTOCOL_OpenPGP,
+      G_PARAM_READWRITE|G_PARAM_CONSTRUCT_ONLY));
 }
 
 static void
 gpa_context_init (GpaContext *context)
 {
-  gpg_error_t err;
-
   context->busy = FALSE;
   context->inhibit_gpgme_events = 0;
+  context->protocol = GPGME_PROTOCOL_OpenPGP;
 
   /* The callback queue */
   context->cbs = NULL;
+}
+
+
+static void
+gpa_context_set_property (GObject *object, guint prop_id,
+                          const GValue *value, GParamSpec *pspec)
+{
+  GpaContext *context = GPA_CONTEXT (object);
+
+  switch (prop_id)
+    {
+    case PROP_PROTOCOL:
+      context->protocol = g_value_get_int (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+
+static void
+gpa_context_get_property (GObject *object, guint prop_id,
+                          GValue *value, GParamSpec *pspec)
+{
+  GpaContext *context = GPA_CONTEXT (object);
+
+  switch (prop_id)
+    {
+    case PROP_PROTOCOL:
+      g_value_set_int (value, context->protocol);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+
+/* Return the index into CONTEXT_POOL for PROTOCOL or -1 if contexts
+   of PROTOCOL are not pooled.  */
+static int
+pool_index (gpgme_protocol_t protocol)
+{
+  if (protocol == GPGME_PROTOCOL_OpenPGP)
+    return 0;
+  if (protocol == GPGME_PROTOCOL_CMS)
+    return 1;
+  return -1;
+}
+
+
+/* Store a gpgme context for PROTOCOL at R_CTX.  A pooled context of
+   PROTOCOL is preferred over a pooled one of the other protocol,
+   which is preferred over a new one.  */
+static gpg_error_t
+take_gpgme_context (gpgme_protocol_t protocol, gpgme_ctx_t *r_ctx)
+{
+  int idx = pool_index (protocol);
+  gpg_error_t err;
+
+  if (idx == -1 || !context_pool[idx])
+    idx = context_pool[0] ? 0 : context_pool[1] ? 1 : -1;
+  if (idx != -1)
+    {
+      *r_ctx = context_pool[idx]->data;
+      context_pool[idx] = g_slist_delete_link (context_pool[idx],
+                                               context_pool[idx]);
+      context_pool_size[idx]--;
+    }
+  else
+    {
+      err = gpgme_new (r_ctx);
+      if (err)
+        return err;
+    }
+
+  err = gpgme_set_protocol (*r_ctx, protocol);
+  if (err)
+    {
+      gpgme_release (*r_ctx);
+      *r_ctx = NULL;
+    }
+  return err;
+}
+
+
+/* Reset CTX to the defaults and put it into the pool.  If it is
+   BUSY, has settings which can't be reset or the pool is full, it is
+   released instead.  */
+static void
+recycle_gpgme_context (gpgme_ctx_t ctx, gboolean busy)
+{
+  int idx = pool_index (gpgme_get_protocol (ctx));
+  const char *akl = gpgme_get_ctx_flag (ctx, "auto-key-locate");
+
+  if (busy || idx == -1 || context_pool_size[idx] >= MAX_POOLED_CONTEXTS
+      || (akl && *akl))
+    {
+      gpgme_release (ctx);
+      return;
+    }
+
+  gpgme_set_armor (ctx, 0);
+  gpgme_set_textmode (ctx, 0);
+  gpgme_set_include_certs (ctx, GPGME_INCLUDE_CERTS_DEFAULT);
+  gpgme_set_keylist_mode (ctx, GPGME_KEYLIST_MODE_LOCAL);
+  gpgme_signers_clear (ctx);
+  gpgme_sig_notation_clear (ctx);
+  gpgme_set_passphrase_cb (ctx, NULL, NULL);
+  gpgme_set_progress_cb (ctx, NULL, NULL);
+  gpgme_set_io_cbs (ctx, NULL);
+
+  context_pool[idx] = g_slist_prepend (context_pool[idx], ctx);
+  context_pool_size[idx]++;
+}
+
+
+static GObject *
+gpa_context_constructor (GType type, guint n_construct_properties,
+                         GObjectConstructParam *construct_properties)
+{
+  GObject *object;
+  GpaContext *context;
+  gpg_error_t err;
+
+  object = parent_class->constructor (type,
+				      n_construct_properties,
+				      construct_properties);
+  context = GPA_CONTEXT (object);
 
   /* The context itself */
-  err = gpgme_new (&context->ctx);
+  err = take_gpgme_context (context->protocol, &context->ctx);
   if (err)
     {
       gpa_gpgme_warning (err);
-      return;
+      return object;
     }
 
   /* Set the appropriate callbacks.  Note that we can't set the
@@ -200,6 +370,8 @@ gpa_context_init (GpaContext *context)
   context->io_cbs->event_priv = context;
   /* Set the callbacks */
   gpgme_set_io_cbs (context->ctx, context->io_cbs);
+
+  return object;
 }
 
 
@@ -208,7 +380,8 @@ gpa_context_finalize (GObject *object)
 {
   GpaContext *context = GPA_CONTEXT (object);
 
-  gpgme_release (context->ctx);
+  if (context->ctx)
+    recycle_gpgme_context (context->ctx, context->busy);
   g_list_free (context->cbs);
   g_free (context->io_cbs);
 
@@ -229,6 +402,18 @@ gpa_context_new (void)
   return context;
 }
 
+
+/* Create a new GpaContext object for PROTOCOL.  */
+GpaContext *
+gpa_context_new_for_protocol (gpgme_protocol_t protocol)
+{
+  GpaContext *context;
+
+  context = g_object_new (GPA_CONTEXT_TYPE, "protocol", protocol, NULL);
+
+  return context;
+}
+
 /* TRUE if an operation is in progress.
  */
 gboolean
@@ -241,6 +426,29 @@ gpa_context_busy (GpaContext *context)
 }
 
 
+/* Report that the current operation of CONTEXT has read DONE bytes
+   of TOTAL.  The "progress" signal is emitted with the progress in
+   permille only if it changed.  */
+void
+gpa_context_data_progress (GpaContext *context, guint64 done, guint64 total)
+{
+  int permille;
+
+  g_return_if_fail (GPA_IS_CONTEXT (context));
+
+  context->bytes_done = done;
+  context->bytes_total = total;
+  if (!total)
+    return;
+
+  permille = done >= total ? 1000 : (int) (done * 1000 / total);
+  if (permille == context->bytes_permille)
+    return;
+  context->bytes_permille = permille;
+  g_signal_emit (context, signals[PROGRESS], 0, permille, 1000);
+}
+
+
 /* Return a malloced string with the last diagnostic data of the
  * context.  Returns NULL if no diagnostics are available.  */
 char *
@@ -307,6 +515,14 @@ gpa_context_get_diag (GpaContext *context)
 }
 
 
+void
+gpa_context_get_totals (unsigned long *r_count, guint64 *r_usec)
+{
+  *r_count = total_count;
+  *r_usec = total_usec;
+}
+
+
 
 /*
  * The GPGME I/O callbacks
@@ -513,6 +729,10 @@ gpa_context_start (GpaContext *context)
 {
 /*   g_debug ("gpgme event START enter"); */
   context->busy = TRUE;
+  context->start_time = g_get_monotonic_time ();
+  context->bytes_done = 0;
+  context->bytes_total = 0;
+  context->bytes_permille = -1;
   /* We have START, register all queued callbacks */
   register_all_callbacks (context);
 /*   g_debug ("gpgme event START leave"); */
@@ -522,6 +742,14 @@ static void
 gpa_context_done (GpaContext *context, gpg_error_t err)
 {
   context->busy = FALSE;
+  if (context->start_time)
+    {
+      total_count++;
+      total_usec += g_get_monotonic_time () - context->start_time;
+      context->start_time = 0;
+    }
+  context->bytes_done = 0;
+  context->bytes_total = 0;
 /*   g_debug ("gpgme event DONE ready"); */
 }
 
@@ -565,5 +793,9 @@ gpa_context_progress_cb (void *opaque, const char *what,
 			 int type, int current, int total)
 {
   GpaContext *context = opaque;
+
+  /* The bytes read from the input are more accurate.  */
+  if (context->bytes_total)
+    return;
   g_signal_emit (context, signals[PROGRESS], 0, current, total);
 }
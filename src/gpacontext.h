@@ -54,6 +54,17 @@ struct _GpaContext {
   struct gpgme_io_cbs *io_cbs;
   /* Hack to block certain events.  */
   int inhibit_gpgme_events;
+  /* The monotonic time the current operation started.  */
+  gint64 start_time;
+  /* The protocol the context has been created for.  */
+  gpgme_protocol_t protocol;
+  /* The number of bytes of the input read by the current operation
+     and the size of the input or 0 if it is not known; see
+     gpa_context_data_progress.  */
+  guint64 bytes_done;
+  guint64 bytes_total;
+  /* The progress in permille last emitted for the bytes read.  */
+  int bytes_permille;
 };
 
 struct _GpaContextClass {
@@ -75,11 +86,26 @@ GType gpa_context_get_type (void) G_GNUC_CONST;
  */
 GpaContext *gpa_context_new (void);
 
+/* Create a new GpaContext object with PROTOCOL already set.  Unused
+   gpgme contexts are recycled; one of the same protocol is preferred.
+ */
+GpaContext *gpa_context_new_for_protocol (gpgme_protocol_t protocol);
+
 /* TRUE if an operation is in progress.
  */
 gboolean gpa_context_busy (GpaContext *context);
 
+/* Report that the current operation of CONTEXT has read DONE bytes
+   of TOTAL.  While the total is known this replaces the progress
+   reported by the engine.  */
+void gpa_context_data_progress (GpaContext *context,
+                                guint64 done, guint64 total);
+
 /* Return a string with the diagnostics from gpgme.  */
 char *gpa_context_get_diag (GpaContext *context);
 
+/* Store the number of operations finished by all contexts at R_COUNT
+   and the time they took in microseconds at R_USEC.  */
+void gpa_context_get_totals (unsigned long *r_count, guint64 *r_usec);
+
 #endif /*GPA_CONTEXT_H*/
@@ -41,12 +41,16 @@
 
 /* Internal functions */
 static gboolean gpa_file_decrypt_operation_idle_cb (gpointer data);
-static void gpa_file_decrypt_operation_done_cb (GpaContext *context,
-						gpg_error_t err,
-						GpaFileDecryptOperation *op);
-static void gpa_file_decrypt_operation_done_error_cb (GpaContext *context,
-						      gpg_error_t err,
-						      GpaFileDecryptOperation *op);
+static gpg_error_t gpa_file_decrypt_operation_start_item
+	(GpaFileOperation *fileop, gpa_file_worker_t worker);
+static void gpa_file_decrypt_operation_finish_item (GpaFileOperation *fileop,
+						    gpa_file_worker_t worker,
+						    gpg_error_t err);
+static void gpa_file_decrypt_operation_finished (GpaFileOperation *fileop,
+						 gpg_error_t err);
+static void gpa_file_decrypt_operation_show_error (GpaFileOperation *fileop,
+						   gpa_file_worker_t worker,
+						   gpg_error_t err);
 
 /* GObject */
 
@@ -111,10 +115,6 @@ gpa_file_decrypt_operation_finalize (GObject *object)
 static void
 gpa_file_decrypt_operation_init (GpaFileDecryptOperation *op)
 {
-  op->cipher_fd = -1;
-  op->plain_fd = -1;
-  op->cipher = NULL;
-  op->plain = NULL;
 }
 
 
@@ -136,31 +136,38 @@ gpa_file_decrypt_operation_constructor
 {
   GObject *object;
   GpaFileDecryptOperation *op;
+  GpaFileOperation *fileop;
 
   /* Invoke parent's constructor */
   object = parent_class->constructor (type,
 				      n_construct_properties,
 				      construct_properties);
   op = GPA_FILE_DECRYPT_OPERATION (object);
+  fileop = GPA_FILE_OPERATION (op);
   /* Initialize */
+  /* Decrypt several files at the same time and collect the results
+     of a batch instead of showing a dialog for each file.  */
+  gpa_file_operation_set_max_workers
+    (fileop, gpa_options_get_file_workers (gpa_options_get_instance ()));
+  gpa_file_operation_set_batch (fileop);
   /* Start with the first file after going back into the main loop */
   g_idle_add (gpa_file_decrypt_operation_idle_cb, op);
-  /* Connect to the "done" signal */
-  g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
-		    G_CALLBACK (gpa_file_decrypt_operation_done_error_cb), op);
-  g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
-		    G_CALLBACK (gpa_file_decrypt_operation_done_cb), op);
   /* Give a title to the progress dialog */
-  gtk_window_set_title (GTK_WINDOW (GPA_FILE_OPERATION (op)->progress_dialog),
+  gtk_window_set_title (GTK_WINDOW (fileop->progress_dialog),
 			_("Decrypting..."));
 
-  if (op->verify)
+  if (op->verify || fileop->batch)
     {
       /* Create the verification dialog */
       op->dialog = gpa_file_verify_dialog_new (GPA_OPERATION (op)->window);
       g_signal_connect (G_OBJECT (op->dialog), "response",
 			G_CALLBACK (gpa_file_decrypt_operation_response_cb),
 			op);
+      if (fileop->batch)
+	gpa_file_verify_dialog_set_batch (GPA_FILE_VERIFY_DIALOG (op->dialog));
+      if (!op->verify)
+	gpa_file_verify_dialog_set_title (GPA_FILE_VERIFY_DIALOG (op->dialog),
+					  _("Decrypt documents"));
     }
 
   return object;
@@ -170,6 +177,7 @@ static void
 gpa_file_decrypt_operation_class_init (GpaFileDecryptOperationClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GpaFileOperationClass *file_op_class = GPA_FILE_OPERATION_CLASS (klass);
 
   parent_class = g_type_class_peek_parent (klass);
 
@@ -178,6 +186,10 @@ gpa_file_decrypt_operation_class_init (GpaFileDecryptOperationClass *klass)
   object_class->set_property = gpa_file_decrypt_operation_set_property;
   object_class->get_property = gpa_file_decrypt_operation_get_property;
 
+  file_op_class->start_item = gpa_file_decrypt_operation_start_item;
+  file_op_class->finish_item = gpa_file_decrypt_operation_finish_item;
+  file_op_class->finished = gpa_file_decrypt_operation_finished;
+
   /* Properties */
   g_object_class_install_property (object_class,
 				   PROP_VERIFY,
@@ -274,15 +286,16 @@ destination_filename (const gchar *filename)
 }
 
 static gpg_error_t
-gpa_file_decrypt_operation_start (GpaFileDecryptOperation *op,
-				  gpa_file_item_t file_item)
+gpa_file_decrypt_operation_start_item (GpaFileOperation *fileop,
+				       gpa_file_worker_t worker)
 {
+  gpa_file_item_t file_item = worker->item;
   gpg_error_t err;
 
   if (file_item->direct_in)
     {
       /* No copy is made.  */
-      err = gpgme_data_new_from_mem (&op->cipher, file_item->direct_in,
+      err = gpgme_data_new_from_mem (&worker->in, file_item->direct_in,
 				     file_item->direct_in_len, 0);
       if (err)
 	{
@@ -290,16 +303,16 @@ gpa_file_decrypt_operation_start (GpaFileDecryptOperation *op,
 	  return err;
 	}
 
-      err = gpgme_data_new (&op->plain);
+      err = gpgme_data_new (&worker->out);
       if (err)
 	{
 	  gpa_gpgme_warning (err);
-	  gpgme_data_release (op->cipher);
-	  op->plain = NULL;
+	  gpgme_data_release (worker->in);
+	  worker->in = NULL;
 	  return err;
 	}
 
-      gpgme_set_protocol (GPA_OPERATION (op)->context->ctx,
+      gpgme_set_protocol (worker->context->ctx,
                           is_cms_data (file_item->direct_in,
                                        file_item->direct_in_len) ?
                           GPGME_PROTOCOL_CMS : GPGME_PROTOCOL_OpenPGP);
@@ -309,109 +322,186 @@ gpa_file_decrypt_operation_start (GpaFileDecryptOperation *op,
       gchar *cipher_filename = file_item->filename_in;
       char *filename_used;
 
-      file_item->filename_out = destination_filename (cipher_filename);
       /* Open the files */
-      op->cipher_fd = gpa_open_input (cipher_filename, &op->cipher,
-				  GPA_OPERATION (op)->window);
-      if (op->cipher_fd == -1)
-	/* FIXME: Error value.  */
-	return gpg_error (GPG_ERR_GENERAL);
-
-      op->plain_fd = gpa_open_output (file_item->filename_out, &op->plain,
-				      GPA_OPERATION (op)->window,
-                                      &filename_used);
-      if (op->plain_fd == -1)
+      worker->in_fd = gpa_file_operation_open_input (fileop, cipher_filename,
+						     &worker->in, &err);
+      if (worker->in_fd == -1)
+	return err;
+      file_item->filename_out = destination_filename (cipher_filename);
+
+      if (g_str_has_suffix (file_item->filename_out, ".tar")
+	  && !g_file_test (file_item->filename_out, G_FILE_TEST_EXISTS))
 	{
-	  gpgme_data_release (op->cipher);
-	  close (op->cipher_fd);
-          xfree (filename_used);
-	  /* FIXME: Error value.  */
-	  return gpg_error (GPG_ERR_GENERAL);
+	  /* A directory archived by GPA is extracted next to the
+	     encrypted file while it is decrypted.  Other data is
+	     written to the .tar file as usual.  */
+	  gchar *destdir = g_path_get_dirname (cipher_filename);
+
+	  err = gpa_tar_extract_new (&worker->archive, &worker->out, destdir,
+				     file_item->filename_out);
+	  g_free (destdir);
+	  if (err)
+	    {
+	      if (!fileop->batch)
+		gpa_gpgme_warning (err);
+	      gpgme_data_release (worker->in);
+	      worker->in = NULL;
+	      close (worker->in_fd);
+	      worker->in_fd = -1;
+	      g_free (file_item->filename_out);
+	      file_item->filename_out = NULL;
+	      return err;
+	    }
+	}
+      else if (fileop->batch)
+	{
+	  /* Never ask in a batch; an existing file is skipped and
+	     reported in the summary by finish_item.  */
+	  worker->out_fd = gpa_open_output_quiet (file_item->filename_out,
+						  &worker->out, &err);
+	  if (worker->out_fd == -1)
+	    {
+	      gpgme_data_release (worker->in);
+	      worker->in = NULL;
+	      close (worker->in_fd);
+	      worker->in_fd = -1;
+	      /* The existing file must not be removed by finish_item.  */
+	      g_free (file_item->filename_out);
+	      file_item->filename_out = NULL;
+	      return err;
+	    }
 	}
+      else
+	{
+	  worker->out_fd = gpa_open_output (file_item->filename_out,
+					    &worker->out,
+					    GPA_OPERATION (fileop)->window,
+					    &filename_used);
+	  if (worker->out_fd == -1)
+	    {
+	      gpgme_data_release (worker->in);
+	      worker->in = NULL;
+	      close (worker->in_fd);
+	      worker->in_fd = -1;
+	      xfree (filename_used);
+	      /* The existing file must not be removed by finish_item.  */
+	      g_free (file_item->filename_out);
+	      file_item->filename_out = NULL;
+	      /* FIXME: Error value.  */
+	      return gpg_error (GPG_ERR_GENERAL);
+	    }
 
-      xfree (file_item->filename_out);
-      file_item->filename_out = filename_used;
+	  xfree (file_item->filename_out);
+	  file_item->filename_out = filename_used;
+	}
 
-      gpgme_set_protocol (GPA_OPERATION (op)->context->ctx,
+      gpgme_set_protocol (worker->context->ctx,
                           is_cms_file (cipher_filename) ?
                           GPGME_PROTOCOL_CMS : GPGME_PROTOCOL_OpenPGP);
     }
 
   /* Start the operation.  */
-  err = gpgme_op_decrypt_verify_start (GPA_OPERATION (op)->context->ctx,
-				       op->cipher, op->plain);
+  err = gpa_file_operation_count_input (fileop, worker);
+  if (!err)
+    err = gpgme_op_decrypt_verify_start (worker->context->ctx,
+					 worker->in, worker->out);
   if (err)
     {
-      gpa_gpgme_warning (err);
+      if (!fileop->batch)
+	gpa_gpgme_warning (err);
 
-      gpgme_data_release (op->plain);
-      op->plain = NULL;
-      close (op->plain_fd);
-      op->plain_fd = -1;
-      gpgme_data_release (op->cipher);
-      op->cipher = NULL;
-      close (op->cipher_fd);
-      op->cipher_fd = -1;
+      gpgme_data_release (worker->out);
+      worker->out = NULL;
+      if (worker->archive)
+	{
+	  /* Nothing has been written yet.  */
+	  gpa_tar_extract_release (worker->archive);
+	  worker->archive = NULL;
+	  g_free (file_item->filename_out);
+	  file_item->filename_out = NULL;
+	}
+      if (worker->out_fd != -1)
+        close (worker->out_fd);
+      worker->out_fd = -1;
+      gpgme_data_release (worker->in);
+      worker->in = NULL;
+      if (worker->in_fd != -1)
+        close (worker->in_fd);
+      worker->in_fd = -1;
 
       return err;
     }
 
-  /* Show and update the progress dialog.  */
-  gtk_widget_show_all (GPA_FILE_OPERATION (op)->progress_dialog);
-  gpa_progress_dialog_set_label (GPA_PROGRESS_DIALOG
-				 (GPA_FILE_OPERATION (op)->progress_dialog),
-				 file_item->direct_name
-				 ? file_item->direct_name
-				 : file_item->filename_in);
   return 0;
 }
 
 
 static void
-gpa_file_decrypt_operation_next (GpaFileDecryptOperation *op)
+gpa_file_decrypt_operation_finished (GpaFileOperation *fileop,
+				     gpg_error_t err)
 {
-  gpg_error_t err;
+  GpaFileDecryptOperation *op = GPA_FILE_DECRYPT_OPERATION (fileop);
 
-  if (! GPA_FILE_OPERATION (op)->current)
+  if (fileop->batch)
     {
-      if (op->verify && op->signed_files)
-	{
-	  op->err = 0;
-	  gtk_widget_show_all (op->dialog);
-	}
-      else
-	g_signal_emit_by_name (GPA_OPERATION (op), "completed", 0);
-      return;
+      gchar *text = gpa_file_operation_get_throughput (fileop);
+
+      /* Show the summary of the batch.  */
+      gpa_file_verify_dialog_set_summary (GPA_FILE_VERIFY_DIALOG (op->dialog),
+					  text);
+      g_free (text);
+      op->err = err;
+      gtk_widget_show_all (op->dialog);
     }
-
-  err = gpa_file_decrypt_operation_start
-    (op, GPA_FILE_OPERATION (op)->current->data);
-  if (err)
+  else if (op->verify && op->signed_files)
     {
-      if (op->verify && op->signed_files)
-	{
-	  /* All files have been verified: show the results dialog */
-	  op->err = err;
-	  gtk_widget_show_all (op->dialog);
-	}
-      else
-	g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
+      /* All files have been verified: show the results dialog */
+      op->err = err;
+      gtk_widget_show_all (op->dialog);
     }
+  else
+    g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
 }
 
 
 static void
-gpa_file_decrypt_operation_done_cb (GpaContext *context,
-				    gpg_error_t err,
-				    GpaFileDecryptOperation *op)
+gpa_file_decrypt_operation_finish_item (GpaFileOperation *fileop,
+					gpa_file_worker_t worker,
+					gpg_error_t err)
 {
-  gpa_file_item_t file_item = GPA_FILE_OPERATION (op)->current->data;
+  GpaFileDecryptOperation *op = GPA_FILE_DECRYPT_OPERATION (fileop);
+  gpa_file_item_t file_item = worker->item;
+
+  if (worker->archive)
+    {
+      /* The data object must be released before the archive.  */
+      gpgme_data_release (worker->out);
+      worker->out = NULL;
+      g_free (file_item->filename_out);
+      file_item->filename_out = NULL;
+      if (!err)
+	err = gpa_tar_extract_finish (worker->archive,
+				      &file_item->filename_out);
+      if (err)
+	/* Remove what has been extracted or written so far.  */
+	gpa_tar_extract_remove (worker->archive);
+      gpa_tar_extract_release (worker->archive);
+      worker->archive = NULL;
+    }
+
+  if (fileop->batch && err && gpg_err_code (err) != GPG_ERR_CANCELED)
+    gpa_file_verify_dialog_add_error (GPA_FILE_VERIFY_DIALOG (op->dialog),
+				      file_item->direct_name
+				      ? file_item->direct_name
+				      : file_item->filename_in, err);
+  else
+    gpa_file_decrypt_operation_show_error (fileop, worker, err);
 
   if (file_item->direct_in)
     {
       size_t len;
-      char *plain_gpgme = gpgme_data_release_and_get_mem (op->plain, &len);
-      op->plain = NULL;
+      char *plain_gpgme = gpgme_data_release_and_get_mem (worker->out, &len);
+      worker->out = NULL;
       /* Do the memory allocation dance.  */
 
       if (plain_gpgme)
@@ -432,27 +522,28 @@ gpa_file_decrypt_operation_done_cb (GpaContext *context,
     }
 
   /* Do clean up on the operation */
-  gpgme_data_release (op->plain);
-  op->plain = NULL;
-  close (op->plain_fd);
-  op->plain_fd = -1;
-  gpgme_data_release (op->cipher);
-  op->cipher = NULL;
-  close (op->cipher_fd);
-  op->cipher_fd = -1;
-  gtk_widget_hide (GPA_FILE_OPERATION (op)->progress_dialog);
+  gpgme_data_release (worker->out);
+  worker->out = NULL;
+  if (worker->out_fd != -1)
+    close (worker->out_fd);
+  worker->out_fd = -1;
+  gpgme_data_release (worker->in);
+  worker->in = NULL;
+  if (worker->in_fd != -1)
+    close (worker->in_fd);
+  worker->in_fd = -1;
   if (err)
     {
-      if (! file_item->direct_in)
+      if (! file_item->direct_in && file_item->filename_out)
 	{
 	  /* If an error happened, (or the user canceled) delete the
-	     created file and abort further decryptions.  */
+	     created file; unless in a batch no further files are
+	     decrypted.  */
 	  g_unlink (file_item->filename_out);
 	  g_free (file_item->filename_out);
 	  file_item->filename_out = NULL;
 	}
       /* FIXME:CLIPBOARD: Server finish?  */
-      g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
     }
   else
     {
@@ -463,7 +554,7 @@ gpa_file_decrypt_operation_done_cb (GpaContext *context,
 	{
 	  gpgme_verify_result_t result;
 
-	  result = gpgme_op_verify_result (GPA_OPERATION (op)->context->ctx);
+	  result = gpgme_op_verify_result (worker->context->ctx);
 	  if (result->signatures)
 	    {
 	      /* Add the file to the result dialog.  FIXME: Maybe we
@@ -477,11 +568,6 @@ gpa_file_decrypt_operation_done_cb (GpaContext *context,
 	      op->signed_files++;
 	    }
 	}
-
-      /* Go to the next file in the list and decrypt it */
-      GPA_FILE_OPERATION (op)->current = g_list_next
-	(GPA_FILE_OPERATION (op)->current);
-      gpa_file_decrypt_operation_next (op);
     }
 }
 
@@ -491,17 +577,18 @@ gpa_file_decrypt_operation_idle_cb (gpointer data)
 {
   GpaFileDecryptOperation *op = data;
 
-  gpa_file_decrypt_operation_next (op);
+  gpa_file_operation_run_workers (GPA_FILE_OPERATION (op));
 
   return FALSE;
 }
 
 
 static void
-gpa_file_decrypt_operation_done_error_cb (GpaContext *context, gpg_error_t err,
-					  GpaFileDecryptOperation *op)
+gpa_file_decrypt_operation_show_error (GpaFileOperation *fileop,
+				       gpa_file_worker_t worker,
+				       gpg_error_t err)
 {
-  gpa_file_item_t file_item = GPA_FILE_OPERATION (op)->current->data;
+  gpa_file_item_t file_item = worker->item;
 
   switch (gpg_err_code (err))
     {
@@ -510,7 +597,7 @@ gpa_file_decrypt_operation_done_error_cb (GpaContext *context, gpg_error_t err,
       /* Ignore these */
       break;
     case GPG_ERR_NO_DATA:
-      gpa_show_warn (GPA_OPERATION (op)->window, GPA_OPERATION (op)->context,
+      gpa_show_warn (GPA_OPERATION (fileop)->window, worker->context,
                      file_item->direct_name
                      ? _("\"%s\" contained no OpenPGP data.")
                      : _("The file \"%s\" contained no OpenPGP"
@@ -520,7 +607,7 @@ gpa_file_decrypt_operation_done_error_cb (GpaContext *context, gpg_error_t err,
                      : file_item->filename_in);
       break;
     case GPG_ERR_DECRYPT_FAILED:
-      gpa_show_warn (GPA_OPERATION (op)->window, GPA_OPERATION (op)->context,
+      gpa_show_warn (GPA_OPERATION (fileop)->window, worker->context,
                      file_item->direct_name
                      ? _("\"%s\" contained no valid "
                          "encrypted data.")
@@ -531,11 +618,11 @@ gpa_file_decrypt_operation_done_error_cb (GpaContext *context, gpg_error_t err,
                      : file_item->filename_in);
       break;
     case GPG_ERR_BAD_PASSPHRASE:
-      gpa_show_warn (GPA_OPERATION (op)->window, GPA_OPERATION (op)->context,
+      gpa_show_warn (GPA_OPERATION (fileop)->window, worker->context,
                      _("Wrong passphrase!"));
       break;
     default:
-      gpa_gpgme_warn (err, NULL, GPA_OPERATION (op)->context);
+      gpa_gpgme_warn (err, NULL, worker->context);
       break;
     }
 }
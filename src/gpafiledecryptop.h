@@ -40,9 +40,6 @@ typedef struct _GpaFileDecryptOperationClass GpaFileDecryptOperationClass;
 struct _GpaFileDecryptOperation {
   GpaFileOperation parent;
 
-  int cipher_fd, plain_fd;
-  gpgme_data_t cipher, plain;
- 
   gboolean verify;
   gpg_error_t err;
   int signed_files;
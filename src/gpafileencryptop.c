@@ -41,12 +41,16 @@
 #include "gpawidgets.h"
 
 /* Internal functions */
-static void gpa_file_encrypt_operation_done_error_cb (GpaContext *context,
-						      gpg_error_t err,
-						      GpaFileEncryptOperation *op);
-static void gpa_file_encrypt_operation_done_cb (GpaContext *context,
-						gpg_error_t err,
-						GpaFileEncryptOperation *op);
+static gpg_error_t gpa_file_encrypt_operation_start_item
+	(GpaFileOperation *fileop, gpa_file_worker_t worker);
+static void gpa_file_encrypt_operation_finish_item (GpaFileOperation *fileop,
+						    gpa_file_worker_t worker,
+						    gpg_error_t err);
+static void gpa_file_encrypt_operation_finished (GpaFileOperation *fileop,
+						 gpg_error_t err);
+static void gpa_file_encrypt_operation_show_error (GpaFileOperation *fileop,
+						   gpa_file_worker_t worker,
+						   gpg_error_t err);
 static void gpa_file_encrypt_operation_response_cb (GtkDialog *dialog,
 						    gint response,
 						    gpointer user_data);
@@ -117,10 +121,6 @@ static void
 gpa_file_encrypt_operation_init (GpaFileEncryptOperation *op)
 {
   op->rset = NULL;
-  op->cipher_fd = -1;
-  op->plain_fd = -1;
-  op->cipher = NULL;
-  op->plain = NULL;
   op->encrypt_dialog = NULL;
   op->force_armor = FALSE;
 }
@@ -145,11 +145,13 @@ gpa_file_encrypt_operation_constructor
     (GPA_OPERATION (op)->window, op->force_armor);
   g_signal_connect (G_OBJECT (op->encrypt_dialog), "response",
 		    G_CALLBACK (gpa_file_encrypt_operation_response_cb), op);
-  /* Connect to the "done" signal */
-  g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
-		    G_CALLBACK (gpa_file_encrypt_operation_done_error_cb), op);
-  g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
-		    G_CALLBACK (gpa_file_encrypt_operation_done_cb), op);
+  /* Encrypt several files at the same time with the same keys.  */
+  gpa_file_operation_set_max_workers
+    (GPA_FILE_OPERATION (op),
+     gpa_options_get_file_workers (gpa_options_get_instance ()));
+  /* Go on after an error in a batch and report all errors with the
+     summary at the end.  */
+  gpa_file_operation_set_batch (GPA_FILE_OPERATION (op));
   /* Give a title to the progress dialog */
   gtk_window_set_title (GTK_WINDOW (GPA_FILE_OPERATION (op)->progress_dialog),
 			_("Encrypting..."));
@@ -163,6 +165,7 @@ static void
 gpa_file_encrypt_operation_class_init (GpaFileEncryptOperationClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GpaFileOperationClass *file_op_class = GPA_FILE_OPERATION_CLASS (klass);
 
   parent_class = g_type_class_peek_parent (klass);
 
@@ -171,6 +174,10 @@ gpa_file_encrypt_operation_class_init (GpaFileEncryptOperationClass *klass)
   object_class->set_property = gpa_file_encrypt_operation_set_property;
   object_class->get_property = gpa_file_encrypt_operation_get_property;
 
+  file_op_class->start_item = gpa_file_encrypt_operation_start_item;
+  file_op_class->finish_item = gpa_file_encrypt_operation_finish_item;
+  file_op_class->finished = gpa_file_encrypt_operation_finished;
+
   g_object_class_install_property (object_class,
 				   PROP_FORCE_ARMOR,
 				   g_param_spec_boolean
@@ -282,15 +289,17 @@ destination_filename (const gchar *filename, gboolean armor)
 
 
 static gpg_error_t
-gpa_file_encrypt_operation_start (GpaFileEncryptOperation *op,
-				  gpa_file_item_t file_item)
+gpa_file_encrypt_operation_start_item (GpaFileOperation *fileop,
+				       gpa_file_worker_t worker)
 {
+  GpaFileEncryptOperation *op = GPA_FILE_ENCRYPT_OPERATION (fileop);
+  gpa_file_item_t file_item = worker->item;
   gpg_error_t err;
 
   if (file_item->direct_in)
     {
       /* No copy is made.  */
-      err = gpgme_data_new_from_mem (&op->plain, file_item->direct_in,
+      err = gpgme_data_new_from_mem (&worker->in, file_item->direct_in,
 				     file_item->direct_in_len, 0);
       if (err)
 	{
@@ -298,12 +307,12 @@ gpa_file_encrypt_operation_start (GpaFileEncryptOperation *op,
 	  return err;
 	}
 
-      err = gpgme_data_new (&op->cipher);
+      err = gpgme_data_new (&worker->out);
       if (err)
 	{
 	  gpa_gpgme_warning (err);
-	  gpgme_data_release (op->plain);
-	  op->plain = NULL;
+	  gpgme_data_release (worker->in);
+	  worker->in = NULL;
 	  return err;
 	}
     }
@@ -312,102 +321,151 @@ gpa_file_encrypt_operation_start (GpaFileEncryptOperation *op,
       gchar *plain_filename = file_item->filename_in;
       char *filename_used;
 
-      file_item->filename_out = destination_filename
-	(plain_filename, gpgme_get_armor (GPA_OPERATION (op)->context->ctx));
-      /* Open the files */
-      op->plain_fd = gpa_open_input (plain_filename, &op->plain,
-				     GPA_OPERATION (op)->window);
-      if (op->plain_fd == -1)
-	/* FIXME: Error value.  */
-	return gpg_error (GPG_ERR_GENERAL);
-
-      op->cipher_fd = gpa_open_output (file_item->filename_out, &op->cipher,
-				       GPA_OPERATION (op)->window,
-                                       &filename_used);
-      if (op->cipher_fd == -1)
+      if (g_file_test (plain_filename, G_FILE_TEST_IS_DIR))
 	{
-	  gpgme_data_release (op->plain);
-	  close (op->plain_fd);
-	  op->plain_fd = -1;
+	  /* A directory is encrypted as a tar archive created on the
+	     fly.  */
+	  gchar *tar_filename = g_strconcat (plain_filename, ".tar", NULL);
+
+	  file_item->filename_out = destination_filename
+	    (tar_filename, gpgme_get_armor (worker->context->ctx));
+	  g_free (tar_filename);
+	  err = gpa_tar_data_new_from_dir (&worker->in, plain_filename);
+	  if (err)
+	    {
+	      /* In a batch finish_item reports the error.  */
+	      if (!fileop->batch)
+		gpa_file_encrypt_operation_show_error (fileop, worker, err);
+	      /* Nothing has been written.  */
+	      g_free (file_item->filename_out);
+	      file_item->filename_out = NULL;
+	      return err;
+	    }
+	}
+      else
+	{
+	  file_item->filename_out = destination_filename
+	    (plain_filename, gpgme_get_armor (worker->context->ctx));
+	  /* Open the files */
+	  worker->in_fd = gpa_file_operation_open_input
+	    (fileop, plain_filename, &worker->in, &err);
+	  if (worker->in_fd == -1)
+	    {
+	      g_free (file_item->filename_out);
+	      file_item->filename_out = NULL;
+	      return err;
+	    }
+	}
+
+      if (fileop->batch)
+	{
+	  /* Never ask in a batch; an existing file is skipped and
+	     reported in the summary.  */
+	  worker->out_fd = gpa_open_output_quiet (file_item->filename_out,
+						  &worker->out, &err);
+	  filename_used = NULL;
+	}
+      else
+	{
+	  worker->out_fd = gpa_open_output (file_item->filename_out,
+					    &worker->out,
+					    GPA_OPERATION (op)->window,
+					    &filename_used);
+	  if (worker->out_fd == -1)
+	    /* FIXME: Error value.  */
+	    err = gpg_error (GPG_ERR_GENERAL);
+	}
+      if (worker->out_fd == -1)
+	{
+	  gpgme_data_release (worker->in);
+	  worker->in = NULL;
+	  if (worker->in_fd != -1)
+	    close (worker->in_fd);
+	  worker->in_fd = -1;
           xfree (filename_used);
-	  /* FIXME: Error value.  */
-	  return gpg_error (GPG_ERR_GENERAL);
+	  /* The existing file must not be removed by finish_item.  */
+	  g_free (file_item->filename_out);
+	  file_item->filename_out = NULL;
+	  return err;
 	}
 
-      xfree (file_item->filename_out);
-      file_item->filename_out = filename_used;
+      if (filename_used)
+	{
+	  xfree (file_item->filename_out);
+	  file_item->filename_out = filename_used;
+	}
     }
 
   /* Start the operation.  */
+  err = gpa_file_operation_count_input (fileop, worker);
   /* Always trust keys, because any untrusted keys were already
      confirmed by the user.  */
-  if (gpa_file_encrypt_dialog_get_sign
-      (GPA_FILE_ENCRYPT_DIALOG (op->encrypt_dialog)))
-    err = gpgme_op_encrypt_sign_start (GPA_OPERATION (op)->context->ctx,
+  if (err)
+    ;
+  else if (gpa_file_encrypt_dialog_get_sign
+	   (GPA_FILE_ENCRYPT_DIALOG (op->encrypt_dialog)))
+    err = gpgme_op_encrypt_sign_start (worker->context->ctx,
 				       op->rset, GPGME_ENCRYPT_ALWAYS_TRUST,
-				       op->plain, op->cipher);
+				       worker->in, worker->out);
   else
-    err = gpgme_op_encrypt_start (GPA_OPERATION (op)->context->ctx,
+    err = gpgme_op_encrypt_start (worker->context->ctx,
 				  op->rset, GPGME_ENCRYPT_ALWAYS_TRUST,
-				  op->plain, op->cipher);
+				  worker->in, worker->out);
 
   if (err)
     {
-      gpa_gpgme_warning (err);
-
-      gpgme_data_release (op->plain);
-      op->plain = NULL;
-      close (op->plain_fd);
-      op->plain_fd = -1;
-      gpgme_data_release (op->cipher);
-      op->cipher = NULL;
-      close (op->cipher_fd);
-      op->cipher_fd = -1;
+      if (!fileop->batch)
+	gpa_gpgme_warning (err);
+
+      gpgme_data_release (worker->in);
+      worker->in = NULL;
+      if (worker->in_fd != -1)
+        close (worker->in_fd);
+      worker->in_fd = -1;
+      gpgme_data_release (worker->out);
+      worker->out = NULL;
+      if (worker->out_fd != -1)
+        close (worker->out_fd);
+      worker->out_fd = -1;
 
       return err;
     }
 
-  /* Show and update the progress dialog.  */
-  gtk_widget_show_all (GPA_FILE_OPERATION (op)->progress_dialog);
-  gpa_progress_dialog_set_label (GPA_PROGRESS_DIALOG
-				 (GPA_FILE_OPERATION (op)->progress_dialog),
-				 file_item->direct_name
-				 ? file_item->direct_name
-				 : file_item->filename_in);
   return 0;
 }
 
+
 static void
 gpa_file_encrypt_operation_next (GpaFileEncryptOperation *op)
 {
-  gpg_error_t err;
+  gpa_file_operation_run_workers (GPA_FILE_OPERATION (op));
+}
 
-  if (! GPA_FILE_OPERATION (op)->current)
-    {
-      g_signal_emit_by_name (GPA_OPERATION (op), "completed", 0);
-      return;
-    }
 
-  err = gpa_file_encrypt_operation_start
-    (op, GPA_FILE_OPERATION (op)->current->data);
-  if (err)
-    g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
+static void
+gpa_file_encrypt_operation_finished (GpaFileOperation *fileop,
+				     gpg_error_t err)
+{
+  gpa_file_operation_show_errors (fileop);
+  g_signal_emit_by_name (GPA_OPERATION (fileop), "completed", err);
 }
 
 
 static void
-gpa_file_encrypt_operation_done_cb (GpaContext *context,
-				    gpg_error_t err,
-				    GpaFileEncryptOperation *op)
+gpa_file_encrypt_operation_finish_item (GpaFileOperation *fileop,
+					gpa_file_worker_t worker,
+					gpg_error_t err)
 {
-  gpa_file_item_t file_item = GPA_FILE_OPERATION (op)->current->data;
+  gpa_file_item_t file_item = worker->item;
+
+  gpa_file_encrypt_operation_show_error (fileop, worker, err);
 
   if (file_item->direct_in)
     {
       size_t len;
-      char *cipher_gpgme = gpgme_data_release_and_get_mem (op->cipher,
+      char *cipher_gpgme = gpgme_data_release_and_get_mem (worker->out,
 							   &len);
-      op->cipher = NULL;
+      worker->out = NULL;
       /* Do the memory allocation dance.  */
 
       if (cipher_gpgme)
@@ -428,37 +486,34 @@ gpa_file_encrypt_operation_done_cb (GpaContext *context,
     }
 
   /* Do clean up on the operation */
-  gpgme_data_release (op->plain);
-  op->plain = NULL;
-  close (op->plain_fd);
-  op->plain_fd = -1;
-  gpgme_data_release (op->cipher);
-  op->cipher = NULL;
-  close (op->cipher_fd);
-  op->cipher_fd = -1;
-  gtk_widget_hide (GPA_FILE_OPERATION (op)->progress_dialog);
+  gpgme_data_release (worker->in);
+  worker->in = NULL;
+  if (worker->in_fd != -1)
+    close (worker->in_fd);
+  worker->in_fd = -1;
+  gpgme_data_release (worker->out);
+  worker->out = NULL;
+  if (worker->out_fd != -1)
+    close (worker->out_fd);
+  worker->out_fd = -1;
 
   if (err)
     {
-      if (! file_item->direct_in)
+      if (! file_item->direct_in && file_item->filename_out)
 	{
 	  /* If an error happened, (or the user canceled) delete the
-	    created file and abort further encryptions.  */
+	     created file.  Unless in a batch no further files are
+	     started, but the running workers finish theirs.  */
 	  g_unlink (file_item->filename_out);
 	  g_free (file_item->filename_out);
 	  file_item->filename_out = NULL;
 	}
-      g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
     }
   else
     {
       /* We've just created a file */
-      g_signal_emit_by_name (GPA_OPERATION (op), "created_file", file_item);
-
-      /* Go to the next file in the list and encrypt it */
-      GPA_FILE_OPERATION (op)->current = g_list_next
-	(GPA_FILE_OPERATION (op)->current);
-      gpa_file_encrypt_operation_next (op);
+      g_signal_emit_by_name (GPA_OPERATION (fileop), "created_file",
+			     file_item);
     }
 }
 
@@ -768,9 +823,12 @@ static void gpa_file_encrypt_operation_response_cb (GtkDialog *dialog,
     }
 }
 
+/* Report the error ERR of the item of WORKER.  It is shown once all
+   workers have finished, because other workers may still run.  */
 static void
-gpa_file_encrypt_operation_done_error_cb (GpaContext *context, gpg_error_t err,
-					  GpaFileEncryptOperation *op)
+gpa_file_encrypt_operation_show_error (GpaFileOperation *fileop,
+				       gpa_file_worker_t worker,
+				       gpg_error_t err)
 {
   switch (gpg_err_code (err))
     {
@@ -779,11 +837,11 @@ gpa_file_encrypt_operation_done_error_cb (GpaContext *context, gpg_error_t err,
       /* Ignore these */
       break;
     case GPG_ERR_BAD_PASSPHRASE:
-      gpa_show_warn (GPA_OPERATION (op)->window, GPA_OPERATION (op)->context,
-                     _("Wrong passphrase!"));
+      gpa_file_operation_add_error (fileop, worker->item,
+				    _("Wrong passphrase!"));
       break;
     default:
-      gpa_gpgme_warn (err, NULL, GPA_OPERATION (op)->context);
+      gpa_file_operation_add_error (fileop, worker->item, gpg_strerror (err));
       break;
     }
 }
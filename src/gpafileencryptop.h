@@ -57,8 +57,6 @@ struct _GpaFileEncryptOperation
   
   GtkWidget *encrypt_dialog;
   gpgme_key_t *rset;
-  int cipher_fd, plain_fd;
-  gpgme_data_t cipher, plain;
 
   gboolean force_armor;
 };
@@ -54,7 +54,10 @@ static GObjectClass *parent_class = NULL;
 static void
 gpa_file_import_operation_finalize (GObject *object)
 {
-  /* GpaFileImportOperation *op = GPA_FILE_IMPORT_OPERATION (object); */
+  GpaFileImportOperation *op = GPA_FILE_IMPORT_OPERATION (object);
+
+  g_strfreev (op->counters.fprs);
+  op->counters.fprs = NULL;
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -21,8 +21,13 @@
 
 #include <config.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
 #include "i18n.h"
 #include "gtktools.h"
+#include "gpgmetools.h"
 #include "gpafileop.h"
 
 /* Signals */
@@ -39,9 +44,17 @@ enum
   PROP_INPUT_FILES
 };
 
+/* The upper limit for the number of workers.  */
+#define MAX_WORKERS 16
+
 static GObjectClass *parent_class = NULL;
 static guint signals [LAST_SIGNAL] = { 0 };
 
+static void worker_done_cb (GpaContext *context, gpg_error_t err,
+                            GpaFileOperation *op);
+static void worker_progress_cb (GpaContext *context, int current, int total,
+                                GpaFileOperation *op);
+
 static void
 gpa_file_operation_get_property (GObject     *object,
 				 guint        prop_id,
@@ -102,9 +115,20 @@ static void
 gpa_file_operation_finalize (GObject *object)
 {
   GpaFileOperation *op = GPA_FILE_OPERATION (object);
+  GList *item;
 
+  for (item = op->contexts; item; item = g_list_next (item))
+    {
+      g_signal_handlers_disconnect_by_func (item->data,
+                                            G_CALLBACK (worker_done_cb), op);
+      g_object_unref (item->data);
+    }
+  g_list_free (op->contexts);
+  g_list_free (op->idle_contexts);
   g_list_foreach (op->input_files, (GFunc) free_file_item, NULL);
   g_list_free (op->input_files);
+  if (op->errors)
+    g_string_free (op->errors, TRUE);
   gtk_widget_destroy (op->progress_dialog);
   
   G_OBJECT_CLASS (parent_class)->finalize (object);
@@ -116,6 +140,7 @@ gpa_file_operation_init (GpaFileOperation *op)
   op->input_files = NULL;
   op->current = NULL;
   op->progress_dialog = NULL;
+  op->max_workers = 1;
 }
 
 static GObject*
@@ -151,6 +176,9 @@ gpa_file_operation_class_init (GpaFileOperationClass *klass)
   object_class->get_property = gpa_file_operation_get_property;
 
   klass->created_file = NULL;
+  klass->start_item = NULL;
+  klass->finish_item = NULL;
+  klass->finished = NULL;
 
   /* Signals */
   signals[CREATED_FILE] =
@@ -230,3 +258,431 @@ gpa_file_operation_current_file (GpaFileOperation *op)
   else
     return NULL;
 }
+
+
+/* Process up to N file items at the same time.  */
+void
+gpa_file_operation_set_max_workers (GpaFileOperation *op, int n)
+{
+  g_return_if_fail (GPA_IS_FILE_OPERATION (op));
+
+  if (n <= 0)
+    n = g_get_num_processors ();
+  op->max_workers = CLAMP (n, 1, MAX_WORKERS);
+}
+
+
+/* Process the items as a batch if there is more than one.  */
+void
+gpa_file_operation_set_batch (GpaFileOperation *op)
+{
+  g_return_if_fail (GPA_IS_FILE_OPERATION (op));
+
+  op->batch = op->input_files && op->input_files->next;
+}
+
+
+/* Return a newly allocated string describing the number of items
+   processed and the throughput.  */
+gchar *
+gpa_file_operation_get_throughput (GpaFileOperation *op)
+{
+  gdouble seconds = 0;
+  gdouble mbytes = op->n_bytes / 1048576.0;
+
+  g_return_val_if_fail (GPA_IS_FILE_OPERATION (op), NULL);
+
+  if (op->start_time)
+    seconds = (g_get_monotonic_time () - op->start_time) / 1000000.0;
+  if (seconds < 0.001)
+    seconds = 0.001;
+
+  return g_strdup_printf (_("%d files, %.1f MB in %.1f s"
+                            " (%.1f files/s, %.1f MB/s)"),
+                          op->n_done, mbytes, seconds,
+                          op->n_done / seconds, mbytes / seconds);
+}
+
+
+/* Return the number of input bytes of the item of WORKER.  */
+static guint64
+worker_input_size (gpa_file_worker_t worker)
+{
+  struct stat st;
+  guint64 size = 0;
+
+  if (worker->item->direct_in)
+    return worker->item->direct_in_len;
+
+  if (worker->in_fd != -1 && !fstat (worker->in_fd, &st))
+    size += st.st_size;
+  if (worker->signed_text_fd != -1 && !fstat (worker->signed_text_fd, &st))
+    size += st.st_size;
+  return size;
+}
+
+
+/* Let the input of WORKER report the bytes read to the context of
+   WORKER.  For a detached signature only the signed text is
+   counted.  */
+gpg_error_t
+gpa_file_operation_count_input (GpaFileOperation *op,
+                                gpa_file_worker_t worker)
+{
+  struct stat st;
+  guint64 total = 0;
+  int fd;
+
+  g_return_val_if_fail (GPA_IS_FILE_OPERATION (op), gpg_error (GPG_ERR_BUG));
+
+  fd = worker->signed_text ? worker->signed_text_fd : worker->in_fd;
+  if (worker->item->direct_in)
+    total = worker->item->direct_in_len;
+  else if (fd != -1 && !fstat (fd, &st) && S_ISREG (st.st_mode))
+    total = st.st_size;
+
+  return gpa_data_new_progress (worker->signed_text ? &worker->signed_text
+                                /* */             : &worker->in,
+                                total, worker->context);
+}
+
+
+/* Open FILENAME for reading by a worker.  An error is shown in a
+   dialog, unless OP is a batch which reports it in its summary.  */
+int
+gpa_file_operation_open_input (GpaFileOperation *op, const gchar *filename,
+                               gpgme_data_t *data, gpg_error_t *r_err)
+{
+  int fd;
+
+  g_return_val_if_fail (GPA_IS_FILE_OPERATION (op), -1);
+
+  fd = gpa_open_input_quiet (filename, data, r_err);
+  if (fd == -1 && !op->batch)
+    {
+      gchar *message;
+
+      message = g_strdup_printf ("%s: %s", filename, gpg_strerror (*r_err));
+      gpa_window_error (message, GPA_OPERATION (op)->window);
+      g_free (message);
+    }
+  return fd;
+}
+
+
+/* Copy the settings relevant for the file operations from the context
+   SRC to DST.  */
+static void
+copy_context_settings (GpaContext *dst, GpaContext *src)
+{
+  gpgme_key_t key;
+  int i;
+
+  gpgme_set_protocol (dst->ctx, gpgme_get_protocol (src->ctx));
+  gpgme_set_armor (dst->ctx, gpgme_get_armor (src->ctx));
+  gpgme_set_textmode (dst->ctx, gpgme_get_textmode (src->ctx));
+  gpgme_signers_clear (dst->ctx);
+  for (i = 0; (key = gpgme_signers_enum (src->ctx, i)); i++)
+    {
+      gpgme_signers_add (dst->ctx, key);
+      gpgme_key_unref (key);
+    }
+}
+
+
+/* Return an unused context for a worker.  The context of the
+   operation is used first; further contexts get the settings of
+   it.  */
+static GpaContext *
+take_worker_context (GpaFileOperation *op)
+{
+  GpaContext *context;
+
+  if (!op->contexts)
+    {
+      context = g_object_ref (GPA_OPERATION (op)->context);
+      op->contexts = g_list_prepend (op->contexts, context);
+      g_signal_connect (G_OBJECT (context), "done",
+                        G_CALLBACK (worker_done_cb), op);
+      g_signal_connect (G_OBJECT (context), "progress",
+                        G_CALLBACK (worker_progress_cb), op);
+    }
+  else if (op->idle_contexts)
+    {
+      context = op->idle_contexts->data;
+      op->idle_contexts = g_list_delete_link (op->idle_contexts,
+                                              op->idle_contexts);
+    }
+  else
+    {
+      context = gpa_context_new_for_protocol
+        (gpgme_get_protocol (GPA_OPERATION (op)->context->ctx));
+      copy_context_settings (context, GPA_OPERATION (op)->context);
+      op->contexts = g_list_prepend (op->contexts, context);
+      g_signal_connect (G_OBJECT (context), "done",
+                        G_CALLBACK (worker_done_cb), op);
+      g_signal_connect (G_OBJECT (context), "progress",
+                        G_CALLBACK (worker_progress_cb), op);
+    }
+  return context;
+}
+
+
+/* Return the size of the input files of all items as far as it is
+   known.  */
+static guint64
+total_input_size (GpaFileOperation *op)
+{
+  struct stat st;
+  guint64 total = 0;
+  GList *cur;
+
+  for (cur = op->input_files; cur; cur = g_list_next (cur))
+    {
+      gpa_file_item_t item = cur->data;
+
+      if (item->direct_in)
+        total += item->direct_in_len;
+      else if (item->filename_in && !g_stat (item->filename_in, &st)
+               && S_ISREG (st.st_mode))
+        total += st.st_size;
+    }
+  return total;
+}
+
+
+/* Show the bytes read by all workers in the progress bar.  The
+   progress of a single context is meaningless with several
+   workers.  */
+static void
+update_worker_bytes (GpaFileOperation *op)
+{
+  GpaProgressDialog *dialog = GPA_PROGRESS_DIALOG (op->progress_dialog);
+  GtkProgressBar *bar = GTK_PROGRESS_BAR (dialog->pbar);
+  guint64 done = op->n_bytes;
+  guint64 total;
+  gchar *text;
+  GList *cur;
+
+  for (cur = op->workers; cur; cur = g_list_next (cur))
+    done += ((gpa_file_worker_t) cur->data)->context->bytes_done;
+  /* The size of a directory archive or of the signed text of a
+     detached signature is not included in the total.  */
+  total = MAX (op->bytes_total, done);
+  if (!total)
+    {
+      /* Without any sizes only the number of items is known.  */
+      guint n = g_list_length (op->input_files);
+
+      if (n)
+        gtk_progress_bar_set_fraction (bar, (gdouble) op->n_done / n);
+      gtk_progress_bar_set_show_text (bar, FALSE);
+      return;
+    }
+
+  gtk_progress_bar_set_fraction (bar, (gdouble) done / (gdouble) total);
+  text = g_strdup_printf (_("%.1f of %.1f MB"),
+                          done / 1048576.0, total / 1048576.0);
+  gtk_progress_bar_set_text (bar, text);
+  gtk_progress_bar_set_show_text (bar, TRUE);
+  g_free (text);
+}
+
+
+/* Signal handler for the "progress" signal of the contexts of the
+   workers.  */
+static void
+worker_progress_cb (GpaContext *context, int current, int total,
+                    GpaFileOperation *op)
+{
+  if (op->max_workers > 1)
+    update_worker_bytes (op);
+}
+
+
+/* Show the progress of the workers.  ITEM is the item which has just
+   been started or NULL.  */
+static void
+update_worker_progress (GpaFileOperation *op, gpa_file_item_t item)
+{
+  GpaProgressDialog *dialog = GPA_PROGRESS_DIALOG (op->progress_dialog);
+  const gchar *name = NULL;
+  gchar *label;
+  guint total;
+
+  if (item)
+    name = item->direct_name ? item->direct_name : item->filename_in;
+
+  if (op->max_workers <= 1)
+    {
+      if (name)
+        gpa_progress_dialog_set_label (dialog, name);
+      return;
+    }
+
+  /* Show the number of finished items and the bytes read by all
+     workers.  */
+  if (gpa_progress_bar_get_context (dialog->pbar))
+    gpa_progress_bar_set_context (dialog->pbar, NULL);
+  total = g_list_length (op->input_files);
+  if (name)
+    label = g_strdup_printf (_("%s\n%d of %u files done"),
+                             name, op->n_done, total);
+  else
+    label = g_strdup_printf (_("%d of %u files done"), op->n_done, total);
+  gpa_progress_dialog_set_label (dialog, label);
+  g_free (label);
+  update_worker_bytes (op);
+}
+
+
+void
+gpa_file_operation_add_error (GpaFileOperation *op, gpa_file_item_t item,
+                              const gchar *text)
+{
+  g_return_if_fail (GPA_IS_FILE_OPERATION (op));
+
+  if (!op->errors)
+    op->errors = g_string_new (NULL);
+  g_string_append_printf (op->errors, "%s: %s\n",
+                          item->direct_name ? item->direct_name
+                          /* */            : item->filename_in, text);
+}
+
+
+void
+gpa_file_operation_show_errors (GpaFileOperation *op)
+{
+  gchar *summary;
+
+  g_return_if_fail (GPA_IS_FILE_OPERATION (op));
+
+  if (op->batch)
+    {
+      summary = gpa_file_operation_get_throughput (op);
+      if (op->errors)
+        gpa_show_warn (GPA_OPERATION (op)->window, NULL, "%s\n\n%s",
+                       summary, op->errors->str);
+      else
+        gpa_show_info (GPA_OPERATION (op)->window, "%s", summary);
+      g_free (summary);
+    }
+  else if (op->errors)
+    gpa_show_warn (GPA_OPERATION (op)->window, NULL, "%s", op->errors->str);
+  if (op->errors)
+    g_string_free (op->errors, TRUE);
+  op->errors = NULL;
+}
+
+
+/* Signal handler for the "done" signal of the contexts of the
+   workers.  */
+static void
+worker_done_cb (GpaContext *context, gpg_error_t err, GpaFileOperation *op)
+{
+  gpa_file_worker_t worker = NULL;
+  GList *item;
+
+  for (item = op->workers; item; item = g_list_next (item))
+    if (((gpa_file_worker_t) item->data)->context == context)
+      {
+        worker = item->data;
+        break;
+      }
+  if (!worker)
+    return;  /* Not started by a worker.  */
+
+  /* The operation may complete and be released by the owner while
+     finish_item runs a dialog.  */
+  g_object_ref (op);
+  op->workers = g_list_delete_link (op->workers, item);
+  op->n_done++;
+  op->n_bytes += worker_input_size (worker);
+  /* A batch goes on after errors but not if the user canceled.  */
+  if (err && !op->worker_err
+      && !(op->batch && gpg_err_code (err) != GPG_ERR_CANCELED))
+    op->worker_err = err;
+  op->finishing_items++;
+  GPA_FILE_OPERATION_GET_CLASS (op)->finish_item (op, worker, err);
+  op->finishing_items--;
+  op->idle_contexts = g_list_prepend (op->idle_contexts, worker->context);
+  g_free (worker);
+
+  update_worker_progress (op, NULL);
+  gpa_file_operation_run_workers (op);
+  g_object_unref (op);
+}
+
+
+/* Start processing the remaining file items.  */
+void
+gpa_file_operation_run_workers (GpaFileOperation *op)
+{
+  GpaFileOperationClass *klass;
+  gpa_file_worker_t worker;
+  gpg_error_t err;
+
+  g_return_if_fail (GPA_IS_FILE_OPERATION (op));
+  klass = GPA_FILE_OPERATION_GET_CLASS (op);
+  g_return_if_fail (klass->start_item && klass->finish_item
+                    && klass->finished);
+
+  /* The outer call starts the next items and finishes the
+     operation.  */
+  if (op->starting_workers)
+    return;
+  op->starting_workers = TRUE;
+  if (!op->start_time)
+    {
+      op->start_time = g_get_monotonic_time ();
+      if (op->max_workers > 1)
+        op->bytes_total = total_input_size (op);
+    }
+
+  while (!op->worker_err && op->current
+         && (int) g_list_length (op->workers) < op->max_workers)
+    {
+      worker = g_malloc0 (sizeof *worker);
+      worker->item = op->current->data;
+      worker->in_fd = -1;
+      worker->out_fd = -1;
+      worker->signed_text_fd = -1;
+      worker->context = take_worker_context (op);
+      op->current = g_list_next (op->current);
+
+      err = klass->start_item (op, worker);
+      if (err && op->batch && gpg_err_code (err) != GPG_ERR_CANCELED)
+        {
+          /* Report the item like a finished one and go on with the
+             next.  */
+          op->n_done++;
+          op->finishing_items++;
+          klass->finish_item (op, worker, err);
+          op->finishing_items--;
+          op->idle_contexts = g_list_prepend (op->idle_contexts,
+                                              worker->context);
+          g_free (worker);
+          update_worker_progress (op, NULL);
+          continue;
+        }
+      if (err)
+        {
+          op->worker_err = err;
+          op->idle_contexts = g_list_prepend (op->idle_contexts,
+                                              worker->context);
+          g_free (worker);
+          break;
+        }
+      op->workers = g_list_append (op->workers, worker);
+      gtk_widget_show_all (op->progress_dialog);
+      update_worker_progress (op, worker->item);
+    }
+  op->starting_workers = FALSE;
+
+  /* The last finish_item to return finishes the operation.  */
+  if (!op->workers && !op->finishing_items)
+    {
+      gtk_widget_hide (op->progress_dialog);
+      klass->finished (op, op->worker_err);
+    }
+}
@@ -27,6 +27,7 @@
 #include <glib-object.h>
 #include "gpaoperation.h"
 #include "gpaprogressdlg.h"
+#include "tarstream.h"
 
 /* GObject stuff */
 #define GPA_FILE_OPERATION_TYPE	  (gpa_file_operation_get_type ())
@@ -57,12 +58,74 @@ struct gpa_file_item_s
 typedef struct gpa_file_item_s *gpa_file_item_t; 
 
 
+/* A worker processing one file item with its own context.  */
+struct gpa_file_worker_s
+{
+  GpaContext *context;
+  gpa_file_item_t item;
+
+  /* The data objects and file descriptors used for ITEM.  */
+  gpgme_data_t in, out;
+  int in_fd, out_fd;
+
+  /* For a detached signature in IN: the signed data and the names of
+     both files.  */
+  gpgme_data_t signed_text;
+  int signed_text_fd;
+  gchar *signed_file, *signature_file;
+
+  /* The extraction of an archive written to OUT or NULL.  */
+  gpa_tar_extract_t archive;
+};
+typedef struct gpa_file_worker_s *gpa_file_worker_t;
+
+
 struct _GpaFileOperation {
   GpaOperation parent;
 
   GList *input_files;
   GList *current;
   GtkWidget *progress_dialog;
+
+  /* The maximum number of file items processed at the same time by
+     gpa_file_operation_run_workers.  */
+  int max_workers;
+
+  /* The running workers, all contexts used by the workers and those
+     not in use.  */
+  GList *workers;
+  GList *contexts;
+  GList *idle_contexts;
+
+  /* Set while gpa_file_operation_run_workers starts items.  A worker
+     may finish while start_item runs a modal dialog.  */
+  gboolean starting_workers;
+
+  /* The number of finish_item calls running.  The operation is not
+     finished before all have returned.  */
+  int finishing_items;
+
+  /* The errors of the items as lines of text, collected while the
+     workers run; see gpa_file_operation_add_error.  */
+  GString *errors;
+
+  /* The number of finished items and the first error.  */
+  int n_done;
+  gpg_error_t worker_err;
+
+  /* If set, an error of a single item does not stop the other items
+     and the operation reports it in its summary instead of a
+     dialog.  */
+  gboolean batch;
+
+  /* The time the first item has been started and the number of input
+     bytes of the finished items.  */
+  gint64 start_time;
+  guint64 n_bytes;
+
+  /* The known size of the input files of all items, for the progress
+     of several workers.  */
+  guint64 bytes_total;
 };
 
 struct _GpaFileOperationClass {
@@ -72,6 +135,18 @@ struct _GpaFileOperationClass {
   /* Called every time a new file is created by the operation,
    * *after* the operations is done with it. */
   void (*created_file) (GpaContext *context, const gchar *file);
+
+  /* Used by gpa_file_operation_run_workers: Start the operation for
+     the item of WORKER.  */
+  gpg_error_t (*start_item) (GpaFileOperation *op, gpa_file_worker_t worker);
+
+  /* The operation for the item of WORKER finished with ERR.  */
+  void (*finish_item) (GpaFileOperation *op, gpa_file_worker_t worker,
+                       gpg_error_t err);
+
+  /* All items have been processed or processing stopped after the
+     error ERR.  */
+  void (*finished) (GpaFileOperation *op, gpg_error_t err);
 };
 
 GType gpa_file_operation_get_type (void) G_GNUC_CONST;
@@ -88,4 +163,54 @@ gpa_file_operation_input_files (GpaFileOperation *op);
 const gchar *
 gpa_file_operation_current_file (GpaFileOperation *op);
 
+/* Process up to N file items at the same time.  With N being 0 the
+   number of processors is used.  */
+void
+gpa_file_operation_set_max_workers (GpaFileOperation *op, int n);
+
+/* Process the items as a batch if there is more than one.  */
+void
+gpa_file_operation_set_batch (GpaFileOperation *op);
+
+/* Return a newly allocated string describing the number of items
+   processed and the throughput.  */
+gchar *
+gpa_file_operation_get_throughput (GpaFileOperation *op);
+
+/* Let the input of WORKER report the bytes read to the context of
+   WORKER.  To be called by the start_item method before starting the
+   operation.  */
+gpg_error_t
+gpa_file_operation_count_input (GpaFileOperation *op,
+                                gpa_file_worker_t worker);
+
+/* Open FILENAME for reading by the item of a worker.  Returns the
+   file descriptor or -1 with the error stored at R_ERR.  The error is
+   shown to the user unless OP is a batch.  */
+int
+gpa_file_operation_open_input (GpaFileOperation *op, const gchar *filename,
+                               gpgme_data_t *data, gpg_error_t *r_err);
+
+/* Remember the error TEXT for ITEM instead of showing a dialog while
+   other workers run.  */
+void
+gpa_file_operation_add_error (GpaFileOperation *op, gpa_file_item_t item,
+                              const gchar *text);
+
+/* Show the errors collected by gpa_file_operation_add_error, if any,
+   in one dialog.  In a batch the dialog is always shown and starts
+   with the summary of gpa_file_operation_get_throughput.  To be
+   called by the finished method.  */
+void
+gpa_file_operation_show_errors (GpaFileOperation *op);
+
+/* Start processing the remaining file items using the start_item and
+   finish_item methods of the class.  Each item runs in its own
+   context.  After an error no further items are started, unless OP
+   is a batch: then the error of an item, including one returned by
+   start_item, is passed to finish_item and the next item is
+   started.  */
+void
+gpa_file_operation_run_workers (GpaFileOperation *op);
+
 #endif
@@ -23,6 +23,7 @@
 
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <sys/stat.h>
 
 #ifdef G_OS_UNIX
 #include <unistd.h>
@@ -261,6 +262,8 @@ gpa_file_sign_operation_start (GpaFileSignOperation *op,
 			       gpa_file_item_t file_item)
 {
   gpg_error_t err;
+  guint64 total = 0;
+  struct stat st;
 
   if (file_item->direct_in)
     {
@@ -315,8 +318,15 @@ gpa_file_sign_operation_start (GpaFileSignOperation *op,
     }
 
   /* Start the operation */
-  err = gpgme_op_sign_start (GPA_OPERATION (op)->context->ctx, op->plain,
-			     op->sig, op->sign_type);
+  if (file_item->direct_in)
+    total = file_item->direct_in_len;
+  else if (!fstat (op->plain_fd, &st) && S_ISREG (st.st_mode))
+    total = st.st_size;
+  err = gpa_data_new_progress (&op->plain, total,
+			       GPA_OPERATION (op)->context);
+  if (!err)
+    err = gpgme_op_sign_start (GPA_OPERATION (op)->context->ctx, op->plain,
+			       op->sig, op->sign_type);
   if (err)
     {
       gpa_gpgme_warning (err);
@@ -41,12 +41,16 @@
 
 /* Internal functions */
 static gboolean gpa_file_verify_operation_idle_cb (gpointer data);
-static void gpa_file_verify_operation_done_error_cb (GpaContext *context,
-						     gpg_error_t err,
-						     GpaFileVerifyOperation *op);
-static void gpa_file_verify_operation_done_cb (GpaContext *context,
-						gpg_error_t err,
-						GpaFileVerifyOperation *op);
+static gpg_error_t gpa_file_verify_operation_start_item
+	(GpaFileOperation *fileop, gpa_file_worker_t worker);
+static void gpa_file_verify_operation_finish_item (GpaFileOperation *fileop,
+						   gpa_file_worker_t worker,
+						   gpg_error_t err);
+static void gpa_file_verify_operation_finished (GpaFileOperation *fileop,
+						gpg_error_t err);
+static void gpa_file_verify_operation_show_error (GpaFileOperation *fileop,
+						  gpa_file_worker_t worker,
+						  gpg_error_t err);
 static void gpa_file_verify_operation_response_cb (GtkDialog *dialog,
 						   gint response,
 						   gpointer user_data);
@@ -69,12 +73,6 @@ gpa_file_verify_operation_finalize (GObject *object)
 static void
 gpa_file_verify_operation_init (GpaFileVerifyOperation *op)
 {
-  op->sig_fd = -1;
-  op->signed_text_fd = -1;
-  op->sig = NULL;
-  op->signed_text = NULL;
-  op->signed_file = NULL;
-  op->signature_file = NULL;
 }
 
 static GObject*
@@ -85,28 +83,32 @@ gpa_file_verify_operation_constructor
 {
   GObject *object;
   GpaFileVerifyOperation *op;
+  GpaFileOperation *fileop;
 
   /* Invoke parent's constructor */
   object = parent_class->constructor (type,
 				      n_construct_properties,
 				      construct_properties);
   op = GPA_FILE_VERIFY_OPERATION (object);
+  fileop = GPA_FILE_OPERATION (op);
   /* Initialize */
+  /* Verify several files at the same time and collect the results of
+     a batch on a summary page.  */
+  gpa_file_operation_set_max_workers
+    (fileop, gpa_options_get_file_workers (gpa_options_get_instance ()));
+  gpa_file_operation_set_batch (fileop);
   /* Start with the first file after going back into the main loop */
   g_idle_add (gpa_file_verify_operation_idle_cb, op);
-  /* Connect to the "done" signal */
-  g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
-		    G_CALLBACK (gpa_file_verify_operation_done_error_cb), op);
-  g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
-		    G_CALLBACK (gpa_file_verify_operation_done_cb), op);
   /* Give a title to the progress dialog */
-  gtk_window_set_title (GTK_WINDOW (GPA_FILE_OPERATION (op)->progress_dialog),
+  gtk_window_set_title (GTK_WINDOW (fileop->progress_dialog),
 			_("Verifying..."));
 
   /* Create the verification dialog */
   op->dialog = gpa_file_verify_dialog_new (GPA_OPERATION (op)->window);
   g_signal_connect (G_OBJECT (op->dialog), "response",
 		    G_CALLBACK (gpa_file_verify_operation_response_cb), op);
+  if (fileop->batch)
+    gpa_file_verify_dialog_set_batch (GPA_FILE_VERIFY_DIALOG (op->dialog));
 
   return object;
 }
@@ -116,11 +118,16 @@ static void
 gpa_file_verify_operation_class_init (GpaFileVerifyOperationClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GpaFileOperationClass *file_op_class = GPA_FILE_OPERATION_CLASS (klass);
 
   parent_class = g_type_class_peek_parent (klass);
 
   object_class->constructor = gpa_file_verify_operation_constructor;
   object_class->finalize = gpa_file_verify_operation_finalize;
+
+  file_op_class->start_item = gpa_file_verify_operation_start_item;
+  file_op_class->finish_item = gpa_file_verify_operation_finish_item;
+  file_op_class->finished = gpa_file_verify_operation_finished;
 }
 
 GType
@@ -190,7 +197,8 @@ ask_use_detached_sig (const gchar *file, const gchar *sig, GtkWidget *parent)
 
 /* Check whether the file is a detached signature and deduce the name of the
  * original file. Since we only have access to the filename, this is not
- * very solid.
+ * very solid.  If WINDOW is NULL a signature found for the file is used
+ * without asking.
  */
 static gboolean
 is_detached_sig (const gchar *filename, gchar **signature_file,
@@ -228,7 +236,7 @@ is_detached_sig (const gchar *filename, gchar **signature_file,
       gchar *sig = g_strconcat (filename, sig_extension[i], NULL);
 
       if (g_file_test (sig, G_FILE_TEST_EXISTS)
-          && ask_use_detached_sig (filename, sig, window))
+          && (!window || ask_use_detached_sig (filename, sig, window)))
         {
           *signed_file = g_strdup (filename);
           *signature_file = sig;
@@ -240,135 +248,146 @@ is_detached_sig (const gchar *filename, gchar **signature_file,
   return FALSE;
 }
 
-static gboolean
-gpa_file_verify_operation_start (GpaFileVerifyOperation *op,
-				 gpa_file_item_t file_item)
+
+/* Release the data objects of WORKER and close its files.  */
+static void
+release_worker_data (gpa_file_worker_t worker)
 {
-  gpgme_error_t err;
+  gpgme_data_release (worker->out);
+  worker->out = NULL;
+  gpgme_data_release (worker->signed_text);
+  worker->signed_text = NULL;
+  if (worker->signed_text_fd != -1)
+    close (worker->signed_text_fd);
+  worker->signed_text_fd = -1;
+  gpgme_data_release (worker->in);
+  worker->in = NULL;
+  if (worker->in_fd != -1)
+    close (worker->in_fd);
+  worker->in_fd = -1;
+  g_free (worker->signed_file);
+  worker->signed_file = NULL;
+  g_free (worker->signature_file);
+  worker->signature_file = NULL;
+}
+
+
+static gpg_error_t
+gpa_file_verify_operation_start_item (GpaFileOperation *fileop,
+				      gpa_file_worker_t worker)
+{
+  gpa_file_item_t file_item = worker->item;
+  gpgme_ctx_t ctx = worker->context->ctx;
+  gpg_error_t err;
 
   if (file_item->direct_in)
     {
       /* Direct input is always an inline signature.  */
 
       /* No copy is made.  */
-      err = gpgme_data_new_from_mem (&op->sig, file_item->direct_in,
+      err = gpgme_data_new_from_mem (&worker->in, file_item->direct_in,
 				     file_item->direct_in_len, 0);
       if (err)
 	{
 	  gpa_gpgme_warning (err);
-	  return FALSE;
+	  return err;
 	}
 
-      err = gpgme_data_new (&op->plain);
+      err = gpgme_data_new (&worker->out);
       if (err)
 	{
 	  gpa_gpgme_warning (err);
-	  gpgme_data_release (op->sig);
-	  op->sig = NULL;
-	  return FALSE;
+	  release_worker_data (worker);
+	  return err;
 	}
 
-      gpgme_set_protocol (GPA_OPERATION (op)->context->ctx,
-                          is_cms_data (file_item->direct_in,
-                                       file_item->direct_in_len) ?
+      gpgme_set_protocol (ctx, is_cms_data (file_item->direct_in,
+                                            file_item->direct_in_len) ?
                           GPGME_PROTOCOL_CMS : GPGME_PROTOCOL_OpenPGP);
     }
   else
     {
       const gchar *sig_filename = file_item->filename_in;
 
-      if (is_detached_sig (sig_filename, &op->signature_file, &op->signed_file,
-			   GPA_OPERATION (op)->window))
+      /* Do not ask for each file of a batch.  */
+      if (is_detached_sig (sig_filename, &worker->signature_file,
+			   &worker->signed_file,
+			   fileop->batch ? NULL : GPA_OPERATION (fileop)->window))
 	{
 	  /* Allocate data objects for a detached signature */
-	  op->sig_fd = gpa_open_input (op->signature_file, &op->sig,
-				       GPA_OPERATION (op)->window);
-	  if (op->sig_fd == -1)
+	  worker->in_fd = gpa_file_operation_open_input
+	    (fileop, worker->signature_file, &worker->in, &err);
+	  if (worker->in_fd == -1)
 	    {
-	      return FALSE;
+	      release_worker_data (worker);
+	      return err;
 	    }
-	  op->signed_text_fd = gpa_open_input (op->signed_file, &op->signed_text,
-					       GPA_OPERATION (op)->window);
-	  if (op->signed_text_fd == -1)
+	  worker->signed_text_fd = gpa_file_operation_open_input
+	    (fileop, worker->signed_file, &worker->signed_text, &err);
+	  if (worker->signed_text_fd == -1)
 	    {
-	      gpgme_data_release (op->sig);
-	      close (op->sig_fd);
-	      return FALSE;
+	      release_worker_data (worker);
+	      return err;
 	    }
-	  op->plain = NULL;
 	}
       else
 	{
 	  /* Allocate data object for non-detached signatures */
-	  op->sig_fd = gpa_open_input (sig_filename, &op->sig,
-				       GPA_OPERATION (op)->window);
-	  if (op->sig_fd == -1)
-	    {
-	      return FALSE;
-	    }
-	  err = gpgme_data_new (&op->plain);
+	  worker->in_fd = gpa_file_operation_open_input (fileop, sig_filename,
+							 &worker->in, &err);
+	  if (worker->in_fd == -1)
+	    return err;
+	  err = gpgme_data_new (&worker->out);
 	  if (err)
 	    {
-	      gpgme_data_release (op->sig);
-	      close (op->sig_fd);
-	      return FALSE;
+	      release_worker_data (worker);
+	      return err;
 	    }
-	  op->signed_text_fd = -1;
-	  op->signed_text = NULL;
 	}
 
-      gpgme_set_protocol (GPA_OPERATION (op)->context->ctx,
-                          is_cms_file (sig_filename) ?
+      gpgme_set_protocol (ctx, is_cms_file (sig_filename) ?
                           GPGME_PROTOCOL_CMS : GPGME_PROTOCOL_OpenPGP);
     }
 
-
   /* Start the operation */
-  err = gpgme_op_verify_start (GPA_OPERATION (op)->context->ctx, op->sig,
-			       op->signed_text, op->plain);
+  err = gpa_file_operation_count_input (fileop, worker);
+  if (!err)
+    err = gpgme_op_verify_start (ctx, worker->in, worker->signed_text,
+				 worker->out);
   if (err)
     {
-      gpa_gpgme_warning (err);
-      return FALSE;
+      if (!fileop->batch)
+	gpa_gpgme_warning (err);
+      release_worker_data (worker);
+      return err;
     }
-  /* Show and update the progress dialog */
-  gtk_widget_show_all (GPA_FILE_OPERATION (op)->progress_dialog);
-  gpa_progress_dialog_set_label (GPA_PROGRESS_DIALOG
-				 (GPA_FILE_OPERATION (op)->progress_dialog),
-				 file_item->direct_name
-				 ? file_item->direct_name
-				 : file_item->filename_in);
-
-  return TRUE;
-}
-
 
-static void
-gpa_file_verify_operation_next (GpaFileVerifyOperation *op)
-{
-  if (! GPA_FILE_OPERATION (op)->current ||
-      ! gpa_file_verify_operation_start (op, GPA_FILE_OPERATION (op)
-					 ->current->data))
-    {
-      /* All files have been verified: show the results dialog */
-      gtk_widget_show_all (op->dialog);
-    }
+  return 0;
 }
 
 
 static void
-gpa_file_verify_operation_done_cb (GpaContext *context,
-				    gpg_error_t err,
-				    GpaFileVerifyOperation *op)
+gpa_file_verify_operation_finish_item (GpaFileOperation *fileop,
+				       gpa_file_worker_t worker,
+				       gpg_error_t err)
 {
-  gpa_file_item_t file_item = GPA_FILE_OPERATION (op)->current->data;
+  GpaFileVerifyOperation *op = GPA_FILE_VERIFY_OPERATION (fileop);
+  gpa_file_item_t file_item = worker->item;
+  const gchar *name = (file_item->direct_name
+		       ? file_item->direct_name
+		       : file_item->filename_in);
+
+  if (fileop->batch && err && gpg_err_code (err) != GPG_ERR_CANCELED)
+    gpa_file_verify_dialog_add_error (GPA_FILE_VERIFY_DIALOG (op->dialog),
+				      name, err);
+  else
+    gpa_file_verify_operation_show_error (fileop, worker, err);
 
-  if (file_item->direct_in)
+  if (file_item->direct_in && !err)
     {
       size_t len;
-      char *plain_gpgme = gpgme_data_release_and_get_mem (op->plain,
-							   &len);
-      op->plain = NULL;
+      char *plain_gpgme = gpgme_data_release_and_get_mem (worker->out, &len);
+      worker->out = NULL;
       /* Do the memory allocation dance.  */
 
       if (plain_gpgme)
@@ -388,66 +407,62 @@ gpa_file_verify_operation_done_cb (GpaContext *context,
 	}
     }
 
-  /* Do clean up on the operation */
-  gpgme_data_release (op->plain);
-  op->plain = NULL;
-  gpgme_data_release (op->signed_text);
-  op->signed_text = NULL;
-  close (op->signed_text_fd);
-  op->signed_text_fd = -1;
-  gpgme_data_release (op->sig);
-  op->sig = NULL;
-  close (op->sig_fd);
-  op->sig_fd = -1;
-
-  gtk_widget_hide (GPA_FILE_OPERATION (op)->progress_dialog);
-  /* Check for error */
-  if (err)
-    {
-      /* Abort further verifications */
-    }
-  else
+  if (!err)
     {
       gpgme_verify_result_t result;
 
-      result = gpgme_op_verify_result (GPA_OPERATION (op)->context->ctx);
+      result = gpgme_op_verify_result (worker->context->ctx);
       /* Add the file to the result dialog.  FIXME: Maybe we should
 	 use the filename without the directory.  */
       gpa_file_verify_dialog_add_file (GPA_FILE_VERIFY_DIALOG (op->dialog),
-				       file_item->direct_name
-				       ? file_item->direct_name
-				       : file_item->filename_in,
-				       op->signed_file, op->signature_file,
+				       name,
+				       worker->signed_file,
+				       worker->signature_file,
 				       result->signatures);
-      /* If this was a dettached sig, reset the signed file */
-      if (op->signed_file)
-	{
-	  g_free (op->signed_file);
-	  op->signed_file = NULL;
-	  g_free (op->signature_file);
-	  op->signature_file = NULL;
-	}
-      else
-	{
-	  /* Otherwise, we created a "file" in direct mode.  */
-	  if (file_item->direct_in)
-	    g_signal_emit_by_name (GPA_OPERATION (op), "created_file",
-				   file_item);
-	}
 
-      /* Go to the next file in the list and verify it */
-      GPA_FILE_OPERATION (op)->current = g_list_next
-	(GPA_FILE_OPERATION (op)->current);
-      gpa_file_verify_operation_next (op);
+      /* Unless this was a detached sig, we created a "file" in
+	 direct mode.  */
+      if (!worker->signed_file && file_item->direct_in)
+	g_signal_emit_by_name (GPA_OPERATION (op), "created_file",
+			       file_item);
     }
+
+  /* Do clean up on the operation */
+  release_worker_data (worker);
 }
 
+
+static void
+gpa_file_verify_operation_finished (GpaFileOperation *fileop,
+				    gpg_error_t err)
+{
+  GpaFileVerifyOperation *op = GPA_FILE_VERIFY_OPERATION (fileop);
+
+  if (fileop->batch)
+    {
+      gchar *text = gpa_file_operation_get_throughput (fileop);
+
+      gpa_file_verify_dialog_set_summary (GPA_FILE_VERIFY_DIALOG (op->dialog),
+					  text);
+      g_free (text);
+    }
+
+  /* All files have been verified: show the results dialog unless
+     nothing could be verified.  */
+  op->err = err;
+  if (fileop->batch || !err)
+    gtk_widget_show_all (op->dialog);
+  else
+    g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
+}
+
+
 static gboolean
 gpa_file_verify_operation_idle_cb (gpointer data)
 {
   GpaFileVerifyOperation *op = data;
 
-  gpa_file_verify_operation_next (op);
+  gpa_file_operation_run_workers (GPA_FILE_OPERATION (op));
 
   return FALSE;
 }
@@ -459,16 +474,16 @@ gpa_file_verify_operation_response_cb (GtkDialog *dialog,
 {
   GpaFileVerifyOperation *op = GPA_FILE_VERIFY_OPERATION (user_data);
 
-  /* FIXME: Error handling.  */
-  g_signal_emit_by_name (GPA_OPERATION (op), "completed", 0);
+  g_signal_emit_by_name (GPA_OPERATION (op), "completed", op->err);
 }
 
 
 static void
-gpa_file_verify_operation_done_error_cb (GpaContext *context, gpg_error_t err,
-					 GpaFileVerifyOperation *op)
+gpa_file_verify_operation_show_error (GpaFileOperation *fileop,
+				      gpa_file_worker_t worker,
+				      gpg_error_t err)
 {
-  gpa_file_item_t file_item = GPA_FILE_OPERATION (op)->current->data;
+  gpa_file_item_t file_item = worker->item;
 
   switch (gpg_err_code (err))
     {
@@ -477,7 +492,7 @@ gpa_file_verify_operation_done_error_cb (GpaContext *context, gpg_error_t err,
       /* Ignore these */
       break;
     case GPG_ERR_NO_DATA:
-      gpa_show_warn (GPA_OPERATION (op)->window, GPA_OPERATION (op)->context,
+      gpa_show_warn (GPA_OPERATION (fileop)->window, worker->context,
                      file_item->direct_name
                      ? _("\"%s\" contained no OpenPGP data.")
                      : _("The file \"%s\" contained no OpenPGP"
@@ -487,11 +502,11 @@ gpa_file_verify_operation_done_error_cb (GpaContext *context, gpg_error_t err,
                      : file_item->filename_in);
       break;
     case GPG_ERR_BAD_PASSPHRASE:
-      gpa_show_warn (GPA_OPERATION (op)->window, GPA_OPERATION (op)->context,
+      gpa_show_warn (GPA_OPERATION (fileop)->window, worker->context,
                      _("Wrong passphrase!"));
       break;
     default:
-      gpa_gpgme_warn (err, NULL, GPA_OPERATION (op)->context);
+      gpa_gpgme_warn (err, NULL, worker->context);
       break;
     }
 }
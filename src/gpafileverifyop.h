@@ -39,9 +39,7 @@ typedef struct _GpaFileVerifyOperationClass GpaFileVerifyOperationClass;
 struct _GpaFileVerifyOperation {
   GpaFileOperation parent;
 
-  int sig_fd, signed_text_fd;
-  gpgme_data_t sig, signed_text, plain;
-  gchar *signed_file, *signature_file;
+  gpg_error_t err;
   GtkWidget *dialog;
 };
 
@@ -64,6 +64,8 @@ gpa_import_operation_finalize (GObject *object)
       g_free (op->source2);
       op->source2 = NULL;
     }
+  g_strfreev (op->fprs);
+  op->fprs = NULL;
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -73,6 +75,7 @@ gpa_import_operation_init (GpaImportOperation *op)
 {
   op->source = NULL;
   op->source2 = NULL;
+  op->fprs = NULL;
 }
 
 static GObject*
@@ -222,6 +225,11 @@ gpa_import_operation_done_cb (GpaContext *context, gpg_error_t err,
       GPA_IMPORT_OPERATION_GET_CLASS (op)->complete_import (op);
 
       res = gpgme_op_import_result (GPA_OPERATION (op)->context->ctx);
+      gpa_gpgme_update_import_results (&result, 0, 0, res);
+      g_strfreev (op->fprs);
+      op->fprs = result.fprs;
+      result.fprs = NULL;
+
       if (res->imported > 0 && res->secret_imported )
 	{
 	  g_signal_emit_by_name (GPA_OPERATION (op), "imported_secret_keys");
@@ -231,7 +239,6 @@ gpa_import_operation_done_cb (GpaContext *context, gpg_error_t err,
 	  g_signal_emit_by_name (GPA_OPERATION (op), "imported_keys");
 	}
 
-      gpa_gpgme_update_import_results (&result, 0, 0, res);
       gpa_gpgme_show_import_results (GPA_OPERATION (op)->window, &result);
     }
   g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
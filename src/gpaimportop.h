@@ -43,6 +43,11 @@ struct _GpaImportOperation {
 
   gpgme_data_t source;    /* Either a data object with the full key  */
   gpgme_key_t *source2;   /* or an array of key descriptions.  */
+
+  /* NULL terminated array with the fingerprints of the keys changed
+     by the import or NULL.  Valid after the "imported_keys" or
+     "imported_secret_keys" signal has been emitted.  */
+  char **fprs;
 };
 
 struct _GpaImportOperationClass {
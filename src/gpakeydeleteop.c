@@ -31,9 +31,11 @@
 #endif
 
 #include "gpa.h"
+#include "keytable.h"
 #include "gpakeydeleteop.h"
 
 /* Internal functions */
+static void gpa_key_delete_operation_ready_cb (gpointer data);
 static gboolean gpa_key_delete_operation_idle_cb (gpointer data);
 static void gpa_key_delete_operation_done_error_cb (GpaContext *context,
 						    gpg_error_t err,
@@ -78,8 +80,11 @@ gpa_key_delete_operation_constructor (GType type,
 		    G_CALLBACK (gpa_key_delete_operation_done_error_cb), op);
   g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
 		    G_CALLBACK (gpa_key_delete_operation_done_cb), op);
-  /* Start with the first key after going back into the main loop */
-  g_idle_add (gpa_key_delete_operation_idle_cb, op);
+  /* Start with the first key after going back into the main loop.
+     The dialog needs to know whether the keys have a secret part, so
+     wait for the secret keytable first.  */
+  gpa_keytable_when_ready (gpa_keytable_get_secret_instance (),
+			   gpa_key_delete_operation_ready_cb, op);
 
   return object;
 }
@@ -165,6 +170,12 @@ gpa_key_delete_operation_start (GpaKeyDeleteOperation *op)
   return 0;
 }
 
+static void
+gpa_key_delete_operation_ready_cb (gpointer data)
+{
+  g_idle_add (gpa_key_delete_operation_idle_cb, data);
+}
+
 static gboolean
 gpa_key_delete_operation_idle_cb (gpointer data)
 {
@@ -172,6 +172,42 @@ gpa_progress_bar_new_with_context (GpaContext *context)
 }
 
 
+/* Show the bytes read by the operation of CONTEXT, the rate and the
+   estimated time left if the size of the input is known.  */
+static void
+show_bytes (GpaContext *context, GpaProgressBar *pbar)
+{
+  GtkProgressBar *bar = GTK_PROGRESS_BAR (pbar);
+  gdouble done = context->bytes_done / 1048576.0;
+  gdouble total = context->bytes_total / 1048576.0;
+  gdouble seconds = 0;
+  gchar *text;
+
+  if (!context->bytes_total)
+    {
+      gtk_progress_bar_set_show_text (bar, FALSE);
+      return;
+    }
+
+  if (context->start_time)
+    seconds = (g_get_monotonic_time () - context->start_time) / 1000000.0;
+  /* The rate is not meaningful right after the start.  */
+  if (seconds >= 1 && done > 0 && done < total)
+    {
+      guint left = (guint) ((total - done) / (done / seconds));
+
+      text = g_strdup_printf (_("%.1f of %.1f MB, %.1f MB/s, %u:%02u left"),
+			      done, total, done / seconds,
+			      left / 60, left % 60);
+    }
+  else
+    text = g_strdup_printf (_("%.1f of %.1f MB"), done, total);
+  gtk_progress_bar_set_text (bar, text);
+  gtk_progress_bar_set_show_text (bar, TRUE);
+  g_free (text);
+}
+
+
 static void
 progress_cb (GpaContext *context, int current, int total, GpaProgressBar *pbar)
 {
@@ -180,6 +216,7 @@ progress_cb (GpaContext *context, int current, int total, GpaProgressBar *pbar)
 				   (gdouble) current / (gdouble) total);
   else
     gtk_progress_bar_pulse (GTK_PROGRESS_BAR (pbar));
+  show_bytes (context, pbar);
 }
 
 
@@ -218,6 +255,7 @@ gpa_progress_bar_set_context (GpaProgressBar *pbar, GpaContext *context)
 				   pbar->sig_id_done);
       g_signal_handler_disconnect (G_OBJECT (pbar->context),
 				   pbar->sig_id_progress);
+      gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR (pbar), FALSE);
     }
   
   pbar->context = context;
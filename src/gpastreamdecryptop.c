@@ -150,11 +150,14 @@ gpa_stream_decrypt_operation_ctor (GType type, guint n_construct_properties,
   g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
 		    G_CALLBACK (done_cb), op);
 
-  gtk_window_set_title
-    (GTK_WINDOW (GPA_STREAM_OPERATION (op)->progress_dialog),
-     _("Decrypting message ..."));
-
-  if (! op->no_verify)
+  if (GPA_STREAM_OPERATION (op)->progress_dialog)
+    gtk_window_set_title
+      (GTK_WINDOW (GPA_STREAM_OPERATION (op)->progress_dialog),
+       _("Decrypting message ..."));
+
+  /* In headless mode the signatures are only reported as status
+     lines.  */
+  if (! op->no_verify && ! headless)
     {
       op->dialog = gpa_file_verify_dialog_new (GPA_OPERATION (op)->window);
       g_signal_connect (G_OBJECT (op->dialog), "response",
@@ -299,7 +302,8 @@ my_percent_escape (const gchar *src)
 static void
 done_cb (GpaContext *context, gpg_error_t err, GpaStreamDecryptOperation *op)
 {
-  gtk_widget_hide (GPA_STREAM_OPERATION (op)->progress_dialog);
+  if (GPA_STREAM_OPERATION (op)->progress_dialog)
+    gtk_widget_hide (GPA_STREAM_OPERATION (op)->progress_dialog);
 
   if (! err && ! op->no_verify)
     {
@@ -336,7 +340,7 @@ done_cb (GpaContext *context, gpg_error_t err, GpaStreamDecryptOperation *op)
 	  g_free (sigdesc);
 	}
 
-      if (res->signatures)
+      if (res->signatures && op->dialog)
 	{
 	  /* Add the file to the result dialog.  */
 	  gpa_file_verify_dialog_add_file
@@ -375,7 +379,8 @@ idle_cb (gpointer data)
       g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
     }
 
-  gtk_widget_show_all (GPA_STREAM_OPERATION (op)->progress_dialog);
+  if (GPA_STREAM_OPERATION (op)->progress_dialog)
+    gtk_widget_show_all (GPA_STREAM_OPERATION (op)->progress_dialog);
 
   return FALSE;
 }
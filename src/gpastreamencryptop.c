@@ -22,6 +22,7 @@
 #include <glib.h>
 
 #include "gpgmetools.h"
+#include "policy.h"
 #include "recipientdlg.h"
 #include "gpawidgets.h"
 #include "gpastreamencryptop.h"
@@ -62,6 +63,7 @@ static void response_cb (GtkDialog *dialog,
                          gint response,
                          gpointer user_data);
 static gboolean start_encryption_cb (gpointer data);
+static gboolean select_keys_cb (gpointer data);
 static void done_error_cb (GpaContext *context, gpg_error_t err,
                            GpaStreamEncryptOperation *op);
 static void done_cb (GpaContext *context, gpg_error_t err,
@@ -194,8 +196,10 @@ gpa_stream_encrypt_operation_constructor
   op = GPA_STREAM_ENCRYPT_OPERATION (object);
 
   /* Create the recipient key selection dialog if we don't know the
-     keys yet. */
-  if (!op->keys && (!op->recipients || !g_slist_length (op->recipients)))
+     keys yet.  In headless mode the policy selects them instead.  */
+  if (!op->keys && headless)
+    g_idle_add (select_keys_cb, op);
+  else if (!op->keys && (!op->recipients || !g_slist_length (op->recipients)))
     {
       /* No recipients - use a generic key selection dialog.  */
       op->key_dialog = select_key_dlg_new (GPA_OPERATION (op)->window);
@@ -224,9 +228,10 @@ gpa_stream_encrypt_operation_constructor
   g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
 		    G_CALLBACK (done_cb), op);
 
-  gtk_window_set_title
-    (GTK_WINDOW (GPA_STREAM_OPERATION (op)->progress_dialog),
-			_("Encrypting message ..."));
+  if (GPA_STREAM_OPERATION (op)->progress_dialog)
+    gtk_window_set_title
+      (GTK_WINDOW (GPA_STREAM_OPERATION (op)->progress_dialog),
+       _("Encrypting message ..."));
 
   if (op->key_dialog)
     gtk_widget_show_all (GTK_WIDGET (op->key_dialog));
@@ -379,10 +384,13 @@ start_encryption (GpaStreamEncryptOperation *op)
         }
 
       /* Show and update the progress dialog.  */
-      gtk_widget_show_all (GPA_STREAM_OPERATION (op)->progress_dialog);
-      gpa_progress_dialog_set_label
-        (GPA_PROGRESS_DIALOG (GPA_STREAM_OPERATION (op)->progress_dialog),
-         _("Message encryption"));
+      if (GPA_STREAM_OPERATION (op)->progress_dialog)
+        {
+          gtk_widget_show_all (GPA_STREAM_OPERATION (op)->progress_dialog);
+          gpa_progress_dialog_set_label
+            (GPA_PROGRESS_DIALOG (GPA_STREAM_OPERATION (op)->progress_dialog),
+             _("Message encryption"));
+        }
     }
   else
     {
@@ -440,6 +448,45 @@ start_encryption_cb (void *user_data)
 }
 
 
+/* The policy has selected the keys.  */
+static void
+policy_keys_cb (gpg_error_t err, gpgme_key_t *keys,
+                gpgme_protocol_t protocol, gpointer user_data)
+{
+  GpaStreamEncryptOperation *op = user_data;
+
+  if (err)
+    {
+      g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
+      return;
+    }
+
+  gpa_gpgme_release_keyarray (op->keys);
+  op->keys = keys;
+  op->selected_protocol = protocol;
+
+  start_encryption (op);
+}
+
+
+/* This is the idle function used in headless mode to select the keys
+   for the recipients according to the policy.  */
+static gboolean
+select_keys_cb (void *user_data)
+{
+  GpaStreamEncryptOperation *op = user_data;
+
+  if (!op->recipients)
+    g_signal_emit_by_name (GPA_OPERATION (op), "completed",
+                           gpg_error (GPG_ERR_NO_PUBKEY));
+  else
+    gpa_policy_select_recipients (op->recipients, op->selected_protocol,
+                                  policy_keys_cb, op);
+
+  return FALSE;  /* Remove this callback from the event loop.  */
+}
+
+
 /*Show an error message. */
 static void
 done_error_cb (GpaContext *context, gpg_error_t err,
@@ -464,7 +511,8 @@ done_error_cb (GpaContext *context, gpg_error_t err,
 static void
 done_cb (GpaContext *context, gpg_error_t err, GpaStreamEncryptOperation *op)
 {
-  gtk_widget_hide (GPA_STREAM_OPERATION (op)->progress_dialog);
+  if (GPA_STREAM_OPERATION (op)->progress_dialog)
+    gtk_widget_hide (GPA_STREAM_OPERATION (op)->progress_dialog);
 
   g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
 }
@@ -102,7 +102,8 @@ gpa_stream_operation_finalize (GObject *object)
   gpgme_data_release (op->input_stream);
   gpgme_data_release (op->output_stream);
   gpgme_data_release (op->message_stream);
-  gtk_widget_destroy (op->progress_dialog);
+  if (op->progress_dialog)
+    gtk_widget_destroy (op->progress_dialog);
   
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -132,8 +133,10 @@ gpa_stream_operation_constructor (GType type,
 				      construct_properties);
   op = GPA_STREAM_OPERATION (object);
 
-  op->progress_dialog = gpa_progress_dialog_new (GPA_OPERATION(op)->window,
-						 GPA_OPERATION(op)->context);
+  /* There is no display in headless mode.  */
+  if (!headless)
+    op->progress_dialog = gpa_progress_dialog_new (GPA_OPERATION(op)->window,
+                                                   GPA_OPERATION(op)->context);
 
   return object;
 }
@@ -24,6 +24,7 @@
 #include "gpgmetools.h"
 #include "gtktools.h"
 #include "filesigndlg.h"
+#include "policy.h"
 #include "gpastreamsignop.h"
 
 
@@ -33,6 +34,7 @@ struct _GpaStreamSignOperation
   GpaStreamOperation parent;
 
   GtkWidget *sign_dialog;
+  gpgme_key_t *signer_keys;
 
   const char *sender;
   gpgme_protocol_t requested_protocol;
@@ -61,6 +63,7 @@ enum
 static void response_cb (GtkDialog *dialog,
                          gint response,
                          gpointer user_data);
+static gboolean select_signers_cb (gpointer data);
 static void done_error_cb (GpaContext *context, gpg_error_t err,
                            GpaStreamSignOperation *op);
 static void done_cb (GpaContext *context, gpg_error_t err,
@@ -123,7 +126,10 @@ gpa_stream_sign_operation_set_property (GObject *object, guint prop_id,
 static void
 gpa_stream_sign_operation_finalize (GObject *object)
 {
-/*   GpaStreamSignOperation *op = GPA_STREAM_SIGN_OPERATION (object); */
+  GpaStreamSignOperation *op = GPA_STREAM_SIGN_OPERATION (object);
+
+  gpa_gpgme_release_keyarray (op->signer_keys);
+  op->signer_keys = NULL;
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -148,21 +154,28 @@ gpa_stream_sign_operation_ctor (GType type, guint n_construct_properties,
 				      construct_properties);
   op = GPA_STREAM_SIGN_OPERATION (object);
 
-  op->sign_dialog = gpa_file_sign_dialog_new (GPA_OPERATION (op)->window);
-  {
-    GpaFileSignDialog *dialog = GPA_FILE_SIGN_DIALOG (op->sign_dialog);
-
-    /* Note: The information here is wrong.  The actual sig_mode and
-       armor settings are determined from the selected key (which
-       determines the protocol).  We set the values here to those for
-       OpenPGP, and force (==hide) the selection widgets.  */
-    gpa_file_sign_dialog_set_armor (dialog, TRUE);
-    gpa_file_sign_dialog_set_force_armor (dialog, TRUE);
-    gpa_file_sign_dialog_set_sig_mode (dialog, GPGME_SIG_MODE_NORMAL);
-    gpa_file_sign_dialog_set_force_sig_mode (dialog, TRUE);
-  }
-  g_signal_connect (G_OBJECT (op->sign_dialog), "response",
-                    G_CALLBACK (response_cb), op);
+  /* In headless mode the policy selects the keys instead of the
+     user.  */
+  if (headless)
+    g_idle_add (select_signers_cb, op);
+  else
+    {
+      GpaFileSignDialog *dialog;
+
+      op->sign_dialog = gpa_file_sign_dialog_new (GPA_OPERATION (op)->window);
+      dialog = GPA_FILE_SIGN_DIALOG (op->sign_dialog);
+
+      /* Note: The information here is wrong.  The actual sig_mode and
+         armor settings are determined from the selected key (which
+         determines the protocol).  We set the values here to those for
+         OpenPGP, and force (==hide) the selection widgets.  */
+      gpa_file_sign_dialog_set_armor (dialog, TRUE);
+      gpa_file_sign_dialog_set_force_armor (dialog, TRUE);
+      gpa_file_sign_dialog_set_sig_mode (dialog, GPGME_SIG_MODE_NORMAL);
+      gpa_file_sign_dialog_set_force_sig_mode (dialog, TRUE);
+      g_signal_connect (G_OBJECT (op->sign_dialog), "response",
+                        G_CALLBACK (response_cb), op);
+    }
 
   /* We connect the done signal to two handles.  The error handler is
      called first.  */
@@ -171,9 +184,10 @@ gpa_stream_sign_operation_ctor (GType type, guint n_construct_properties,
   g_signal_connect (G_OBJECT (GPA_OPERATION (op)->context), "done",
 		    G_CALLBACK (done_cb), op);
 
-  gtk_window_set_title
-    (GTK_WINDOW (GPA_STREAM_OPERATION (op)->progress_dialog),
-			_("Signing message ..."));
+  if (GPA_STREAM_OPERATION (op)->progress_dialog)
+    gtk_window_set_title
+      (GTK_WINDOW (GPA_STREAM_OPERATION (op)->progress_dialog),
+       _("Signing message ..."));
 
   if (op->sign_dialog)
     gtk_widget_show_all (GTK_WIDGET (op->sign_dialog));
@@ -308,16 +322,23 @@ start_signing (GpaStreamSignOperation *op)
 {
   gpg_error_t err;
   int prep_only = 0;
-  GList *signers;
+  GList *signers = NULL;
   gpgme_protocol_t protocol;
+  int idx;
 
-  signers = gpa_file_sign_dialog_signers
-    (GPA_FILE_SIGN_DIALOG (op->sign_dialog));
+  if (op->sign_dialog)
+    signers = gpa_file_sign_dialog_signers
+      (GPA_FILE_SIGN_DIALOG (op->sign_dialog));
+  else
+    for (idx = 0; op->signer_keys && op->signer_keys[idx]; idx++)
+      signers = g_list_append (signers, op->signer_keys[idx]);
   if (!set_signers (op, signers))
     {
+      g_list_free (signers);
       err = gpg_error (GPG_ERR_NO_SECKEY);
       goto leave;
     }
+  g_list_free (signers);
 
   protocol = gpgme_get_protocol (GPA_OPERATION (op)->context->ctx);
   if (protocol == GPGME_PROTOCOL_OpenPGP)
@@ -357,10 +378,13 @@ start_signing (GpaStreamSignOperation *op)
         }
 
       /* Show and update the progress dialog.  */
-      gtk_widget_show_all (GPA_STREAM_OPERATION (op)->progress_dialog);
-      gpa_progress_dialog_set_label
-        (GPA_PROGRESS_DIALOG (GPA_STREAM_OPERATION (op)->progress_dialog),
-         _("Message signing"));
+      if (GPA_STREAM_OPERATION (op)->progress_dialog)
+        {
+          gtk_widget_show_all (GPA_STREAM_OPERATION (op)->progress_dialog);
+          gpa_progress_dialog_set_label
+            (GPA_PROGRESS_DIALOG (GPA_STREAM_OPERATION (op)->progress_dialog),
+             _("Message signing"));
+        }
     }
   else
     {
@@ -410,6 +434,40 @@ start_signing_cb (void *user_data)
 }
 #endif
 
+
+/* The policy has selected the keys.  */
+static void
+policy_keys_cb (gpg_error_t err, gpgme_key_t *keys,
+                gpgme_protocol_t protocol, gpointer user_data)
+{
+  GpaStreamSignOperation *op = user_data;
+
+  if (err)
+    {
+      g_signal_emit_by_name (GPA_OPERATION (op), "completed", err);
+      return;
+    }
+
+  gpa_gpgme_release_keyarray (op->signer_keys);
+  op->signer_keys = keys;
+
+  start_signing (op);
+}
+
+
+/* This is the idle function used in headless mode to select the
+   signing keys according to the policy.  */
+static gboolean
+select_signers_cb (void *user_data)
+{
+  GpaStreamSignOperation *op = user_data;
+
+  gpa_policy_select_signers (op->sender, op->requested_protocol,
+                             policy_keys_cb, op);
+
+  return FALSE;  /* Remove this callback from the event loop.  */
+}
+
 /* Show an error message. */
 static void
 done_error_cb (GpaContext *context, gpg_error_t err,
@@ -435,7 +493,8 @@ done_error_cb (GpaContext *context, gpg_error_t err,
 static void
 done_cb (GpaContext *context, gpg_error_t err, GpaStreamSignOperation *op)
 {
-  gtk_widget_hide (GPA_STREAM_OPERATION (op)->progress_dialog);
+  if (GPA_STREAM_OPERATION (op)->progress_dialog)
+    gtk_widget_hide (GPA_STREAM_OPERATION (op)->progress_dialog);
 
   if (! err)
     {
@@ -140,6 +140,10 @@ gpa_stream_verify_operation_ctor (GType type, guint n_construct_properties,
 				      construct_properties);
   op = GPA_STREAM_VERIFY_OPERATION (object);
 
+  /* Nobody could look at the result dialog in headless mode.  */
+  if (headless)
+    op->silent = TRUE;
+
   /* Start with the first file after going back into the main loop */
   g_idle_add (idle_cb, op);
 
@@ -151,12 +155,16 @@ gpa_stream_verify_operation_ctor (GType type, guint n_construct_properties,
 		    G_CALLBACK (done_cb), op);
 
   /* FIXME: Implement silent option.  */
-  gtk_window_set_title
-    (GTK_WINDOW (GPA_STREAM_OPERATION (op)->progress_dialog),
-     _("Verifying message ..."));
+  if (GPA_STREAM_OPERATION (op)->progress_dialog)
+    gtk_window_set_title
+      (GTK_WINDOW (GPA_STREAM_OPERATION (op)->progress_dialog),
+       _("Verifying message ..."));
 
   if (op->silent)
-    gtk_widget_hide (GPA_STREAM_OPERATION (op)->progress_dialog);
+    {
+      if (GPA_STREAM_OPERATION (op)->progress_dialog)
+        gtk_widget_hide (GPA_STREAM_OPERATION (op)->progress_dialog);
+    }
   else
     {
       char *strval;
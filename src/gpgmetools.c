@@ -276,31 +276,173 @@ gpa_open_output (const char *filename, gpgme_data_t *data, GtkWidget *parent,
 }
 
 
+int
+gpa_open_output_quiet (const char *filename, gpgme_data_t *data,
+		       gpg_error_t *r_err)
+{
+  gpg_error_t err;
+  int target = -1;
+
+  target = g_open (filename,
+		   O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+  if (target == -1)
+    {
+      *r_err = gpg_error_from_syserror ();
+      return -1;
+    }
+  err = gpgme_data_new_from_fd (data, target);
+  if (gpg_err_code (err) != GPG_ERR_NO_ERROR)
+    {
+      close (target);
+      g_unlink (filename);
+      *r_err = err;
+      return -1;
+    }
+
+  *r_err = 0;
+  return target;
+}
+
+
 int
 gpa_open_input (const char *filename, gpgme_data_t *data, GtkWidget *parent)
 {
   gpg_error_t err;
   int target = -1;
 
-  target = g_open (filename, O_RDONLY | O_BINARY, 0);
+  target = gpa_open_input_quiet (filename, data, &err);
   if (target == -1)
     {
       gchar *message;
-      message = g_strdup_printf ("%s: %s", filename, strerror(errno));
+      message = g_strdup_printf ("%s: %s", filename, gpg_strerror (err));
       gpa_window_error (message, parent);
       g_free (message);
     }
+
+  return target;
+}
+
+
+int
+gpa_open_input_quiet (const char *filename, gpgme_data_t *data,
+		      gpg_error_t *r_err)
+{
+  gpg_error_t err;
+  int target = -1;
+
+  target = g_open (filename, O_RDONLY | O_BINARY, 0);
+  if (target == -1)
+    {
+      *r_err = gpg_error_from_syserror ();
+      return -1;
+    }
   err = gpgme_data_new_from_fd (data, target);
   if (gpg_err_code (err) != GPG_ERR_NO_ERROR)
     {
       close (target);
-      target = -1;
+      *r_err = err;
+      return -1;
     }
 
+  *r_err = 0;
   return target;
 }
 
 
+/* A data object counting the bytes read from another one for the
+   progress of a context.  */
+struct progress_data_s
+{
+  gpgme_data_t data;
+  GpaContext *context;
+  guint64 done;
+  guint64 total;
+};
+
+
+static ssize_t
+progress_data_read (void *handle, void *buffer, size_t size)
+{
+  struct progress_data_s *pd = handle;
+  ssize_t n;
+
+  n = gpgme_data_read (pd->data, buffer, size);
+  if (n > 0)
+    {
+      pd->done += n;
+      gpa_context_data_progress (pd->context, pd->done, pd->total);
+    }
+  return n;
+}
+
+
+static off_t
+progress_data_seek (void *handle, off_t offset, int whence)
+{
+  struct progress_data_s *pd = handle;
+  off_t off;
+
+  off = gpgme_data_seek (pd->data, offset, whence);
+  if (off >= 0)
+    pd->done = off;
+  return off;
+}
+
+
+static void
+progress_data_release (void *handle)
+{
+  struct progress_data_s *pd = handle;
+
+  gpgme_data_release (pd->data);
+  g_object_unref (pd->context);
+  g_free (pd);
+}
+
+
+static struct gpgme_data_cbs progress_data_cbs =
+  {
+    progress_data_read,
+    NULL,
+    progress_data_seek,
+    progress_data_release
+  };
+
+
+/* Replace *DATA by a data object reading from it which reports the
+   bytes read to CONTEXT.  TOTAL is the size of *DATA or 0 if it is
+   not known.  *DATA is released with the new object.  On error *DATA
+   is not changed.  */
+gpg_error_t
+gpa_data_new_progress (gpgme_data_t *data, guint64 total, GpaContext *context)
+{
+  struct progress_data_s *pd;
+  gpgme_data_t wrapper;
+  gpg_error_t err;
+  char hint[32];
+
+  pd = g_malloc0 (sizeof *pd);
+  pd->data = *data;
+  pd->context = g_object_ref (context);
+  pd->total = total;
+  err = gpgme_data_new_from_cbs (&wrapper, &progress_data_cbs, pd);
+  if (err)
+    {
+      g_object_unref (pd->context);
+      g_free (pd);
+      return err;
+    }
+  gpgme_data_set_encoding (wrapper, gpgme_data_get_encoding (*data));
+  if (total)
+    {
+      snprintf (hint, sizeof hint, "%" G_GUINT64_FORMAT, total);
+      gpgme_data_set_flag (wrapper, "size-hint", hint);
+    }
+  *data = wrapper;
+  return 0;
+}
+
+
 /* Do a gpgme_data_new_from_file and report any GPGME_File_Error to
    the user.  */
 gpg_error_t
@@ -1269,12 +1411,16 @@ gpa_get_key_capabilities_text (gpgme_key_t key)
 
 
 /* Update the result structure RESULT using the gpgme result INFO and
-   the FILES and BAD_FILES counter.  */
+   the FILES and BAD_FILES counter.  The fingerprints of new or changed
+   keys are appended to the FPRS array of RESULT.  */
 void
 gpa_gpgme_update_import_results (gpa_import_result_t result,
                                  unsigned int files, unsigned int bad_files,
                                  gpgme_import_result_t info)
 {
+  gpgme_import_status_t imp;
+  unsigned int n_old, n_new;
+
   result->files     += files;
   result->bad_files += bad_files;
   if (info)
@@ -1285,6 +1431,20 @@ gpa_gpgme_update_import_results (gpa_import_result_t result,
       result->secret_read      += info->secret_read;
       result->secret_imported  += info->secret_imported;
       result->secret_unchanged += info->secret_unchanged;
+
+      n_new = 0;
+      for (imp = info->imports; imp; imp = imp->next)
+        if (!imp->result && imp->status && imp->fpr)
+          n_new++;
+      if (n_new)
+        {
+          n_old = result->fprs? g_strv_length (result->fprs) : 0;
+          result->fprs = g_renew (char *, result->fprs, n_old + n_new + 1);
+          for (imp = info->imports; imp; imp = imp->next)
+            if (!imp->result && imp->status && imp->fpr)
+              result->fprs[n_old++] = g_strdup (imp->fpr);
+          result->fprs[n_old] = NULL;
+        }
     }
 }
 
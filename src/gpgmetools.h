@@ -85,6 +85,10 @@ struct gpa_import_result_s
   int secret_read;
   int secret_imported;
   int secret_unchanged;
+
+  /* NULL terminated array with the fingerprints of the new or changed
+     keys or NULL.  Free with g_strfreev.  */
+  char **fprs;
 };
 typedef struct gpa_import_result_s *gpa_import_result_t;
 
@@ -145,11 +149,29 @@ int gpa_open_output_direct (const char *filename, gpgme_data_t *data,
 int gpa_open_output (const char *filename, gpgme_data_t *data,
 		     GtkWidget *parent, char **filename_used);
 
+/* Create a new gpgme_data_t for the new file FILENAME and return the
+   file descriptor for the file.  An existing file is never
+   overwritten.  Errors are not reported to the user; instead -1 is
+   returned and the error is stored at R_ERR.  */
+int gpa_open_output_quiet (const char *filename, gpgme_data_t *data,
+			   gpg_error_t *r_err);
+
 /* Create a new gpgme_data_t from a file for reading, and return the
    file descriptor for the file.  Always reports all errors to the user.  */
 int gpa_open_input (const char *filename, gpgme_data_t *data,
 		    GtkWidget *parent);
 
+/* Like gpa_open_input, but errors are not reported to the user.
+   Instead -1 is returned and the error is stored at R_ERR.  */
+int gpa_open_input_quiet (const char *filename, gpgme_data_t *data,
+			  gpg_error_t *r_err);
+
+/* Replace *DATA by a data object reading from it which reports the
+   bytes read to CONTEXT; see gpa_context_data_progress.  TOTAL is the
+   size of *DATA or 0.  */
+gpg_error_t gpa_data_new_progress (gpgme_data_t *data, guint64 total,
+                                   GpaContext *context);
+
 /* Write the contents of the gpgme_data_t into the clipboard.  */
 int dump_data_to_clipboard (gpgme_data_t data, GtkClipboard *clipboard);
 
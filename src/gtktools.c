@@ -102,6 +102,13 @@ show_gtk_message (GtkWidget *parent, GtkMessageType mtype, GpaContext *ctx,
   char *buffer;
 
   buffer = g_strdup_vprintf (format, arg_ptr);
+  if (headless)
+    {
+      /* There is nobody to show the message to.  */
+      g_message ("%s", buffer);
+      g_free (buffer);
+      return;
+    }
   dialog = gtk_message_dialog_new (parent? GTK_WINDOW (parent):NULL,
                                    GTK_DIALOG_MODAL,
                                    mtype,
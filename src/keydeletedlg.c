@@ -79,7 +79,8 @@ confirm_delete_secret (GtkWidget * parent)
  * user chose Yes, FALSE otherwise. Display information about the public
  * key key in the dialog so that the user knows which key is to be
  * deleted. If has_secret_key is true, display a special warning for
- * deleting secret keys.
+ * deleting secret keys.  The secret keytable should have been filled
+ * before; if not, the key is assumed to have a secret part.
  */
 gboolean
 gpa_delete_dialog_run (GtkWidget * parent, gpgme_key_t key)
@@ -89,9 +90,10 @@ gpa_delete_dialog_run (GtkWidget * parent, gpgme_key_t key)
   GtkWidget * label;
   GtkWidget * info;
 
-  gboolean has_secret_key = (gpa_keytable_lookup_key 
-			     (gpa_keytable_get_secret_instance(), 
-			      key->subkeys->fpr) != NULL);
+  GpaKeyTable *sectable = gpa_keytable_get_secret_instance ();
+  gboolean has_secret_key = (!sectable->initialized
+			     || gpa_keytable_lookup_key
+			     (sectable, key->subkeys->fpr) != NULL);
 
   window = gtk_dialog_new_with_buttons (_("Remove Key"), GTK_WINDOW(parent),
                                         GTK_DIALOG_MODAL,
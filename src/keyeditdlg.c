@@ -108,6 +108,29 @@ gpa_key_edit_dialog_set_property (GObject     *object,
     }
 }
 
+/* Make the expiry date changeable if the key has a secret key.  Called
+   when the secret keytable has been filled.  */
+static void
+update_expiry_button (gpointer data)
+{
+  GpaKeyEditDialog *dialog = data;
+
+  gtk_widget_set_sensitive (dialog->expiry_button,
+			    (gpa_keytable_lookup_key
+			     (gpa_keytable_get_secret_instance (),
+			      dialog->key->subkeys->fpr) != NULL));
+}
+
+
+/* Signal handler for the "destroy" signal.  */
+static void
+gpa_key_edit_dialog_destroy_cb (GtkWidget *widget, GpaKeyEditDialog *dialog)
+{
+  gpa_keytable_cancel_ready (gpa_keytable_get_secret_instance (),
+			     update_expiry_button, dialog);
+}
+
+
 static void
 gpa_key_edit_dialog_finalize (GObject *object)
 {
@@ -182,15 +205,18 @@ gpa_key_edit_dialog_constructor (GType                  type,
 
   button = gtk_button_new_with_mnemonic (_("Change _expiration"));
   gtk_box_pack_start (GTK_BOX (hbox), button, FALSE, FALSE, 0);
-  gtk_widget_set_sensitive (button,(gpa_keytable_lookup_key
-			     (gpa_keytable_get_secret_instance(),
-			      dialog->key->subkeys->fpr) != NULL));
+  dialog->expiry_button = button;
+  gtk_widget_set_sensitive (button, FALSE);
+  gpa_keytable_when_ready (gpa_keytable_get_secret_instance (),
+			   update_expiry_button, dialog);
   g_signal_connect (G_OBJECT (button), "clicked",
 		    G_CALLBACK (gpa_key_edit_change_expiry), dialog);
 
   /* Close the dialog in response */
   g_signal_connect (G_OBJECT (dialog), "response",
 		    G_CALLBACK (gtk_widget_destroy), dialog);
+  g_signal_connect (G_OBJECT (dialog), "destroy",
+		    G_CALLBACK (gpa_key_edit_dialog_destroy_cb), dialog);
 
   return object;
 }
@@ -200,6 +226,7 @@ gpa_key_edit_dialog_init (GpaKeyEditDialog *dialog)
 {
   dialog->key = NULL;
   dialog->expiry = NULL;
+  dialog->expiry_button = NULL;
 }
 
 static void
@@ -45,6 +45,9 @@ struct _GpaKeyEditDialog {
 
   /* Expiry date label */
   GtkWidget *expiry;
+
+  /* The button to change the expiry date.  */
+  GtkWidget *expiry_button;
 };
 
 struct _GpaKeyEditDialogClass {
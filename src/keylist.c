@@ -30,6 +30,7 @@
 #include "keytable.h"
 #include "icons.h"
 #include "format-dn.h"
+#include "keysnapshot.h"
 
 
 /* Properties */
@@ -45,14 +46,37 @@ enum
   PROP_ONLY_USABLE_KEYS
 };
 
+/* Signals */
+enum
+{
+  PROGRESS,
+  LAST_SIGNAL
+};
+
 /* GObject */
 static GObjectClass *parent_class = NULL;
+static guint signals[LAST_SIGNAL] = { 0 };
+
+
+/* The maximum number of keys reloaded by gpa_keylist_refresh_keys.
+   For more keys a full reload is done.  */
+#define GPA_KEYLIST_MAX_REFRESH 500
+
+/* The number of rows for which the formatted dates are cached.  This
+   should be larger than the number of visible rows.  */
+#define GPA_KEYLIST_FORMAT_CACHE_SIZE 256
+
+/* The time in milliseconds spent at most in one run of the idle
+   handler inserting the listed keys.  */
+#define GPA_KEYLIST_INSERT_BUDGET 20
 
 
 /* Symbols to access the columns.  */
 typedef enum
 {
-  /* These are the displayed columns */
+  /* These are the displayed columns.  KEYTYPE to VALIDITY are only
+     stored for rows without a key; otherwise they are formatted on
+     demand.  */
   GPA_KEYLIST_COLUMN_IMAGE,
   GPA_KEYLIST_COLUMN_KEYTYPE,
   GPA_KEYLIST_COLUMN_CREATED,
@@ -72,10 +96,30 @@ typedef enum
 } GpaKeyListColumn;
 
 
+/* The values of a row which are costly to format.  */
+struct formatted_row_s
+{
+  gpgme_key_t key;
+  gchar *created;
+  gchar *expiry;
+};
+
+
 
 static void add_trustdb_dialog (GpaKeyList * keylist);
 static void gpa_keylist_next (gpgme_key_t key, gpointer data);
 static void gpa_keylist_end (gpointer data);
+static void cancel_refresh (GpaKeyList *keylist);
+static void secret_ready_cb (gpointer data);
+static void load_snapshot (GpaKeyList *list);
+static void refresh_next_cb (gpgme_key_t key, gpointer data);
+static void refresh_end_cb (gpointer data);
+static void clear_formatted_rows (GpaKeyList *list);
+static void clear_pending_keys (GpaKeyList *list);
+static void start_loading (GpaKeyList *list);
+static gboolean row_visible_func (GtkTreeModel *model, GtkTreeIter *iter,
+                                  gpointer data);
+static void update_search (GpaKeyList *list);
 
 
 
@@ -164,6 +208,9 @@ gpa_keylist_dispose (GObject *object)
   GpaKeyList *list = GPA_KEYLIST (object);
 
   list->disposed = 1;
+  clear_pending_keys (list);
+  gpa_keytable_cancel_ready (gpa_keytable_get_secret_instance (),
+                             secret_ready_cb, list);
 
   G_OBJECT_CLASS (parent_class)->dispose (object);
 }
@@ -175,24 +222,64 @@ gpa_keylist_finalize (GObject *object)
   GpaKeyList *list = GPA_KEYLIST (object);
 
   /* Dereference all keys in the list */
-  g_list_foreach (list->keys, (GFunc) gpgme_key_unref, NULL);
-  g_list_free (list->keys);
+  clear_pending_keys (list);
+  clear_formatted_rows (list);
+  g_hash_table_destroy (list->formatted);
+  g_hash_table_destroy (list->keys);
   list->keys = NULL;
+  cancel_refresh (list);
+  gpa_keysnapshot_close (list->snapshot);
+  list->snapshot = NULL;
+  if (list->search_result)
+    g_hash_table_destroy (list->search_result);
+  g_strfreev (list->search_words);
+  g_object_unref (list->filter);
+  g_object_unref (list->store);
   gpa_gpgme_release_keyarray (list->initial_keys);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
 
+static void
+gpa_keylist_constructed (GObject *object)
+{
+  GpaKeyList *list = GPA_KEYLIST (object);
+
+  if (G_OBJECT_CLASS (parent_class)->constructed)
+    G_OBJECT_CLASS (parent_class)->constructed (object);
+
+  /* The properties are only known now and thus the snapshot can only
+     now be filtered like the real listing.  The listing is started
+     only after loading the snapshot because its end callback may be
+     called right away if it fails to start.  */
+  if (list->snapshot)
+    {
+      load_snapshot (list);
+      gpa_keysnapshot_close (list->snapshot);
+      list->snapshot = NULL;
+      gpa_keytable_list_keys (gpa_keytable_get_public_instance (),
+                              refresh_next_cb, refresh_end_cb, list);
+    }
+}
+
+
 static void
 gpa_keylist_init (GTypeInstance *instance, void *class_ptr)
 {
   GpaKeyList *list = GPA_KEYLIST (instance);
-  GtkListStore *store;
+  GtkTreeModel *sorted;
   GtkTreeSelection *selection;
 
-  /* Setup the model.  */
-  store = gtk_list_store_new (GPA_KEYLIST_N_COLUMNS,
+  list->keys = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                      (GDestroyNotify) gpgme_key_unref, NULL);
+  list->formatted = g_hash_table_new (g_direct_hash, g_direct_equal);
+  g_queue_init (&list->formatted_lru);
+  g_queue_init (&list->pending_keys);
+
+  /* Setup the model.  The rows are kept in a list store which is
+     filtered by the search and then sorted for the view.  */
+  list->store = gtk_list_store_new (GPA_KEYLIST_N_COLUMNS,
 			      G_TYPE_STRING,
 			      G_TYPE_STRING,
 			      G_TYPE_STRING,
@@ -206,9 +293,15 @@ gpa_keylist_init (GTypeInstance *instance, void *class_ptr)
 			      G_TYPE_ULONG,
 			      G_TYPE_ULONG,
 			      G_TYPE_LONG);
+  list->filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (list->store),
+                                            NULL);
+  gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (list->filter),
+                                          row_visible_func, list, NULL);
+  sorted = gtk_tree_model_sort_new_with_model (list->filter);
 
   /* Setup the view.  */
-  gtk_tree_view_set_model (GTK_TREE_VIEW (list), GTK_TREE_MODEL (store));
+  gtk_tree_view_set_model (GTK_TREE_VIEW (list), sorted);
+  g_object_unref (sorted);
   gpa_keylist_set_brief (list);
   selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (list));
   gtk_tree_selection_set_mode (selection, GTK_SELECTION_MULTIPLE);
@@ -221,6 +314,7 @@ gpa_keylist_init (GTypeInstance *instance, void *class_ptr)
       int idx;
       gpgme_key_t key;
 
+      start_loading (list);
       for (idx=0; (key = list->initial_keys[idx]); idx++)
         {
           gpgme_key_ref (key);
@@ -232,16 +326,29 @@ gpa_keylist_init (GTypeInstance *instance, void *class_ptr)
     {
       /* Initialize from the global keytable.
        *
-       * We must forcefully load the secret keytable first to
-       * prevent concurrent access to the TOFU database. */
-      gpa_keytable_force_reload (gpa_keytable_get_secret_instance (),
-                                 NULL, (GpaKeyTableEndFunc) g_application_quit,
-                                 NULL);
-      // gtk_main ();
-
-      /* Now we can load the public keyring. */
-      gpa_keytable_list_keys (gpa_keytable_get_public_instance(),
-                              gpa_keylist_next, gpa_keylist_end, list);
+       * The secret keytable is listed concurrently with the public
+       * keyring.  Rows added before it is ready are updated by
+       * secret_ready_cb.  */
+      if (!list->public_only)
+        gpa_keytable_when_ready (gpa_keytable_get_secret_instance (),
+                                 secret_ready_cb, list);
+
+      /* If the keys need to be listed first, the rows are filled
+       * from the snapshot by gpa_keylist_constructed, which then
+       * starts the listing to update them like a refresh.  */
+      if (keylist_cache
+          && !gpa_keytable_get_public_instance ()->initialized)
+        list->snapshot = gpa_keysnapshot_open ();
+      if (list->snapshot)
+        list->refresh_rows = g_hash_table_new_full
+          (g_str_hash, g_str_equal,
+           g_free, (GDestroyNotify) gtk_tree_iter_free);
+      else
+        {
+          start_loading (list);
+          gpa_keytable_list_keys (gpa_keytable_get_public_instance(),
+                                  gpa_keylist_next, gpa_keylist_end, list);
+        }
     }
 
 }
@@ -258,9 +365,20 @@ gpa_keylist_class_init (void *class_ptr, void *class_data)
 
   object_class->dispose = gpa_keylist_dispose;
   object_class->finalize = gpa_keylist_finalize;
+  object_class->constructed = gpa_keylist_constructed;
   object_class->set_property = gpa_keylist_set_property;
   object_class->get_property = gpa_keylist_get_property;
 
+  signals[PROGRESS] =
+    g_signal_new ("progress",
+                  G_TYPE_FROM_CLASS (object_class),
+                  G_SIGNAL_RUN_FIRST,
+                  G_STRUCT_OFFSET (GpaKeyListClass, progress),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__INT,
+                  G_TYPE_NONE, 1,
+                  G_TYPE_INT);
+
   g_object_class_install_property
     (object_class, PROP_PUBLIC_ONLY,
      g_param_spec_boolean
@@ -350,7 +468,10 @@ gpa_keylist_get_type (void)
 static gboolean
 display_dialog (GpaKeyList * keylist)
 {
-  gtk_widget_show_all (keylist->dialog);
+  /* If someone shows the progress of the listing, the dialog is not
+     needed.  */
+  if (!g_signal_has_handler_pending (keylist, signals[PROGRESS], 0, TRUE))
+    gtk_widget_show_all (keylist->dialog);
 
   keylist->timeout_id = 0;
 
@@ -394,25 +515,6 @@ remove_trustdb_dialog (GpaKeyList * keylist)
 }
 
 
-static const gchar *
-get_key_pixbuf (gpgme_key_t key)
-{
-  gpgme_key_t seckey;
-
-  seckey = gpa_keytable_lookup_key (gpa_keytable_get_secret_instance (),
-                                    key->subkeys->fpr);
-  if (seckey)
-    {
-      if (seckey->subkeys && seckey->subkeys->is_cardkey)
-        return "blue_yellow_cardkey"; //GPA_STOCK_SECRET_CARDKEY;
-      return "blue_yellow_key"; //GPA_STOCK_SECRET_KEY;
-    }
-  else
-    return "blue_key"; //GPA_STOCK_PUBLIC_KEY;
-}
-
-
-
 /* For keys, gpg can't cope with, the fingerprint is set to all
    zero. This helper function returns true for such a FPR. */
 static int
@@ -425,34 +527,43 @@ is_zero_fpr (const char *fpr)
 }
 
 
-/* Note that this function takes ownership of KEY.  */
-static void
-gpa_keylist_next (gpgme_key_t key, gpointer data)
+/* Return the secret key for KEY or NULL if there is none or the
+   secret keytable is not yet ready.  */
+static gpgme_key_t
+lookup_secret_key (gpgme_key_t key)
 {
-  GpaKeyList *list = data;
-  GtkListStore *store;
-  GtkTreeIter iter;
-  const gchar *ownertrust, *validity;
-  gchar *userid, *created, *expiry;
-  gboolean has_secret;
-  long int val_value;
-  const char *keytype;
+  if (is_zero_fpr (key->subkeys->fpr))
+    return NULL;
+  return gpa_keytable_lookup_key (gpa_keytable_get_secret_instance (),
+                                  key->subkeys->fpr);
+}
 
-  /* Remove the dialog if it is being displayed */
-  remove_trustdb_dialog (list);
 
-  if (list->disposed)
-    return;  /* Should not access our store anymore.  */
-
-  /* Filter out keys we don't want.  */
-  if (key && list->protocol != GPGME_PROTOCOL_UNKNOWN
-      && key->protocol != list->protocol)
+/* Return the icon name for a key with the secret key SECKEY.  */
+static const gchar *
+get_key_pixbuf (gpgme_key_t seckey)
+{
+  if (seckey)
     {
-      gpgme_key_unref (key);
-      return;
+      if (seckey->subkeys && seckey->subkeys->is_cardkey)
+        return "blue_yellow_cardkey"; //GPA_STOCK_SECRET_CARDKEY;
+      return "blue_yellow_key"; //GPA_STOCK_SECRET_KEY;
     }
+  else
+    return "blue_key"; //GPA_STOCK_PUBLIC_KEY;
+}
+
+
+
+/* Return true if KEY shall be shown in LIST.  */
+static gboolean
+key_is_wanted (GpaKeyList *list, gpgme_key_t key)
+{
+  if (list->protocol != GPGME_PROTOCOL_UNKNOWN
+      && key->protocol != list->protocol)
+    return FALSE;
 
-  if (key && list->requested_usage)
+  if (list->requested_usage)
     {
       if ((key->can_sign && list->requested_usage & KEY_USAGE_SIGN))
         ;
@@ -461,42 +572,149 @@ gpa_keylist_next (gpgme_key_t key, gpointer data)
       else if ((key->can_certify && list->requested_usage & KEY_USAGE_CERT))
         ;
       else
-        {
-          gpgme_key_unref (key);
-          return;
-        }
+        return FALSE;
     }
 
-  if (key && list->only_usable_keys
+  if (list->only_usable_keys
       && (key->revoked || key->disabled || key->expired || key->invalid))
+    return FALSE;
+
+  return TRUE;
+}
+
+
+/* Return the string for the key type column of KEY.  */
+static const char *
+get_key_type_string (gpgme_key_t key)
+{
+  return (key->protocol == GPGME_PROTOCOL_OpenPGP? "P" :
+          key->protocol == GPGME_PROTOCOL_CMS? "X" : "?");
+}
+
+
+/* Release a cached formatted row.  */
+static void
+free_formatted_row (struct formatted_row_s *row)
+{
+  g_free (row->created);
+  g_free (row->expiry);
+  g_free (row);
+}
+
+
+/* Return the formatted dates of KEY.  They are cached for the
+   GPA_KEYLIST_FORMAT_CACHE_SIZE most recently displayed keys.  */
+static struct formatted_row_s *
+get_formatted_row (GpaKeyList *list, gpgme_key_t key)
+{
+  struct formatted_row_s *row;
+  GList *link;
+
+  link = g_hash_table_lookup (list->formatted, key);
+  if (link)
     {
-      gpgme_key_unref (key);
-      return;
+      /* Move to the front.  */
+      g_queue_unlink (&list->formatted_lru, link);
+      g_queue_push_head_link (&list->formatted_lru, link);
+      return link->data;
     }
 
-  /* Append the key to the list.  */
-  list->keys = g_list_append (list->keys, key);
-  store = GTK_LIST_STORE (gtk_tree_view_get_model (GTK_TREE_VIEW (list)));
-  /* Get the column values */
-  keytype = (key->protocol == GPGME_PROTOCOL_OpenPGP? "P" :
-             key->protocol == GPGME_PROTOCOL_CMS? "X" : "?");
-  created = gpa_creation_date_string (key->subkeys->timestamp);
-  expiry = gpa_expiry_date_string (key->subkeys->expires);
-  ownertrust = gpa_key_ownertrust_string (key);
-  validity = gpa_key_validity_string (key);
+  row = g_malloc0 (sizeof *row);
+  row->key = key;
+  row->created = gpa_creation_date_string (key->subkeys->timestamp);
+  row->expiry = gpa_expiry_date_string (key->subkeys->expires);
+  g_queue_push_head (&list->formatted_lru, row);
+  g_hash_table_insert (list->formatted, key, list->formatted_lru.head);
+
+  if (list->formatted_lru.length > GPA_KEYLIST_FORMAT_CACHE_SIZE)
+    {
+      struct formatted_row_s *old = g_queue_pop_tail (&list->formatted_lru);
+
+      g_hash_table_remove (list->formatted, old->key);
+      free_formatted_row (old);
+    }
+
+  return row;
+}
+
+
+/* Remove the cached formatted row of KEY.  This must be called
+   before the list releases its reference to KEY.  */
+static void
+forget_formatted_row (GpaKeyList *list, gpgme_key_t key)
+{
+  GList *link;
+
+  link = g_hash_table_lookup (list->formatted, key);
+  if (link)
+    {
+      g_hash_table_remove (list->formatted, key);
+      free_formatted_row (link->data);
+      g_queue_delete_link (&list->formatted_lru, link);
+    }
+}
+
+
+/* Remove all cached formatted rows.  */
+static void
+clear_formatted_rows (GpaKeyList *list)
+{
+  g_hash_table_remove_all (list->formatted);
+  g_queue_foreach (&list->formatted_lru, (GFunc) free_formatted_row, NULL);
+  g_queue_clear (&list->formatted_lru);
+}
+
+
+/* Add KEY to the keys owned by LIST.  */
+static void
+add_list_key (GpaKeyList *list, gpgme_key_t key)
+{
+  g_hash_table_add (list->keys, key);
+}
+
+
+/* Release the reference LIST holds for KEY.  */
+static void
+remove_list_key (GpaKeyList *list, gpgme_key_t key)
+{
+  forget_formatted_row (list, key);
+  g_hash_table_remove (list->keys, key);
+}
+
+
+/* Set the columns of the row ITER in STORE from KEY with the secret
+   key SECKEY.  If ROWKEY is not set, KEY is only used for display and
+   not stored in the row.  */
+static void
+set_row (GpaKeyList *list, GtkListStore *store, GtkTreeIter *iter,
+         gpgme_key_t key, gpgme_key_t seckey, gboolean rowkey)
+{
+  const gchar *ownertrust, *validity;
+  gchar *userid, *created, *expiry;
+  long int val_value;
+  const char *keytype;
+
+  /* Get the column values.  For rows with a key most of them are
+     formatted on demand by key_cell_data_func.  */
+  if (rowkey)
+    {
+      keytype = ownertrust = validity = NULL;
+      created = expiry = NULL;
+    }
+  else
+    {
+      keytype = get_key_type_string (key);
+      created = gpa_creation_date_string (key->subkeys->timestamp);
+      expiry = gpa_expiry_date_string (key->subkeys->expires);
+      ownertrust = gpa_key_ownertrust_string (key);
+      validity = gpa_key_validity_string (key);
+    }
   if (key->protocol == GPGME_PROTOCOL_CMS)
     userid = gpa_format_dn (key->uids? key->uids->uid : NULL);
   else
     userid = gpa_gpgme_key_get_userid (key->uids);
   if (list->public_only)
-    has_secret = 0;
-  else
-    has_secret = (!is_zero_fpr (key->subkeys->fpr)
-                  && gpa_keytable_lookup_key
-                  (gpa_keytable_get_secret_instance(), key->subkeys->fpr));
-
-  /* Append the key to the list */
-  gtk_list_store_append (store, &iter);
+    seckey = NULL;
 
   /* Set an appropiate value for sorting revoked and expired keys. This
    * includes a hack for forcing a value to a range outside the
@@ -510,15 +728,15 @@ gpa_keylist_next (gpgme_key_t key, gpointer data)
   else
       val_value = GPGME_VALIDITY_UNKNOWN;
 
-  gtk_list_store_set (store, &iter,
+  gtk_list_store_set (store, iter,
 		      GPA_KEYLIST_COLUMN_KEYTYPE, keytype,
 		      GPA_KEYLIST_COLUMN_CREATED, created,
 		      GPA_KEYLIST_COLUMN_EXPIRY, expiry,
 		      GPA_KEYLIST_COLUMN_OWNERTRUST, ownertrust,
 		      GPA_KEYLIST_COLUMN_VALIDITY, validity,
 		      GPA_KEYLIST_COLUMN_USERID, userid,
-		      GPA_KEYLIST_COLUMN_KEY, key,
-		      GPA_KEYLIST_COLUMN_HAS_SECRET, has_secret,
+		      GPA_KEYLIST_COLUMN_KEY, rowkey? key : NULL,
+		      GPA_KEYLIST_COLUMN_HAS_SECRET, seckey != NULL,
 		      GPA_KEYLIST_COLUMN_CREATED_TS, key->subkeys->timestamp,
 
 		      /* Set "no expiration" to a large value for sorting */
@@ -533,7 +751,7 @@ gpa_keylist_next (gpgme_key_t key, gpointer data)
 		      GPA_KEYLIST_COLUMN_VALIDITY_VALUE, val_value,
                       /* Store the image only if enabled.  */
 		      list->public_only ? -1 : GPA_KEYLIST_COLUMN_IMAGE,
-                      list->public_only ? NULL : get_key_pixbuf (key),
+                      list->public_only ? NULL : get_key_pixbuf (seckey),
 		      -1);
   /* Clean up */
   g_free (userid);
@@ -542,12 +760,448 @@ gpa_keylist_next (gpgme_key_t key, gpointer data)
 }
 
 
+/* Set the columns of the row ITER in STORE from KEY.  */
+static void
+set_key_row (GpaKeyList *list, GtkListStore *store, GtkTreeIter *iter,
+             gpgme_key_t key)
+{
+  set_row (list, store, iter, key,
+           list->public_only? NULL : lookup_secret_key (key), TRUE);
+}
+
+
+/* Fill LIST from the key listing snapshot.  The rows are registered
+   like the rows of a refresh so that the real listing updates them
+   in place and removes the rows of keys which are gone.  */
+static void
+load_snapshot (GpaKeyList *list)
+{
+  struct gpa_keysnapshot_key_s snapkey;
+  GtkListStore *store;
+  GtkTreeIter iter;
+  unsigned int idx, n;
+
+  if (!list->refresh_rows)
+    return;
+
+  store = list->store;
+  n = gpa_keysnapshot_count (list->snapshot);
+  for (idx = 0; idx < n; idx++)
+    {
+      gpa_keysnapshot_get_key (list->snapshot, idx, &snapkey);
+      if (!key_is_wanted (list, &snapkey.key)
+          || g_hash_table_contains (list->refresh_rows,
+                                    snapkey.subkey.fpr))
+        continue;
+
+      gtk_list_store_append (store, &iter);
+      set_row (list, store, &iter, &snapkey.key, snapkey.seckey, FALSE);
+      g_hash_table_insert (list->refresh_rows, g_strdup (snapkey.subkey.fpr),
+                           gtk_tree_iter_copy (&iter));
+    }
+
+  /* The keys are already usable for browsing.  */
+  if (n)
+    remove_trustdb_dialog (list);
+}
+
+
+/* Disable sorting of the model while a listing is in flight.
+   Otherwise each inserted row is sorted into place.  */
+static void
+freeze_sort (GpaKeyList *list)
+{
+  GtkTreeSortable *sortable;
+
+  if (list->sort_frozen)
+    return;
+
+  sortable = GTK_TREE_SORTABLE (gtk_tree_view_get_model
+                                (GTK_TREE_VIEW (list)));
+  gtk_tree_sortable_get_sort_column_id (sortable, &list->sort_column,
+                                        &list->sort_order);
+  gtk_tree_sortable_set_sort_column_id
+    (sortable, GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
+  list->sort_frozen = TRUE;
+}
+
+
+/* Restore the sorting disabled by freeze_sort.  This sorts the model
+   once.  */
+static void
+thaw_sort (GpaKeyList *list)
+{
+  GtkTreeSortable *sortable;
+  gint column;
+  GtkSortType order;
+
+  if (!list->sort_frozen)
+    return;
+  list->sort_frozen = FALSE;
+
+  sortable = GTK_TREE_SORTABLE (gtk_tree_view_get_model
+                                (GTK_TREE_VIEW (list)));
+  /* Do not override a sort order selected by the user meanwhile.  */
+  gtk_tree_sortable_get_sort_column_id (sortable, &column, &order);
+  if (column == GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID)
+    gtk_tree_sortable_set_sort_column_id (sortable, list->sort_column,
+                                          list->sort_order);
+}
+
+
+/* Append the key at the front of the queue of pending keys to the
+   model.  */
+static void
+insert_pending_key (GpaKeyList *list, GtkListStore *store)
+{
+  gpgme_key_t key;
+  GtkTreeIter iter;
+
+  key = g_queue_pop_head (&list->pending_keys);
+  add_list_key (list, key);
+  gtk_list_store_append (store, &iter);
+  set_key_row (list, store, &iter, key);
+  list->nloaded++;
+}
+
+
+/* Insert all pending keys at once.  */
+static void
+flush_pending_keys (GpaKeyList *list)
+{
+  GtkListStore *store;
+
+  store = list->store;
+  while (!g_queue_is_empty (&list->pending_keys))
+    insert_pending_key (list, store);
+}
+
+
+/* Drop all pending keys.  */
+static void
+clear_pending_keys (GpaKeyList *list)
+{
+  if (list->insert_idle_id)
+    {
+      g_source_remove (list->insert_idle_id);
+      list->insert_idle_id = 0;
+    }
+  g_queue_foreach (&list->pending_keys, (GFunc) gpgme_key_unref, NULL);
+  g_queue_clear (&list->pending_keys);
+}
+
+
+/* Idle handler to insert the pending keys in chunks.  Each run takes
+   at most GPA_KEYLIST_INSERT_BUDGET milliseconds so that the user
+   interface stays responsive.  */
+static gboolean
+insert_idle_cb (gpointer data)
+{
+  GpaKeyList *list = data;
+  GtkListStore *store;
+  gint64 deadline;
+  int count;
+
+  deadline = g_get_monotonic_time () + GPA_KEYLIST_INSERT_BUDGET * 1000;
+  store = list->store;
+  if (list->loading)
+    freeze_sort (list);
+
+  for (count = 0; !g_queue_is_empty (&list->pending_keys); count++)
+    {
+      /* Checking the time for each key would be too costly.  */
+      if (!(count % 32) && count && g_get_monotonic_time () > deadline)
+        break;
+      insert_pending_key (list, store);
+    }
+
+  if (!g_queue_is_empty (&list->pending_keys) || list->loading)
+    {
+      g_signal_emit (list, signals[PROGRESS], 0, (gint) list->nloaded);
+      if (!g_queue_is_empty (&list->pending_keys))
+        return TRUE;
+      /* Wait for more keys.  */
+      list->insert_idle_id = 0;
+      return FALSE;
+    }
+
+  /* The listing is complete.  */
+  thaw_sort (list);
+  update_search (list);
+  g_signal_emit (list, signals[PROGRESS], 0, -1);
+  list->insert_idle_id = 0;
+  return FALSE;
+}
+
+
+/* Schedule the insertion of the pending keys.  */
+static void
+schedule_insert (GpaKeyList *list)
+{
+  if (!list->insert_idle_id)
+    list->insert_idle_id = g_idle_add (insert_idle_cb, list);
+}
+
+
+/* Return true if the user ID USERID contains all WORDS.  */
+static gboolean
+userid_matches (const gchar *userid, gchar **words)
+{
+  gchar *lower;
+  gboolean result = TRUE;
+  int idx;
+
+  if (!userid)
+    return FALSE;
+  lower = g_utf8_strdown (userid, -1);
+  for (idx = 0; words[idx] && result; idx++)
+    if (!strstr (lower, words[idx]))
+      result = FALSE;
+  g_free (lower);
+  return result;
+}
+
+
+/* Visible function of the filter model.  */
+static gboolean
+row_visible_func (GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+  GpaKeyList *list = data;
+  gpgme_key_t key;
+  gchar *userid;
+  gboolean visible;
+
+  if (!list->search_words)
+    return TRUE;
+
+  gtk_tree_model_get (model, iter, GPA_KEYLIST_COLUMN_KEY, &key, -1);
+  if (key && list->search_result)
+    return g_hash_table_contains (list->search_result, key);
+
+  /* Without the index (e.g. for rows from the snapshot) only the
+     displayed user ID is searched.  */
+  gtk_tree_model_get (model, iter, GPA_KEYLIST_COLUMN_USERID, &userid, -1);
+  visible = userid_matches (userid, list->search_words);
+  g_free (userid);
+  return visible;
+}
+
+
+/* Run the search again, e.g. because keys have been added.  */
+static void
+update_search (GpaKeyList *list)
+{
+  gchar *query;
+
+  if (!list->search_words)
+    return;
+
+  if (list->search_result)
+    g_hash_table_destroy (list->search_result);
+  query = g_strjoinv (" ", list->search_words);
+  list->search_result = gpa_keytable_search
+    (gpa_keytable_get_public_instance (), query);
+  g_free (query);
+  gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (list->filter));
+}
+
+
+/* Note that this function takes ownership of KEY.  The key is only
+   queued here and inserted by insert_idle_cb.  */
+static void
+gpa_keylist_next (gpgme_key_t key, gpointer data)
+{
+  GpaKeyList *list = data;
+
+  /* Remove the dialog if it is being displayed */
+  remove_trustdb_dialog (list);
+
+  if (list->disposed)
+    return;  /* Should not access our store anymore.  */
+
+  /* Filter out keys we don't want.  */
+  if (!key || !key_is_wanted (list, key))
+    {
+      if (key)
+        gpgme_key_unref (key);
+      return;
+    }
+
+  g_queue_push_tail (&list->pending_keys, key);
+  schedule_insert (list);
+}
+
+
 static void
 gpa_keylist_end (gpointer data)
 {
   GpaKeyList *list = data;
 
   remove_trustdb_dialog (list);
+  if (list->disposed)
+    return;
+
+  /* Let the idle handler finish the listing.  */
+  list->loading = FALSE;
+  schedule_insert (list);
+}
+
+
+/* Prepare LIST for a full listing of the keys.  */
+static void
+start_loading (GpaKeyList *list)
+{
+  clear_pending_keys (list);
+  list->loading = TRUE;
+  list->nloaded = 0;
+}
+
+
+/* Called when the secret keytable is ready.  Update the secret key
+   flag and the icon of the rows added before.  */
+static void
+secret_ready_cb (gpointer data)
+{
+  GpaKeyList *list = data;
+  GtkListStore *store;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  gboolean valid;
+  gpgme_key_t key, seckey;
+
+  if (list->disposed || list->public_only)
+    return;
+
+  store = list->store;
+  model = GTK_TREE_MODEL (store);
+  for (valid = gtk_tree_model_get_iter_first (model, &iter); valid;
+       valid = gtk_tree_model_iter_next (model, &iter))
+    {
+      gtk_tree_model_get (model, &iter, GPA_KEYLIST_COLUMN_KEY, &key, -1);
+      if (!key)
+        continue;
+      seckey = lookup_secret_key (key);
+      gtk_list_store_set (store, &iter,
+                          GPA_KEYLIST_COLUMN_HAS_SECRET, seckey != NULL,
+                          GPA_KEYLIST_COLUMN_IMAGE, get_key_pixbuf (seckey),
+                          -1);
+    }
+}
+
+
+/* Forget about a running refresh.  */
+static void
+cancel_refresh (GpaKeyList *keylist)
+{
+  if (keylist->refresh_rows)
+    {
+      g_hash_table_destroy (keylist->refresh_rows);
+      keylist->refresh_rows = NULL;
+    }
+  g_strfreev (keylist->refresh_fprs);
+  keylist->refresh_fprs = NULL;
+}
+
+
+/* Remove the row ITER and its key from LIST.  */
+static void
+remove_key_row (GpaKeyList *list, GtkListStore *store, GtkTreeIter *iter)
+{
+  gpgme_key_t oldkey;
+
+  gtk_tree_model_get (GTK_TREE_MODEL (store), iter,
+                      GPA_KEYLIST_COLUMN_KEY, &oldkey, -1);
+  gtk_list_store_remove (store, iter);
+  if (oldkey)
+    remove_list_key (list, oldkey);
+}
+
+
+/* Called for each key reloaded by gpa_keylist_refresh_keys.  Note
+   that this function takes ownership of KEY.  */
+static void
+refresh_next_cb (gpgme_key_t key, gpointer data)
+{
+  GpaKeyList *list = data;
+  GtkListStore *store;
+  GtkTreeIter *iter;
+  gpgme_key_t oldkey;
+
+  if (list->disposed || !list->refresh_rows)
+    {
+      gpgme_key_unref (key);
+      return;
+    }
+
+  iter = g_hash_table_lookup (list->refresh_rows, key->subkeys->fpr);
+  if (!iter)
+    {
+      /* A key which is not yet in the list.  */
+      gpa_keylist_next (key, list);
+      return;
+    }
+
+  store = list->store;
+  if (!key_is_wanted (list, key))
+    {
+      remove_key_row (list, store, iter);
+      gpgme_key_unref (key);
+    }
+  else
+    {
+      /* Replace the key and update the row in place.  */
+      gtk_tree_model_get (GTK_TREE_MODEL (store), iter,
+                          GPA_KEYLIST_COLUMN_KEY, &oldkey, -1);
+      add_list_key (list, key);
+      set_key_row (list, store, iter, key);
+      if (oldkey && oldkey != key)
+        remove_list_key (list, oldkey);
+    }
+  g_hash_table_remove (list->refresh_rows, key->subkeys->fpr);
+}
+
+
+/* Called at the end of a refresh.  All rows which have not been
+   updated belong to deleted keys.  */
+static void
+refresh_end_cb (gpointer data)
+{
+  GpaKeyList *list = data;
+  GtkListStore *store;
+  GHashTableIter hiter;
+  gpointer value;
+
+  remove_trustdb_dialog (list);
+  if (!list->disposed && list->refresh_rows)
+    {
+      store = list->store;
+      g_hash_table_iter_init (&hiter, list->refresh_rows);
+      while (g_hash_table_iter_next (&hiter, NULL, &value))
+        remove_key_row (list, store, value);
+    }
+  cancel_refresh (list);
+  if (!list->disposed)
+    update_search (list);
+}
+
+
+/* Called when the secret keys of a refresh have been reloaded.  Now
+   the public keys are reloaded so that the secret key flag of the
+   rows is up to date.  */
+static void
+refresh_secret_end_cb (gpointer data)
+{
+  GpaKeyList *list = data;
+
+  if (list->disposed || !list->refresh_fprs)
+    {
+      cancel_refresh (list);
+      return;
+    }
+
+  gpa_keytable_refresh_keys (gpa_keytable_get_public_instance (),
+                             (const char **) list->refresh_fprs,
+                             refresh_next_cb, refresh_end_cb, list);
 }
 
 
@@ -593,6 +1247,72 @@ search_keylist_function (GtkTreeModel *model, gint column,
 }
 
 
+/* Cell data function for the columns which are formatted on demand.
+   DATA is the column of the model.  */
+static void
+key_cell_data_func (GtkTreeViewColumn *column, GtkCellRenderer *renderer,
+                    GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+  GpaKeyList *list;
+  gint colid = GPOINTER_TO_INT (data);
+  gpgme_key_t key;
+  gchar *stored;
+  const gchar *text;
+
+  gtk_tree_model_get (model, iter, GPA_KEYLIST_COLUMN_KEY, &key, -1);
+  if (!key)
+    {
+      /* A row from the key listing snapshot.  */
+      gtk_tree_model_get (model, iter, colid, &stored, -1);
+      g_object_set (renderer, "text", stored, NULL);
+      g_free (stored);
+      return;
+    }
+
+  list = GPA_KEYLIST (gtk_tree_view_column_get_tree_view (column));
+  switch (colid)
+    {
+    case GPA_KEYLIST_COLUMN_KEYTYPE:
+      text = get_key_type_string (key);
+      break;
+    case GPA_KEYLIST_COLUMN_CREATED:
+      text = get_formatted_row (list, key)->created;
+      break;
+    case GPA_KEYLIST_COLUMN_EXPIRY:
+      text = get_formatted_row (list, key)->expiry;
+      break;
+    case GPA_KEYLIST_COLUMN_OWNERTRUST:
+      text = gpa_key_ownertrust_string (key);
+      break;
+    case GPA_KEYLIST_COLUMN_VALIDITY:
+      text = gpa_key_validity_string (key);
+      break;
+    default:
+      text = NULL;
+      break;
+    }
+  g_object_set (renderer, "text", text, NULL);
+}
+
+
+/* Return a new column displaying the model column COLID by means of
+   key_cell_data_func.  */
+static GtkTreeViewColumn *
+new_formatted_column (gint colid)
+{
+  GtkCellRenderer *renderer;
+  GtkTreeViewColumn *column;
+
+  renderer = gtk_cell_renderer_text_new ();
+  column = gtk_tree_view_column_new ();
+  gtk_tree_view_column_pack_start (column, renderer, TRUE);
+  gtk_tree_view_column_set_cell_data_func (column, renderer,
+                                           key_cell_data_func,
+                                           GINT_TO_POINTER (colid), NULL);
+  return column;
+}
+
+
 static void
 setup_columns (GpaKeyList *keylist, gboolean detailed)
 {
@@ -620,18 +1340,14 @@ setup_columns (GpaKeyList *keylist, gboolean detailed)
       gtk_tree_view_column_set_sort_indicator (column, TRUE);
     }
 
-  renderer = gtk_cell_renderer_text_new ();
-  column = gtk_tree_view_column_new_with_attributes
-    (NULL, renderer, "text", GPA_KEYLIST_COLUMN_KEYTYPE, NULL);
+  column = new_formatted_column (GPA_KEYLIST_COLUMN_KEYTYPE);
   gpa_set_column_title
     (column, " ",
      _("This columns lists the type of the certificate."
        "  A 'P' denotes OpenPGP and a 'X' denotes X.509 (S/MIME)."));
   gtk_tree_view_append_column (GTK_TREE_VIEW (keylist), column);
 
-  renderer = gtk_cell_renderer_text_new ();
-  column = gtk_tree_view_column_new_with_attributes
-    (NULL, renderer, "text", GPA_KEYLIST_COLUMN_CREATED, NULL);
+  column = new_formatted_column (GPA_KEYLIST_COLUMN_CREATED);
   gpa_set_column_title
     (column, _("Created"),
      _("The Creation Date is the date the certificate was created."));
@@ -642,9 +1358,7 @@ setup_columns (GpaKeyList *keylist, gboolean detailed)
 
   if (detailed)
     {
-      renderer = gtk_cell_renderer_text_new ();
-      column = gtk_tree_view_column_new_with_attributes
-        (NULL, renderer, "text", GPA_KEYLIST_COLUMN_EXPIRY, NULL);
+      column = new_formatted_column (GPA_KEYLIST_COLUMN_EXPIRY);
       gpa_set_column_title
         (column, _("Expiry Date"),
          _("The Expiry Date is the date until the certificate is valid."));
@@ -653,9 +1367,7 @@ setup_columns (GpaKeyList *keylist, gboolean detailed)
         (column, GPA_KEYLIST_COLUMN_EXPIRY_TS);
       gtk_tree_view_column_set_sort_indicator (column, TRUE);
 
-      renderer = gtk_cell_renderer_text_new ();
-      column = gtk_tree_view_column_new_with_attributes
-        (NULL, renderer, "text", GPA_KEYLIST_COLUMN_OWNERTRUST, NULL);
+      column = new_formatted_column (GPA_KEYLIST_COLUMN_OWNERTRUST);
       gpa_set_column_title
         (column, _("Owner Trust"),
          _("The Owner Trust has been set by you and describes how far you"
@@ -666,9 +1378,7 @@ setup_columns (GpaKeyList *keylist, gboolean detailed)
         (column, GPA_KEYLIST_COLUMN_OWNERTRUST_VALUE);
       gtk_tree_view_column_set_sort_indicator (column, TRUE);
 
-      renderer = gtk_cell_renderer_text_new ();
-      column = gtk_tree_view_column_new_with_attributes
-        (NULL, renderer, "text", GPA_KEYLIST_COLUMN_VALIDITY, NULL);
+      column = new_formatted_column (GPA_KEYLIST_COLUMN_VALIDITY);
       gpa_set_column_title
         (column, _("Validity"),
          _("The Validity describes the trust level the system has"
@@ -804,8 +1514,10 @@ gpa_keylist_has_single_secret_selection (GpaKeyList *keylist)
 
       g_list_foreach (list, (GFunc) gtk_tree_path_free, NULL);
       g_list_free (list);
-      return (gpa_keytable_lookup_key (gpa_keytable_get_secret_instance(),
-				       key->subkeys->fpr) != NULL);
+      /* Rows from the key listing snapshot have no key yet.  */
+      return (key
+              && gpa_keytable_lookup_key (gpa_keytable_get_secret_instance(),
+                                          key->subkeys->fpr) != NULL);
     }
   else
     {
@@ -881,7 +1593,8 @@ gpa_keylist_get_selected_key (GpaKeyList *keylist)
   gtk_tree_model_get_value (model, &iter, GPA_KEYLIST_COLUMN_KEY, &value);
   key = g_value_get_pointer (&value);
   g_value_unset (&value);
-  gpgme_key_ref (key);
+  if (key)
+    gpgme_key_ref (key);
 
   g_list_foreach (list, (GFunc) gtk_tree_path_free, NULL);
   g_list_free (list);
@@ -897,11 +1610,11 @@ gpa_keylist_start_reload (GpaKeyList * keylist)
   GtkTreeSelection *selection =
     gtk_tree_view_get_selection (GTK_TREE_VIEW (keylist));
   gtk_tree_selection_unselect_all (selection);
-  gtk_list_store_clear (GTK_LIST_STORE (gtk_tree_view_get_model
-					(GTK_TREE_VIEW (keylist))));
-  g_list_foreach (keylist->keys, (GFunc) gpgme_key_unref, NULL);
-  g_list_free (keylist->keys);
-  keylist->keys = NULL;
+  gtk_list_store_clear (keylist->store);
+  clear_formatted_rows (keylist);
+  g_hash_table_remove_all (keylist->keys);
+  cancel_refresh (keylist);
+  start_loading (keylist);
   add_trustdb_dialog (keylist);
 
   gpa_keytable_force_reload (gpa_keytable_get_public_instance (),
@@ -909,25 +1622,113 @@ gpa_keylist_start_reload (GpaKeyList * keylist)
 }
 
 
+/* Let the keylist know that the keys with the fingerprints FPRS (a
+   NULL terminated array) have been changed.  Only these keys are
+   reloaded and their rows are updated in place.  */
+void
+gpa_keylist_refresh_keys (GpaKeyList *keylist, const char **fprs)
+{
+  GHashTable *wanted;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  gboolean valid;
+  gpgme_key_t key;
+  int idx;
+
+  g_return_if_fail (GPA_IS_KEYLIST (keylist));
+
+  /* The rows of the changed keys need to exist.  */
+  flush_pending_keys (keylist);
+
+  for (idx = 0; fprs && fprs[idx]; idx++)
+    ;
+  if (!idx || idx > GPA_KEYLIST_MAX_REFRESH || keylist->refresh_rows
+      || !gpa_keytable_get_public_instance ()->initialized
+      || !gpa_keytable_get_secret_instance ()->initialized)
+    {
+      /* A full reload is cheaper or required.  */
+      gpa_keylist_imported_secret_key (keylist);
+      gpa_keylist_start_reload (keylist);
+      return;
+    }
+
+  wanted = g_hash_table_new (g_str_hash, g_str_equal);
+  for (idx = 0; fprs[idx]; idx++)
+    g_hash_table_insert (wanted, (char *) fprs[idx], NULL);
+
+  /* Find the rows of the changed keys.  The iters of a list store
+     persist as long as the row exists.  */
+  keylist->refresh_fprs = g_strdupv ((char **) fprs);
+  keylist->refresh_rows = g_hash_table_new_full
+    (g_str_hash, g_str_equal, g_free, (GDestroyNotify) gtk_tree_iter_free);
+  model = GTK_TREE_MODEL (keylist->store);
+  for (valid = gtk_tree_model_get_iter_first (model, &iter); valid;
+       valid = gtk_tree_model_iter_next (model, &iter))
+    {
+      gtk_tree_model_get (model, &iter, GPA_KEYLIST_COLUMN_KEY, &key, -1);
+      if (key && key->subkeys && key->subkeys->fpr
+          && g_hash_table_contains (wanted, key->subkeys->fpr))
+        g_hash_table_insert (keylist->refresh_rows,
+                             g_strdup (key->subkeys->fpr),
+                             gtk_tree_iter_copy (&iter));
+    }
+  g_hash_table_destroy (wanted);
+
+  /* First update the secret keys, then the public keys.  */
+  gpa_keytable_refresh_keys (gpa_keytable_get_secret_instance (),
+                             (const char **) keylist->refresh_fprs,
+                             NULL, refresh_secret_end_cb, keylist);
+}
+
+
 /* Let the keylist know that a new key with the given fingerprint is
    available.  */
 void
 gpa_keylist_new_key (GpaKeyList * keylist, const char *fpr)
 {
-  /* FIXME: I don't understand the code.  Investigate this and
-     implement public_only.  */
+  const char *fprs[2];
 
-  add_trustdb_dialog (keylist);
-  gpa_keytable_load_new (gpa_keytable_get_secret_instance (), fpr,
-			 NULL, (GpaKeyTableEndFunc) g_application_quit, NULL);
-  /* Hack. Turn the asynchronous listing into a synchronous one */
-  gtk_main ();
-  remove_trustdb_dialog (keylist);
-  /* The trustdb seems not to be updated for a --list-secret, so we
-   * cdisplay the dialog both times, just in case */
-  add_trustdb_dialog (keylist);
-  gpa_keytable_load_new (gpa_keytable_get_public_instance (), fpr,
-			 gpa_keylist_next, gpa_keylist_end, keylist);
+  fprs[0] = fpr;
+  fprs[1] = NULL;
+  gpa_keylist_refresh_keys (keylist, fprs);
+}
+
+
+/* Show only the keys matching QUERY.  QUERY is a list of whitespace
+   separated words which all need to be found in the user IDs, mail
+   addresses, fingerprints or key IDs of a key.  If QUERY is NULL or
+   empty all keys are shown.  */
+void
+gpa_keylist_set_search (GpaKeyList *keylist, const char *query)
+{
+  gchar *lower;
+
+  g_return_if_fail (GPA_IS_KEYLIST (keylist));
+
+  g_strfreev (keylist->search_words);
+  keylist->search_words = NULL;
+  if (keylist->search_result)
+    {
+      g_hash_table_destroy (keylist->search_result);
+      keylist->search_result = NULL;
+    }
+
+  if (query)
+    {
+      lower = g_utf8_strdown (query, -1);
+      keylist->search_words = g_strsplit_set (g_strstrip (lower), " \t", -1);
+      g_free (lower);
+      if (!keylist->search_words[0])
+        {
+          g_strfreev (keylist->search_words);
+          keylist->search_words = NULL;
+        }
+    }
+
+  if (keylist->search_words)
+    update_search (keylist);
+  else
+    gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (keylist->filter));
 }
 
 
@@ -935,13 +1736,10 @@ gpa_keylist_new_key (GpaKeyList * keylist, const char *fpr)
 void
 gpa_keylist_imported_secret_key (GpaKeyList *keylist)
 {
-  /* KEYLIST is currently not used. */
-
-  gpa_keytable_load_new (gpa_keytable_get_secret_instance (), NULL,
-			 NULL, (GpaKeyTableEndFunc) g_application_quit, NULL);
-  /* Hack. Turn the asynchronous listing into a synchronous one */
-  /* FIXME:  Does that work well with the server shutdown code? */
-  // gtk_main ();
+  /* Reload the secret keys and then update the secret key flags of
+     the rows.  */
+  gpa_keytable_force_reload (gpa_keytable_get_secret_instance (),
+                             NULL, secret_ready_cb, keylist);
 }
 
 
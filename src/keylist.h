@@ -22,6 +22,7 @@
 #define GPA_KEYLIST_H
 
 #include <gtk/gtk.h>
+#include "keytable.h"
 
 /* GObject stuff */
 #define GPA_KEYLIST_TYPE	  (gpa_keylist_get_type ())
@@ -40,8 +41,25 @@ struct _GpaKeyList {
   gboolean secret;
   /* Parent window for dialogs */
   GtkWidget *window;
-  /* Keys loaded into the model */
-  GList *keys;
+  /* Keys loaded into the model.  This is a set which owns a
+     reference to each key.  */
+  GHashTable *keys;
+  /* Cache of formatted values of the recently displayed rows: A hash
+     table mapping the key to a link of FORMATTED_LRU.  */
+  GHashTable *formatted;
+  GQueue formatted_lru;
+  /* Listed keys not yet inserted into the model, the ID of the idle
+     handler inserting them and the number of keys inserted so far.
+     LOADING is set while a full listing is in flight.  */
+  GQueue pending_keys;
+  guint insert_idle_id;
+  guint nloaded;
+  gboolean loading;
+  /* The sort order of the model saved while a listing is in
+     flight.  */
+  gboolean sort_frozen;
+  gint sort_column;
+  GtkSortType sort_order;
   /* Dialog for warning about a trustdb rebuilding */
   GtkWidget *dialog;
   /* ID of the timeout that displays the dialog */
@@ -56,6 +74,24 @@ struct _GpaKeyList {
   int requested_usage;
   gboolean only_usable_keys;
 
+  /* The fingerprints of the keys to be updated by a running refresh
+     and their rows in the model indexed by fingerprint.  */
+  char **refresh_fprs;
+  GHashTable *refresh_rows;
+
+  /* The model holding all rows and the filter model for the
+     search.  */
+  GtkListStore *store;
+  GtkTreeModel *filter;
+  /* The lowercase words of the current search or NULL and the set of
+     matching keys.  */
+  gchar **search_words;
+  GHashTable *search_result;
+
+  /* The key listing snapshot used to fill the list until the real
+     listing is available.  Only set during construction.  */
+  struct gpa_keysnapshot_s *snapshot;
+
   int disposed;
 };
 
@@ -64,6 +100,9 @@ struct _GpaKeyListClass {
 
   /* Signal handlers */
   void (*context_menu) (GpaKeyList *keylist);
+  /* Emitted while the keys are listed with the number of keys
+     loaded so far and with -1 when the listing is complete.  */
+  void (*progress) (GpaKeyList *keylist, gint nkeys);
 };
 
 GType gpa_keylist_get_type (void) G_GNUC_CONST;
@@ -71,13 +110,6 @@ GType gpa_keylist_get_type (void) G_GNUC_CONST;
 /* API */
 
 
-/* Usage flags.  */
-#define KEY_USAGE_SIGN 1   /* Good for signatures. */
-#define KEY_USAGE_ENCR 2   /* Good for encryption. */
-#define KEY_USAGE_CERT 4   /* Good to certify other keys. */
-#define KEY_USAGE_AUTH 8   /* Good for authentication. */
-
-
 /* Create a new key list widget.  */
 GtkWidget *gpa_keylist_new (GtkWidget * window);
 
@@ -121,8 +153,16 @@ void gpa_keylist_start_reload (GpaKeyList * keylist);
    available. */
 void gpa_keylist_new_key (GpaKeyList * keylist, const char *fpr);
 
+/* Let the keylist know that the keys with the fingerprints FPRS (a
+   NULL terminated array) have been changed.  Only these keys are
+   reloaded and their rows are updated in place.  */
+void gpa_keylist_refresh_keys (GpaKeyList *keylist, const char **fprs);
+
 /* Let the keylist know that a new sceret key has been imported.  */
 void gpa_keylist_imported_secret_key (GpaKeyList * keylist);
 
+/* Show only the keys matching the words of QUERY.  */
+void gpa_keylist_set_search (GpaKeyList *keylist, const char *query);
+
 
 #endif /* GPA_KEYLIST_H */
@@ -289,21 +289,46 @@ key_manager_current_key (GpaKeyManager *self)
 /* Action callbacks.  */
 
 
+/* Reload the keys changed by the key operation OP.  Changing the
+   ownertrust of a key changes the validity of all keys certified by
+   it, and so does signing or deleting a key which is trusted; all
+   keys are reloaded in these cases.  */
 static void
-gpa_key_manager_changed_wot_cb (gpointer data)
+gpa_key_manager_changed_wot_cb (gpointer data, GpaKeyOperation *op)
 {
   GpaKeyManager *self = data;
-  gpa_keylist_start_reload (self->keylist);
+  GList *keys = gpa_key_operation_keys (op);
+  gboolean reload_all;
+  const char **fprs;
+  int idx;
+
+  reload_all = G_TYPE_CHECK_INSTANCE_TYPE (op, GPA_KEY_TRUST_OPERATION_TYPE);
+  fprs = g_new0 (const char *, g_list_length (keys) + 1);
+  for (idx = 0; keys; keys = g_list_next (keys))
+    {
+      gpgme_key_t key = keys->data;
+
+      if (key && key->protocol == GPGME_PROTOCOL_OpenPGP
+          && key->owner_trust >= GPGME_VALIDITY_MARGINAL)
+        reload_all = TRUE;
+      if (key && key->subkeys && key->subkeys->fpr)
+        fprs[idx++] = key->subkeys->fpr;
+    }
+  if (reload_all)
+    gpa_keylist_start_reload (self->keylist);
+  else
+    gpa_keylist_refresh_keys (self->keylist, fprs);
+  g_free (fprs);
 }
 
 
+/* Reload the keys changed by the import operation OP.  */
 static void
-gpa_key_manager_changed_wot_secret_cb (gpointer data)
+gpa_key_manager_imported_keys_cb (gpointer data, GpaImportOperation *op)
 {
   GpaKeyManager *self = data;
 
-  gpa_keylist_imported_secret_key (self->keylist);
-  gpa_keylist_start_reload (self->keylist);
+  gpa_keylist_refresh_keys (self->keylist, (const char **) op->fprs);
 }
 
 static void
@@ -311,7 +336,11 @@ gpa_key_manager_key_modified (GpaKeyEditDialog *dialog, gpgme_key_t key,
 				 gpointer data)
 {
   GpaKeyManager *self = data;
-  gpa_keylist_start_reload (self->keylist);
+  const char *fprs[2];
+
+  fprs[0] = key? key->subkeys->fpr : NULL;
+  fprs[1] = NULL;
+  gpa_keylist_refresh_keys (self->keylist, fprs);
 }
 
 
@@ -341,12 +370,11 @@ static void
 register_import_operation (GpaKeyManager *self, GpaImportOperation *op)
 {
   g_signal_connect_swapped (G_OBJECT (op), "imported_keys",
-			    G_CALLBACK (gpa_key_manager_changed_wot_cb),
+			    G_CALLBACK (gpa_key_manager_imported_keys_cb),
+			    self);
+  g_signal_connect_swapped (G_OBJECT (op), "imported_secret_keys",
+			    G_CALLBACK (gpa_key_manager_imported_keys_cb),
 			    self);
-  g_signal_connect_swapped
-    (G_OBJECT (op), "imported_secret_keys",
-     G_CALLBACK (gpa_key_manager_changed_wot_secret_cb),
-     self);
   g_signal_connect (G_OBJECT (op), "completed",
 		    G_CALLBACK (g_object_unref), self);
 }
@@ -1672,6 +1700,41 @@ keyring_update_status_bar (GpaKeyManager *self)
 }
 
 
+/* Filter the keylist.  This is the callback for the "search-changed"
+   signal of the search entry.  */
+static void
+key_manager_search_changed (GtkSearchEntry *entry, gpointer param)
+{
+  GpaKeyManager *self = param;
+
+  gpa_keylist_set_search (self->keylist,
+                          gtk_entry_get_text (GTK_ENTRY (entry)));
+}
+
+
+/* Show the progress of the key listing in the status bar.  This is
+   the callback for the "progress" signal of the keylist.  */
+static void
+keyring_listing_progress (GpaKeyManager *self, gint nkeys)
+{
+  gchar *string;
+
+  if (nkeys < 0)
+    {
+      keyring_update_status_bar (self);
+      return;
+    }
+
+  string = g_strdup_printf (ngettext ("Loading keys ... %d key",
+                                      "Loading keys ... %d keys", nkeys),
+                            nkeys);
+  gtk_label_set_text (GTK_LABEL (self->status_label), string);
+  gtk_label_set_text (GTK_LABEL (self->status_key_user), "");
+  gtk_label_set_text (GTK_LABEL (self->status_key_id), "");
+  g_free (string);
+}
+
+
 /* FIXME: Check. */
 /* The context menu of the keyring list.  This is the callback for the
    "button_press_event" signal.  */
@@ -1753,6 +1816,8 @@ construct_widgets (GpaKeyManager *self)
   GtkWidget *icon;
   GtkWidget *paned;
   GtkWidget *statusbar;
+  GtkWidget *list_box;
+  GtkWidget *search;
   GtkWidget *main_box;
   GtkWidget *align;
   gchar *markup;
@@ -1804,8 +1869,16 @@ construct_widgets (GpaKeyManager *self)
   gtk_box_pack_start (GTK_BOX (main_box), paned, TRUE, TRUE, 0);
   gtk_container_add (GTK_CONTAINER (align), main_box);
 
+  list_box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  gtk_paned_pack1 (GTK_PANED (paned), list_box, TRUE, TRUE);
+
+  search = gtk_search_entry_new ();
+  gtk_entry_set_placeholder_text (GTK_ENTRY (search),
+                                  _("Search for name, mail address or key ID"));
+  gtk_box_pack_start (GTK_BOX (list_box), search, FALSE, TRUE, 0);
+
   scrolled = gtk_scrolled_window_new (NULL, NULL);
-  gtk_paned_pack1 (GTK_PANED (paned), scrolled, TRUE, TRUE);
+  gtk_box_pack_start (GTK_BOX (list_box), scrolled, TRUE, TRUE, 0);
   gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled),
                                   GTK_POLICY_AUTOMATIC,
                                   GTK_POLICY_AUTOMATIC);
@@ -1831,6 +1904,8 @@ construct_widgets (GpaKeyManager *self)
 
   g_signal_connect_swapped (G_OBJECT (keylist), "button_press_event",
                             G_CALLBACK (display_popup_menu), self);
+  g_signal_connect (G_OBJECT (search), "search-changed",
+                    G_CALLBACK (key_manager_search_changed), self);
 
   self->details = gpa_key_details_new ();
   gtk_paned_pack2 (GTK_PANED (paned), self->details, TRUE, TRUE);
@@ -1841,6 +1916,8 @@ construct_widgets (GpaKeyManager *self)
   g_signal_connect (G_OBJECT (gpa_options_get_instance ()),
 		    "changed_default_key",
                     G_CALLBACK (keyring_default_key_changed), self);
+  g_signal_connect_swapped (G_OBJECT (keylist), "progress",
+                            G_CALLBACK (keyring_listing_progress), self);
 
   keyring_update_status_bar (self);
   update_selection_sensitive_actions (self);
@@ -0,0 +1,395 @@
+/* keysnapshot.c - On-disk snapshot of the key listing.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "gpa.h"
+#include "membuf.h"
+#include "keysnapshot.h"
+
+
+/* The snapshot file consists of a header, an array of fixed size
+   records and a table of Nul terminated strings.  The records refer
+   to the strings by their offset into that table.  All numbers are
+   stored in host byte order; a snapshot written on another platform
+   is thus rejected due to the magic value.  */
+
+#define SNAPSHOT_NAME    "gpa-keylist.cache"
+#define SNAPSHOT_MAGIC   0x4b415047  /* "GPAK" */
+#define SNAPSHOT_VERSION 1
+
+/* The files in the GnuPG home directory which are modified if the
+   key listing changes.  The snapshot is only used if their
+   modification times and sizes are still the same as at the time it
+   was written.  */
+static const char *stamped_files[] =
+  {
+    "pubring.kbx",        /* gpg and gpgsm keybox.  */
+    "pubring.gpg",        /* Old gpg keyring.  */
+    "trustdb.gpg",        /* Validity of OpenPGP keys.  */
+    "trustlist.txt",      /* Trusted root certificates.  */
+    "private-keys-v1.d"   /* Secret keys.  */
+  };
+#define N_STAMPED_FILES DIM (stamped_files)
+
+struct snapshot_stamp_s
+{
+  guint64 mtime;
+  guint64 size;
+};
+
+struct snapshot_header_s
+{
+  guint32 magic;
+  guint32 version;
+  struct snapshot_stamp_s stamps[N_STAMPED_FILES];
+  guint32 nrecords;
+  guint32 strings_len;
+};
+
+/* Flags of a record.  */
+#define SNAPSHOT_SECRET      (1 << 0)
+#define SNAPSHOT_CARDKEY     (1 << 1)
+#define SNAPSHOT_REVOKED     (1 << 2)
+#define SNAPSHOT_EXPIRED     (1 << 3)
+#define SNAPSHOT_DISABLED    (1 << 4)
+#define SNAPSHOT_INVALID     (1 << 5)
+#define SNAPSHOT_CAN_ENCRYPT (1 << 6)
+#define SNAPSHOT_CAN_SIGN    (1 << 7)
+#define SNAPSHOT_CAN_CERTIFY (1 << 8)
+#define SNAPSHOT_HAS_UID     (1 << 9)
+#define SNAPSHOT_UID_REVOKED (1 << 10)
+
+struct snapshot_record_s
+{
+  guint32 fpr;         /* Offset of the fingerprint.  */
+  guint32 uid;         /* Offset of the first user ID.  */
+  guint64 created;
+  guint64 expires;
+  guint32 protocol;
+  guint32 owner_trust;
+  guint32 validity;    /* Validity of the first user ID.  */
+  guint32 flags;
+};
+
+
+struct gpa_keysnapshot_s
+{
+  GMappedFile *file;
+  const struct snapshot_record_s *records;
+  unsigned int nrecords;
+  const char *strings;
+};
+
+
+
+/* Return the file name of the snapshot.  */
+static gchar *
+snapshot_filename (void)
+{
+  return g_build_filename (gnupg_homedir, SNAPSHOT_NAME, NULL);
+}
+
+
+/* Store the current stamps of the files in STAMPS.  */
+static void
+get_stamps (struct snapshot_stamp_s *stamps)
+{
+  GStatBuf st;
+  gchar *fname;
+  unsigned int i;
+
+  for (i = 0; i < N_STAMPED_FILES; i++)
+    {
+      fname = g_build_filename (gnupg_homedir, stamped_files[i], NULL);
+      if (g_stat (fname, &st))
+        {
+          stamps[i].mtime = 0;
+          stamps[i].size = 0;
+        }
+      else
+        {
+          stamps[i].mtime = st.st_mtime;
+          stamps[i].size = st.st_size;
+        }
+      g_free (fname);
+    }
+}
+
+
+/* Combine the stamps of all stamped files into one value.  */
+guint64
+gpa_keysnapshot_keyring_stamp (void)
+{
+  struct snapshot_stamp_s stamps[N_STAMPED_FILES];
+  guint64 stamp = 0;
+  unsigned int i;
+
+  get_stamps (stamps);
+  for (i = 0; i < N_STAMPED_FILES; i++)
+    stamp = (stamp * 1000003) ^ (stamps[i].mtime * 31 + stamps[i].size);
+  return stamp;
+}
+
+
+/* Return true if the N RECORDS refer only to strings in the string
+   table STRINGS of length STRINGS_LEN.  */
+static gboolean
+check_records (const struct snapshot_record_s *records, unsigned int n,
+               const char *strings, guint32 strings_len)
+{
+  unsigned int i;
+
+  if (!strings_len || strings[strings_len - 1])
+    return FALSE;
+  for (i = 0; i < n; i++)
+    if (records[i].fpr >= strings_len || records[i].uid >= strings_len)
+      return FALSE;
+  return TRUE;
+}
+
+
+gpa_keysnapshot_t
+gpa_keysnapshot_open (void)
+{
+  struct snapshot_stamp_s stamps[N_STAMPED_FILES];
+  const struct snapshot_header_s *hdr;
+  gpa_keysnapshot_t snap;
+  GMappedFile *file;
+  gchar *fname;
+  const char *data;
+  gsize len, n;
+
+  fname = snapshot_filename ();
+  file = g_mapped_file_new (fname, FALSE, NULL);
+  g_free (fname);
+  if (!file)
+    return NULL;
+
+  data = g_mapped_file_get_contents (file);
+  len = g_mapped_file_get_length (file);
+  hdr = (const struct snapshot_header_s *) data;
+  get_stamps (stamps);
+  if (len < sizeof *hdr
+      || hdr->magic != SNAPSHOT_MAGIC
+      || hdr->version != SNAPSHOT_VERSION
+      || memcmp (hdr->stamps, stamps, sizeof stamps))
+    goto leave;
+
+  n = hdr->nrecords;
+  if (n > (len - sizeof *hdr) / sizeof (struct snapshot_record_s)
+      || hdr->strings_len != (len - sizeof *hdr
+                              - n * sizeof (struct snapshot_record_s)))
+    goto leave;
+
+  snap = g_malloc0 (sizeof *snap);
+  snap->file = file;
+  snap->nrecords = n;
+  snap->records = (const struct snapshot_record_s *) (data + sizeof *hdr);
+  snap->strings = (const char *) (snap->records + n);
+  if (!check_records (snap->records, n, snap->strings, hdr->strings_len))
+    {
+      g_free (snap);
+      goto leave;
+    }
+  return snap;
+
+ leave:
+  g_mapped_file_unref (file);
+  return NULL;
+}
+
+
+void
+gpa_keysnapshot_close (gpa_keysnapshot_t snap)
+{
+  if (!snap)
+    return;
+  g_mapped_file_unref (snap->file);
+  g_free (snap);
+}
+
+
+unsigned int
+gpa_keysnapshot_count (gpa_keysnapshot_t snap)
+{
+  return snap? snap->nrecords : 0;
+}
+
+
+void
+gpa_keysnapshot_get_key (gpa_keysnapshot_t snap, unsigned int idx,
+                         struct gpa_keysnapshot_key_s *r_key)
+{
+  const struct snapshot_record_s *rec;
+  gpgme_key_t key = &r_key->key;
+  gpgme_subkey_t subkey = &r_key->subkey;
+  gpgme_user_id_t uid = &r_key->uid;
+
+  memset (r_key, 0, sizeof *r_key);
+  g_return_if_fail (snap && idx < snap->nrecords);
+  rec = snap->records + idx;
+
+  subkey->fpr = (char *) snap->strings + rec->fpr;
+  subkey->timestamp = rec->created;
+  subkey->expires = rec->expires;
+  subkey->revoked = key->revoked = !!(rec->flags & SNAPSHOT_REVOKED);
+  subkey->expired = key->expired = !!(rec->flags & SNAPSHOT_EXPIRED);
+  subkey->disabled = key->disabled = !!(rec->flags & SNAPSHOT_DISABLED);
+  subkey->invalid = key->invalid = !!(rec->flags & SNAPSHOT_INVALID);
+  subkey->is_cardkey = !!(rec->flags & SNAPSHOT_CARDKEY);
+  key->can_encrypt = !!(rec->flags & SNAPSHOT_CAN_ENCRYPT);
+  key->can_sign = !!(rec->flags & SNAPSHOT_CAN_SIGN);
+  key->can_certify = !!(rec->flags & SNAPSHOT_CAN_CERTIFY);
+  key->protocol = rec->protocol;
+  key->owner_trust = rec->owner_trust;
+  key->subkeys = subkey;
+  if ((rec->flags & SNAPSHOT_HAS_UID))
+    {
+      uid->uid = (char *) snap->strings + rec->uid;
+      uid->validity = rec->validity;
+      uid->revoked = !!(rec->flags & SNAPSHOT_UID_REVOKED);
+      key->uids = uid;
+    }
+  if ((rec->flags & SNAPSHOT_SECRET))
+    r_key->seckey = key;
+}
+
+
+/* Append STRING to the string table STRINGS and return its offset.  */
+static guint32
+add_string (membuf_t *strings, const char *string)
+{
+  guint32 off = get_membuf_len (strings);
+
+  put_membuf (strings, string, strlen (string) + 1);
+  return off;
+}
+
+
+gpg_error_t
+gpa_keysnapshot_write (GList *keys, GpaKeyTable *sectable)
+{
+  struct snapshot_header_s hdr;
+  struct snapshot_record_s rec;
+  membuf_t records, strings;
+  gpgme_key_t key, seckey;
+  char *recbuf, *strbuf, *buffer;
+  size_t reclen, strings_len;
+  gchar *fname;
+  GError *error = NULL;
+  gboolean okay;
+  GList *cur;
+
+  if (!sectable->initialized)
+    return gpg_error (GPG_ERR_NOT_INITIALIZED);
+
+  /* Note that the stamps are taken after the listing.  If the
+     keyrings were modified in the meantime the snapshot is stale
+     until the next listing; that is harmless because the snapshot is
+     always replaced by the real listing.  */
+  memset (&hdr, 0, sizeof hdr);
+  hdr.magic = SNAPSHOT_MAGIC;
+  hdr.version = SNAPSHOT_VERSION;
+  get_stamps (hdr.stamps);
+
+  init_membuf (&records, 4096);
+  init_membuf (&strings, 4096);
+  /* Offset 0 is the empty string.  */
+  add_string (&strings, "");
+  for (cur = keys; cur; cur = g_list_next (cur))
+    {
+      key = cur->data;
+      if (!key->subkeys || !key->subkeys->fpr)
+        continue;
+
+      memset (&rec, 0, sizeof rec);
+      rec.fpr = add_string (&strings, key->subkeys->fpr);
+      rec.created = key->subkeys->timestamp;
+      rec.expires = key->subkeys->expires;
+      rec.protocol = key->protocol;
+      rec.owner_trust = key->owner_trust;
+      if (key->revoked)
+        rec.flags |= SNAPSHOT_REVOKED;
+      if (key->expired)
+        rec.flags |= SNAPSHOT_EXPIRED;
+      if (key->disabled)
+        rec.flags |= SNAPSHOT_DISABLED;
+      if (key->invalid)
+        rec.flags |= SNAPSHOT_INVALID;
+      if (key->can_encrypt)
+        rec.flags |= SNAPSHOT_CAN_ENCRYPT;
+      if (key->can_sign)
+        rec.flags |= SNAPSHOT_CAN_SIGN;
+      if (key->can_certify)
+        rec.flags |= SNAPSHOT_CAN_CERTIFY;
+      if (key->uids && key->uids->uid)
+        {
+          rec.flags |= SNAPSHOT_HAS_UID;
+          if (key->uids->revoked)
+            rec.flags |= SNAPSHOT_UID_REVOKED;
+          rec.uid = add_string (&strings, key->uids->uid);
+          rec.validity = key->uids->validity;
+        }
+      seckey = gpa_keytable_lookup_key (sectable, key->subkeys->fpr);
+      if (seckey)
+        {
+          rec.flags |= SNAPSHOT_SECRET;
+          if (seckey->subkeys && seckey->subkeys->is_cardkey)
+            rec.flags |= SNAPSHOT_CARDKEY;
+        }
+      put_membuf (&records, &rec, sizeof rec);
+      hdr.nrecords++;
+    }
+
+  recbuf = get_membuf (&records, &reclen);
+  strbuf = get_membuf (&strings, &strings_len);
+  if (!recbuf || !strbuf)
+    {
+      g_free (recbuf);
+      g_free (strbuf);
+      return gpg_error (GPG_ERR_ENOMEM);
+    }
+  hdr.strings_len = strings_len;
+
+  buffer = g_malloc (sizeof hdr + reclen + strings_len);
+  memcpy (buffer, &hdr, sizeof hdr);
+  memcpy (buffer + sizeof hdr, recbuf, reclen);
+  memcpy (buffer + sizeof hdr + reclen, strbuf, strings_len);
+  g_free (recbuf);
+  g_free (strbuf);
+
+  /* This writes a temporary file and renames it so that a concurrent
+     reader never sees a partial snapshot.  */
+  fname = snapshot_filename ();
+  okay = g_file_set_contents (fname, buffer,
+                              sizeof hdr + reclen + strings_len, &error);
+  g_free (fname);
+  g_free (buffer);
+  if (!okay)
+    {
+      g_debug ("error writing key listing snapshot: %s", error->message);
+      g_error_free (error);
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+/* keysnapshot.h - On-disk snapshot of the key listing.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+/* The snapshot stores the attributes of the keys shown by the key
+   list so that they can be displayed at startup before the real key
+   listing has been done.  It is only valid as long as the keyrings
+   have not been modified.  */
+
+#ifndef KEYSNAPSHOT_H
+#define KEYSNAPSHOT_H
+
+#include <glib.h>
+#include <gpgme.h>
+
+#include "keytable.h"
+
+/* An opened snapshot.  */
+typedef struct gpa_keysnapshot_s *gpa_keysnapshot_t;
+
+/* A key recreated from the snapshot.  KEY may only be used with the
+   functions formatting a key for display.  The strings point into
+   the snapshot and are valid until it is closed.  */
+struct gpa_keysnapshot_key_s
+{
+  struct _gpgme_key key;
+  struct _gpgme_subkey subkey;
+  struct _gpgme_user_id uid;
+  /* The key has a secret key.  SECKEY may then be used as the secret
+     key for display.  */
+  gpgme_key_t seckey;
+};
+
+
+/* Map the snapshot of the current GnuPG home directory.  Returns
+   NULL if there is none or if it is not valid anymore.  */
+gpa_keysnapshot_t gpa_keysnapshot_open (void);
+
+/* Release SNAP.  */
+void gpa_keysnapshot_close (gpa_keysnapshot_t snap);
+
+/* Return the number of keys in SNAP.  */
+unsigned int gpa_keysnapshot_count (gpa_keysnapshot_t snap);
+
+/* Store the key number IDX of SNAP at R_KEY.  */
+void gpa_keysnapshot_get_key (gpa_keysnapshot_t snap, unsigned int idx,
+                              struct gpa_keysnapshot_key_s *r_key);
+
+/* Write a snapshot of the public keys KEYS.  SECTABLE is used to
+   find the secret keys and must already be filled.  */
+gpg_error_t gpa_keysnapshot_write (GList *keys, GpaKeyTable *sectable);
+
+/* Return a value which changes whenever the keyrings of the current
+   GnuPG home directory are modified.  */
+guint64 gpa_keysnapshot_keyring_stamp (void);
+
+#endif /* KEYSNAPSHOT_H */
@@ -25,12 +25,34 @@
 #include "gpgmetools.h"
 #include "keytable.h"
 #include "gtktools.h"
+#include "keysnapshot.h"
 
 /* Internal */
-static void first_half_done_cb (GpaContext *context, gpg_error_t err,
-                                GpaKeyTable *keytable);
+static void invalidate_sorted_tokens (GpaKeyTable *keytable);
+static void context_done_cb (GpaContext *context, gpg_error_t err,
+                             GpaKeyTable *keytable);
 static void next_key_cb (GpaContext *context, gpgme_key_t key,
 			 GpaKeyTable *keytable);
+static void free_queued_listing (struct queued_listing_s *listing);
+static void start_queued_listing (GpaKeyTable *keytable);
+
+/* A callback queued by gpa_keytable_when_ready.  */
+struct ready_cb_s
+{
+  GpaKeyTableEndFunc func;
+  gpointer data;
+};
+
+/* A listing requested while another one was running.  */
+struct queued_listing_s
+{
+  GpaKeyTableNextFunc next;
+  GpaKeyTableEndFunc end;
+  gpointer data;
+  gboolean new_key;
+  gboolean refresh;
+  char **fprs;
+};
 
 /* GObject type functions */
 
@@ -86,20 +108,39 @@ gpa_keytable_init (GpaKeyTable *keytable)
   keytable->next = NULL;
   keytable->end = NULL;
   keytable->data = NULL;
-  keytable->did_first_half = 0;
-  keytable->first_half_err = 0;
+  keytable->pending = 0;
+  keytable->pgp_err = 0;
+  keytable->cms_err = 0;
   keytable->context = gpa_context_new ();
+  keytable->cms_context = gpa_context_new ();
   keytable->keys = NULL;
   keytable->secret = FALSE;
   keytable->initialized = FALSE;
+  keytable->failed = FALSE;
   keytable->new_key = FALSE;
+  keytable->refresh = FALSE;
+  keytable->fprs = NULL;
   keytable->tmp_list = NULL;
+  keytable->index = g_hash_table_new (g_str_hash, g_str_equal);
+  keytable->tokens = NULL;
+  keytable->sorted_tokens = NULL;
+  keytable->sorted_rtokens = NULL;
+  keytable->mailboxes = g_hash_table_new_full
+    (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+  keytable->ready_cbs = NULL;
+  keytable->queued = NULL;
   /* Note, that the next_key and done signals are emitted by means of
      gpgme events with the help of gpacontext.c:gpa_context_event_cb.  */
+  gpgme_set_protocol (keytable->context->ctx, GPGME_PROTOCOL_OpenPGP);
   g_signal_connect (G_OBJECT (keytable->context), "next_key",
 		    G_CALLBACK (next_key_cb), keytable);
   g_signal_connect (G_OBJECT (keytable->context), "done",
-		    G_CALLBACK (first_half_done_cb), keytable);
+		    G_CALLBACK (context_done_cb), keytable);
+  gpgme_set_protocol (keytable->cms_context->ctx, GPGME_PROTOCOL_CMS);
+  g_signal_connect (G_OBJECT (keytable->cms_context), "next_key",
+		    G_CALLBACK (next_key_cb), keytable);
+  g_signal_connect (G_OBJECT (keytable->cms_context), "done",
+		    G_CALLBACK (context_done_cb), keytable);
 }
 
 static void
@@ -108,61 +149,490 @@ gpa_keytable_finalize (GObject *object)
   GpaKeyTable *keytable = GPA_KEYTABLE (object);
 
   g_object_unref (keytable->context);
+  g_object_unref (keytable->cms_context);
+  g_hash_table_destroy (keytable->index);
+  if (keytable->tokens)
+    g_hash_table_destroy (keytable->tokens);
+  invalidate_sorted_tokens (keytable);
+  g_hash_table_destroy (keytable->mailboxes);
+  g_strfreev (keytable->fprs);
+  g_list_free_full (keytable->ready_cbs, g_free);
+  g_list_free_full (keytable->queued, (GDestroyNotify) free_queued_listing);
+  g_list_foreach (keytable->tmp_list, (GFunc) gpgme_key_unref, NULL);
+  g_list_free (keytable->tmp_list);
   g_list_foreach (keytable->keys, (GFunc) gpgme_key_unref, NULL);
   g_list_free (keytable->keys);
 }
 
 /* Internal functions */
 
+/* Release the sorted tokens of KEYTABLE after the tokens changed.  */
 static void
-reload_cache (GpaKeyTable *keytable, const char *fpr)
+invalidate_sorted_tokens (GpaKeyTable *keytable)
 {
-  gpg_error_t err;
+  if (keytable->sorted_tokens)
+    {
+      g_ptr_array_unref (keytable->sorted_tokens);
+      keytable->sorted_tokens = NULL;
+    }
+  if (keytable->sorted_rtokens)
+    {
+      g_ptr_array_unref (keytable->sorted_rtokens);
+      keytable->sorted_rtokens = NULL;
+    }
+}
 
-  /* We select the Open PGP protocol here.  At the end
-     first_half_done_cb will do another keylist_start for X,509.  */
-  keytable->did_first_half = 0;
-  keytable->first_half_err = 0;
-  keytable->fpr = fpr;
-  gpgme_set_protocol (keytable->context->ctx, GPGME_PROTOCOL_OpenPGP);
-  err = gpgme_op_keylist_start (keytable->context->ctx, fpr,
-				keytable->secret);
-  if (gpg_err_code (err) != GPG_ERR_NO_ERROR)
+
+/* Add the lowercase words of STRING to the set WORDS.  */
+static void
+add_search_words (GHashTable *words, const char *string)
+{
+  gchar *lower, *p, *start;
+
+  lower = g_utf8_strdown (string, -1);
+  for (p = lower; *p; )
     {
-      gpa_gpgme_warning (err);
-      if (keytable->end)
-	{
-	  keytable->end (keytable->data);
-	}
-      return;
+      /* Non-ASCII characters are taken as part of a word.  */
+      for (start = p; *p && ((*p & 0x80) || g_ascii_isalnum (*p)); p++)
+        ;
+      if (p > start)
+        g_hash_table_add (words, g_strndup (start, p - start));
+      if (*p)
+        p++;
     }
-  keytable->tmp_list = NULL;
+  g_free (lower);
+}
+
+
+/* Return a new set with the search tokens of KEY.  */
+static GHashTable *
+get_search_tokens (gpgme_key_t key)
+{
+  GHashTable *tokens;
+  gpgme_user_id_t uid;
+  gpgme_subkey_t subkey;
+  gchar *email, *p;
+
+  tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (uid = key->uids; uid; uid = uid->next)
+    {
+      if (uid->uid)
+        add_search_words (tokens, uid->uid);
+      if (uid->email && *uid->email)
+        {
+          /* X.509 mail addresses are enclosed in angle brackets.  */
+          email = g_utf8_strdown (uid->email + (*uid->email == '<'), -1);
+          p = strchr (email, '>');
+          if (p)
+            *p = 0;
+          p = strchr (email, '@');
+          if (p && p[1])
+            g_hash_table_add (tokens, g_strdup (p + 1));
+          g_hash_table_add (tokens, email);
+        }
+    }
+  for (subkey = key->subkeys; subkey; subkey = subkey->next)
+    {
+      if (subkey->fpr)
+        g_hash_table_add (tokens, g_ascii_strdown (subkey->fpr, -1));
+      if (subkey->keyid)
+        g_hash_table_add (tokens, g_ascii_strdown (subkey->keyid, -1));
+    }
+
+  return tokens;
 }
 
+
+/* Add KEY to the search index.  */
 static void
-done_cb (GpaContext *context, gpg_error_t err, GpaKeyTable *keytable)
+search_index_add_key (GpaKeyTable *keytable, gpgme_key_t key)
 {
-  if (err || keytable->first_half_err)
+  GHashTable *tokens;
+  GHashTableIter iter;
+  gpointer token;
+  GPtrArray *keys;
+
+  tokens = get_search_tokens (key);
+  g_hash_table_iter_init (&iter, tokens);
+  while (g_hash_table_iter_next (&iter, &token, NULL))
     {
-      if (keytable->first_half_err)
-        gpa_gpgme_warning (keytable->first_half_err);
-      if (err)
-        gpa_gpgme_warning (err);
+      keys = g_hash_table_lookup (keytable->tokens, token);
+      if (!keys)
+        {
+          keys = g_ptr_array_new ();
+          /* Move the token to the index.  */
+          g_hash_table_iter_steal (&iter);
+          g_hash_table_insert (keytable->tokens, token, keys);
+          invalidate_sorted_tokens (keytable);
+        }
+      g_ptr_array_add (keys, key);
+    }
+  g_hash_table_destroy (tokens);
+}
+
+
+/* Remove KEY from the search index.  */
+static void
+search_index_remove_key (GpaKeyTable *keytable, gpgme_key_t key)
+{
+  GHashTable *tokens;
+  GHashTableIter iter;
+  gpointer token;
+  GPtrArray *keys;
+
+  tokens = get_search_tokens (key);
+  g_hash_table_iter_init (&iter, tokens);
+  while (g_hash_table_iter_next (&iter, &token, NULL))
+    {
+      keys = g_hash_table_lookup (keytable->tokens, token);
+      if (keys)
+        {
+          g_ptr_array_remove_fast (keys, key);
+          if (!keys->len)
+            {
+              invalidate_sorted_tokens (keytable);
+              g_hash_table_remove (keytable->tokens, token);
+            }
+        }
+    }
+  g_hash_table_destroy (tokens);
+}
+
+
+/* Return the lowercase addr-spec of the mail address ADDR.  See
+   keytable.h for the details.  */
+gchar *
+gpa_keytable_normalize_mailbox (const char *addr)
+{
+  const char *s, *e;
+  gchar *tmp, *result;
+
+  if (!addr)
+    return NULL;
+  s = strchr (addr, '<');
+  if (s)
+    {
+      s++;
+      e = strchr (s, '>');
+      if (!e)
+        e = s + strlen (s);
+    }
+  else
+    {
+      s = addr;
+      e = s + strlen (s);
+    }
+  while (s < e && g_ascii_isspace (*s))
+    s++;
+  while (e > s && g_ascii_isspace (e[-1]))
+    e--;
+  if (s == e || !memchr (s, '@', e - s))
+    return NULL;
+
+  tmp = g_strndup (s, e - s);
+  result = g_ascii_strdown (tmp, -1);
+  g_free (tmp);
+  return result;
+}
+
+
+/* Add KEY to the mailbox index.  */
+static void
+mailbox_index_add_key (GpaKeyTable *keytable, gpgme_key_t key)
+{
+  gpgme_user_id_t uid;
+  GPtrArray *keys;
+  gchar *mbox;
+  guint i;
+
+  for (uid = key->uids; uid; uid = uid->next)
+    {
+      mbox = gpa_keytable_normalize_mailbox (uid->email);
+      if (!mbox)
+        continue;
+      keys = g_hash_table_lookup (keytable->mailboxes, mbox);
+      if (!keys)
+        {
+          keys = g_ptr_array_new ();
+          g_hash_table_insert (keytable->mailboxes, mbox, keys);
+        }
+      else
+        g_free (mbox);
+      /* Several user IDs may have the same address.  */
+      for (i = 0; i < keys->len; i++)
+        if (keys->pdata[i] == key)
+          break;
+      if (i == keys->len)
+        g_ptr_array_add (keys, key);
+    }
+}
+
+
+/* Remove KEY from the mailbox index.  */
+static void
+mailbox_index_remove_key (GpaKeyTable *keytable, gpgme_key_t key)
+{
+  gpgme_user_id_t uid;
+  GPtrArray *keys;
+  gchar *mbox;
+
+  for (uid = key->uids; uid; uid = uid->next)
+    {
+      mbox = gpa_keytable_normalize_mailbox (uid->email);
+      if (!mbox)
+        continue;
+      keys = g_hash_table_lookup (keytable->mailboxes, mbox);
+      if (keys)
+        {
+          g_ptr_array_remove_fast (keys, key);
+          if (!keys->len)
+            g_hash_table_remove (keytable->mailboxes, mbox);
+        }
+      g_free (mbox);
+    }
+}
+
+
+/* Add the fingerprints and key IDs of KEY to the index.  */
+static void
+index_add_key (GpaKeyTable *keytable, gpgme_key_t key)
+{
+  gpgme_subkey_t subkey;
+
+  for (subkey = key->subkeys; subkey; subkey = subkey->next)
+    {
+      if (subkey->fpr)
+        g_hash_table_insert (keytable->index, subkey->fpr, key);
+      if (subkey->keyid)
+        g_hash_table_insert (keytable->index, subkey->keyid, key);
+    }
+  mailbox_index_add_key (keytable, key);
+  if (keytable->tokens)
+    search_index_add_key (keytable, key);
+}
+
+
+/* Remove the fingerprints and key IDs of KEY from the index.  Entries
+   which meanwhile point to another key are kept.  */
+static void
+index_remove_key (GpaKeyTable *keytable, gpgme_key_t key)
+{
+  gpgme_subkey_t subkey;
+
+  for (subkey = key->subkeys; subkey; subkey = subkey->next)
+    {
+      if (subkey->fpr
+          && g_hash_table_lookup (keytable->index, subkey->fpr) == key)
+        g_hash_table_remove (keytable->index, subkey->fpr);
+      if (subkey->keyid
+          && g_hash_table_lookup (keytable->index, subkey->keyid) == key)
+        g_hash_table_remove (keytable->index, subkey->keyid);
+    }
+  mailbox_index_remove_key (keytable, key);
+  if (keytable->tokens)
+    search_index_remove_key (keytable, key);
+}
+
+
+/* Remove a key with the same primary fingerprint as KEY from the
+   list of cached keys.  This is used to replace keys loaded by
+   gpa_keytable_load_new.  */
+static void
+remove_cached_key (GpaKeyTable *keytable, gpgme_key_t key)
+{
+  gpgme_key_t oldkey;
+
+  if (!key->subkeys || !key->subkeys->fpr)
+    return;
+  oldkey = g_hash_table_lookup (keytable->index, key->subkeys->fpr);
+  if (!oldkey || oldkey == key || oldkey->protocol != key->protocol
+      || !g_str_equal (oldkey->subkeys->fpr, key->subkeys->fpr))
+    return;
+
+  index_remove_key (keytable, oldkey);
+  keytable->keys = g_list_remove (keytable->keys, oldkey);
+  gpgme_key_unref (oldkey);
+}
+
+
+/* Start a key listing in CONTEXT.  */
+static gpg_error_t
+start_keylist (GpaKeyTable *keytable, GpaContext *context)
+{
+  if (keytable->fprs)
+    return gpgme_op_keylist_ext_start (context->ctx,
+                                       (const char **) keytable->fprs,
+                                       keytable->secret, 0);
+  else
+    return gpgme_op_keylist_start (context->ctx, NULL, keytable->secret);
+}
+
+
+/* Call and remove all callbacks queued by gpa_keytable_when_ready.  */
+static void
+run_ready_cbs (GpaKeyTable *keytable)
+{
+  GList *list, *cur;
+
+  /* Detach the list first because the callbacks may queue new
+     callbacks.  */
+  list = keytable->ready_cbs;
+  keytable->ready_cbs = NULL;
+  for (cur = list; cur; cur = g_list_next (cur))
+    {
+      struct ready_cb_s *cb = cur->data;
+
+      cb->func (cb->data);
+    }
+  g_list_free_full (list, g_free);
+}
+
+
+/* Return a copy of the NULL terminated array FPRS without
+   duplicates.  */
+static char **
+copy_fprs (const char **fprs)
+{
+  GHashTable *seen;
+  char **result;
+  int idx, n;
+
+  for (n = 0; fprs[n]; n++)
+    ;
+  result = g_new (char *, n + 1);
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  for (idx = n = 0; fprs[idx]; idx++)
+    if (!g_hash_table_contains (seen, fprs[idx]))
+      {
+        g_hash_table_add (seen, (char *) fprs[idx]);
+        result[n++] = g_strdup (fprs[idx]);
+      }
+  result[n] = NULL;
+  g_hash_table_destroy (seen);
+
+  return result;
+}
+
+
+/* Return true if ERR is an error returned for a key listing of a
+   key which does not exist.  */
+static int
+is_not_found_error (gpg_error_t err)
+{
+  switch (gpg_err_code (err))
+    {
+    case GPG_ERR_NOT_FOUND:
+    case GPG_ERR_NO_PUBKEY:
+    case GPG_ERR_NO_SECKEY:
+    case GPG_ERR_EOF:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+/* Write the key listing snapshot.  Called when the secret keytable
+   is ready.  */
+static void
+save_snapshot_cb (gpointer data)
+{
+  GpaKeyTable *keytable = data;
+  gpg_error_t err;
+
+  err = gpa_keysnapshot_write (keytable->keys,
+                               gpa_keytable_get_secret_instance ());
+  if (err && verbose)
+    g_message ("writing the key listing snapshot failed: %s",
+               gpg_strerror (err));
+}
+
+
+/* Merge the results of the OpenPGP and the X.509 key listing into
+   the cache.  Called after both listings are finished.  */
+static void
+done_cb (GpaKeyTable *keytable)
+{
+  gpg_error_t pgp_err = keytable->pgp_err;
+  gpg_error_t cms_err = keytable->cms_err;
+  GList *cur;
+  int idx;
+
+  if (keytable->refresh)
+    {
+      /* Keys which have been deleted are not found again.  */
+      if (is_not_found_error (pgp_err))
+        pgp_err = 0;
+      if (is_not_found_error (cms_err))
+        cms_err = 0;
+    }
+  if (pgp_err || cms_err)
+    {
+      if (pgp_err)
+        gpa_gpgme_warning (pgp_err);
+      if (cms_err)
+        gpa_gpgme_warning (cms_err);
+      /* Keep the cache as it is but let the caller finish.  An
+         empty cache is not filled again until a reload is requested
+         explicitly.  */
+      if (!keytable->initialized)
+        keytable->failed = TRUE;
+      g_list_foreach (keytable->tmp_list, (GFunc) gpgme_key_unref, NULL);
+      g_list_free (keytable->tmp_list);
+      keytable->tmp_list = NULL;
+      g_strfreev (keytable->fprs);
+      keytable->fprs = NULL;
+      keytable->new_key = FALSE;
+      keytable->refresh = FALSE;
+      if (keytable->end)
+        keytable->end (keytable->data);
+      run_ready_cbs (keytable);
+      start_queued_listing (keytable);
       return;
     }
   /* Reverse the list to have the keys come up in the same order they
    * were listed */
   keytable->tmp_list = g_list_reverse (keytable->tmp_list);
-  if (keytable->new_key)
+  if (keytable->new_key || keytable->refresh)
     {
-      /* Append the new key(s)
+      if (keytable->refresh)
+        {
+          /* Drop the old versions of the requested keys.  Keys which
+             have not been listed again are thus removed.  */
+          for (idx = 0; keytable->fprs && keytable->fprs[idx]; idx++)
+            {
+              gpgme_key_t oldkey;
+
+              oldkey = g_hash_table_lookup (keytable->index,
+                                            keytable->fprs[idx]);
+              if (oldkey)
+                {
+                  index_remove_key (keytable, oldkey);
+                  keytable->keys = g_list_remove (keytable->keys, oldkey);
+                  gpgme_key_unref (oldkey);
+                }
+            }
+        }
+
+      /* Append the new key(s) replacing older versions of them.
        */
+      for (cur = keytable->tmp_list; cur; cur = g_list_next (cur))
+        remove_cached_key (keytable, cur->data);
+      for (cur = keytable->tmp_list; cur; cur = g_list_next (cur))
+        index_add_key (keytable, cur->data);
       keytable->keys = g_list_concat (keytable->keys, keytable->tmp_list);
+      keytable->new_key = FALSE;
+      keytable->refresh = FALSE;
     }
   else
     {
       /* Replace the list
        */
+      g_hash_table_remove_all (keytable->index);
+      g_hash_table_remove_all (keytable->mailboxes);
+      if (keytable->tokens)
+        g_hash_table_remove_all (keytable->tokens);
+      invalidate_sorted_tokens (keytable);
       if (keytable->keys)
 	{
 	  g_list_foreach (keytable->keys, (GFunc) gpgme_key_unref,
@@ -170,68 +640,162 @@ done_cb (GpaContext *context, gpg_error_t err, GpaKeyTable *keytable)
 	  g_list_free (keytable->keys);
 	}
       keytable->keys = keytable->tmp_list;
+      for (cur = keytable->keys; cur; cur = g_list_next (cur))
+        index_add_key (keytable, cur->data);
     }
+  keytable->tmp_list = NULL;
+  g_strfreev (keytable->fprs);
+  keytable->fprs = NULL;
   keytable->initialized = TRUE;
+  keytable->failed = FALSE;
+  keytable->generation++;
+  if (keylist_cache && !keytable->secret)
+    {
+      GpaKeyTable *sectable = gpa_keytable_get_secret_instance ();
+
+      /* The snapshot also records which keys have a secret key.  */
+      gpa_keytable_cancel_ready (sectable, save_snapshot_cb, keytable);
+      gpa_keytable_when_ready (sectable, save_snapshot_cb, keytable);
+    }
   if (keytable->end)
     {
       keytable->end (keytable->data);
     }
+  run_ready_cbs (keytable);
+  start_queued_listing (keytable);
 }
 
 
+/* Start listing the keys given by the NULL terminated array FPRS or
+   all keys if FPRS is NULL.  OpenPGP and X.509 keys are listed
+   concurrently in their own contexts; done_cb merges the results after
+   both listings are finished.  Must not be called while a listing is
+   running; use start_listing.  */
 static void
-first_half_done_cb (GpaContext *context, gpg_error_t err,
-                    GpaKeyTable *keytable)
-{
-  if (keytable->did_first_half || !cms_hack)
-    {
-      /* We are here for the second time and thus we continue with the
-         real done handler.  We do this also if the CMS_HACK has not
-         been enabled.  We reset the protocol to OpenPGP because some
-         old code might assume that it is in OpenPGP mode.  */
-      keytable->fpr = NULL; /* Not needed anymore.  */
-      gpgme_set_protocol (keytable->context->ctx, GPGME_PROTOCOL_OpenPGP);
-      done_cb (context, err, keytable);
-      return;
-    }
+reload_cache (GpaKeyTable *keytable, const char **fprs)
+{
+  gpg_error_t err;
+
+  g_return_if_fail (!keytable->pending && !keytable->tmp_list);
 
-  /* Now continue with a key listing for X.509 keys but save the error
-     of the the PGP key listing.  */
-  keytable->first_half_err = err;
-  keytable->did_first_half = 1;
+  keytable->pgp_err = 0;
+  keytable->cms_err = 0;
+  g_strfreev (keytable->fprs);
+  keytable->fprs = fprs? copy_fprs (fprs) : NULL;
 
-  gpgme_set_protocol (context->ctx, GPGME_PROTOCOL_CMS);
-  err = gpgme_op_keylist_start (keytable->context->ctx,
-                                keytable->fpr,
-				keytable->secret);
-  keytable->fpr = NULL; /* Not needed anymore.  */
+  keytable->pending++;
+  err = start_keylist (keytable, keytable->context);
   if (err)
     {
-      if (keytable->first_half_err)
-        gpa_gpgme_warning (keytable->first_half_err);
+      keytable->pending--;
+      keytable->pgp_err = err;
+    }
 
-      if ((gpg_err_code (err) == GPG_ERR_INV_ENGINE
-           || gpg_err_code (err) == GPG_ERR_UNSUPPORTED_PROTOCOL)
-          && gpg_err_source (err) == GPG_ERR_SOURCE_GPGME)
+  if (cms_hack)
+    {
+      keytable->pending++;
+      err = start_keylist (keytable, keytable->cms_context);
+      if (err)
         {
-          if (gpg_err_code (err) == GPG_ERR_UNSUPPORTED_PROTOCOL)
-            g_message ("Note: Please check libgpgme has "
-                       "been build with support for CMS");
-          gpa_window_error
-            (_("It seems that no CMS engine is installed.\n\n"
-               "Temporary disabling support for X.509.\n\n"
-               "Please install a CMS engine or invoke this program\n"
-               "with the option --disable-x509 ."), NULL);
-          cms_hack = 0;
-          err = 0;
+          keytable->pending--;
+          if ((gpg_err_code (err) == GPG_ERR_INV_ENGINE
+               || gpg_err_code (err) == GPG_ERR_UNSUPPORTED_PROTOCOL)
+              && gpg_err_source (err) == GPG_ERR_SOURCE_GPGME)
+            {
+              if (gpg_err_code (err) == GPG_ERR_UNSUPPORTED_PROTOCOL)
+                g_message ("Note: Please check libgpgme has "
+                           "been build with support for CMS");
+              gpa_window_error
+                (_("It seems that no CMS engine is installed.\n\n"
+                   "Temporary disabling support for X.509.\n\n"
+                   "Please install a CMS engine or invoke this program\n"
+                   "with the option --disable-x509 ."), NULL);
+              cms_hack = 0;
+            }
+          else
+            keytable->cms_err = err;
         }
-      else
-        gpa_gpgme_warning (err);
-      if (keytable->end)
-	{
-	  keytable->end (keytable->data);
-	}
     }
+
+  if (!keytable->pending)
+    done_cb (keytable);
+}
+
+
+/* Start a listing of the keys given by FPRS with the callbacks NEXT
+   and END.  If a listing is running, the new one is queued and
+   started after it is done; the callbacks of the running listing
+   are thus still called.  */
+static void
+start_listing (GpaKeyTable *keytable, const char **fprs,
+               gboolean new_key, gboolean refresh,
+               GpaKeyTableNextFunc next, GpaKeyTableEndFunc end,
+               gpointer data)
+{
+  if (keytable->pending)
+    {
+      struct queued_listing_s *listing;
+
+      listing = g_malloc (sizeof *listing);
+      listing->next = next;
+      listing->end = end;
+      listing->data = data;
+      listing->new_key = new_key;
+      listing->refresh = refresh;
+      listing->fprs = fprs? copy_fprs (fprs) : NULL;
+      keytable->queued = g_list_append (keytable->queued, listing);
+      return;
+    }
+
+  keytable->next = next;
+  keytable->end = end;
+  keytable->data = data;
+  keytable->new_key = new_key;
+  keytable->refresh = refresh;
+  reload_cache (keytable, fprs);
+}
+
+
+static void
+free_queued_listing (struct queued_listing_s *listing)
+{
+  g_strfreev (listing->fprs);
+  g_free (listing);
+}
+
+
+/* Start the oldest queued listing unless a listing is running.  */
+static void
+start_queued_listing (GpaKeyTable *keytable)
+{
+  struct queued_listing_s *listing;
+
+  if (keytable->pending || !keytable->queued)
+    return;
+
+  listing = keytable->queued->data;
+  keytable->queued = g_list_delete_link (keytable->queued, keytable->queued);
+  start_listing (keytable, (const char **) listing->fprs,
+                 listing->new_key, listing->refresh,
+                 listing->next, listing->end, listing->data);
+  free_queued_listing (listing);
+}
+
+
+static void
+context_done_cb (GpaContext *context, gpg_error_t err, GpaKeyTable *keytable)
+{
+  if (!keytable->pending)
+    return;  /* Not a listing started by us.  */
+
+  if (context == keytable->cms_context)
+    keytable->cms_err = err;
+  else
+    keytable->pgp_err = err;
+
+  keytable->pending--;
+  if (!keytable->pending)
+    done_cb (keytable);
 }
 
 
@@ -247,7 +811,8 @@ next_key_cb (GpaContext *context, gpgme_key_t key, GpaKeyTable *keytable)
 }
 
 static void
-list_cache (GpaKeyTable *keytable)
+list_cache (GpaKeyTable *keytable, GpaKeyTableNextFunc next,
+            GpaKeyTableEndFunc end, gpointer data)
 {
   GList *list = keytable->keys;
 
@@ -255,15 +820,15 @@ list_cache (GpaKeyTable *keytable)
     {
       gpgme_key_t key = (gpgme_key_t) list->data;
       gpgme_key_ref (key);
-      if (keytable->next)
+      if (next)
 	{
-	  keytable->next (key, keytable->data);
+	  next (key, data);
 	}
     }
 
-  if (keytable->end)
+  if (end)
     {
-      keytable->end (keytable->data);
+      end (data);
     }
 }
 
@@ -326,19 +891,15 @@ gpa_keytable_list_keys (GpaKeyTable *keytable,
   g_return_if_fail (keytable != NULL);
   g_return_if_fail (GPA_IS_KEYTABLE (keytable));
 
-  /* Set up callbacks */
-  keytable->next = next;
-  keytable->end = end;
-  keytable->data = data;
   /* List keys */
   if (keytable->keys)
     {
       /* There is a cached list */
-      list_cache (keytable);
+      list_cache (keytable, next, end, data);
     }
   else
     {
-      reload_cache (keytable, NULL);
+      start_listing (keytable, NULL, FALSE, FALSE, next, end, data);
     }
 }
 
@@ -353,12 +914,8 @@ gpa_keytable_force_reload (GpaKeyTable *keytable,
   g_return_if_fail (keytable != NULL);
   g_return_if_fail (GPA_IS_KEYTABLE (keytable));
 
-  /* Set up callbacks */
-  keytable->next = next;
-  keytable->end = end;
-  keytable->data = data;
   /* List keys */
-  reload_cache (keytable, NULL);
+  start_listing (keytable, NULL, FALSE, FALSE, next, end, data);
 }
 
 /* Load the key with the given fingerprint from GnuPG, replacing it in the
@@ -374,43 +931,391 @@ gpa_keytable_load_new (GpaKeyTable *keytable,
   g_return_if_fail (keytable != NULL);
   g_return_if_fail (GPA_IS_KEYTABLE (keytable));
 
-  /* Set up callbacks */
-  keytable->next = next;
-  keytable->end = end;
-  keytable->data = data;
   /* List keys */
-  keytable->new_key = TRUE;
-  reload_cache (keytable, fpr);
+  if (fpr)
+    {
+      const char *fprs[2];
+
+      fprs[0] = fpr;
+      fprs[1] = NULL;
+      start_listing (keytable, fprs, TRUE, FALSE, next, end, data);
+    }
+  else
+    start_listing (keytable, NULL, TRUE, FALSE, next, end, data);
 }
 
+
+/* Reload the keys with the fingerprints given by the NULL terminated
+ * array FPRS from GnuPG and update the cache in place.  Keys which
+ * are not anymore available are removed from the cache.  If the cache
+ * has not yet been filled, all keys are listed.
+ */
+void
+gpa_keytable_refresh_keys (GpaKeyTable *keytable,
+                           const char **fprs,
+                           GpaKeyTableNextFunc next,
+                           GpaKeyTableEndFunc end,
+                           gpointer data)
+{
+  g_return_if_fail (keytable != NULL);
+  g_return_if_fail (GPA_IS_KEYTABLE (keytable));
+
+  /* List keys */
+  if (!keytable->initialized || !fprs || !*fprs)
+    start_listing (keytable, NULL, FALSE, FALSE, next, end, data);
+  else
+    start_listing (keytable, fprs, FALSE, TRUE, next, end, data);
+}
+
+/* Start filling the keytable unless it is already filled, a listing
+   is running or filling it failed before.  */
+static void
+start_initial_listing (GpaKeyTable *keytable)
+{
+  if (keytable->initialized || keytable->failed
+      || keytable->pending || keytable->queued)
+    return;
+
+  /* Nobody waits for the keys.  */
+  start_listing (keytable, NULL, FALSE, FALSE, NULL, NULL, NULL);
+}
+
+
+/* Call FUNC with DATA as soon as the keytable has been filled.  If
+ * that is already the case FUNC is called immediately, otherwise a
+ * listing is started if none is running.  FUNC is also called if the
+ * listing failed; if it failed before, FUNC is called immediately.
+ */
+void
+gpa_keytable_when_ready (GpaKeyTable *keytable,
+                         GpaKeyTableEndFunc func,
+                         gpointer data)
+{
+  struct ready_cb_s *cb;
+
+  g_return_if_fail (GPA_IS_KEYTABLE (keytable));
+  g_return_if_fail (func != NULL);
+
+  if (keytable->initialized
+      || (keytable->failed && !keytable->pending && !keytable->queued))
+    {
+      func (data);
+      return;
+    }
+
+  cb = g_malloc (sizeof *cb);
+  cb->func = func;
+  cb->data = data;
+  keytable->ready_cbs = g_list_append (keytable->ready_cbs, cb);
+  start_initial_listing (keytable);
+}
+
+
+/* Remove a callback queued by gpa_keytable_when_ready.
+ */
+void
+gpa_keytable_cancel_ready (GpaKeyTable *keytable,
+                           GpaKeyTableEndFunc func,
+                           gpointer data)
+{
+  GList *cur, *next;
+
+  g_return_if_fail (GPA_IS_KEYTABLE (keytable));
+
+  for (cur = keytable->ready_cbs; cur; cur = next)
+    {
+      struct ready_cb_s *cb = cur->data;
+
+      next = g_list_next (cur);
+      if (cb->func == func && cb->data == data)
+        {
+          keytable->ready_cbs = g_list_delete_link (keytable->ready_cbs, cur);
+          g_free (cb);
+        }
+    }
+}
+
+
 /* Return the key with a given fingerprint from the keytable, NULL if
-   there is none. No reference is provided.  */
+   there is none.  If the keytable has not yet been filled NULL is
+   returned as well; use gpa_keytable_when_ready to wait for it.  No
+   reference is provided.  */
 gpgme_key_t
 gpa_keytable_lookup_key (GpaKeyTable *keytable, const char *fpr)
 {
-  if (keytable->initialized)
+  g_return_val_if_fail (GPA_IS_KEYTABLE (keytable), NULL);
+
+  if (!fpr)
+    return NULL;
+  if (!keytable->initialized)
     {
-      GList *cur;
-      for (cur = keytable->keys; cur; cur = g_list_next (cur))
-	{
-	  gpgme_key_t key = (gpgme_key_t) cur->data;
-	  if (g_str_equal (fpr, key->subkeys->fpr))
-	    {
-	      return key;
-	    }
-	}
+      start_initial_listing (keytable);
       return NULL;
     }
-  else
+  return g_hash_table_lookup (keytable->index, fpr);
+}
+
+
+/* Return the key with the given key ID from the keytable, NULL if
+   there is none.  KEYID may be a fingerprint or a long key ID of the
+   primary key or of a subkey, optionally prefixed with "0x" and in
+   any case.  Like gpa_keytable_lookup_key this does not wait for the
+   keytable to be filled.  No reference is provided.  */
+gpgme_key_t
+gpa_keytable_lookup_keyid (GpaKeyTable *keytable, const char *keyid)
+{
+  gpgme_key_t key;
+  char *tmp;
+
+  g_return_val_if_fail (GPA_IS_KEYTABLE (keytable), NULL);
+
+  if (!keyid)
+    return NULL;
+  if (keyid[0] == '0' && (keyid[1] == 'x' || keyid[1] == 'X'))
+    keyid += 2;
+  if (!keytable->initialized)
     {
-      /* There is no list yet. We really, really, need to one, so we list it.
-       * FIXME: This is a hack and a basic problem. Hopefully it won't cause
-       * any real problems.
-       */
-      keytable->end = (GpaKeyTableEndFunc) gtk_main_quit;
-      reload_cache (keytable, NULL);
-      gtk_main ();
-      keytable->end = NULL;
-      return gpa_keytable_lookup_key (keytable, fpr);
+      start_initial_listing (keytable);
+      return NULL;
+    }
+  tmp = g_ascii_strup (keyid, -1);
+  key = g_hash_table_lookup (keytable->index, tmp);
+  g_free (tmp);
+  return key;
+}
+
+
+static gint
+compare_tokens (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+
+/* Sort the tokens of the search index of KEYTABLE for prefix and
+   suffix lookups unless that has already been done.  */
+static void
+sort_tokens (GpaKeyTable *keytable)
+{
+  GHashTableIter iter;
+  gpointer token;
+  guint n;
+
+  if (keytable->sorted_tokens)
+    return;
+
+  n = g_hash_table_size (keytable->tokens);
+  keytable->sorted_tokens = g_ptr_array_sized_new (n);
+  keytable->sorted_rtokens = g_ptr_array_new_full (n, g_free);
+  g_hash_table_iter_init (&iter, keytable->tokens);
+  while (g_hash_table_iter_next (&iter, &token, NULL))
+    {
+      g_ptr_array_add (keytable->sorted_tokens, token);
+      g_ptr_array_add (keytable->sorted_rtokens,
+                       g_strreverse (g_strdup (token)));
+    }
+  g_ptr_array_sort (keytable->sorted_tokens, compare_tokens);
+  g_ptr_array_sort (keytable->sorted_rtokens, compare_tokens);
+}
+
+
+/* Return the index of the first string of the sorted array TOKENS
+   which is not less than WORD.  */
+static guint
+lower_bound (GPtrArray *tokens, const gchar *word)
+{
+  guint lo = 0, hi = tokens->len, mid;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (strcmp (tokens->pdata[mid], word) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
+  return lo;
+}
+
+
+/* Add the keys of the search token TOKEN to MATCHES.  If RESULT is
+   not NULL only keys in RESULT are added.  */
+static void
+add_token_matches (GpaKeyTable *keytable, const gchar *token,
+                   GHashTable *result, GHashTable *matches)
+{
+  GPtrArray *keys;
+  guint i;
+
+  keys = g_hash_table_lookup (keytable->tokens, token);
+  if (!keys)
+    return;
+  for (i = 0; i < keys->len; i++)
+    if (!result || g_hash_table_contains (result, keys->pdata[i]))
+      g_hash_table_add (matches, keys->pdata[i]);
+}
+
+
+/* Return a hash table with all keys of the keytable matching each
+   whitespace separated word of QUERY.  Returns NULL if the keytable
+   has not yet been filled.  */
+GHashTable *
+gpa_keytable_search (GpaKeyTable *keytable, const char *query)
+{
+  GHashTable *result, *matches;
+  GPtrArray *tokens;
+  gchar *lower, **words, *word, *rword, *token;
+  GList *cur;
+  size_t len;
+  int idx;
+  guint i;
+
+  g_return_val_if_fail (GPA_IS_KEYTABLE (keytable), NULL);
+
+  if (!keytable->initialized)
+    {
+      start_initial_listing (keytable);
+      return NULL;
+    }
+
+  if (!keytable->tokens)
+    {
+      /* Build the search index on first use.  It is then kept up to
+         date by index_add_key and index_remove_key.  */
+      keytable->tokens = g_hash_table_new_full
+        (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+      for (cur = keytable->keys; cur; cur = g_list_next (cur))
+        search_index_add_key (keytable, cur->data);
+    }
+  sort_tokens (keytable);
+
+  result = NULL;
+  lower = g_utf8_strdown (query, -1);
+  words = g_strsplit_set (lower, " \t", -1);
+  g_free (lower);
+  for (idx = 0; words[idx]; idx++)
+    {
+      word = words[idx];
+      if (!*word)
+        continue;
+      if (word[0] == '0' && word[1] == 'x' && word[2])
+        word += 2;
+
+      matches = g_hash_table_new (g_direct_hash, g_direct_equal);
+      len = strlen (word);
+
+      /* The tokens starting with WORD.  */
+      tokens = keytable->sorted_tokens;
+      for (i = lower_bound (tokens, word);
+           i < tokens->len && !strncmp (tokens->pdata[i], word, len); i++)
+        add_token_matches (keytable, tokens->pdata[i], result, matches);
+
+      /* The tokens ending with WORD.  */
+      tokens = keytable->sorted_rtokens;
+      rword = g_strreverse (g_strdup (word));
+      for (i = lower_bound (tokens, rword);
+           i < tokens->len && !strncmp (tokens->pdata[i], rword, len); i++)
+        {
+          token = g_strreverse (g_strdup (tokens->pdata[i]));
+          add_token_matches (keytable, token, result, matches);
+          g_free (token);
+        }
+      g_free (rword);
+
+      if (result)
+        g_hash_table_destroy (result);
+      result = matches;
+    }
+  g_strfreev (words);
+
+  if (!result)
+    {
+      /* An empty query matches all keys.  */
+      result = g_hash_table_new (g_direct_hash, g_direct_equal);
+      for (cur = keytable->keys; cur; cur = g_list_next (cur))
+        g_hash_table_add (result, cur->data);
+    }
+
+  return result;
+}
+
+
+/* Find the keys with the mail address MAILBOX.  See keytable.h for
+   the details.  */
+gboolean
+gpa_keytable_find_keys (GpaKeyTable *keytable, const char *mailbox,
+                        gpgme_protocol_t protocol, int usage,
+                        gboolean only_usable, gpgme_key_t **r_keys)
+{
+  GPtrArray *keys;
+  gpgme_key_t key, *result;
+  gchar *mbox;
+  guint i, n;
+
+  g_return_val_if_fail (GPA_IS_KEYTABLE (keytable), FALSE);
+  g_return_val_if_fail (r_keys, FALSE);
+
+  *r_keys = NULL;
+  if (!keytable->initialized)
+    {
+      keytable->misses++;
+      start_initial_listing (keytable);
+      return FALSE;
+    }
+
+  mbox = gpa_keytable_normalize_mailbox (mailbox);
+  if (!mbox)
+    {
+      keytable->misses++;
+      return FALSE;
+    }
+  keys = g_hash_table_lookup (keytable->mailboxes, mbox);
+  g_free (mbox);
+
+  result = g_new (gpgme_key_t, (keys? keys->len : 0) + 1);
+  for (i = n = 0; keys && i < keys->len; i++)
+    {
+      key = keys->pdata[i];
+      if (protocol != GPGME_PROTOCOL_UNKNOWN && key->protocol != protocol)
+        continue;
+      if (usage
+          && !((key->can_sign && (usage & KEY_USAGE_SIGN))
+               || (key->can_encrypt && (usage & KEY_USAGE_ENCR))
+               || (key->can_certify && (usage & KEY_USAGE_CERT))
+               || (key->can_authenticate && (usage & KEY_USAGE_AUTH))))
+        continue;
+      if (only_usable
+          && (key->revoked || key->disabled || key->expired || key->invalid))
+        continue;
+      gpgme_key_ref (key);
+      result[n++] = key;
+    }
+  result[n] = NULL;
+  *r_keys = result;
+  if (n)
+    keytable->hits++;
+  else
+    keytable->misses++;
+
+  return TRUE;
+}
+
+
+unsigned int
+gpa_keytable_get_generation (GpaKeyTable *keytable)
+{
+  g_return_val_if_fail (GPA_IS_KEYTABLE (keytable), 0);
+
+  return keytable->generation;
+}
+
+
+void
+gpa_keytable_get_stats (GpaKeyTable *keytable,
+                        unsigned long *r_hits, unsigned long *r_misses)
+{
+  g_return_if_fail (GPA_IS_KEYTABLE (keytable));
+
+  *r_hits = keytable->hits;
+  *r_misses = keytable->misses;
 }
@@ -40,25 +40,75 @@
 typedef struct _GpaKeyTable GpaKeyTable;
 typedef struct _GpaKeyTableClass GpaKeyTableClass;
 
+/* Usage flags.  */
+#define KEY_USAGE_SIGN 1   /* Good for signatures. */
+#define KEY_USAGE_ENCR 2   /* Good for encryption. */
+#define KEY_USAGE_CERT 4   /* Good to certify other keys. */
+#define KEY_USAGE_AUTH 8   /* Good for authentication. */
+
 typedef void (*GpaKeyTableNextFunc) (gpgme_key_t key, gpointer data);
 typedef void (*GpaKeyTableEndFunc) (gpointer data);
 
 struct _GpaKeyTable {
   GObject parent;
 
+  /* The contexts used for listing OpenPGP and X.509 keys.  */
   GpaContext *context;
+  GpaContext *cms_context;
 
   gboolean secret;
   gboolean new_key;
+  gboolean refresh;
   gboolean initialized;
+  /* Filling the empty cache failed.  It is only retried by an
+     explicit reload.  */
+  gboolean failed;
   GpaKeyTableNextFunc next;
   GpaKeyTableEndFunc end;
   gpointer data;
-  const char *fpr;
-  int did_first_half;
-  gpg_error_t first_half_err;
+  char **fprs;
+  /* Number of running listings and their results.  */
+  int pending;
+  gpg_error_t pgp_err;
+  gpg_error_t cms_err;
 
   GList *keys, *tmp_list;
+
+  /* Index of the keys in KEYS.  It maps the fingerprints and the long
+     key IDs of the primary key and of all subkeys to the key.  The
+     strings used as hash keys are owned by the gpgme keys.  */
+  GHashTable *index;
+
+  /* Inverted index for gpa_keytable_search.  It maps the lowercase
+     words of the user IDs, the mail addresses, their domains and the
+     fingerprints and key IDs to an array of keys.  Only created by
+     the first search.  */
+  GHashTable *tokens;
+
+  /* The tokens sorted for prefix lookups and the reversed tokens
+     sorted for suffix lookups.  Built by a search after the tokens
+     changed.  The tokens are owned by TOKENS.  */
+  GPtrArray *sorted_tokens;
+  GPtrArray *sorted_rtokens;
+
+  /* Index of the keys by mail address.  It maps the lowercase
+     addr-spec of all user IDs to an array of keys.  */
+  GHashTable *mailboxes;
+
+  /* Callbacks queued by gpa_keytable_when_ready.  */
+  GList *ready_cbs;
+
+  /* Listings requested while another one was running.  */
+  GList *queued;
+
+  /* Incremented whenever the cached keys change.  */
+  unsigned int generation;
+
+  /* The number of calls to gpa_keytable_find_keys which found keys
+     in the cache and of those which found none, including the calls
+     made before the cache was filled.  */
+  unsigned long hits;
+  unsigned long misses;
 };
 
 struct _GpaKeyTableClass {
@@ -104,8 +154,90 @@ void gpa_keytable_load_new (GpaKeyTable *keytable,
 			    GpaKeyTableEndFunc end,
 			    gpointer data);
 
+/* Reload the keys with the fingerprints given by the NULL terminated
+ * array FPRS from GnuPG and update the cache in place.  Keys which
+ * are not anymore available are removed from the cache.  If the cache
+ * has not yet been filled, all keys are listed.
+ *
+ * The "next" function is called for every reloaded key, providing a
+ * new reference for that key that should be freed.
+ *
+ * The "end" function is called when the refresh is complete.
+ */
+void gpa_keytable_refresh_keys (GpaKeyTable *keytable,
+                                const char **fprs,
+                                GpaKeyTableNextFunc next,
+                                GpaKeyTableEndFunc end,
+                                gpointer data);
+
+/* Call FUNC with DATA as soon as the keytable has been filled.  If
+ * that is already the case FUNC is called immediately, otherwise a
+ * listing is started if none is running.  FUNC is also called if the
+ * listing failed.
+ */
+void gpa_keytable_when_ready (GpaKeyTable *keytable,
+                              GpaKeyTableEndFunc func,
+                              gpointer data);
+
+/* Remove a callback queued by gpa_keytable_when_ready.
+ */
+void gpa_keytable_cancel_ready (GpaKeyTable *keytable,
+                                GpaKeyTableEndFunc func,
+                                gpointer data);
+
 /* Return the key with a given fingerprint from the keytable, NULL if
-   there is none. No reference is provided.  */
+   there is none.  If the keytable has not yet been filled NULL is
+   returned as well; use gpa_keytable_when_ready to wait for it.  No
+   reference is provided.  */
 gpgme_key_t gpa_keytable_lookup_key (GpaKeyTable *keytable, const char *fpr);
 
+/* Return the key with the given key ID from the keytable, NULL if
+   there is none.  KEYID may be a fingerprint or a long key ID of the
+   primary key or of a subkey, optionally prefixed with "0x" and in
+   any case.  Like gpa_keytable_lookup_key this does not wait for the
+   keytable to be filled.  No reference is provided.  */
+gpgme_key_t gpa_keytable_lookup_keyid (GpaKeyTable *keytable,
+                                       const char *keyid);
+
+/* Find the keys with the mail address MAILBOX.  MAILBOX may be an
+   addr-spec or a mailbox with the address in angle brackets.  Unless
+   PROTOCOL is GPGME_PROTOCOL_UNKNOWN only keys of that protocol are
+   returned.  USAGE is a bit vector of KEY_USAGE_* values; if not 0
+   only keys with at least one of these capabilities are returned.
+   If ONLY_USABLE is set revoked, disabled, expired and invalid keys
+   are skipped.  On success TRUE is returned and a NULL terminated
+   array of keys is stored at R_KEYS; each key has a new reference
+   and the array shall be released with gpa_gpgme_release_keyarray.
+   If the keytable has not yet been filled or MAILBOX is not a mail
+   address FALSE is returned.  */
+gboolean gpa_keytable_find_keys (GpaKeyTable *keytable, const char *mailbox,
+                                 gpgme_protocol_t protocol, int usage,
+                                 gboolean only_usable, gpgme_key_t **r_keys);
+
+/* Return the lowercase addr-spec of the mail address ADDR or NULL if
+   it does not look like one.  ADDR may have the address in angle
+   brackets.  This is the form used to index the keys by mail
+   address.  The result must be released with g_free.  */
+gchar *gpa_keytable_normalize_mailbox (const char *addr);
+
+/* Return a hash table with all keys of the keytable matching each
+   whitespace separated word of QUERY.  A word matches if it is a
+   prefix or a suffix of a word of a user ID, a mail address or
+   domain, or a fingerprint or key ID.  Thus a short key ID matches
+   the end of the fingerprint and a domain the end of the mail
+   addresses.  A word in the middle of such a word does not match.
+   Case is ignored.  Returns NULL if the keytable has not yet been
+   filled.  The caller must destroy the table; no references to the
+   keys are provided.  */
+GHashTable *gpa_keytable_search (GpaKeyTable *keytable, const char *query);
+
+/* Return a counter which is incremented whenever the keys in
+   KEYTABLE change.  */
+unsigned int gpa_keytable_get_generation (GpaKeyTable *keytable);
+
+/* Store the number of lookups of KEYTABLE which found keys in the
+   cache at R_HITS and of those which did not at R_MISSES.  */
+void gpa_keytable_get_stats (GpaKeyTable *keytable,
+                             unsigned long *r_hits, unsigned long *r_misses);
+
 #endif /* KEYTABLE_H */
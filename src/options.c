@@ -150,6 +150,7 @@ gpa_options_init (GpaOptions *options)
   options->default_key_fpr = NULL;
   options->default_keyserver = NULL;
   options->detailed_view = FALSE;
+  options->file_workers = 0;
 }
 
 static void
@@ -414,6 +415,15 @@ gpa_options_get_backup_generated (GpaOptions *options)
   return options->backup_generated;
 }
 
+
+/* Return the number of files processed at the same time.  This is
+   only set in the options file.  */
+gint
+gpa_options_get_file_workers (GpaOptions *options)
+{
+  return options->file_workers;
+}
+
 static void
 gpa_options_save_settings (GpaOptions *options)
 {
@@ -454,6 +464,10 @@ gpa_options_save_settings (GpaOptions *options)
         {
           fprintf (options_file, "%s\n", "detailed-view");
         }
+      if (options->file_workers)
+        {
+          fprintf (options_file, "file-workers %d\n", options->file_workers);
+        }
       fclose (options_file);
     }
 
@@ -496,6 +510,7 @@ typedef enum
    PARSE_OPTIONS_STATE_START,
    PARSE_OPTIONS_STATE_HAVE_KEY,
    PARSE_OPTIONS_STATE_HAVE_KEYSERVER,
+   PARSE_OPTIONS_STATE_HAVE_FILE_WORKERS,
  } ParseOptionsState;
 
 /* This MUST be called ONLY from gpa_options_new (). We don't emit any
@@ -552,6 +567,10 @@ gpa_options_read_settings (GpaOptions *options)
                 {
                   options->detailed_view = TRUE;
                 }
+              else if (g_str_equal (next_word, "file-workers"))
+                {
+                  state = PARSE_OPTIONS_STATE_HAVE_FILE_WORKERS;
+                }
               break;
             case PARSE_OPTIONS_STATE_HAVE_KEY:
               options->default_key_fpr = g_strdup (next_word);
@@ -562,6 +581,10 @@ gpa_options_read_settings (GpaOptions *options)
               /* options->default_keyserver = g_strdup (next_word); */
               state = PARSE_OPTIONS_STATE_START;
               break;
+            case PARSE_OPTIONS_STATE_HAVE_FILE_WORKERS:
+              options->file_workers = MAX (atoi (next_word), 0);
+              state = PARSE_OPTIONS_STATE_START;
+              break;
             default:
               /* Can't happen */
               return;
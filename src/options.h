@@ -50,6 +50,10 @@ struct _GpaOptions {
   gchar *default_keyserver;
 
   gboolean detailed_view;
+
+  /* The number of files processed at the same time or 0 for the
+     number of processors.  */
+  gint file_workers;
 };
 
 struct _GpaOptionsClass {
@@ -109,5 +113,10 @@ gboolean gpa_options_get_backup_generated (GpaOptions *options);
 void gpa_options_set_detailed_view (GpaOptions *options, gboolean value);
 gboolean gpa_options_get_detailed_view (GpaOptions *options);
 
+/* Return the number of files processed at the same time as set by
+   "file-workers" in the options file; 0 uses the number of
+   processors.  */
+gint gpa_options_get_file_workers (GpaOptions *options);
+
 #endif /*OPTIONS_H*/
 
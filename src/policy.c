@@ -0,0 +1,426 @@
+/* policy.c - Key selection without dialogs.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "gpa.h"
+#include "keytable.h"
+#include "policy.h"
+
+#define POLICY_NAME "gpa-policy.conf"
+
+
+/* The parsed policy file.  */
+struct policy_s
+{
+  /* Mapping the mail addresses to an array of fingerprints.  */
+  GHashTable *recipients;
+  /* The fingerprints of the signing keys.  */
+  GPtrArray *signers;
+  gboolean allow_untrusted;
+};
+typedef struct policy_s *policy_t;
+
+
+/* A pending selection.  */
+struct select_s
+{
+  GSList *recipients;
+  char *sender;
+  gpgme_protocol_t protocol;
+  GpaPolicyKeysFunc cb;
+  gpointer data;
+};
+typedef struct select_s *select_t;
+
+
+
+static void
+policy_free (policy_t policy)
+{
+  g_hash_table_destroy (policy->recipients);
+  g_ptr_array_free (policy->signers, TRUE);
+  g_free (policy);
+}
+
+
+/* Read the policy file.  A missing file is an empty policy.  */
+static policy_t
+policy_read (void)
+{
+  policy_t policy;
+  char *fname;
+  char *buffer;
+  char **lines;
+  GError *error = NULL;
+  int i;
+
+  policy = g_malloc0 (sizeof (*policy));
+  policy->recipients = g_hash_table_new_full
+    (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+  policy->signers = g_ptr_array_new_with_free_func (g_free);
+
+  fname = g_build_filename (gnupg_homedir, POLICY_NAME, NULL);
+  if (! g_file_get_contents (fname, &buffer, NULL, &error))
+    {
+      if (! g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_message ("error reading `%s': %s", fname, error->message);
+      g_error_free (error);
+      g_free (fname);
+      return policy;
+    }
+
+  lines = g_strsplit (buffer, "\n", -1);
+  g_free (buffer);
+  for (i = 0; lines[i]; i++)
+    {
+      char **words = g_strsplit_set (g_strstrip (lines[i]), " \t", -1);
+      char *argv[3];
+      int argc, n;
+
+      for (argc = n = 0; words[n]; n++)
+        if (*words[n] && argc < DIM (argv))
+          argv[argc++] = words[n];
+
+      if (! argc || *argv[0] == '#')
+        ;
+      else if (! strcmp (argv[0], "recipient") && argc == 3)
+        {
+          char *mbox = gpa_keytable_normalize_mailbox (argv[1]);
+          GPtrArray *fprs;
+
+          if (! mbox)
+            g_message ("%s:%d: invalid mail address", fname, i + 1);
+          else
+            {
+              fprs = g_hash_table_lookup (policy->recipients, mbox);
+              if (! fprs)
+                {
+                  fprs = g_ptr_array_new_with_free_func (g_free);
+                  g_hash_table_insert (policy->recipients, mbox, fprs);
+                }
+              else
+                g_free (mbox);
+              g_ptr_array_add (fprs, g_ascii_strup (argv[2], -1));
+            }
+        }
+      else if (! strcmp (argv[0], "signer") && argc == 2)
+        g_ptr_array_add (policy->signers, g_ascii_strup (argv[1], -1));
+      else if (! strcmp (argv[0], "allow-untrusted") && argc == 1)
+        policy->allow_untrusted = TRUE;
+      else
+        g_message ("%s:%d: invalid line", fname, i + 1);
+
+      g_strfreev (words);
+    }
+  g_strfreev (lines);
+  g_free (fname);
+
+  return policy;
+}
+
+
+
+/* Return true if KEY may be used for USAGE.  */
+static gboolean
+key_usable (gpgme_key_t key, int usage)
+{
+  if (key->revoked || key->disabled || key->expired || key->invalid)
+    return FALSE;
+  if ((usage & KEY_USAGE_SIGN) && ! key->can_sign)
+    return FALSE;
+  if ((usage & KEY_USAGE_ENCR) && ! key->can_encrypt)
+    return FALSE;
+  return TRUE;
+}
+
+
+/* Return true if the user ID of KEY with the mail address MBOX is at
+   least marginally valid.  */
+static gboolean
+key_trusted (gpgme_key_t key, const char *mbox)
+{
+  gpgme_user_id_t uid;
+
+  for (uid = key->uids; uid; uid = uid->next)
+    {
+      char *addr = gpa_keytable_normalize_mailbox (uid->email && *uid->email
+                                                   ? uid->email : uid->uid);
+      gboolean match = addr && ! strcmp (addr, mbox);
+
+      g_free (addr);
+      if (match && ! uid->revoked && uid->validity >= GPGME_VALIDITY_MARGINAL)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+
+/* Add KEY with a new reference to KEYS unless it is already there.  */
+static void
+add_key (GPtrArray *keys, gpgme_key_t key)
+{
+  int i;
+
+  for (i = 0; i < keys->len; i++)
+    if (g_ptr_array_index (keys, i) == key)
+      return;
+  gpgme_key_ref (key);
+  g_ptr_array_add (keys, key);
+}
+
+
+/* Add the keys given by the fingerprints FPRS of PROTOCOL to KEYS.
+   Returns false if none of them is usable for USAGE.  */
+static gboolean
+add_listed_keys (GPtrArray *keys, GpaKeyTable *keytable, GPtrArray *fprs,
+                 gpgme_protocol_t protocol, int usage)
+{
+  gboolean found = FALSE;
+  int i;
+
+  for (i = 0; i < fprs->len; i++)
+    {
+      gpgme_key_t key = gpa_keytable_lookup_key (keytable,
+                                                 g_ptr_array_index (fprs, i));
+
+      if (key && key->protocol == protocol && key_usable (key, usage))
+        {
+          add_key (keys, key);
+          found = TRUE;
+        }
+    }
+  return found;
+}
+
+
+/* Add the only usable key of PROTOCOL for MAILBOX to KEYS.  */
+static gpg_error_t
+add_mailbox_key (GPtrArray *keys, GpaKeyTable *keytable, policy_t policy,
+                 const char *mailbox, gpgme_protocol_t protocol, int usage)
+{
+  gpgme_key_t *found;
+  gpgme_key_t key = NULL;
+  char *mbox;
+  int i;
+
+  mbox = gpa_keytable_normalize_mailbox (mailbox);
+  if (! mbox)
+    return gpg_error (GPG_ERR_INV_USER_ID);
+  if (! gpa_keytable_find_keys (keytable, mbox, protocol, usage, TRUE, &found))
+    {
+      g_free (mbox);
+      return gpg_error (GPG_ERR_NO_PUBKEY);
+    }
+
+  for (i = 0; found[i]; i++)
+    if (policy->allow_untrusted || key_trusted (found[i], mbox))
+      {
+        if (key)
+          {
+            gpa_gpgme_release_keyarray (found);
+            g_free (mbox);
+            return gpg_error (GPG_ERR_AMBIGUOUS_NAME);
+          }
+        key = found[i];
+      }
+  if (key)
+    add_key (keys, key);
+  gpa_gpgme_release_keyarray (found);
+  g_free (mbox);
+
+  return key ? 0 : gpg_error (GPG_ERR_NO_PUBKEY);
+}
+
+
+/* Return the NULL terminated array of the keys in KEYS.  */
+static gpgme_key_t *
+take_keyarray (GPtrArray *keys)
+{
+  g_ptr_array_add (keys, NULL);
+  return (gpgme_key_t *) g_ptr_array_free (keys, FALSE);
+}
+
+
+/* Select the keys of PROTOCOL for all recipients of SEL.  */
+static gpg_error_t
+select_recipients (select_t sel, policy_t policy, gpgme_protocol_t protocol,
+                   gpgme_key_t **r_keys)
+{
+  GpaKeyTable *keytable = gpa_keytable_get_public_instance ();
+  GPtrArray *keys = g_ptr_array_new ();
+  gpg_error_t err = 0;
+  GSList *recp;
+
+  for (recp = sel->recipients; recp && ! err; recp = g_slist_next (recp))
+    {
+      char *mbox = gpa_keytable_normalize_mailbox (recp->data);
+      GPtrArray *fprs = mbox ? g_hash_table_lookup (policy->recipients,
+                                                    mbox) : NULL;
+
+      if (fprs)
+        {
+          if (! add_listed_keys (keys, keytable, fprs, protocol,
+                                 KEY_USAGE_ENCR))
+            err = gpg_error (GPG_ERR_NO_PUBKEY);
+        }
+      else
+        err = add_mailbox_key (keys, keytable, policy, recp->data,
+                               protocol, KEY_USAGE_ENCR);
+      g_free (mbox);
+    }
+
+  if (! err && ! keys->len)
+    err = gpg_error (GPG_ERR_NO_PUBKEY);
+  *r_keys = take_keyarray (keys);
+  if (err)
+    {
+      gpa_gpgme_release_keyarray (*r_keys);
+      *r_keys = NULL;
+    }
+  return err;
+}
+
+
+/* Select the signing keys of PROTOCOL for SEL.  */
+static gpg_error_t
+select_signers (select_t sel, policy_t policy, gpgme_protocol_t protocol,
+                gpgme_key_t **r_keys)
+{
+  GpaKeyTable *keytable = gpa_keytable_get_secret_instance ();
+  GPtrArray *keys = g_ptr_array_new ();
+  gpg_error_t err = 0;
+
+  if (policy->signers->len)
+    {
+      if (! add_listed_keys (keys, keytable, policy->signers, protocol,
+                             KEY_USAGE_SIGN))
+        err = gpg_error (GPG_ERR_NO_SECKEY);
+    }
+  else if (sel->sender)
+    {
+      err = add_mailbox_key (keys, keytable, policy, sel->sender,
+                             protocol, KEY_USAGE_SIGN);
+      if (gpg_err_code (err) == GPG_ERR_NO_PUBKEY)
+        err = gpg_error (GPG_ERR_NO_SECKEY);
+    }
+  else
+    {
+      gpgme_key_t key = gpa_options_get_default_key
+        (gpa_options_get_instance ());
+
+      if (key && key->protocol == protocol)
+        add_key (keys, key);
+      else
+        err = gpg_error (GPG_ERR_NO_SECKEY);
+    }
+
+  *r_keys = take_keyarray (keys);
+  if (err)
+    {
+      gpa_gpgme_release_keyarray (*r_keys);
+      *r_keys = NULL;
+    }
+  return err;
+}
+
+
+/* Called when the keytable is ready.  Tries the protocols in turn
+   and reports the first successful selection or the first error.  */
+static void
+keytable_ready_cb (gpointer data)
+{
+  select_t sel = data;
+  static const gpgme_protocol_t protocols[] =
+    { GPGME_PROTOCOL_OpenPGP, GPGME_PROTOCOL_CMS };
+  policy_t policy = policy_read ();
+  gpgme_key_t *keys = NULL;
+  gpgme_protocol_t protocol = GPGME_PROTOCOL_UNKNOWN;
+  gpg_error_t err = 0;
+  int i;
+
+  for (i = 0; i < DIM (protocols); i++)
+    {
+      gpg_error_t err2;
+
+      if (sel->protocol != GPGME_PROTOCOL_UNKNOWN
+          && sel->protocol != protocols[i])
+        continue;
+      if (! cms_hack && protocols[i] == GPGME_PROTOCOL_CMS)
+        continue;
+
+      if (sel->recipients)
+        err2 = select_recipients (sel, policy, protocols[i], &keys);
+      else
+        err2 = select_signers (sel, policy, protocols[i], &keys);
+      if (! err2)
+        {
+          protocol = protocols[i];
+          err = 0;
+          break;
+        }
+      if (! err)
+        err = err2;
+    }
+  if (! keys && ! err)
+    err = gpg_error (GPG_ERR_UNSUPPORTED_PROTOCOL);
+  policy_free (policy);
+
+  sel->cb (err, keys, protocol, sel->data);
+
+  g_slist_free_full (sel->recipients, g_free);
+  g_free (sel->sender);
+  g_free (sel);
+}
+
+
+void
+gpa_policy_select_recipients (GSList *recipients, gpgme_protocol_t protocol,
+                              GpaPolicyKeysFunc cb, gpointer data)
+{
+  select_t sel;
+  GSList *recp;
+
+  g_return_if_fail (recipients);
+
+  sel = g_malloc0 (sizeof (*sel));
+  for (recp = recipients; recp; recp = g_slist_next (recp))
+    sel->recipients = g_slist_append (sel->recipients, g_strdup (recp->data));
+  sel->protocol = protocol;
+  sel->cb = cb;
+  sel->data = data;
+  gpa_keytable_when_ready (gpa_keytable_get_public_instance (),
+                           keytable_ready_cb, sel);
+}
+
+
+void
+gpa_policy_select_signers (const char *sender, gpgme_protocol_t protocol,
+                           GpaPolicyKeysFunc cb, gpointer data)
+{
+  select_t sel = g_malloc0 (sizeof (*sel));
+
+  sel->sender = g_strdup (sender);
+  sel->protocol = protocol;
+  sel->cb = cb;
+  sel->data = data;
+  gpa_keytable_when_ready (gpa_keytable_get_secret_instance (),
+                           keytable_ready_cb, sel);
+}
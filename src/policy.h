@@ -0,0 +1,63 @@
+/* policy.h - Key selection without dialogs.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+/* In headless mode and for batches the keys for the UI server
+   commands are selected according to the policy file
+   "gpa-policy.conf" in the GnuPG home directory instead of asking the
+   user.  The file is read for each selection and may contain these
+   lines:
+
+     recipient MAILBOX FPR  Use the key FPR for MAILBOX.  Several
+                            lines for the same MAILBOX add keys.
+     signer FPR             Sign with the key FPR.
+     allow-untrusted        Also use keys for a mail address if the
+                            validity of its user ID is not at least
+                            marginal.
+
+   Empty lines and lines starting with '#' are ignored.  A recipient
+   without a "recipient" line needs to have exactly one usable key.
+   Without a "signer" line the key of the sender or the default key is
+   used.  */
+
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <glib.h>
+#include <gpgme.h>
+
+/* Called with the selected KEYS of PROTOCOL or with an error.  KEYS
+   is a NULL terminated array owned by the callee which shall be
+   released with gpa_gpgme_release_keyarray.  */
+typedef void (*GpaPolicyKeysFunc) (gpg_error_t err, gpgme_key_t *keys,
+                                   gpgme_protocol_t protocol, gpointer data);
+
+/* Select the keys for the mailboxes RECIPIENTS.  Unless PROTOCOL is
+   GPGME_PROTOCOL_UNKNOWN only keys of that protocol are selected.
+   CB may be called before this function returns.  */
+void gpa_policy_select_recipients (GSList *recipients,
+                                   gpgme_protocol_t protocol,
+                                   GpaPolicyKeysFunc cb, gpointer data);
+
+/* Select the signing keys for SENDER, which may be NULL.  Unless
+   PROTOCOL is GPGME_PROTOCOL_UNKNOWN only keys of that protocol are
+   selected.  CB may be called before this function returns.  */
+void gpa_policy_select_signers (const char *sender,
+                                gpgme_protocol_t protocol,
+                                GpaPolicyKeysFunc cb, gpointer data);
+
+#endif /* POLICY_H */
@@ -20,6 +20,7 @@
 # include <config.h>
 #endif
 
+#include <string.h>
 #include <gtk/gtk.h>
 
 #include "gpa.h"
@@ -28,6 +29,9 @@
 #include "gtktools.h"
 #include "selectkeydlg.h"
 #include "recipientdlg.h"
+#include "keytable.h"
+#include "keylist.h"
+#include "gpacontext.h"
 
 
 struct _RecipientDlg
@@ -56,6 +60,9 @@ struct _RecipientDlg
 
   /* The selected protocol.  This is also set by update_statushint.  */
   gpgme_protocol_t selected_protocol;
+
+  /* The running key listings for the recipients (struct lookup_s).  */
+  GSList *lookups;
 };
 
 
@@ -301,7 +308,9 @@ update_statushint (RecipientDlg *dialog)
     sel_protocol = req_protocol;
 
 
-  if (missing_keys)
+  if (dialog->lookups)
+    hint = _("Looking for the keys of the recipients ...");
+  else if (missing_keys)
     hint = _("You need to select a key for each recipient.\n"
              "To select a key right-click on the respective line.");
   else if ((sel_protocol == GPGME_PROTOCOL_OpenPGP
@@ -460,84 +469,317 @@ update_recplist_row (GtkListStore *store, GtkTreeIter *iter,
 }
 
 
-/* Parse one recipient, this is the working horse of parse_recipeints. */
+/* Store the usable encryption keys of PROTOCOL for MAILBOX from the
+   keytable in KEYINFO.  Returns the number of keys found or -1 if the
+   keytable can't be used because it is not yet filled or MAILBOX is
+   not a plain mail address; the engine needs to be asked then.  */
+static int
+find_cached_keys (struct keyinfo_s *keyinfo, const char *mailbox,
+                  gpgme_protocol_t protocol)
+{
+  gpgme_key_t *keys;
+  int idx;
+
+  if (!gpa_keytable_find_keys (gpa_keytable_get_public_instance (),
+                               mailbox, protocol, KEY_USAGE_ENCR, TRUE,
+                               &keys))
+    return -1;
+
+  for (idx=0; keys[idx]; idx++)
+    {
+      if (keyinfo->truncated)
+        gpgme_key_unref (keys[idx]);
+      else if (append_key_to_keyinfo (keyinfo, keys[idx])
+               >= TRUNCATE_KEYSEARCH_AT)
+        keyinfo->truncated = 1;
+    }
+  g_free (keys);
+  return idx;
+}
+
+
+/* An asynchronous key listing of one protocol for all recipients
+   which could not be resolved using the keytable.  */
+struct lookup_s
+{
+  /* The dialog or NULL if the result is not needed anymore.  */
+  RecipientDlg *dialog;
+
+  GpaContext *context;
+  gpgme_protocol_t protocol;
+
+  /* The patterns for the listing.  */
+  GPtrArray *patterns;
+
+  /* The set of the userdata of all rows of the listing.  */
+  GHashTable *infos;
+
+  /* Table mapping normalized mail addresses to a GSList with the
+     userdata of the rows.  */
+  GHashTable *mailboxes;
+
+  /* The userdata of rows whose mailbox is not a plain mail
+     address.  */
+  GSList *others;
+};
+
+
 static void
-parse_one_recipient (gpgme_ctx_t ctx, GtkListStore *store, GtkTreeIter *iter,
-                     struct userdata_s *info)
+free_slist (gpointer data)
 {
-  static int have_locate = -1;
-  gpgme_key_t key = NULL;
-  gpgme_keylist_mode_t mode;
+  g_slist_free (data);
+}
 
-  if (have_locate == -1)
-    have_locate = is_gpg_version_at_least ("2.0.10");
 
-  g_return_if_fail (info);
+/* Release LOOKUP.  Used as idle handler because the context can't be
+   released while it emits its done signal.  */
+static gboolean
+release_lookup (gpointer data)
+{
+  struct lookup_s *lookup = data;
+
+  if (lookup->context)
+    g_object_unref (lookup->context);
+  g_ptr_array_unref (lookup->patterns);
+  g_hash_table_destroy (lookup->infos);
+  g_hash_table_destroy (lookup->mailboxes);
+  g_slist_free (lookup->others);
+  g_free (lookup);
+  return FALSE;
+}
+
 
-  clear_keyinfo (&info->pgp);
-  gpgme_set_protocol (ctx, GPGME_PROTOCOL_OpenPGP);
-  mode = gpgme_get_keylist_mode (ctx);
-  if (have_locate)
-    gpgme_set_keylist_mode (ctx, (mode | (GPGME_KEYLIST_MODE_LOCAL
-                                          | GPGME_KEYLIST_MODE_EXTERN)));
-  if (!gpgme_op_keylist_start (ctx, info->mailbox, 0))
+/* Add the recipient INFO to the lookup at R_LOOKUP.  The lookup is
+   created if needed.  */
+static void
+add_to_lookup (struct lookup_s **r_lookup, gpgme_protocol_t protocol,
+               struct userdata_s *info)
+{
+  struct lookup_s *lookup = *r_lookup;
+  GSList *rows;
+  gchar *mbox;
+
+  if (!lookup)
     {
-      while (!gpgme_op_keylist_next (ctx, &key))
-        {
-          if (key->revoked || key->disabled || key->expired
-              || !key->can_encrypt)
-            gpgme_key_unref (key);
-          else if (append_key_to_keyinfo (&info->pgp, key)
-                   >= TRUNCATE_KEYSEARCH_AT)
-            {
-              /* Note that the truncation flag is not 100% correct.  In
-                 case the next iteration would not yield a new key we
-                 have not actually truncated the search.  */
-              info->pgp.truncated = 1;
-              break;
-            }
-        }
+      lookup = g_malloc0 (sizeof *lookup);
+      lookup->protocol = protocol;
+      lookup->patterns = g_ptr_array_new_with_free_func (g_free);
+      lookup->infos = g_hash_table_new (NULL, NULL);
+      lookup->mailboxes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, free_slist);
+      *r_lookup = lookup;
     }
-  gpgme_op_keylist_end (ctx);
-  gpgme_set_keylist_mode (ctx, mode);
 
-  clear_keyinfo (&info->x509);
-  gpgme_set_protocol (ctx, GPGME_PROTOCOL_CMS);
-  if (!gpgme_op_keylist_start (ctx, info->mailbox, 0))
+  g_hash_table_add (lookup->infos, info);
+  mbox = gpa_keytable_normalize_mailbox (info->mailbox);
+  if (!mbox)
     {
-      while (!gpgme_op_keylist_next (ctx, &key))
+      lookup->others = g_slist_prepend (lookup->others, info);
+      g_ptr_array_add (lookup->patterns, g_strdup (info->mailbox));
+      return;
+    }
+  rows = g_hash_table_lookup (lookup->mailboxes, mbox);
+  if (rows)
+    {
+      /* The address is already listed; keep the head of the list.  */
+      g_slist_insert (rows, info, 1);
+      g_free (mbox);
+      return;
+    }
+  g_ptr_array_add (lookup->patterns, g_strdup (info->mailbox));
+  g_hash_table_insert (lookup->mailboxes, mbox, g_slist_prepend (NULL, info));
+}
+
+
+/* Return true if one of the user IDs of KEY contains the string
+   PATTERN.  */
+static int
+key_matches_pattern (gpgme_key_t key, const char *pattern)
+{
+  gpgme_user_id_t uid;
+  gchar *lpattern, *luid;
+  int found = 0;
+
+  lpattern = g_utf8_strdown (pattern, -1);
+  for (uid = key->uids; uid && !found; uid = uid->next)
+    if (uid->uid)
+      {
+        luid = g_utf8_strdown (uid->uid, -1);
+        found = !!strstr (luid, lpattern);
+        g_free (luid);
+      }
+  g_free (lpattern);
+  return found;
+}
+
+
+/* Signal handler for the "next_key" signal of a lookup.  The key is
+   assigned to all recipients it has been listed for.  */
+static void
+lookup_next_key_cb (GpaContext *context, gpgme_key_t key,
+                    struct lookup_s *lookup)
+{
+  GSList *matches = NULL;
+  GSList *item;
+  gpgme_user_id_t uid;
+  struct userdata_s *info;
+  struct keyinfo_s *keyinfo;
+  gchar *mbox;
+
+  if (!lookup->dialog
+      || key->revoked || key->disabled || key->expired || !key->can_encrypt)
+    {
+      gpgme_key_unref (key);
+      return;
+    }
+
+  for (uid = key->uids; uid; uid = uid->next)
+    {
+      mbox = gpa_keytable_normalize_mailbox (uid->email);
+      if (!mbox)
+        continue;
+      for (item = g_hash_table_lookup (lookup->mailboxes, mbox);
+           item; item = item->next)
+        if (!g_slist_find (matches, item->data))
+          matches = g_slist_prepend (matches, item->data);
+      g_free (mbox);
+    }
+  for (item = lookup->others; item; item = item->next)
+    {
+      info = item->data;
+      if (key_matches_pattern (key, info->mailbox))
+        matches = g_slist_prepend (matches, info);
+    }
+
+  for (item = matches; item; item = item->next)
+    {
+      info = item->data;
+      if (lookup->protocol == GPGME_PROTOCOL_OpenPGP)
+        keyinfo = &info->pgp;
+      else
+        keyinfo = &info->x509;
+      if (keyinfo->truncated)
+        continue;
+      gpgme_key_ref (key);
+      if (append_key_to_keyinfo (keyinfo, key) >= TRUNCATE_KEYSEARCH_AT)
         {
-          if (key->revoked || key->disabled || key->expired
-              || !key->can_encrypt)
-            gpgme_key_unref (key);
-          else if (append_key_to_keyinfo (&info->x509,key)
-                   >= TRUNCATE_KEYSEARCH_AT)
-            {
-              info->x509.truncated = 1;
-              break;
-            }
+          /* Note that the truncation flag is not 100% correct.  In
+             case the listing would not yield another key we have not
+             actually truncated the search.  */
+          keyinfo->truncated = 1;
         }
     }
-  gpgme_op_keylist_end (ctx);
-
-  update_recplist_row (store, iter, info);
+  g_slist_free (matches);
+  gpgme_key_unref (key);
 }
 
 
-/* Parse the list of recipients, find possible keys and update the
-   store.  */
+/* Signal handler for the "done" signal of a lookup.  */
 static void
-parse_recipients (GtkListStore *store)
+lookup_done_cb (GpaContext *context, gpg_error_t err,
+                struct lookup_s *lookup)
 {
+  RecipientDlg *dialog = lookup->dialog;
   GtkTreeModel *model;
   GtkTreeIter iter;
+  struct userdata_s *info;
+
+  if (err && gpg_err_code (err) != GPG_ERR_EOF)
+    g_debug ("listing keys for the recipients failed: %s",
+             gpg_strerror (err));
+
+  if (dialog)
+    {
+      dialog->lookups = g_slist_remove (dialog->lookups, lookup);
+      model = gtk_tree_view_get_model (GTK_TREE_VIEW (dialog->clist_keys));
+      if (gtk_tree_model_get_iter_first (model, &iter))
+        do
+          {
+            gtk_tree_model_get (model, &iter,
+                                RECPLIST_USERDATA, &info,
+                                -1);
+            if (info && g_hash_table_contains (lookup->infos, info))
+              update_recplist_row (GTK_LIST_STORE (model), &iter, info);
+          }
+        while (gtk_tree_model_iter_next (model, &iter));
+      update_statushint (dialog);
+    }
+
+  g_idle_add (release_lookup, lookup);
+}
+
+
+/* Start the listing of LOOKUP for DIALOG.  If LOCATE is set the keys
+   are also located.  */
+static void
+start_lookup (RecipientDlg *dialog, struct lookup_s *lookup, int locate)
+{
   gpg_error_t err;
-  gpgme_ctx_t ctx;
 
-  err = gpgme_new (&ctx);
+  if (!lookup)
+    return;
+
+  lookup->context = gpa_context_new ();
+  gpgme_set_protocol (lookup->context->ctx, lookup->protocol);
+  if (locate)
+    gpgme_set_keylist_mode (lookup->context->ctx,
+                            (gpgme_get_keylist_mode (lookup->context->ctx)
+                             | GPGME_KEYLIST_MODE_LOCAL
+                             | GPGME_KEYLIST_MODE_EXTERN));
+  g_signal_connect (G_OBJECT (lookup->context), "next_key",
+                    G_CALLBACK (lookup_next_key_cb), lookup);
+  g_signal_connect (G_OBJECT (lookup->context), "done",
+                    G_CALLBACK (lookup_done_cb), lookup);
+
+  g_ptr_array_add (lookup->patterns, NULL);
+  err = gpgme_op_keylist_ext_start (lookup->context->ctx,
+                                    (const char **)lookup->patterns->pdata,
+                                    0, 0);
   if (err)
-    gpa_gpgme_error (err);
+    {
+      g_debug ("listing keys for the recipients failed: %s",
+               gpg_strerror (err));
+      release_lookup (lookup);
+      return;
+    }
 
+  lookup->dialog = dialog;
+  dialog->lookups = g_slist_prepend (dialog->lookups, lookup);
+}
+
+
+/* Detach all running lookups from DIALOG; their results are
+   dropped.  */
+static void
+cancel_lookups (RecipientDlg *dialog)
+{
+  GSList *item;
+
+  for (item = dialog->lookups; item; item = item->next)
+    ((struct lookup_s *)item->data)->dialog = NULL;
+  g_slist_free (dialog->lookups);
+  dialog->lookups = NULL;
+}
+
+
+/* Parse the list of recipients, find possible keys and update the
+   store.  The keys are taken from the keytable if possible.  For all
+   remaining recipients a single listing per protocol is started
+   which updates the rows when done.  */
+static void
+parse_recipients (RecipientDlg *dialog, GtkListStore *store)
+{
+  static int have_locate = -1;
+  struct lookup_s *pgp_lookup = NULL;
+  struct lookup_s *x509_lookup = NULL;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  int nkeys;
+
+  if (have_locate == -1)
+    have_locate = is_gpg_version_at_least ("2.0.10");
+
+  cancel_lookups (dialog);
 
   model = GTK_TREE_MODEL (store);
   /* Walk through the list, reading each row. */
@@ -550,14 +792,28 @@ parse_recipients (GtkListStore *store)
         gtk_tree_model_get (model, &iter,
                             RECPLIST_USERDATA, &info,
                             -1);
-
-        /* Do something with the data */
-        /*g_print ("parsing mailbox `%s'\n", info? info->mailbox:"(null)");*/
-        parse_one_recipient (ctx, store, &iter,info);
+        if (!info)
+          continue;
+
+        /* Only recipients without a local OpenPGP key require a
+           listing to locate the key.  */
+        clear_keyinfo (&info->pgp);
+        nkeys = find_cached_keys (&info->pgp, info->mailbox,
+                                  GPGME_PROTOCOL_OpenPGP);
+        if (nkeys < 0 || (!nkeys && have_locate))
+          add_to_lookup (&pgp_lookup, GPGME_PROTOCOL_OpenPGP, info);
+
+        clear_keyinfo (&info->x509);
+        if (find_cached_keys (&info->x509, info->mailbox,
+                              GPGME_PROTOCOL_CMS) < 0)
+          add_to_lookup (&x509_lookup, GPGME_PROTOCOL_CMS, info);
+
+        update_recplist_row (store, &iter, info);
       }
     while (gtk_tree_model_iter_next (model, &iter));
 
-  gpgme_release (ctx);
+  start_lookup (dialog, pgp_lookup, have_locate);
+  start_lookup (dialog, x509_lookup, 0);
 }
 
 
@@ -920,6 +1176,7 @@ static void
 recipient_dlg_finalize (GObject *object)
 {
   /* Fixme:  Release the store.  */
+  cancel_lookups (RECIPIENT_DLG (object));
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -1158,7 +1415,7 @@ recipient_dlg_set_recipients (RecipientDlg *dialog, GSList *recipients,
         }
     }
 
-  parse_recipients (store);
+  parse_recipients (dialog, store);
   dialog->freeze_update_statushint--;
   update_statushint (dialog);
 }
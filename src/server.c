@@ -25,9 +25,14 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifndef HAVE_W32_SYSTEM
 # include <sys/socket.h>
 # include <sys/un.h>
+# include <sys/uio.h>
+# include <poll.h>
 #endif /*HAVE_W32_SYSTEM*/
 
 #include <gpgme.h>
@@ -46,10 +51,58 @@
 #include "gpafiledecryptop.h"
 #include "gpafileverifyop.h"
 #include "gpafileimportop.h"
+#include "gtktools.h"
+#include "keytable.h"
+#include "keysnapshot.h"
+#include "checksum.h"
+#include "policy.h"
 
 
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
 
+/* The size of the buffers used for the INPUT, OUTPUT and MESSAGE
+   streams.  */
+#define STREAM_BUFFER_SIZE (256 * 1024)
+
+/* The interval in microseconds between PROGRESS status lines for the
+   data read from a stream.  */
+#define PROGRESS_INTERVAL 1000000
+
+/* The time in milliseconds to wait for a client which does not read
+   its OUTPUT.  The wait blocks the main loop, thus a client which
+   does not catch up within this time lets the command fail.  */
+#define STREAM_WRITE_TIMEOUT 5000
+
+
+/* A buffered stream for one of the file descriptors passed by the
+   client.  */
+struct server_stream_s
+{
+  int fd;
+
+  /* The buffer with LEN bytes of data at offset START.  For an input
+     stream this is data read ahead, for an output stream data not yet
+     written.  */
+  char *buffer;
+  size_t start;
+  size_t len;
+
+  /* Set if EOF has been read.  */
+  int eof;
+
+  /* For an input stream reporting its progress the context to write
+     the PROGRESS status lines to, the name of the stream, the size of
+     the file or 0 if it is not known, the number of bytes read and
+     the monotonic times the stream has been prepared and the last
+     status line has been written.  */
+  assuan_context_t ctx;
+  const char *what;
+  guint64 total;
+  guint64 nread;
+  gint64 start_time;
+  gint64 last_report;
+};
+
 /* The object used to keep track of the a connection's state.  */
 struct conn_ctrl_s;
 typedef struct conn_ctrl_s *conn_ctrl_t;
@@ -69,6 +122,17 @@ struct conn_ctrl_s
      comes from our command handler.  */
   int is_unfinished;
 
+  /* True while a command returned as unfinished and has not yet been
+     finished by run_server_continuation.  */
+  int pending;
+
+  /* The channel of the connection and the source ids of its input
+     watch and of the idle handler for an already buffered line.  The
+     watch is removed while a command is being processed.  */
+  GIOChannel *channel;
+  guint watch_id;
+  guint idle_id;
+
   /* An GPAOperation object.  */
   GpaOperation *gpa_op;
 
@@ -82,10 +146,10 @@ struct conn_ctrl_s
   /* Flag indicating the the output shall be binary.  */
   int output_binary;
 
-  /* Channels used with the gpgme callbacks.  */
-  GIOChannel *input_channel;
-  GIOChannel *output_channel;
-  GIOChannel *message_channel;
+  /* Streams used with the gpgme callbacks.  */
+  struct server_stream_s *input_stream;
+  struct server_stream_s *output_stream;
+  struct server_stream_s *message_stream;
 
   /* List of collected recipients.  */
   GSList *recipients;
@@ -114,6 +178,28 @@ struct conn_ctrl_s
 /* The number of active connections.  */
 static int connection_counter;
 
+/* Counters reported by "GETINFO metrics".  */
+static struct
+{
+  /* Mapping the names of the commands to the number of times they
+     have been run.  */
+  GHashTable *commands;
+  /* The number of commands which have returned as unfinished and
+     are still running.  */
+  unsigned int in_flight;
+  /* The number of bytes read from INPUT and MESSAGE and written to
+     OUTPUT.  */
+  guint64 bytes_in;
+  guint64 bytes_out;
+  /* The number of times the input of a connection has been suspended
+     because it sent a command while the previous one was still
+     running.  */
+  unsigned long input_waits;
+  /* Lookups in the recipient key cache.  */
+  unsigned long recipient_cache_hits;
+  unsigned long recipient_cache_misses;
+} metrics;
+
 /* A flag requesting a shutdown.  */
 static gboolean shutdown_pending;
 
@@ -127,6 +213,11 @@ static assuan_sock_nonce_t socket_nonce;
 
 /* Forward declarations.  */
 static void run_server_continuation (assuan_context_t ctx, gpg_error_t err);
+static gboolean receive_cb (GIOChannel *channel, GIOCondition condition,
+                            void *data);
+static void resume_input (assuan_context_t ctx);
+static gpg_error_t impl_batch (assuan_context_t ctx, char *line, int sign,
+                               gpgme_protocol_t protocol);
 
 
 
@@ -136,6 +227,9 @@ static int
 not_finished (conn_ctrl_t ctrl)
 {
   ctrl->is_unfinished = 1;
+  if (!ctrl->pending)
+    metrics.in_flight++;
+  ctrl->pending = 1;
   return gpg_error (GPG_ERR_UNFINISHED);
 }
 
@@ -194,108 +288,279 @@ free_func (void *p, void *dummy)
 }
 
 
-static ssize_t
-my_gpgme_read_cb (void *opaque, void *buffer, size_t size)
-{
-  conn_ctrl_t ctrl = opaque;
-  GIOStatus  status;
-  size_t nread;
-  int retval;
-
-/*   g_debug ("my_gpgme_read_cb: requesting %d bytes\n", (int)size); */
-  status = g_io_channel_read_chars (ctrl->input_channel, buffer, size,
-                                    &nread, NULL);
-  if (status == G_IO_STATUS_AGAIN
-      || (status == G_IO_STATUS_NORMAL && !nread))
-    {
-      errno = EAGAIN;
-      retval = -1;
-    }
-  else if (status == G_IO_STATUS_NORMAL)
-    retval = (int)nread;
-  else if (status == G_IO_STATUS_EOF)
-    retval = 0;
-  else
-    {
-      errno = EIO;
-      retval = -1;
-    }
-/*   g_debug ("my_gpgme_read_cb: got status=%x, %d bytes, retval=%d\n",  */
-/*            status, (int)size, retval); */
+/* Create a buffered stream for the file descriptor FD.  */
+static struct server_stream_s *
+stream_new (int fd)
+{
+  struct server_stream_s *stream;
 
-  return retval;
+  stream = g_malloc0 (sizeof *stream);
+  stream->fd = fd;
+  stream->buffer = g_malloc (STREAM_BUFFER_SIZE);
+  return stream;
 }
 
 
-static ssize_t
-my_gpgme_write_cb (void *opaque, const void *buffer, size_t size)
+/* Let STREAM write PROGRESS status lines named WHAT to CTX while it is
+   read by a long running operation.  */
+static void
+stream_enable_progress (struct server_stream_s *stream,
+                        assuan_context_t ctx, const char *what)
+{
+  struct stat st;
+
+  stream->ctx = ctx;
+  stream->what = what;
+  if (!fstat (stream->fd, &st) && S_ISREG (st.st_mode))
+    stream->total = st.st_size;
+  stream->start_time = g_get_monotonic_time ();
+}
+
+
+/* Count the N bytes read from STREAM and write a PROGRESS status line
+   in the format used by GnuPG if it is due.  The first line is
+   written after the operation has been running for PROGRESS_INTERVAL
+   and the last one at EOF.  Sizes are given in KiB.  */
+static void
+stream_progress (struct server_stream_s *stream, size_t n)
 {
-  conn_ctrl_t ctrl = opaque;
-  GIOStatus  status;
-  size_t nwritten;
-  int retval;
+  char line[100];
+  gint64 now;
+
+  metrics.bytes_in += n;
+  if (!stream->ctx)
+    return;
+  stream->nread += n;
+
+  now = g_get_monotonic_time ();
+  if (n && now - (stream->last_report ? stream->last_report
+                  /* */             : stream->start_time) < PROGRESS_INTERVAL)
+    return;
+  if (!n && !stream->last_report)
+    return;
+  stream->last_report = now;
+
+  snprintf (line, sizeof line,
+            "%s ? %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " KiB",
+            stream->what, stream->nread / 1024,
+            n ? stream->total / 1024 : stream->nread / 1024);
+  assuan_write_status (stream->ctx, "PROGRESS", line);
+}
+
 
-  status = g_io_channel_write_chars (ctrl->output_channel, buffer, size,
-                                     &nwritten, NULL);
-  if (status == G_IO_STATUS_AGAIN)
+/* Wait until the non-blocking descriptor of STREAM accepts data
+   again, at most STREAM_WRITE_TIMEOUT milliseconds.  Returns 0 if it
+   is ready or -1 with ERRNO set.  */
+static int
+stream_wait_writable (struct server_stream_s *stream)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)stream;
+  errno = EAGAIN;
+  return -1;
+#else
+  struct pollfd pfd;
+  int rc;
+
+  pfd.fd = stream->fd;
+  pfd.events = POLLOUT;
+  do
+    rc = poll (&pfd, 1, STREAM_WRITE_TIMEOUT);
+  while (rc == -1 && errno == EINTR);
+  if (rc == -1)
+    return -1;
+  if (!rc)
     {
-      errno = EAGAIN;
-      retval = -1;
+      g_debug ("timeout writing to stream %d", stream->fd);
+      errno = ETIMEDOUT;
+      return -1;
     }
-  else if (status == G_IO_STATUS_NORMAL)
-    retval = (int)nwritten;
-  else
+  return 0;
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
+/* Write LENGTH bytes from BUFFER to STREAM bypassing its buffer.
+   Waits a limited time if the descriptor is not ready.  Returns 0 on
+   success.  */
+static int
+stream_write_all (struct server_stream_s *stream,
+                  const char *buffer, size_t length)
+{
+  ssize_t n;
+
+  while (length)
     {
-      errno = EIO;
-      retval = 1;
+      n = write (stream->fd, buffer, length);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1 && errno == EAGAIN)
+        {
+          if (stream_wait_writable (stream))
+            return -1;
+          continue;
+        }
+      if (n == -1)
+        return -1;
+      buffer += n;
+      length -= n;
     }
+  return 0;
+}
+
+
+/* Write out the buffered data of the output stream STREAM.  Returns
+   0 on success or -1 with ERRNO set.  The buffered data is discarded
+   in any case.  */
+static int
+stream_flush (struct server_stream_s *stream)
+{
+  int rc;
 
-  return retval;
+  if (!stream->len)
+    return 0;
+  rc = stream_write_all (stream, stream->buffer + stream->start, stream->len);
+  if (rc)
+    g_debug ("error flushing stream %d: %s", stream->fd, strerror (errno));
+  stream->start = stream->len = 0;
+  return rc;
 }
 
 
-static struct gpgme_data_cbs my_gpgme_data_cbs =
-  {
-    my_gpgme_read_cb,
-    my_gpgme_write_cb,
-    NULL,
-    NULL
-  };
+/* Release STREAM.  Output streams need to be flushed before.  The
+   file descriptor is not closed.  */
+static void
+stream_release (struct server_stream_s *stream)
+{
+  if (!stream)
+    return;
+  g_free (stream->buffer);
+  g_free (stream);
+}
 
 
+/* The gpgme read callback for a stream.  Data is read ahead into the
+   buffer of the stream; large requests are read directly into
+   BUFFER.  */
 static ssize_t
-my_gpgme_message_read_cb (void *opaque, void *buffer, size_t size)
+stream_read_cb (void *opaque, void *buffer, size_t size)
 {
-  conn_ctrl_t ctrl = opaque;
-  GIOStatus  status;
-  size_t nread;
-  int retval;
+  struct server_stream_s *stream = opaque;
+  ssize_t n;
 
-  status = g_io_channel_read_chars (ctrl->message_channel, buffer, size,
-                                    &nread, NULL);
-  if (status == G_IO_STATUS_AGAIN
-      || (status == G_IO_STATUS_NORMAL && !nread))
+  if (!stream->len)
     {
-      errno = EAGAIN;
-      retval = -1;
+      if (stream->eof)
+        return 0;
+
+      do
+        {
+          if (size >= STREAM_BUFFER_SIZE)
+            n = read (stream->fd, buffer, size);
+          else
+            n = read (stream->fd, stream->buffer, STREAM_BUFFER_SIZE);
+        }
+      while (n == -1 && errno == EINTR);
+      if (n == -1)
+        return -1;  /* ERRNO is EAGAIN or the real error.  */
+      if (!n)
+        {
+          stream->eof = 1;
+          stream_progress (stream, 0);
+          return 0;
+        }
+      if (size >= STREAM_BUFFER_SIZE)
+        {
+          stream_progress (stream, n);
+          return n;
+        }
+      stream->start = 0;
+      stream->len = n;
     }
-  else if (status == G_IO_STATUS_NORMAL)
-    retval = (int)nread;
-  else if (status == G_IO_STATUS_EOF)
-    retval = 0;
-  else
+
+  if (size > stream->len)
+    size = stream->len;
+  memcpy (buffer, stream->buffer + stream->start, size);
+  stream->start += size;
+  stream->len -= size;
+  stream_progress (stream, size);
+  return size;
+}
+
+
+/* The gpgme write callback for a stream.  Small writes are collected
+   in the buffer and written out together with the next write which
+   does not fit into the buffer.  */
+static ssize_t
+stream_write_cb (void *opaque, const void *buffer, size_t size)
+{
+  struct server_stream_s *stream = opaque;
+  ssize_t n;
+
+  if (stream->start + stream->len + size > STREAM_BUFFER_SIZE
+      && stream->len + size <= STREAM_BUFFER_SIZE)
     {
-      errno = EIO;
-      retval = -1;
+      memmove (stream->buffer, stream->buffer + stream->start, stream->len);
+      stream->start = 0;
+    }
+  if (stream->start + stream->len + size <= STREAM_BUFFER_SIZE)
+    {
+      memcpy (stream->buffer + stream->start + stream->len, buffer, size);
+      stream->len += size;
+      metrics.bytes_out += size;
+      return size;
     }
 
-  return retval;
+  /* Write the buffered data and BUFFER with one system call.  */
+  for (;;)
+    {
+#ifdef HAVE_W32_SYSTEM
+      if (stream->len)
+        n = write (stream->fd, stream->buffer + stream->start, stream->len);
+      else
+        n = write (stream->fd, buffer, size);
+#else
+      struct iovec iov[2];
+
+      iov[0].iov_base = stream->buffer + stream->start;
+      iov[0].iov_len = stream->len;
+      iov[1].iov_base = (void *)buffer;
+      iov[1].iov_len = size;
+      n = writev (stream->fd, stream->len? iov : iov + 1,
+                  stream->len? 2 : 1);
+#endif
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1)
+        return -1;  /* ERRNO is EAGAIN or the real error.  */
+      if ((size_t)n < stream->len)
+        {
+          stream->start += n;
+          stream->len -= n;
+          continue;
+        }
+      n -= stream->len;
+      stream->start = stream->len = 0;
+      if (n)
+        {
+          metrics.bytes_out += n;
+          return n;
+        }
+      if (size <= STREAM_BUFFER_SIZE)
+        {
+          memcpy (stream->buffer, buffer, size);
+          stream->len = size;
+          metrics.bytes_out += size;
+          return size;
+        }
+    }
 }
 
-static struct gpgme_data_cbs my_gpgme_message_cbs =
+
+static struct gpgme_data_cbs my_gpgme_data_cbs =
   {
-    my_gpgme_message_read_cb,
-    NULL,
+    stream_read_cb,
+    stream_write_cb,
     NULL,
     NULL
   };
@@ -376,6 +641,172 @@ reset_prepared_keys (conn_ctrl_t ctrl)
 }
 
 
+/* The cache of the keys selected for a set of recipients.  It maps
+   the string built by recipient_cache_key to a struct
+   recipient_cache_s.  This allows clients encrypting many messages
+   to the same recipients to skip the key selection.  An entry is
+   only used as long as the keyrings have not been modified.  */
+static GHashTable *recipient_cache;
+
+/* The cache is cleared when it would exceed this number of entries.  */
+#define MAX_RECIPIENT_CACHE 64
+
+struct recipient_cache_s
+{
+  gpgme_key_t *keys;
+  unsigned int generation;
+  guint64 stamp;
+};
+
+
+static void
+recipient_cache_free (gpointer data)
+{
+  struct recipient_cache_s *entry = data;
+
+  gpa_gpgme_release_keyarray (entry->keys);
+  g_free (entry);
+}
+
+
+static int
+compare_strings (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+
+/* Return the cache key for RECIPIENTS and PROTOCOL.  The recipients
+   are normalized to their mail addresses and sorted so that the
+   order of the RECIPIENT commands does not matter.  Returns NULL if
+   there are no recipients.  */
+static char *
+recipient_cache_key (GSList *recipients, gpgme_protocol_t protocol)
+{
+  GPtrArray *names;
+  GString *key;
+  GSList *recp;
+  int i;
+
+  if (! recipients)
+    return NULL;
+
+  names = g_ptr_array_new_with_free_func (g_free);
+  for (recp = recipients; recp; recp = g_slist_next (recp))
+    {
+      char *name = gpa_keytable_normalize_mailbox (recp->data);
+      if (! name)
+        name = g_strstrip (g_utf8_strdown (recp->data, -1));
+      g_ptr_array_add (names, name);
+    }
+  g_ptr_array_sort (names, compare_strings);
+
+  key = g_string_new (NULL);
+  g_string_printf (key, "%d", (int) protocol);
+  for (i = 0; i < names->len; i++)
+    if (! i || strcmp (g_ptr_array_index (names, i),
+                       g_ptr_array_index (names, i - 1)))
+      {
+        g_string_append_c (key, '\n');
+        g_string_append (key, g_ptr_array_index (names, i));
+      }
+  g_ptr_array_free (names, TRUE);
+
+  return g_string_free (key, FALSE);
+}
+
+
+/* Return a copy of the cached keys for RECIPIENTS and PROTOCOL or
+   NULL if there are none.  */
+static gpgme_key_t *
+recipient_cache_lookup (GSList *recipients, gpgme_protocol_t protocol)
+{
+  struct recipient_cache_s *entry;
+  char *key;
+
+  if (! recipient_cache)
+    return NULL;
+  key = recipient_cache_key (recipients, protocol);
+  if (! key)
+    return NULL;
+
+  entry = g_hash_table_lookup (recipient_cache, key);
+  if (entry
+      && (entry->generation != gpa_keytable_get_generation
+          (gpa_keytable_get_public_instance ())
+          || entry->stamp != gpa_keysnapshot_keyring_stamp ()))
+    {
+      /* The keyrings have been modified.  */
+      g_hash_table_remove_all (recipient_cache);
+      entry = NULL;
+    }
+  g_free (key);
+
+  if (! entry)
+    {
+      metrics.recipient_cache_misses++;
+      return NULL;
+    }
+  metrics.recipient_cache_hits++;
+  return gpa_gpgme_copy_keyarray (entry->keys);
+}
+
+
+/* Return a copy of the cached keys for RECIPIENTS and PROTOCOL.  If
+   PROTOCOL is GPGME_PROTOCOL_UNKNOWN keys of any protocol are
+   returned and their protocol is stored at R_PROTOCOL.  */
+static gpgme_key_t *
+recipient_cache_get (GSList *recipients, gpgme_protocol_t protocol,
+                     gpgme_protocol_t *r_protocol)
+{
+  gpgme_key_t *keys = NULL;
+
+  if (protocol == GPGME_PROTOCOL_UNKNOWN)
+    {
+      protocol = GPGME_PROTOCOL_OpenPGP;
+      keys = recipient_cache_lookup (recipients, protocol);
+      if (! keys)
+        protocol = GPGME_PROTOCOL_CMS;
+    }
+  if (! keys)
+    keys = recipient_cache_lookup (recipients, protocol);
+  if (keys && r_protocol)
+    *r_protocol = protocol;
+  return keys;
+}
+
+
+/* Store KEYS of PROTOCOL as the keys for RECIPIENTS.  In headless
+   mode nothing is stored so that changes of the policy file take
+   effect immediately.  */
+static void
+recipient_cache_put (GSList *recipients, gpgme_protocol_t protocol,
+                     gpgme_key_t *keys)
+{
+  struct recipient_cache_s *entry;
+  char *key;
+
+  if (! keys || protocol == GPGME_PROTOCOL_UNKNOWN || headless)
+    return;
+  key = recipient_cache_key (recipients, protocol);
+  if (! key)
+    return;
+
+  if (! recipient_cache)
+    recipient_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, recipient_cache_free);
+  else if (g_hash_table_size (recipient_cache) >= MAX_RECIPIENT_CACHE)
+    g_hash_table_remove_all (recipient_cache);
+
+  entry = g_malloc0 (sizeof (*entry));
+  entry->keys = gpa_gpgme_copy_keyarray (keys);
+  entry->generation = gpa_keytable_get_generation
+    (gpa_keytable_get_public_instance ());
+  entry->stamp = gpa_keysnapshot_keyring_stamp ();
+  g_hash_table_replace (recipient_cache, key, entry);
+}
+
+
 /* Helper to parse an protocol option.  */
 static gpg_error_t
 parse_protocol_option (assuan_context_t ctx, char *line, int mandatory,
@@ -406,12 +837,15 @@ close_message_fd (conn_ctrl_t ctrl)
 }
 
 
-static void
+/* Release the data objects and streams of the current command.
+   Returns an error if the remaining output could not be written.  */
+static gpg_error_t
 finish_io_streams (assuan_context_t ctx,
                    gpgme_data_t *r_input_data, gpgme_data_t *r_output_data,
                    gpgme_data_t *r_message_data)
 {
   conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err = 0;
 
   if (r_input_data)
     gpgme_data_release (*r_input_data);
@@ -419,20 +853,29 @@ finish_io_streams (assuan_context_t ctx,
     gpgme_data_release (*r_output_data);
   if (r_message_data)
     gpgme_data_release (*r_message_data);
-  if (ctrl->input_channel)
+  if (ctrl->input_stream)
     {
-      g_io_channel_shutdown (ctrl->input_channel, 0, NULL);
-      ctrl->input_channel = NULL;
+      stream_release (ctrl->input_stream);
+      ctrl->input_stream = NULL;
+#ifdef HAVE_W32_SYSTEM
+      /* This is the descriptor translated from the system handle.  */
+      close (ctrl->input_fd);
+#endif
     }
-  if (ctrl->output_channel)
+  if (ctrl->output_stream)
     {
-      g_io_channel_shutdown (ctrl->output_channel, 0, NULL);
-      ctrl->output_channel = NULL;
+      if (stream_flush (ctrl->output_stream))
+        err = gpg_error_from_syserror ();
+      stream_release (ctrl->output_stream);
+      ctrl->output_stream = NULL;
+#ifdef HAVE_W32_SYSTEM
+      close (ctrl->output_fd);
+#endif
     }
-  if (ctrl->message_channel)
+  if (ctrl->message_stream)
     {
-      g_io_channel_shutdown (ctrl->message_channel, 0, NULL);
-      ctrl->message_channel = NULL;
+      stream_release (ctrl->message_stream);
+      ctrl->message_stream = NULL;
     }
 
   close_message_fd (ctrl);
@@ -440,6 +883,7 @@ finish_io_streams (assuan_context_t ctx,
   assuan_close_output_fd (ctx);
   ctrl->input_fd = -1;
   ctrl->output_fd = -1;
+  return err;
 }
 
 
@@ -476,74 +920,34 @@ prepare_io_streams (assuan_context_t ctx,
     *r_message_data = NULL;
 
   if (ctrl->input_fd != -1 && r_input_data)
-    {
-#ifdef HAVE_W32_SYSTEM
-      ctrl->input_channel = g_io_channel_win32_new_fd (ctrl->input_fd);
-#else
-      ctrl->input_channel = g_io_channel_unix_new (ctrl->input_fd);
-#endif
-      if (!ctrl->input_channel)
-        {
-          /* g_debug ("error creating input channel"); */
-          err = gpg_error (GPG_ERR_EIO);
-          goto leave;
-        }
-      g_io_channel_set_encoding (ctrl->input_channel, NULL, NULL);
-      g_io_channel_set_buffered (ctrl->input_channel, FALSE);
-    }
-
+    ctrl->input_stream = stream_new (ctrl->input_fd);
   if (ctrl->output_fd != -1 && r_output_data)
-    {
-#ifdef HAVE_W32_SYSTEM
-      ctrl->output_channel = g_io_channel_win32_new_fd (ctrl->output_fd);
-#else
-      ctrl->output_channel = g_io_channel_unix_new (ctrl->output_fd);
-#endif
-      if (!ctrl->output_channel)
-        {
-          g_debug ("error creating output channel");
-          err = gpg_error (GPG_ERR_EIO);
-          goto leave;
-        }
-      g_io_channel_set_encoding (ctrl->output_channel, NULL, NULL);
-      g_io_channel_set_buffered (ctrl->output_channel, FALSE);
-    }
-
+    ctrl->output_stream = stream_new (ctrl->output_fd);
   if (ctrl->message_fd != -1 && r_message_data)
-    {
-#ifdef HAVE_W32_SYSTEM
-      ctrl->message_channel = g_io_channel_win32_new_fd (ctrl->message_fd);
-#else
-      ctrl->message_channel = g_io_channel_unix_new (ctrl->message_fd);
-#endif
-      if (!ctrl->message_channel)
-        {
-          g_debug ("error creating message channel");
-          err = gpg_error (GPG_ERR_EIO);
-          goto leave;
-        }
-      g_io_channel_set_encoding (ctrl->message_channel, NULL, NULL);
-      g_io_channel_set_buffered (ctrl->message_channel, FALSE);
-    }
+    ctrl->message_stream = stream_new (ctrl->message_fd);
 
-  if (ctrl->input_channel)
+  if (ctrl->input_stream)
     {
-      err = gpgme_data_new_from_cbs (r_input_data, &my_gpgme_data_cbs, ctrl);
+      stream_enable_progress (ctrl->input_stream, ctx, "input");
+      err = gpgme_data_new_from_cbs (r_input_data, &my_gpgme_data_cbs,
+                                     ctrl->input_stream);
       if (err)
         goto leave;
     }
-  if (ctrl->output_channel)
+  if (ctrl->output_stream)
     {
-      err = gpgme_data_new_from_cbs (r_output_data, &my_gpgme_data_cbs, ctrl);
+      err = gpgme_data_new_from_cbs (r_output_data, &my_gpgme_data_cbs,
+                                     ctrl->output_stream);
       if (err)
         goto leave;
       if (ctrl->output_binary)
         gpgme_data_set_encoding (*r_output_data, GPGME_DATA_ENCODING_BINARY);
     }
-  if (ctrl->message_channel)
+  if (ctrl->message_stream)
     {
+      stream_enable_progress (ctrl->message_stream, ctx, "message");
       err = gpgme_data_new_from_cbs (r_message_data,
-				     &my_gpgme_message_cbs, ctrl);
+				     &my_gpgme_data_cbs, ctrl->message_stream);
       if (err)
         goto leave;
     }
@@ -650,11 +1054,14 @@ static void
 cont_encrypt (assuan_context_t ctx, gpg_error_t err)
 {
   conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t flush_err;
 
   g_debug ("cont_encrypt called with ERR=%s <%s>",
            gpg_strerror (err), gpg_strsource (err));
 
-  finish_io_streams (ctx, NULL, NULL, NULL);
+  flush_err = finish_io_streams (ctx, NULL, NULL, NULL);
+  if (!err)
+    err = flush_err;
   if (!err)
     release_recipients (ctrl);
   assuan_process_done (ctx, err);
@@ -662,9 +1069,16 @@ cont_encrypt (assuan_context_t ctx, gpg_error_t err)
 
 
 static const char hlp_encrypt[] =
-  "ENCRYPT --protocol=OpenPGP|CMS\n"
+  "ENCRYPT --protocol=OpenPGP|CMS [--batch[=N]]\n"
   "\n"
-  "Encrypt the data received on INPUT to OUTPUT.";
+  "Encrypt the data received on INPUT to OUTPUT.\n"
+  "\n"
+  "With --batch, N messages or all messages up to EOF are read from\n"
+  "INPUT and encrypted for the same recipients.  Each message is\n"
+  "preceded by its length as a decimal number and a LF; the results\n"
+  "are written to OUTPUT in the same format.  The keys of an earlier\n"
+  "PREP_ENCRYPT are used or the keys are selected according to the\n"
+  "key policy without asking the user.";
 static gpg_error_t
 cmd_encrypt (assuan_context_t ctx, char *line)
 {
@@ -679,6 +1093,9 @@ cmd_encrypt (assuan_context_t ctx, char *line)
   if (err)
     goto leave;
 
+  if (has_option_name (line, "--batch"))
+    return impl_batch (ctx, line, 0, protocol);
+
   if (protocol != ctrl->selected_protocol)
     {
       if (ctrl->selected_protocol != GPGME_PROTOCOL_UNKNOWN)
@@ -693,6 +1110,16 @@ cmd_encrypt (assuan_context_t ctx, char *line)
       goto leave;
     }
 
+  /* Use the keys selected by an earlier command for the same
+     recipients.  */
+  if (!ctrl->recipient_keys)
+    {
+      ctrl->recipient_keys = recipient_cache_get (ctrl->recipients,
+                                                  protocol, NULL);
+      if (ctrl->recipient_keys)
+        ctrl->selected_protocol = protocol;
+    }
+
   err = translate_io_streams (ctx);
   if (err)
     goto leave;
@@ -742,6 +1169,8 @@ cont_prep_encrypt (assuan_context_t ctx, gpg_error_t err)
       ctrl->recipient_keys = gpa_stream_encrypt_operation_get_keys
         (GPA_STREAM_ENCRYPT_OPERATION (ctrl->gpa_op),
          &ctrl->selected_protocol);
+      recipient_cache_put (ctrl->recipients, ctrl->selected_protocol,
+                           ctrl->recipient_keys);
 
       if (ctrl->recipient_keys)
         g_print ("received some keys\n");
@@ -761,7 +1190,10 @@ static const char hlp_prep_encrypt[] =
   "PREP_ENCRYPT [--protocol=OpenPGP|CMS]\n"
   "\n"
   "Dummy encryption command used to check whether the given recipients\n"
-  "are all valid and to tell the client the preferred protocol.";
+  "are all valid and to tell the client the preferred protocol.  The\n"
+  "keys selected for a set of recipients are remembered by the server\n"
+  "and used again by later PREP_ENCRYPT and ENCRYPT commands for the\n"
+  "same recipients until the keyrings are modified.";
 static gpg_error_t
 cmd_prep_encrypt (assuan_context_t ctx, char *line)
 {
@@ -783,6 +1215,16 @@ cmd_prep_encrypt (assuan_context_t ctx, char *line)
 
   reset_prepared_keys (ctrl);
 
+  ctrl->recipient_keys = recipient_cache_get (ctrl->recipients, protocol,
+                                              &ctrl->selected_protocol);
+  if (ctrl->recipient_keys)
+    {
+      err = assuan_write_status (ctx, "PROTOCOL",
+                                 ctrl->selected_protocol == GPGME_PROTOCOL_CMS
+                                 ? "CMS" : "OpenPGP");
+      goto leave;
+    }
+
   if (ctrl->gpa_op)
     {
       g_debug ("Oops: there is still an GPA_OP active\n");
@@ -842,55 +1284,513 @@ cmd_sender (assuan_context_t ctx, char *line)
   if (*line)
     ctrl->sender = xstrdup (line);
 
-  if (!err)
-    ctrl->sender_protocol_hint = protocol;
+  if (!err)
+    ctrl->sender_protocol_hint = protocol;
+
+ leave:
+  return assuan_process_done (ctx, err);
+}
+
+
+
+/* Continuation for cmd_sign.  */
+static void
+cont_sign (assuan_context_t ctx, gpg_error_t err)
+{
+  conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t flush_err;
+
+  g_debug ("cont_sign called with ERR=%s <%s>",
+           gpg_strerror (err), gpg_strsource (err));
+
+  flush_err = finish_io_streams (ctx, NULL, NULL, NULL);
+  if (!err)
+    err = flush_err;
+  if (!err)
+    {
+      xfree (ctrl->sender);
+      ctrl->sender = NULL;
+      ctrl->sender_protocol_hint = GPGME_PROTOCOL_UNKNOWN;
+    }
+  assuan_process_done (ctx, err);
+}
+
+
+static const char hlp_sign[] =
+  "SIGN --protocol=OpenPGP|CMS [--detached] [--batch[=N]]\n"
+  "\n"
+  "Sign the data received on INPUT to OUTPUT.\n"
+  "\n"
+  "With --batch, N messages or all messages up to EOF are read from\n"
+  "INPUT and signed, using the format described for ENCRYPT.  The\n"
+  "signing keys are selected according to the key policy without\n"
+  "asking the user.";
+static gpg_error_t
+cmd_sign (assuan_context_t ctx, char *line)
+{
+  conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  gpgme_protocol_t protocol;
+  gboolean detached;
+  GpaStreamSignOperation *op;
+  gpgme_data_t input_data = NULL;
+  gpgme_data_t output_data = NULL;
+
+  err = parse_protocol_option (ctx, line, 1, &protocol);
+  if (err)
+    goto leave;
+
+  if (has_option_name (line, "--batch"))
+    return impl_batch (ctx, line, 1, protocol);
+
+  detached = has_option (line, "--detached");
+
+  line = skip_options (line);
+  if (*line)
+    {
+      err = set_error (GPG_ERR_ASS_SYNTAX, NULL);
+      goto leave;
+    }
+
+  err = translate_io_streams (ctx);
+  if (err)
+    goto leave;
+  err = prepare_io_streams (ctx, &input_data, &output_data, NULL);
+  if (err)
+    goto leave;
+
+  ctrl->cont_cmd = cont_sign;
+  op = gpa_stream_sign_operation_new (NULL, input_data, output_data,
+                                      ctrl->sender, protocol, detached);
+  input_data = output_data = NULL;
+  g_signal_connect_swapped (G_OBJECT (op), "completed",
+			    G_CALLBACK (run_server_continuation), ctx);
+  g_signal_connect (G_OBJECT (op), "completed",
+                    G_CALLBACK (g_object_unref), NULL);
+  g_signal_connect_swapped (G_OBJECT (op), "status",
+			    G_CALLBACK (assuan_write_status), ctx);
+
+  return not_finished (ctrl);
+
+ leave:
+  finish_io_streams (ctx, &input_data, &output_data, NULL);
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+  ctrl->input_fd = -1;
+  ctrl->output_fd = -1;
+  return assuan_process_done (ctx, err);
+}
+
+
+
+/* State of an ENCRYPT or SIGN command with the option --batch.  All
+   messages are processed with the same keys and the same GPA
+   context.  */
+struct batch_s
+{
+  assuan_context_t ctx;
+  GpaContext *context;
+  int sign;
+  int detached;
+  gpgme_key_t *keys;
+  gpgme_protocol_t protocol;
+
+  /* The number of messages requested or 0 to read messages until
+     EOF, and the number of messages processed.  */
+  unsigned int count;
+  unsigned int done;
+
+  /* The number of bytes of the current message not yet read.  */
+  size_t remaining;
+
+  /* The length of the next message parsed so far and the number of
+     its digits.  */
+  size_t length;
+  int ndigits;
+
+  /* The channel for the input descriptor and the watch waiting for
+     the length line of the next message.  */
+  GIOChannel *channel;
+  guint watch_id;
+
+  /* The current message and the buffer for its result.  */
+  gpgme_data_t input;
+  gpgme_data_t output;
+};
+typedef struct batch_s *batch_t;
+
+
+/* Read once from the descriptor of STREAM into its empty buffer.
+   Shall only be called if the descriptor is readable.  Returns the
+   number of bytes read, 0 on EOF and -1 on error.  */
+static ssize_t
+stream_fill (struct server_stream_s *stream)
+{
+  ssize_t n;
+
+  do
+    n = read (stream->fd, stream->buffer, STREAM_BUFFER_SIZE);
+  while (n == -1 && errno == EINTR);
+  if (n > 0)
+    {
+      stream->start = 0;
+      stream->len = n;
+    }
+  else if (!n)
+    stream->eof = 1;
+  return n;
+}
+
+
+/* Write LENGTH bytes from BUFFER to STREAM waiting a limited time if
+   the descriptor is not ready.  Returns 0 on success.  */
+static int
+stream_write_buffered (struct server_stream_s *stream,
+                       const char *buffer, size_t length)
+{
+  ssize_t n;
+
+  while (length)
+    {
+      n = stream_write_cb (stream, buffer, length);
+      if (n == -1)
+        {
+          if (errno == EAGAIN && !stream_wait_writable (stream))
+            continue;
+          return -1;
+        }
+      buffer += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* Parse the length line of the next message of BATCH from the data
+   buffered by STREAM.  The line may arrive in pieces; the digits
+   parsed so far are kept in BATCH.  Returns GPG_ERR_EAGAIN if more
+   data is needed and GPG_ERR_EOF if there are no more messages.  */
+static gpg_error_t
+batch_parse_length (batch_t batch, struct server_stream_s *stream)
+{
+  char c;
+
+  for (;;)
+    {
+      if (!stream->len)
+        {
+          if (!stream->eof)
+            return gpg_error (GPG_ERR_EAGAIN);
+          return gpg_error (batch->ndigits ? GPG_ERR_TRUNCATED : GPG_ERR_EOF);
+        }
+      stream_read_cb (stream, &c, 1);
+      if (c == '\n')
+        break;
+      if (c < '0' || c > '9' || batch->ndigits++ >= 10)
+        return gpg_error (GPG_ERR_INV_LENGTH);
+      batch->length = batch->length * 10 + (c - '0');
+    }
+  if (!batch->ndigits)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+
+  batch->remaining = batch->length;
+  batch->length = 0;
+  batch->ndigits = 0;
+  return 0;
+}
+
+
+/* The gpgme read callback for the current message of a batch.  */
+static ssize_t
+batch_read_cb (void *opaque, void *buffer, size_t size)
+{
+  batch_t batch = opaque;
+  conn_ctrl_t ctrl = assuan_get_pointer (batch->ctx);
+  ssize_t n;
+
+  if (!batch->remaining)
+    return 0;
+  if (size > batch->remaining)
+    size = batch->remaining;
+  n = stream_read_cb (ctrl->input_stream, buffer, size);
+  if (!n)
+    {
+      /* The message has been truncated.  */
+      errno = EIO;
+      return -1;
+    }
+  if (n > 0)
+    batch->remaining -= n;
+  return n;
+}
+
+
+static struct gpgme_data_cbs batch_data_cbs =
+  {
+    batch_read_cb,
+    NULL,
+    NULL,
+    NULL
+  };
+
+
+/* Release BATCH and finish the command with ERR.  */
+static void
+batch_finish (batch_t batch, gpg_error_t err)
+{
+  assuan_context_t ctx = batch->ctx;
+
+  g_debug ("batch finished after %u messages: %s",
+           batch->done, gpg_strerror (err));
+
+  if (batch->watch_id)
+    g_source_remove (batch->watch_id);
+  if (batch->channel)
+    g_io_channel_unref (batch->channel);
+  gpgme_data_release (batch->input);
+  gpgme_data_release (batch->output);
+  if (batch->context)
+    g_object_unref (batch->context);
+  gpa_gpgme_release_keyarray (batch->keys);
+  g_free (batch);
+
+  run_server_continuation (ctx, err);
+}
+
+
+static gboolean batch_input_cb (GIOChannel *channel,
+                                GIOCondition condition, gpointer data);
+
+/* Start the operation for the next message of BATCH.  If its length
+   line has not yet been received, wait for it without blocking the
+   main loop.  */
+static void
+batch_next (batch_t batch)
+{
+  conn_ctrl_t ctrl = assuan_get_pointer (batch->ctx);
+  gpgme_ctx_t gctx = batch->context->ctx;
+  gpg_error_t err;
+
+  if (batch->count && batch->done == batch->count)
+    {
+      batch_finish (batch, 0);
+      return;
+    }
+
+  err = batch_parse_length (batch, ctrl->input_stream);
+  if (gpg_err_code (err) == GPG_ERR_EAGAIN)
+    {
+      if (!batch->channel)
+        {
+#ifdef HAVE_W32_SYSTEM
+          batch->channel = g_io_channel_win32_new_fd (ctrl->input_fd);
+#else
+          batch->channel = g_io_channel_unix_new (ctrl->input_fd);
+#endif
+          g_io_channel_set_encoding (batch->channel, NULL, NULL);
+          g_io_channel_set_buffered (batch->channel, FALSE);
+        }
+      batch->watch_id = g_io_add_watch (batch->channel,
+                                        G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                        batch_input_cb, batch);
+      return;
+    }
+  if (gpg_err_code (err) == GPG_ERR_EOF)
+    {
+      /* Running out of messages is only an error if a count has been
+         given.  */
+      batch_finish (batch, batch->count? gpg_error (GPG_ERR_TRUNCATED) : 0);
+      return;
+    }
+  if (!err)
+    err = gpgme_data_new_from_cbs (&batch->input, &batch_data_cbs, batch);
+  if (!err)
+    err = gpgme_data_new (&batch->output);
+  if (err)
+    {
+      batch_finish (batch, err);
+      return;
+    }
+  if (!ctrl->output_binary && batch->protocol == GPGME_PROTOCOL_CMS)
+    gpgme_data_set_encoding (batch->output, GPGME_DATA_ENCODING_BASE64);
+
+  if (batch->sign)
+    err = gpgme_op_sign_start (gctx, batch->input, batch->output,
+                               (batch->detached? GPGME_SIG_MODE_DETACH
+                                /* */          : GPGME_SIG_MODE_NORMAL));
+  else
+    err = gpgme_op_encrypt_start (gctx, batch->keys,
+                                  GPGME_ENCRYPT_ALWAYS_TRUST,
+                                  batch->input, batch->output);
+  if (err)
+    batch_finish (batch, err);
+}
+
+
+/* Watch function for the input descriptor of BATCH while waiting for
+   the length line of the next message.  */
+static gboolean
+batch_input_cb (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+  batch_t batch = data;
+  conn_ctrl_t ctrl = assuan_get_pointer (batch->ctx);
+
+  batch->watch_id = 0;
+  if (stream_fill (ctrl->input_stream) == -1)
+    batch_finish (batch, gpg_error_from_syserror ());
+  else
+    batch_next (batch);
+  return FALSE;
+}
+
+
+/* Signal handler for the "done" signal of the context of a batch.
+   Writes the result of the current message and starts the next
+   one.  */
+static void
+batch_done_cb (GpaContext *context, gpg_error_t err, batch_t batch)
+{
+  conn_ctrl_t ctrl = assuan_get_pointer (batch->ctx);
+  char buffer[256];
+  char *data;
+  size_t length;
+
+  gpgme_data_release (batch->input);
+  batch->input = NULL;
+  data = gpgme_data_release_and_get_mem (batch->output, &length);
+  batch->output = NULL;
+  if (err)
+    {
+      gpgme_free (data);
+      batch_finish (batch, err);
+      return;
+    }
+
+  /* Skip what the engine did not read of the message.  */
+  while (batch->remaining
+         && batch_read_cb (batch, buffer, sizeof buffer) > 0)
+    ;
+
+  /* The result is flushed right away because the client may wait for
+     it before sending the next message.  */
+  snprintf (buffer, sizeof buffer, "%lu\n", (unsigned long) length);
+  if (stream_write_buffered (ctrl->output_stream, buffer, strlen (buffer))
+      || stream_write_buffered (ctrl->output_stream, data, length)
+      || stream_flush (ctrl->output_stream))
+    err = gpg_error_from_syserror ();
+  gpgme_free (data);
+  if (err)
+    {
+      batch_finish (batch, err);
+      return;
+    }
+
+  batch->done++;
+  batch_next (batch);
+}
+
+
+/* Set up BATCH for KEYS of PROTOCOL and start it.  */
+static void
+batch_keys_cb (gpg_error_t err, gpgme_key_t *keys,
+               gpgme_protocol_t protocol, gpointer data)
+{
+  batch_t batch = data;
+  conn_ctrl_t ctrl = assuan_get_pointer (batch->ctx);
+  gpgme_ctx_t gctx;
+  int idx;
+
+  if (err)
+    {
+      batch_finish (batch, err);
+      return;
+    }
+  batch->keys = keys;
+  batch->protocol = protocol;
+
+  err = assuan_write_status (batch->ctx, "PROTOCOL",
+                             protocol == GPGME_PROTOCOL_CMS
+                             ? "CMS" : "OpenPGP");
+  if (err)
+    {
+      batch_finish (batch, err);
+      return;
+    }
+
+  batch->context = gpa_context_new_for_protocol (protocol);
+  gctx = batch->context->ctx;
+  if (!ctrl->output_binary && protocol == GPGME_PROTOCOL_OpenPGP)
+    gpgme_set_armor (gctx, 1);
+  if (batch->sign)
+    for (idx = 0; keys[idx]; idx++)
+      gpgme_signers_add (gctx, keys[idx]);
+  g_signal_connect (G_OBJECT (batch->context), "done",
+                    G_CALLBACK (batch_done_cb), batch);
 
- leave:
-  return assuan_process_done (ctx, err);
+  batch_next (batch);
 }
 
 
-
-/* Continuation for cmd_sign.  */
-static void
-cont_sign (assuan_context_t ctx, gpg_error_t err)
+/* Idle function to select the keys of a batch.  The keys prepared by
+   an earlier command are used if possible; the user is never
+   asked.  */
+static gboolean
+batch_select_keys_cb (gpointer data)
 {
-  conn_ctrl_t ctrl = assuan_get_pointer (ctx);
-
-  g_debug ("cont_sign called with ERR=%s <%s>",
-           gpg_strerror (err), gpg_strsource (err));
+  batch_t batch = data;
+  conn_ctrl_t ctrl = assuan_get_pointer (batch->ctx);
+  gpgme_key_t *keys;
 
-  finish_io_streams (ctx, NULL, NULL, NULL);
-  if (!err)
+  if (batch->sign)
     {
-      xfree (ctrl->sender);
-      ctrl->sender = NULL;
-      ctrl->sender_protocol_hint = GPGME_PROTOCOL_UNKNOWN;
+      gpa_policy_select_signers (ctrl->sender, batch->protocol,
+                                 batch_keys_cb, batch);
+      return FALSE;
     }
-  assuan_process_done (ctx, err);
+
+  if (ctrl->recipient_keys && ctrl->selected_protocol == batch->protocol)
+    keys = gpa_gpgme_copy_keyarray (ctrl->recipient_keys);
+  else
+    keys = recipient_cache_get (ctrl->recipients, batch->protocol, NULL);
+  if (keys)
+    batch_keys_cb (0, keys, batch->protocol, batch);
+  else if (ctrl->recipients)
+    gpa_policy_select_recipients (ctrl->recipients, batch->protocol,
+                                  batch_keys_cb, batch);
+  else
+    batch_finish (batch, gpg_error (GPG_ERR_NO_PUBKEY));
+
+  return FALSE;
 }
 
 
-static const char hlp_sign[] =
-  "SIGN --protocol=OpenPGP|CMS [--detached]\n"
-  "\n"
-  "Sign the data received on INPUT to OUTPUT.";
+/* Implementation of the option --batch[=N] of the ENCRYPT and SIGN
+   commands.  */
 static gpg_error_t
-cmd_sign (assuan_context_t ctx, char *line)
+impl_batch (assuan_context_t ctx, char *line, int sign,
+            gpgme_protocol_t protocol)
 {
   conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+  const char *s;
+  batch_t batch;
   gpg_error_t err;
-  gpgme_protocol_t protocol;
-  gboolean detached;
-  GpaStreamSignOperation *op;
-  gpgme_data_t input_data = NULL;
-  gpgme_data_t output_data = NULL;
+  unsigned long count = 0;
+  int detached;
 
-  err = parse_protocol_option (ctx, line, 1, &protocol);
-  if (err)
-    goto leave;
+  s = has_option_name (line, "--batch");
+  if (*s == '=')
+    {
+      char *endp;
 
-  detached = has_option (line, "--detached");
+      count = strtoul (s + 1, &endp, 10);
+      if (!count || count > UINT_MAX || (*endp && !spacep (endp)))
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid batch count");
+          goto leave;
+        }
+    }
+  detached = sign && has_option (line, "--detached");
 
   line = skip_options (line);
   if (*line)
@@ -902,43 +1802,41 @@ cmd_sign (assuan_context_t ctx, char *line)
   err = translate_io_streams (ctx);
   if (err)
     goto leave;
-  err = prepare_io_streams (ctx, &input_data, &output_data, NULL);
-  if (err)
-    goto leave;
+  ctrl->input_stream = stream_new (ctrl->input_fd);
+  ctrl->output_stream = stream_new (ctrl->output_fd);
 
-  ctrl->cont_cmd = cont_sign;
-  op = gpa_stream_sign_operation_new (NULL, input_data, output_data,
-                                      ctrl->sender, protocol, detached);
-  input_data = output_data = NULL;
-  g_signal_connect_swapped (G_OBJECT (op), "completed",
-			    G_CALLBACK (run_server_continuation), ctx);
-  g_signal_connect (G_OBJECT (op), "completed",
-                    G_CALLBACK (g_object_unref), NULL);
-  g_signal_connect_swapped (G_OBJECT (op), "status",
-			    G_CALLBACK (assuan_write_status), ctx);
+  batch = g_malloc0 (sizeof *batch);
+  batch->ctx = ctx;
+  batch->sign = sign;
+  batch->detached = detached;
+  batch->protocol = protocol;
+  batch->count = count;
+
+  ctrl->cont_cmd = sign? cont_sign : cont_encrypt;
+  g_idle_add (batch_select_keys_cb, batch);
 
   return not_finished (ctrl);
 
  leave:
-  finish_io_streams (ctx, &input_data, &output_data, NULL);
-  close_message_fd (ctrl);
-  assuan_close_input_fd (ctx);
-  assuan_close_output_fd (ctx);
-  ctrl->input_fd = -1;
-  ctrl->output_fd = -1;
+  finish_io_streams (ctx, NULL, NULL, NULL);
   return assuan_process_done (ctx, err);
 }
 
 
+
 
 /* Continuation for cmd_decrypt.  */
 static void
 cont_decrypt (assuan_context_t ctx, gpg_error_t err)
 {
+  gpg_error_t flush_err;
+
   g_debug ("cont_decrypt called with ERR=%s <%s>",
            gpg_strerror (err), gpg_strsource (err));
 
-  finish_io_streams (ctx, NULL, NULL, NULL);
+  flush_err = finish_io_streams (ctx, NULL, NULL, NULL);
+  if (!err)
+    err = flush_err;
   assuan_process_done (ctx, err);
 }
 
@@ -1016,10 +1914,14 @@ cmd_decrypt (assuan_context_t ctx, char *line)
 static void
 cont_verify (assuan_context_t ctx, gpg_error_t err)
 {
+  gpg_error_t flush_err;
+
   g_debug ("cont_verify called with ERR=%s <%s>",
            gpg_strerror (err), gpg_strsource (err));
 
-  finish_io_streams (ctx, NULL, NULL, NULL);
+  flush_err = finish_io_streams (ctx, NULL, NULL, NULL);
+  if (!err)
+    err = flush_err;
   assuan_process_done (ctx, err);
 }
 
@@ -1146,6 +2048,17 @@ cmd_verify (assuan_context_t ctx, char *line)
 
 
 
+/* Return an error in headless mode, where no windows can be
+   shown.  */
+static gpg_error_t
+check_windows (assuan_context_t ctx)
+{
+  if (headless)
+    return set_error (GPG_ERR_NOT_SUPPORTED, "not available in headless mode");
+  return 0;
+}
+
+
 static const char hlp_start_keymanager[] =
   "START_KEYMANAGER\n"
   "\n"
@@ -1155,9 +2068,12 @@ static const char hlp_start_keymanager[] =
 static gpg_error_t
 cmd_start_keymanager (assuan_context_t ctx, char *line)
 {
-  gpa_open_key_manager (NULL, NULL, NULL);
+  gpg_error_t err = check_windows (ctx);
 
-  return assuan_process_done (ctx, 0);
+  if (! err)
+    gpa_open_key_manager (NULL, NULL, NULL);
+
+  return assuan_process_done (ctx, err);
 }
 
 static const char hlp_start_clipboard[] =
@@ -1169,9 +2085,12 @@ static const char hlp_start_clipboard[] =
 static gpg_error_t
 cmd_start_clipboard (assuan_context_t ctx, char *line)
 {
-  gpa_open_clipboard (NULL, NULL, NULL);
+  gpg_error_t err = check_windows (ctx);
 
-  return assuan_process_done (ctx, 0);
+  if (! err)
+    gpa_open_clipboard (NULL, NULL, NULL);
+
+  return assuan_process_done (ctx, err);
 }
 
 static const char hlp_start_filemanager[] =
@@ -1183,9 +2102,12 @@ static const char hlp_start_filemanager[] =
 static gpg_error_t
 cmd_start_filemanager (assuan_context_t ctx, char *line)
 {
-  gpa_open_filemanager (NULL, NULL, NULL);
+  gpg_error_t err = check_windows (ctx);
 
-  return assuan_process_done (ctx, 0);
+  if (! err)
+    gpa_open_filemanager (NULL, NULL, NULL);
+
+  return assuan_process_done (ctx, err);
 }
 
 
@@ -1199,9 +2121,12 @@ static const char hlp_start_cardmanager[] =
 static gpg_error_t
 cmd_start_cardmanager (assuan_context_t ctx, char *line)
 {
-  gpa_open_cardmanager (NULL, NULL, NULL);
+  gpg_error_t err = check_windows (ctx);
 
-  return assuan_process_done (ctx, 0);
+  if (! err)
+    gpa_open_cardmanager (NULL, NULL, NULL);
+
+  return assuan_process_done (ctx, err);
 }
 #endif /*ENABLE_CARD_MANAGER*/
 
@@ -1214,14 +2139,65 @@ static const char hlp_start_confdialog[] =
 static gpg_error_t
 cmd_start_confdialog (assuan_context_t ctx, char *line)
 {
-  gpa_open_settings_dialog (NULL, NULL, NULL);
+  gpg_error_t err = check_windows (ctx);
 
-  return assuan_process_done (ctx, 0);
+  if (! err)
+    gpa_open_settings_dialog (NULL, NULL, NULL);
+
+  return assuan_process_done (ctx, err);
 }
 
 
 
 
+/* Return a string with the counters for "GETINFO metrics".  Each
+   line has the name of a counter and its value.  */
+static char *
+get_metrics (void)
+{
+  GString *string = g_string_new (NULL);
+  unsigned long hits, misses, count;
+  guint64 usec;
+  GList *names, *cur;
+
+  g_string_append_printf (string, "connections %d\n", connection_counter);
+  g_string_append_printf (string, "operations-in-flight %u\n",
+                          metrics.in_flight);
+  g_string_append_printf (string, "bytes-in %" G_GUINT64_FORMAT "\n",
+                          metrics.bytes_in);
+  g_string_append_printf (string, "bytes-out %" G_GUINT64_FORMAT "\n",
+                          metrics.bytes_out);
+  g_string_append_printf (string, "input-waits %lu\n", metrics.input_waits);
+  g_string_append_printf (string, "recipient-cache-hits %lu\n",
+                          metrics.recipient_cache_hits);
+  g_string_append_printf (string, "recipient-cache-misses %lu\n",
+                          metrics.recipient_cache_misses);
+  gpa_keytable_get_stats (gpa_keytable_get_public_instance (),
+                          &hits, &misses);
+  g_string_append_printf (string, "keytable-hits %lu\n", hits);
+  g_string_append_printf (string, "keytable-misses %lu\n", misses);
+  gpa_context_get_totals (&count, &usec);
+  g_string_append_printf (string, "engine-operations %lu\n", count);
+  g_string_append_printf (string, "engine-msec %" G_GUINT64_FORMAT "\n",
+                          usec / 1000);
+
+  if (metrics.commands)
+    {
+      names = g_list_sort (g_hash_table_get_keys (metrics.commands),
+                           (GCompareFunc) strcmp);
+      for (cur = names; cur; cur = g_list_next (cur))
+        g_string_append_printf (string, "command-%s %u\n",
+                                (char *) cur->data,
+                                GPOINTER_TO_UINT (g_hash_table_lookup
+                                                  (metrics.commands,
+                                                   cur->data)));
+      g_list_free (names);
+    }
+
+  return g_string_free (string, FALSE);
+}
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -1230,7 +2206,9 @@ static const char hlp_getinfo[] =
   "\n"
   "  version     - Return the version of the program.\n"
   "  name        - Return the name of the program\n"
-  "  pid         - Return the process id of the server.";
+  "  pid         - Return the process id of the server.\n"
+  "  metrics     - Return lines with the name and the value of\n"
+  "                counters describing the state of the server.";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -1253,6 +2231,12 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       const char *s = PACKAGE_NAME;
       err = assuan_send_data (ctx, s, strlen (s));
     }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *s = get_metrics ();
+      err = assuan_send_data (ctx, s, strlen (s));
+      g_free (s);
+    }
   else
     err = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
 
@@ -1309,6 +2293,11 @@ impl_encrypt_sign_files (assuan_context_t ctx, int encr, int sign)
       return assuan_process_done (ctx, err);
     }
 
+  /* The file operations ask for the keys and the output files.  */
+  err = check_windows (ctx);
+  if (err)
+    return assuan_process_done (ctx, err);
+
   /* FIXME: Needs a root window.  Need to set "sign" default.  */
   if (encr && sign)
     op = (GpaFileOperation *)
@@ -1414,6 +2403,11 @@ impl_decrypt_verify_files (assuan_context_t ctx, int decrypt, int verify)
       return assuan_process_done (ctx, err);
     }
 
+  /* The file operations ask for the keys and the output files.  */
+  err = check_windows (ctx);
+  if (err)
+    return assuan_process_done (ctx, err);
+
   /* FIXME: Needs a root window.  Need to enable "verify".  */
   if (decrypt && verify)
     op = (GpaFileOperation *)
@@ -1527,18 +2521,150 @@ cmd_import_files (assuan_context_t ctx, char *line)
 
 
 
-/* CHECKSUM_CREATE_FILES --nohup  */
+/* The state of a checksum command.  CTX is NULL if the command has
+   been run with --nohup.  */
+struct checksum_cmd_s
+{
+  assuan_context_t ctx;
+  int verify;
+};
+
+
+/* Report the result for FILENAME to the client.  */
+static void
+checksum_file_cb (const char *filename, gpa_checksum_status_t status,
+                  unsigned int done, unsigned int total, gpointer data)
+{
+  struct checksum_cmd_s *cmd = data;
+  conn_ctrl_t ctrl;
+  char *name;
+  char *line;
+
+  if (! cmd->ctx)
+    return;
+  ctrl = assuan_get_pointer (cmd->ctx);
+  if (ctrl->client_died)
+    return;
+
+  name = percent_escape (filename, NULL, 1);
+  line = g_strdup_printf ("%s %s", gpa_checksum_status_string (status), name);
+  assuan_write_status (cmd->ctx, "CHECKSUM", line);
+  g_free (line);
+  g_free (name);
+
+  line = g_strdup_printf ("checksum ? %u %u", done, total);
+  assuan_write_status (cmd->ctx, "PROGRESS", line);
+  g_free (line);
+}
+
+
+static void
+checksum_done_cb (gpg_error_t err, unsigned int nbad, gpointer data)
+{
+  struct checksum_cmd_s *cmd = data;
+
+  if (cmd->ctx)
+    {
+      if (! err && nbad)
+        err = gpg_error (GPG_ERR_CHECKSUM);
+      run_server_continuation (cmd->ctx, err);
+    }
+  else if (err)
+    gpa_show_warn (NULL, NULL, _("Error accessing the checksum files: %s"),
+                   gpg_strerror (err));
+  else if (nbad && cmd->verify)
+    gpa_show_warn (NULL, NULL,
+                   _("%u files could not be verified.  The files may have "
+                     "been modified since the checksums were created."),
+                   nbad);
+  else if (nbad)
+    gpa_show_warn (NULL, NULL,
+                   _("The checksums of %u files could not be created."),
+                   nbad);
+  else if (cmd->verify)
+    gpa_show_info (NULL, _("All files have been verified successfully."));
+  else
+    gpa_show_info (NULL, _("The checksum files have been created."));
+
+  g_free (cmd);
+}
+
+
+/* Continuation for the checksum commands.  */
+static void
+cont_checksum (assuan_context_t ctx, gpg_error_t err)
+{
+  g_debug ("cont_checksum called with ERR=%s <%s>",
+           gpg_strerror (err), gpg_strsource (err));
+
+  assuan_process_done (ctx, err);
+}
+
+
+/* Create or verify the checksums of the files set by FILE.  */
 static gpg_error_t
-cmd_checksum_create_files (assuan_context_t ctx, char *line)
+impl_checksum_files (assuan_context_t ctx, int verify, int nohup,
+                     GChecksumType type)
 {
   gpg_error_t err;
+  conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+  struct checksum_cmd_s *cmd;
+  GList *filenames = NULL;
+  GList *cur;
 
-  if (! has_option (line, "--nohup"))
+  if (! ctrl->files)
     {
-      err = set_error (GPG_ERR_ASS_PARAMETER, "file ops require --nohup");
+      err = set_error (GPG_ERR_ASS_SYNTAX, "no files specified");
       return assuan_process_done (ctx, err);
     }
 
+  for (cur = ctrl->files; cur; cur = g_list_next (cur))
+    {
+      gpa_file_item_t item = cur->data;
+      filenames = g_list_append (filenames, item->filename_in);
+    }
+
+  cmd = g_malloc0 (sizeof (*cmd));
+  cmd->ctx = nohup ? NULL : ctx;
+  cmd->verify = verify;
+  if (! nohup)
+    ctrl->cont_cmd = cont_checksum;
+
+  /* The callbacks are not called before we return.  */
+  if (verify)
+    gpa_checksum_verify (filenames, checksum_file_cb, checksum_done_cb, cmd);
+  else
+    gpa_checksum_create (filenames, type,
+                         checksum_file_cb, checksum_done_cb, cmd);
+  g_list_free (filenames);
+  release_files (ctrl);
+
+  if (nohup)
+    return assuan_process_done (ctx, 0);
+  return not_finished (ctrl);
+}
+
+
+static const char hlp_checksum_create_files[] =
+  "CHECKSUM_CREATE_FILES [--sha512] [--nohup]\n"
+  "\n"
+  "Compute the checksums of the files set by FILE and store them in\n"
+  "the checksum files \"sha256sum.txt\" or with --sha512 \"sha512sum.txt\"\n"
+  "of their directories.  For a directory all regular files in it are\n"
+  "used.  For each file a status line\n"
+  "\n"
+  "  CHECKSUM CREATED|MISSING <filename>\n"
+  "\n"
+  "with the percent-plus escaped name of the file is emitted.  With\n"
+  "--nohup the command returns immediately and the result is shown\n"
+  "to the user.";
+static gpg_error_t
+cmd_checksum_create_files (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  int nohup = has_option (line, "--nohup");
+  int sha512 = has_option (line, "--sha512");
+
   line = skip_options (line);
   if (*line)
     {
@@ -1546,22 +2672,30 @@ cmd_checksum_create_files (assuan_context_t ctx, char *line)
       return assuan_process_done (ctx, err);
     }
 
-  err = set_error (GPG_ERR_NOT_IMPLEMENTED, "not implemented");
-  return assuan_process_done (ctx, err);
+  return impl_checksum_files (ctx, 0, nohup,
+                              sha512 ? G_CHECKSUM_SHA512 : G_CHECKSUM_SHA256);
 }
 
-
-/* CHECKSUM_VERIFY_FILES --nohup  */
+
+static const char hlp_checksum_verify_files[] =
+  "CHECKSUM_VERIFY_FILES [--nohup]\n"
+  "\n"
+  "Verify the files set by FILE against the checksum files of their\n"
+  "directories.  If FILE names a checksum file or a directory, all\n"
+  "files listed in the checksum file or in the checksum files of the\n"
+  "directory are verified.  For each file a status line\n"
+  "\n"
+  "  CHECKSUM OK|BAD|MISSING|NOENTRY <filename>\n"
+  "\n"
+  "with the percent-plus escaped name of the file is emitted.  The\n"
+  "command fails if not all files could be verified.  With --nohup\n"
+  "the command returns immediately and the result is shown to the\n"
+  "user.";
 static gpg_error_t
 cmd_checksum_verify_files (assuan_context_t ctx, char *line)
 {
   gpg_error_t err;
-
-  if (! has_option (line, "--nohup"))
-    {
-      err = set_error (GPG_ERR_ASS_PARAMETER, "file ops require --nohup");
-      return assuan_process_done (ctx, err);
-    }
+  int nohup = has_option (line, "--nohup");
 
   line = skip_options (line);
   if (*line)
@@ -1570,12 +2704,11 @@ cmd_checksum_verify_files (assuan_context_t ctx, char *line)
       return assuan_process_done (ctx, err);
     }
 
-  err = set_error (GPG_ERR_NOT_IMPLEMENTED, "not implemented");
-  return assuan_process_done (ctx, err);
+  return impl_checksum_files (ctx, 1, nohup, G_CHECKSUM_SHA256);
 }
 
 
-
+
 /* KILL_UISERVER  */
 static gpg_error_t
 cmd_kill_uiserver (assuan_context_t ctx, char *line)
@@ -1669,8 +2802,10 @@ register_commands (assuan_context_t ctx)
     { "VERIFY_FILES", cmd_verify_files },
     { "DECRYPT_VERIFY_FILES", cmd_decrypt_verify_files },
     { "IMPORT_FILES", cmd_import_files },
-    { "CHECKSUM_CREATE_FILES", cmd_checksum_create_files },
-    { "CHECKSUM_VERIFY_FILES", cmd_checksum_verify_files },
+    { "CHECKSUM_CREATE_FILES", cmd_checksum_create_files,
+      hlp_checksum_create_files },
+    { "CHECKSUM_VERIFY_FILES", cmd_checksum_verify_files,
+      hlp_checksum_verify_files },
     { "KILL_UISERVER", cmd_kill_uiserver },
     { NULL }
   };
@@ -1688,6 +2823,24 @@ register_commands (assuan_context_t ctx)
 }
 
 
+/* Count the command CMD for "GETINFO metrics".  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  guint count;
+
+  (void)ctx;
+
+  if (!metrics.commands)
+    metrics.commands = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, NULL);
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (metrics.commands, cmd));
+  g_hash_table_insert (metrics.commands, g_strdup (cmd),
+                       GUINT_TO_POINTER (count + 1));
+  return 0;
+}
+
+
 /* Prepare for a new connection on descriptor FD.  */
 static assuan_context_t
 connection_startup (assuan_fd_t fd)
@@ -1727,6 +2880,7 @@ connection_startup (assuan_fd_t fd)
   assuan_set_pointer (ctx, ctrl);
   assuan_set_log_stream (ctx, stderr);
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_output_notify (ctx, output_notify);
   ctrl->message_fd = -1;
 
@@ -1744,12 +2898,18 @@ connection_finish (assuan_context_t ctx)
     {
       conn_ctrl_t ctrl = assuan_get_pointer (ctx);
 
+      if (ctrl->watch_id)
+        g_source_remove (ctrl->watch_id);
+      if (ctrl->idle_id)
+        g_source_remove (ctrl->idle_id);
       reset_notify (ctx, NULL);
       assuan_release (ctx);
+      if (ctrl->channel)
+        g_io_channel_unref (ctrl->channel);
       g_free (ctrl);
       connection_counter--;
       if (!connection_counter && shutdown_pending)
-        g_application_quit (G_APPLICATION(get_gpa_application ()));
+        gpa_quit ();
     }
 }
 
@@ -1768,6 +2928,9 @@ run_server_continuation (assuan_context_t ctx, gpg_error_t err)
       return;
     }
   g_debug ("calling gpa_run_server_continuation (%s)", gpg_strerror (err));
+  if (ctrl->pending)
+    metrics.in_flight--;
+  ctrl->pending = 0;
   if (!ctrl->cont_cmd)
     {
       g_debug ("no continuation defined; using default");
@@ -1777,6 +2940,8 @@ run_server_continuation (assuan_context_t ctx, gpg_error_t err)
     {
       g_debug ("not running continuation as client has disconnected");
       connection_finish (ctx);
+      g_debug ("leaving gpa_run_server_continuation");
+      return;
     }
   else
     {
@@ -1784,10 +2949,116 @@ run_server_continuation (assuan_context_t ctx, gpg_error_t err)
       ctrl->cont_cmd = NULL;
       cont_cmd (ctx, err);
     }
+  resume_input (ctx);
   g_debug ("leaving gpa_run_server_continuation");
 }
 
 
+/* Return true if the connection CTRL is busy with a command.  */
+static int
+connection_busy (conn_ctrl_t ctrl)
+{
+  return ctrl->in_command || ctrl->cont_cmd || ctrl->pending;
+}
+
+
+/* Process the next command of the connection CTX.  Returns false if
+   the client closed the connection; the input watch has then been
+   removed.  */
+static gboolean
+process_input (assuan_context_t ctx)
+{
+  conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int done = 0;
+
+  ctrl->in_command++;
+  err = assuan_process_next (ctx, &done);
+  ctrl->in_command--;
+  if (err)
+    {
+      g_debug ("assuan_process_next returned: %s <%s>",
+               gpg_strerror (err), gpg_strsource (err));
+    }
+  else
+    {
+      g_debug ("assuan_process_next returned: %s",
+               done ? "done" : "success");
+    }
+  if (gpg_err_code (err) == GPG_ERR_EAGAIN)
+    ; /* Ignore.  */
+  else if (!err && done)
+    {
+      if (ctrl->cont_cmd)
+        {
+          ctrl->client_died = 1; /* Need to delay the cleanup.  */
+          if (ctrl->watch_id)
+            g_source_remove (ctrl->watch_id);
+          ctrl->watch_id = 0;
+        }
+      else
+        connection_finish (ctx);
+      return FALSE;
+    }
+  else if (gpg_err_code (err) == GPG_ERR_UNFINISHED)
+    {
+      if (!ctrl->is_unfinished)
+        {
+          /* It is quite possible that some other subsystem
+             returns that error code.  Tell the user about
+             this curiosity and finish the command.  */
+          g_debug ("note: Unfinished error code not emitted by us");
+          if (ctrl->cont_cmd)
+            g_debug ("OOPS: pending continuation!");
+          assuan_process_done (ctx, err);
+        }
+    }
+  else
+    assuan_process_done (ctx, err);
+
+  resume_input (ctx);
+  return TRUE;
+}
+
+
+/* Idle handler to process a line which Assuan has already read from
+   the client.  */
+static gboolean
+pending_line_cb (void *data)
+{
+  assuan_context_t ctx = data;
+  conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  ctrl->idle_id = 0;
+  if (!connection_busy (ctrl))
+    process_input (ctx);
+  return FALSE;
+}
+
+
+/* Watch the connection CTX for input again unless it is still busy
+   with a command.  */
+static void
+resume_input (assuan_context_t ctx)
+{
+  conn_ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  if (!ctrl || connection_busy (ctrl) || ctrl->client_died)
+    return;
+
+  if (!ctrl->watch_id)
+    {
+      g_debug ("resuming input");
+      ctrl->watch_id = g_io_add_watch (ctrl->channel, G_IO_IN,
+                                       receive_cb, ctx);
+    }
+  /* The client may have sent several commands at once; those are not
+     signaled by the channel.  */
+  if (!ctrl->idle_id && assuan_pending_line (ctx))
+    ctrl->idle_id = g_idle_add (pending_line_cb, ctx);
+}
+
+
 /* This function is called by the main event loop if data can be read
    from the status channel.  */
 static gboolean
@@ -1795,64 +3066,24 @@ receive_cb (GIOChannel *channel, GIOCondition condition, void *data)
 {
   assuan_context_t ctx = data;
   conn_ctrl_t ctrl = assuan_get_pointer (ctx);
-  gpg_error_t err;
 
   assert (ctrl);
   if (condition & G_IO_IN)
     {
       g_debug ("receive_cb");
-      if (ctrl->cont_cmd)
-        {
-          g_debug ("  input received while waiting for continuation");
-          g_usleep (2000000);
-        }
-      else if (ctrl->in_command)
-        {
-          g_debug ("  input received while still processing command");
-          g_usleep (2000000);
-        }
-      else
+      if (connection_busy (ctrl))
         {
-	  int done = 0;
-          ctrl->in_command++;
-          err = assuan_process_next (ctx, &done);
-          ctrl->in_command--;
-	  if (err)
-	    {
-	      g_debug ("assuan_process_next returned: %s <%s>",
-		       gpg_strerror (err), gpg_strsource (err));
-	    }
-	  else
-	    {
-	      g_debug ("assuan_process_next returned: %s",
-		       done ? "done" : "success");
-	    }
-          if (gpg_err_code (err) == GPG_ERR_EAGAIN)
-            ; /* Ignore.  */
-          else if (!err && done)
-            {
-              if (ctrl->cont_cmd)
-                ctrl->client_died = 1; /* Need to delay the cleanup.  */
-              else
-                connection_finish (ctx);
-              return FALSE; /* Remove from the watch.  */
-            }
-          else if (gpg_err_code (err) == GPG_ERR_UNFINISHED)
-            {
-              if (!ctrl->is_unfinished)
-                {
-                  /* It is quite possible that some other subsystem
-                     returns that error code.  Tell the user about
-                     this curiosity and finish the command.  */
-                  g_debug ("note: Unfinished error code not emitted by us");
-                  if (ctrl->cont_cmd)
-                    g_debug ("OOPS: pending continuation!");
-                  assuan_process_done (ctx, err);
-                }
-            }
-          else
-            assuan_process_done (ctx, err);
+          /* Do not read the next command before the current one has
+             been finished.  The watch is installed again by
+             resume_input; meanwhile the other connections are
+             served as usual.  */
+          g_debug ("  input received while processing command - suspending");
+          metrics.input_waits++;
+          ctrl->watch_id = 0;
+          return FALSE; /* Remove from the watch.  */
         }
+      if (!process_input (ctx))
+        return FALSE; /* Remove from the watch.  */
     }
   return TRUE;
 }
@@ -1870,6 +3101,7 @@ accept_connection_cb (GIOChannel *listen_channel,
   struct sockaddr_un paddr;
   socklen_t plen = sizeof paddr;
   assuan_context_t ctx;
+  conn_ctrl_t ctrl;
   GIOChannel *channel;
   unsigned int source_id;
 
@@ -1916,6 +3148,9 @@ accept_connection_cb (GIOChannel *listen_channel,
       g_io_channel_shutdown (channel, 0, NULL);
       goto leave;
     }
+  ctrl = assuan_get_pointer (ctx);
+  ctrl->channel = channel;
+  ctrl->watch_id = source_id;
   err = assuan_accept (ctx);
   if (err)
     {
@@ -1934,8 +3169,8 @@ accept_connection_cb (GIOChannel *listen_channel,
 
 
 
-/* Startup the server.  */
-void
+/* Startup the server.  Returns 0 on success.  */
+int
 gpa_start_server (void)
 {
   char *socket_name;
@@ -1953,7 +3188,7 @@ gpa_start_server (void)
     {
       g_debug ("assuan_sock_init failed: %s <%s>",
                gpg_strerror (err), gpg_strsource (err));
-      return;
+      return -1;
     }
 
   socket_name = g_build_filename (gnupg_homedir, "S.uiserver", NULL);
@@ -1961,7 +3196,7 @@ gpa_start_server (void)
     {
       g_debug ("name of socket too long\n");
       g_free (socket_name);
-      return;
+      return -1;
     }
   g_debug ("using server socket `%s'", socket_name);
 
@@ -1970,7 +3205,7 @@ gpa_start_server (void)
     {
       g_debug ("can't create socket: %s\n", strerror(errno));
       g_free (socket_name);
-      return;
+      return -1;
     }
 
   memset (&serv_addr, 0, sizeof serv_addr);
@@ -1994,7 +3229,7 @@ gpa_start_server (void)
                serv_addr.sun_path, strerror (errno) );
       assuan_sock_close (fd);
       g_free (socket_name);
-      return;
+      return -1;
     }
   g_free (socket_name);
   socket_name = NULL;
@@ -2003,7 +3238,7 @@ gpa_start_server (void)
     {
       g_debug ("listen() failed: %s\n", strerror (errno));
       assuan_sock_close (fd);
-      return;
+      return -1;
     }
 #ifdef HAVE_W32_SYSTEM
   channel = g_io_channel_win32_new_socket ((int) fd);
@@ -2014,7 +3249,7 @@ gpa_start_server (void)
     {
       g_debug ("error creating a new listening channel\n");
       assuan_sock_close (fd);
-      return;
+      return -1;
     }
   g_io_channel_set_encoding (channel, NULL, NULL);
   g_io_channel_set_buffered (channel, FALSE);
@@ -2025,9 +3260,10 @@ gpa_start_server (void)
       g_debug ("error creating watch for listening channel\n");
       g_io_channel_shutdown (channel, 0, NULL);
       assuan_sock_close (fd);
-      return;
+      return -1;
     }
 
+  return 0;
 }
 
 /* Set a flag to shutdown the server in a friendly way.  */
@@ -2036,7 +3272,7 @@ gpa_stop_server (void)
 {
   shutdown_pending = TRUE;
   if (!connection_counter)
-    g_application_quit (G_APPLICATION(get_gpa_application ()));
+    gpa_quit ();
 }
 
 
@@ -0,0 +1,1007 @@
+/* tarstream.c - Streaming of directory trees as tar archives.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "gpa.h"
+#include "tarstream.h"
+
+#ifndef O_BINARY
+#ifdef _O_BINARY
+#define O_BINARY	_O_BINARY
+#else
+#define O_BINARY	0
+#endif
+#endif
+
+/* The size of the blocks of a tar archive.  */
+#define BLOCKSIZE 512
+
+/* The longest GNU long name entry or pax header accepted.  */
+#define MAX_LONGNAME 65536
+
+/* Offsets and lengths of the fields of a ustar header.  */
+#define HDR_NAME	0
+#define HDR_NAME_LEN	100
+#define HDR_MODE	100
+#define HDR_UID		108
+#define HDR_GID		116
+#define HDR_SIZE	124
+#define HDR_MTIME	136
+#define HDR_CHKSUM	148
+#define HDR_TYPE	156
+#define HDR_MAGIC	257
+#define HDR_VERSION	263
+#define HDR_PREFIX	345
+#define HDR_PREFIX_LEN	155
+
+/* The name of the pax global header marking an archive of a
+   directory made by GPA and its record.  */
+#define MARKER_NAME	"GPA-directory-archive"
+#define MARKER_RECORD	"33 comment=GPA directory archive\n"
+
+/* The number of padding bytes after LENGTH bytes of data.  */
+#define PADDING(length) ((BLOCKSIZE - (length) % BLOCKSIZE) % BLOCKSIZE)
+
+
+/* A directory being archived.  */
+struct tar_dir_s
+{
+  GDir *dir;
+  /* The name of the directory in the archive.  */
+  gchar *name;
+};
+
+
+/* The state of an archive being created.  */
+struct tar_create_s
+{
+  /* The parent of the archived directory.  */
+  gchar *base;
+
+  /* The open directories, the innermost first.  */
+  GSList *dirs;
+
+  /* Headers and padding not yet read.  */
+  GByteArray *pending;
+  guint pending_pos;
+
+  /* The file being archived and the number of its bytes not yet
+     read.  */
+  int fd;
+  guint64 remaining;
+  guint64 padding;
+
+  /* Set after the end of the archive has been queued.  */
+  gboolean finished;
+};
+typedef struct tar_create_s *tar_create_t;
+
+
+/* The state of an archive being extracted.  */
+struct gpa_tar_extract_s
+{
+  /* The file written instead if the data does not start with the
+     marker of GPA, and its descriptor.  CHECKED is set once the first
+     header has been checked.  */
+  gchar *plain_name;
+  int plain_fd;
+  gboolean checked;
+
+  /* The files and directories created, the last one first.  */
+  GSList *created;
+
+  /* The header being received.  */
+  unsigned char header[BLOCKSIZE];
+  size_t header_len;
+
+  /* The number of data and padding bytes of the current entry not yet
+     received.  */
+  guint64 remaining;
+  guint64 padding;
+
+  /* The file being extracted or -1 if the data is skipped.  */
+  int fd;
+
+  /* The data of a GNU long name entry or of a pax header, which is
+     set for the latter, and the name it gives to the next entry.  */
+  GString *longname;
+  gboolean pax;
+  gchar *next_name;
+
+  /* The directory the archive is extracted to.  It is named after
+     PLAIN_NAME without the ".tar" suffix and must not yet exist.  The
+     single top-level directory of the archive, whose name is stored
+     in ARCHIVED_TOP, is extracted as this directory.  */
+  gchar *topdir;
+  gchar *archived_top;
+
+  /* The number of zero blocks in a row; two end the archive.  */
+  int zero_blocks;
+  gboolean done;
+};
+
+
+
+/* Store VALUE in the numeric header field of LEN bytes at FIELD.  */
+static void
+store_number (unsigned char *field, int len, guint64 value)
+{
+  int i;
+
+  if (value < ((guint64) 1 << (3 * (len - 1))))
+    {
+      /* Octal digits with a trailing Nul.  */
+      field[len - 1] = 0;
+      for (i = len - 2; i >= 0; i--)
+        {
+          field[i] = '0' + (value & 7);
+          value >>= 3;
+        }
+    }
+  else
+    {
+      /* The base-256 encoding of GNU tar for large files.  */
+      for (i = len - 1; i > 0; i--)
+        {
+          field[i] = value & 0xff;
+          value >>= 8;
+        }
+      field[0] = 0x80;
+    }
+}
+
+
+/* Return the value of the numeric header field of LEN bytes at
+   FIELD.  */
+static guint64
+parse_number (const unsigned char *field, int len)
+{
+  guint64 value = 0;
+  int i;
+
+  if (*field & 0x80)
+    {
+      for (i = 1; i < len; i++)
+        value = (value << 8) | field[i];
+      return value;
+    }
+
+  for (i = 0; i < len && field[i] == ' '; i++)
+    ;
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    value = (value << 3) | (field[i] - '0');
+  return value;
+}
+
+
+/* Return the checksum of the header BLOCK.  */
+static unsigned int
+header_checksum (const unsigned char *block)
+{
+  unsigned int sum = 0;
+  int i;
+
+  for (i = 0; i < BLOCKSIZE; i++)
+    if (i >= HDR_CHKSUM && i < HDR_CHKSUM + 8)
+      sum += ' ';
+    else
+      sum += block[i];
+  return sum;
+}
+
+
+
+/* Archive creation.  */
+
+static void
+queue_zero (tar_create_t tar, guint64 count)
+{
+  static const guint8 zero[BLOCKSIZE];
+
+  while (count)
+    {
+      guint n = MIN (count, sizeof zero);
+
+      g_byte_array_append (tar->pending, zero, n);
+      count -= n;
+    }
+}
+
+
+/* Queue the header of an entry of TYPE with NAME, SIZE, MODE and
+   MTIME.  Names not fitting into the ustar fields are stored in a GNU
+   long name entry.  */
+static void
+queue_header (tar_create_t tar, const gchar *name, int type,
+              guint64 size, unsigned int mode, time_t mtime)
+{
+  unsigned char block[BLOCKSIZE];
+  size_t len = strlen (name);
+  size_t split = 0;
+  const gchar *s;
+
+  if (len > HDR_NAME_LEN)
+    {
+      /* Split the name at a slash into prefix and name.  */
+      for (s = strchr (name, '/'); s; s = strchr (s + 1, '/'))
+        if (len - (s - name) - 1 <= HDR_NAME_LEN)
+          {
+            if (s - name <= HDR_PREFIX_LEN && s[1])
+              split = s - name;
+            break;
+          }
+      if (!split)
+        {
+          queue_header (tar, "././@LongLink", 'L', len + 1, 0644, 0);
+          g_byte_array_append (tar->pending, (const guint8 *) name, len + 1);
+          queue_zero (tar, PADDING (len + 1));
+        }
+    }
+
+  memset (block, 0, sizeof block);
+  if (split)
+    {
+      memcpy (block + HDR_PREFIX, name, split);
+      memcpy (block + HDR_NAME, name + split + 1, len - split - 1);
+    }
+  else
+    memcpy (block + HDR_NAME, name, MIN (len, HDR_NAME_LEN));
+  store_number (block + HDR_MODE, 8, mode & 07777);
+  store_number (block + HDR_UID, 8, 0);
+  store_number (block + HDR_GID, 8, 0);
+  store_number (block + HDR_SIZE, 12, size);
+  store_number (block + HDR_MTIME, 12, mtime > 0 ? mtime : 0);
+  block[HDR_TYPE] = type;
+  memcpy (block + HDR_MAGIC, "ustar", 6);
+  memcpy (block + HDR_VERSION, "00", 2);
+  snprintf ((char *) block + HDR_CHKSUM, 8, "%06o", header_checksum (block));
+  block[HDR_CHKSUM + 7] = ' ';
+
+  g_byte_array_append (tar->pending, block, BLOCKSIZE);
+}
+
+
+/* Queue the pax global header marking the archive as made by GPA.
+   Other tar programs ignore it.  */
+static void
+queue_marker (tar_create_t tar)
+{
+  size_t len = strlen (MARKER_RECORD);
+
+  queue_header (tar, MARKER_NAME, 'g', len, 0644, 0);
+  g_byte_array_append (tar->pending, (const guint8 *) MARKER_RECORD, len);
+  queue_zero (tar, PADDING (len));
+}
+
+
+/* Add the file or directory ENTRY of the directory DIRNAME in the
+   archive, or the top directory if DIRNAME is NULL.  Other types of
+   files are skipped.  Returns -1 with ERRNO set on error.  */
+static int
+add_entry (tar_create_t tar, const gchar *dirname, const gchar *entry)
+{
+  struct stat st;
+  gchar *name;
+  gchar *path;
+  int rc = 0;
+
+  name = dirname ? g_strconcat (dirname, "/", entry, NULL) : g_strdup (entry);
+  path = g_build_filename (tar->base, name, NULL);
+
+  if (g_lstat (path, &st))
+    rc = -1;
+  else if (S_ISDIR (st.st_mode))
+    {
+      struct tar_dir_s *dir;
+      GError *error = NULL;
+      gchar *dirname_slash;
+
+      dir = g_malloc0 (sizeof *dir);
+      dir->dir = g_dir_open (path, 0, &error);
+      if (!dir->dir)
+        {
+          g_message ("can't read directory: %s", error->message);
+          g_error_free (error);
+          g_free (dir);
+          errno = EIO;
+          rc = -1;
+        }
+      else
+        {
+          dirname_slash = g_strconcat (name, "/", NULL);
+          queue_header (tar, dirname_slash, '5', 0, st.st_mode, st.st_mtime);
+          g_free (dirname_slash);
+          dir->name = name;
+          name = NULL;
+          tar->dirs = g_slist_prepend (tar->dirs, dir);
+        }
+    }
+  else if (S_ISREG (st.st_mode))
+    {
+      tar->fd = g_open (path, O_RDONLY | O_BINARY, 0);
+      if (tar->fd == -1)
+        rc = -1;
+      else
+        {
+          queue_header (tar, name, '0', st.st_size, st.st_mode, st.st_mtime);
+          tar->remaining = st.st_size;
+          tar->padding = PADDING (tar->remaining);
+        }
+    }
+  else
+    g_debug ("not archiving special file `%s'", path);
+
+  g_free (path);
+  g_free (name);
+  return rc;
+}
+
+
+/* Queue the next entry of the archive.  */
+static int
+next_entry (tar_create_t tar)
+{
+  while (tar->dirs)
+    {
+      struct tar_dir_s *dir = tar->dirs->data;
+      const gchar *entry;
+
+      entry = g_dir_read_name (dir->dir);
+      if (entry)
+        return add_entry (tar, dir->name, entry);
+
+      g_dir_close (dir->dir);
+      g_free (dir->name);
+      g_free (dir);
+      tar->dirs = g_slist_delete_link (tar->dirs, tar->dirs);
+    }
+
+  /* The end of the archive.  */
+  queue_zero (tar, 2 * BLOCKSIZE);
+  tar->finished = TRUE;
+  return 0;
+}
+
+
+/* The gpgme read callback of an archive.  */
+static ssize_t
+create_read_cb (void *handle, void *buffer, size_t size)
+{
+  tar_create_t tar = handle;
+  ssize_t n;
+
+  if (!size)
+    return 0;
+
+  for (;;)
+    {
+      if (tar->pending_pos < tar->pending->len)
+        {
+          n = MIN (size, tar->pending->len - tar->pending_pos);
+          memcpy (buffer, tar->pending->data + tar->pending_pos, n);
+          tar->pending_pos += n;
+          if (tar->pending_pos == tar->pending->len)
+            {
+              g_byte_array_set_size (tar->pending, 0);
+              tar->pending_pos = 0;
+            }
+          return n;
+        }
+
+      if (tar->fd != -1)
+        {
+          if (tar->remaining)
+            {
+              n = read (tar->fd, buffer, MIN (size, tar->remaining));
+              if (n < 0 && errno == EINTR)
+                continue;
+              if (!n)
+                {
+                  /* The file has been truncated meanwhile.  */
+                  errno = EIO;
+                  n = -1;
+                }
+              if (n > 0)
+                tar->remaining -= n;
+              return n;
+            }
+          close (tar->fd);
+          tar->fd = -1;
+          queue_zero (tar, tar->padding);
+          continue;
+        }
+
+      if (tar->finished)
+        return 0;
+      if (next_entry (tar))
+        return -1;
+    }
+}
+
+
+static void
+create_release_cb (void *handle)
+{
+  tar_create_t tar = handle;
+
+  while (tar->dirs)
+    {
+      struct tar_dir_s *dir = tar->dirs->data;
+
+      g_dir_close (dir->dir);
+      g_free (dir->name);
+      g_free (dir);
+      tar->dirs = g_slist_delete_link (tar->dirs, tar->dirs);
+    }
+  if (tar->fd != -1)
+    close (tar->fd);
+  g_byte_array_free (tar->pending, TRUE);
+  g_free (tar->base);
+  g_free (tar);
+}
+
+
+static struct gpgme_data_cbs create_cbs =
+  {
+    create_read_cb,
+    NULL,
+    NULL,
+    create_release_cb
+  };
+
+
+gpg_error_t
+gpa_tar_data_new_from_dir (gpgme_data_t *r_data, const gchar *dirname)
+{
+  tar_create_t tar;
+  gchar *top;
+  gpg_error_t err;
+
+  tar = g_malloc0 (sizeof *tar);
+  tar->base = g_path_get_dirname (dirname);
+  tar->pending = g_byte_array_new ();
+  tar->fd = -1;
+  queue_marker (tar);
+
+  top = g_path_get_basename (dirname);
+  if (add_entry (tar, NULL, top))
+    err = gpg_error_from_syserror ();
+  else
+    err = gpgme_data_new_from_cbs (r_data, &create_cbs, tar);
+  g_free (top);
+  if (err)
+    {
+      create_release_cb (tar);
+      return err;
+    }
+
+  return 0;
+}
+
+
+
+/* Archive extraction.  */
+
+/* Write LENGTH bytes of BUFFER to FD.  */
+static int
+write_all (int fd, const char *buffer, size_t length)
+{
+  ssize_t n;
+
+  while (length)
+    {
+      n = write (fd, buffer, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return -1;
+      buffer += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* Return true if BLOCK is the header written by queue_marker.  */
+static int
+is_marker (const unsigned char *block)
+{
+  return (block[HDR_TYPE] == 'g'
+          && parse_number (block + HDR_CHKSUM, 8) == header_checksum (block)
+          && !strncmp ((const char *) block + HDR_NAME, MARKER_NAME,
+                       HDR_NAME_LEN));
+}
+
+
+/* Create the plain file of TAR and write LENGTH bytes of BUFFER to
+   it.  */
+static int
+open_plain (gpa_tar_extract_t tar, const void *buffer, size_t length)
+{
+  /* Never overwrite an existing file.  */
+  tar->plain_fd = g_open (tar->plain_name,
+                          O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+  if (tar->plain_fd == -1)
+    return -1;
+  tar->created = g_slist_prepend (tar->created, g_strdup (tar->plain_name));
+  return write_all (tar->plain_fd, buffer, length);
+}
+
+
+/* Create the directory PATH and its missing parents and remember
+   them as created by TAR.  */
+static int
+make_dirs (gpa_tar_extract_t tar, const gchar *path)
+{
+  gchar *parent;
+  int rc = 0;
+
+  if (g_file_test (path, G_FILE_TEST_IS_DIR))
+    return 0;
+
+  parent = g_path_get_dirname (path);
+  if (strcmp (parent, path))
+    rc = make_dirs (tar, parent);
+  g_free (parent);
+  if (!rc)
+    rc = g_mkdir (path, 0777);
+  if (!rc)
+    tar->created = g_slist_prepend (tar->created, g_strdup (path));
+  return rc;
+}
+
+
+/* Return the path for the archived NAME in R_PATH or NULL if there
+   is nothing to extract.  IS_DIR tells whether NAME is a directory.
+   All names must be below one top-level directory, which is mapped
+   to the directory TOPDIR of TAR; that directory is created for the
+   first entry.  Absolute names, names leaving the top-level directory
+   and any other top-level entry are rejected.  */
+static int
+extract_path (gpa_tar_extract_t tar, const gchar *name, gboolean is_dir,
+              gchar **r_path)
+{
+  GPtrArray *parts;
+  gchar **names;
+  const gchar *top = NULL;
+  int i;
+  int rc = 0;
+
+  *r_path = NULL;
+  if (*name == '/')
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  parts = g_ptr_array_new ();
+  g_ptr_array_add (parts, tar->topdir);
+  names = g_strsplit (name, "/", -1);
+  for (i = 0; names[i]; i++)
+    {
+      if (!*names[i] || g_str_equal (names[i], "."))
+        continue;
+      if (g_str_equal (names[i], "..")
+#ifdef G_OS_WIN32
+          || strchr (names[i], '\\') || strchr (names[i], ':')
+#endif
+          )
+        {
+          errno = EINVAL;
+          rc = -1;
+          break;
+        }
+      if (!top)
+        top = names[i];
+      else
+        g_ptr_array_add (parts, names[i]);
+    }
+
+  if (!rc && top)
+    {
+      if ((parts->len == 1 && !is_dir)
+          || (tar->archived_top && strcmp (top, tar->archived_top)))
+        {
+          /* A file or a second directory at the top level.  */
+          errno = EINVAL;
+          rc = -1;
+        }
+      else if (!tar->archived_top)
+        {
+          /* Never extract into an existing directory.  */
+          rc = g_mkdir (tar->topdir, 0777);
+          if (!rc)
+            {
+              tar->created = g_slist_prepend (tar->created,
+                                              g_strdup (tar->topdir));
+              tar->archived_top = g_strdup (top);
+            }
+        }
+    }
+
+  if (!rc && parts->len > 1)
+    {
+      g_ptr_array_add (parts, NULL);
+      *r_path = g_build_filenamev ((gchar **) parts->pdata);
+    }
+
+  g_strfreev (names);
+  g_ptr_array_free (parts, TRUE);
+  return rc;
+}
+
+
+/* Return the value of the "path" record of the pax header DATA or
+   NULL.  */
+static gchar *
+pax_path (const gchar *data, size_t length)
+{
+  const gchar *end = data + length;
+  const gchar *s;
+  gchar *endp;
+  unsigned long reclen;
+
+  /* Each record is "LENGTH KEY=VALUE\n" with LENGTH covering the
+     whole record.  */
+  while (data < end)
+    {
+      reclen = strtoul (data, &endp, 10);
+      if (reclen < 3 || reclen > (unsigned long) (end - data) || *endp != ' '
+          || data[reclen - 1] != '\n')
+        break;
+      s = endp + 1;
+      if (data + reclen - s > 5 && !strncmp (s, "path=", 5))
+        return g_strndup (s + 5, data + reclen - 1 - (s + 5));
+      data += reclen;
+    }
+  return NULL;
+}
+
+
+/* The data of the current entry has been received.  */
+static int
+finish_entry (gpa_tar_extract_t tar)
+{
+  int rc = 0;
+
+  if (tar->fd != -1)
+    {
+      rc = close (tar->fd);
+      tar->fd = -1;
+    }
+  if (tar->longname)
+    {
+      gchar *name;
+
+      if (tar->pax)
+        name = pax_path (tar->longname->str, tar->longname->len);
+      else
+        name = g_strdup (tar->longname->str);
+      if (name)
+        {
+          g_free (tar->next_name);
+          tar->next_name = name;
+        }
+      g_string_free (tar->longname, TRUE);
+      tar->longname = NULL;
+      tar->pax = FALSE;
+    }
+  return rc;
+}
+
+
+/* Process the header block received by TAR.  */
+static int
+process_header (gpa_tar_extract_t tar)
+{
+  const unsigned char *block = tar->header;
+  guint64 size;
+  unsigned int mode;
+  gchar *name;
+  gchar *path = NULL;
+  int rc = 0;
+  int i;
+
+  for (i = 0; i < BLOCKSIZE && !block[i]; i++)
+    ;
+  if (i == BLOCKSIZE)
+    {
+      if (++tar->zero_blocks == 2)
+        tar->done = TRUE;
+      return 0;
+    }
+  tar->zero_blocks = 0;
+
+  if (parse_number (block + HDR_CHKSUM, 8) != header_checksum (block))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  size = parse_number (block + HDR_SIZE, 12);
+  mode = parse_number (block + HDR_MODE, 8) & 0777;
+
+  if (tar->next_name)
+    {
+      name = tar->next_name;
+      tar->next_name = NULL;
+    }
+  else if (!memcmp (block + HDR_MAGIC, "ustar", 5) && block[HDR_PREFIX])
+    name = g_strdup_printf ("%.*s/%.*s",
+                            HDR_PREFIX_LEN, (const gchar *) block + HDR_PREFIX,
+                            HDR_NAME_LEN, (const gchar *) block + HDR_NAME);
+  else
+    name = g_strndup ((const gchar *) block + HDR_NAME, HDR_NAME_LEN);
+
+  switch (block[HDR_TYPE])
+    {
+    case 'L':
+    case 'x':
+      if (size > MAX_LONGNAME)
+        {
+          errno = ENAMETOOLONG;
+          rc = -1;
+        }
+      else
+        {
+          tar->longname = g_string_sized_new (size);
+          tar->pax = block[HDR_TYPE] == 'x';
+        }
+      break;
+
+    case 'g':
+      /* A pax global header, for example the marker of GPA, is
+         skipped.  */
+      break;
+
+    case '5':
+      rc = extract_path (tar, name, TRUE, &path);
+      if (!rc && path)
+        rc = make_dirs (tar, path);
+      break;
+
+    case '0':
+    case '7':
+    case '\0':
+      rc = extract_path (tar, name, FALSE, &path);
+      if (!rc && path)
+        {
+          gchar *dirname = g_path_get_dirname (path);
+
+          rc = make_dirs (tar, dirname);
+          g_free (dirname);
+          if (!rc)
+            {
+              /* Never overwrite an existing file.  */
+              tar->fd = g_open (path, O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
+                                mode ? mode : 0666);
+              if (tar->fd == -1)
+                rc = -1;
+              else
+                tar->created = g_slist_prepend (tar->created,
+                                                g_strdup (path));
+            }
+        }
+      break;
+
+    default:
+      g_debug ("not extracting `%s' of type %d", name, block[HDR_TYPE]);
+      break;
+    }
+
+  g_free (path);
+  g_free (name);
+  if (rc)
+    return rc;
+
+  tar->remaining = size;
+  tar->padding = PADDING (size);
+  if (!tar->remaining)
+    return finish_entry (tar);
+  return 0;
+}
+
+
+/* The gpgme write callback of an extraction.  */
+static ssize_t
+extract_write_cb (void *handle, const void *buffer, size_t size)
+{
+  gpa_tar_extract_t tar = handle;
+  const char *p = buffer;
+  size_t left = size;
+  size_t n;
+
+  if (tar->plain_fd != -1)
+    return write_all (tar->plain_fd, buffer, size) ? -1 : (ssize_t) size;
+
+  while (left)
+    {
+      if (tar->remaining)
+        {
+          n = MIN (left, tar->remaining);
+          if (tar->longname)
+            g_string_append_len (tar->longname, p, n);
+          else if (tar->fd != -1 && write_all (tar->fd, p, n))
+            return -1;
+          tar->remaining -= n;
+          if (!tar->remaining && finish_entry (tar))
+            return -1;
+        }
+      else if (tar->padding)
+        {
+          n = MIN (left, tar->padding);
+          tar->padding -= n;
+        }
+      else if (tar->done)
+        {
+          /* Ignore what follows the end of the archive.  */
+          n = left;
+        }
+      else
+        {
+          n = MIN (left, BLOCKSIZE - tar->header_len);
+          memcpy (tar->header + tar->header_len, p, n);
+          tar->header_len += n;
+          if (tar->header_len == BLOCKSIZE)
+            {
+              tar->header_len = 0;
+              if (!tar->checked && !is_marker (tar->header))
+                {
+                  /* Not a directory archive made by GPA; write the
+                     data as it is.  */
+                  if (open_plain (tar, tar->header, BLOCKSIZE)
+                      || write_all (tar->plain_fd, p + n, left - n))
+                    return -1;
+                  return size;
+                }
+              tar->checked = TRUE;
+              if (process_header (tar))
+                return -1;
+            }
+        }
+      p += n;
+      left -= n;
+    }
+
+  return size;
+}
+
+
+static struct gpgme_data_cbs extract_cbs =
+  {
+    NULL,
+    extract_write_cb,
+    NULL,
+    NULL
+  };
+
+
+gpg_error_t
+gpa_tar_extract_new (gpa_tar_extract_t *r_tar, gpgme_data_t *r_data,
+                     const gchar *destdir, const gchar *plain_name)
+{
+  gpa_tar_extract_t tar;
+  gchar *base;
+  gpg_error_t err;
+
+  tar = g_malloc0 (sizeof *tar);
+  tar->plain_name = g_strdup (plain_name);
+  base = g_path_get_basename (plain_name);
+  if (g_str_has_suffix (base, ".tar"))
+    base[strlen (base) - 4] = 0;
+  tar->topdir = g_build_filename (destdir, base, NULL);
+  g_free (base);
+  tar->fd = -1;
+  tar->plain_fd = -1;
+
+  err = gpgme_data_new_from_cbs (r_data, &extract_cbs, tar);
+  if (err)
+    {
+      gpa_tar_extract_release (tar);
+      return err;
+    }
+
+  *r_tar = tar;
+  return 0;
+}
+
+
+gpg_error_t
+gpa_tar_extract_finish (gpa_tar_extract_t tar, gchar **r_name)
+{
+  *r_name = NULL;
+
+  if (!tar->checked && tar->plain_fd == -1)
+    {
+      /* Less than a header has been received.  */
+      if (open_plain (tar, tar->header, tar->header_len))
+        return gpg_error_from_syserror ();
+    }
+  if (tar->plain_fd != -1)
+    {
+      int rc = close (tar->plain_fd);
+
+      tar->plain_fd = -1;
+      if (rc)
+        return gpg_error_from_syserror ();
+      *r_name = g_strdup (tar->plain_name);
+      return 0;
+    }
+
+  /* Some tools omit the end of archive marker; only an archive
+     ending within an entry is an error.  */
+  if (tar->remaining || tar->header_len || tar->longname || tar->next_name)
+    return gpg_error (GPG_ERR_TRUNCATED);
+  if (!tar->archived_top)
+    return gpg_error (GPG_ERR_NO_DATA);
+
+  *r_name = g_strdup (tar->topdir);
+  return 0;
+}
+
+
+void
+gpa_tar_extract_remove (gpa_tar_extract_t tar)
+{
+  GSList *item;
+
+  if (tar->fd != -1)
+    close (tar->fd);
+  tar->fd = -1;
+  if (tar->plain_fd != -1)
+    close (tar->plain_fd);
+  tar->plain_fd = -1;
+
+  /* The contents of a directory come before it in the list.  */
+  for (item = tar->created; item; item = g_slist_next (item))
+    if (g_remove (item->data))
+      g_debug ("can't remove `%s': %s",
+               (const gchar *) item->data, strerror (errno));
+  g_slist_free_full (tar->created, g_free);
+  tar->created = NULL;
+}
+
+
+void
+gpa_tar_extract_release (gpa_tar_extract_t tar)
+{
+  if (!tar)
+    return;
+
+  if (tar->fd != -1)
+    close (tar->fd);
+  if (tar->plain_fd != -1)
+    close (tar->plain_fd);
+  g_slist_free_full (tar->created, g_free);
+  g_free (tar->plain_name);
+  if (tar->longname)
+    g_string_free (tar->longname, TRUE);
+  g_free (tar->next_name);
+  g_free (tar->topdir);
+  g_free (tar->archived_top);
+  g_free (tar);
+}
@@ -0,0 +1,65 @@
+/* tarstream.h - Streaming of directory trees as tar archives.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+/* A directory is encrypted as a ustar archive, the format also used
+   by gpgtar.  The archive is created while the engine reads it and
+   extracted while the engine writes the plaintext; it is never
+   stored on disk.  Only directories and regular files are archived;
+   names are stored relative to the parent of the directory.  The
+   archive starts with a pax global header marking it as made by GPA;
+   only such archives are extracted.  */
+
+#ifndef TARSTREAM_H
+#define TARSTREAM_H
+
+#include <glib.h>
+#include <gpgme.h>
+
+/* The state of an extraction.  */
+typedef struct gpa_tar_extract_s *gpa_tar_extract_t;
+
+/* Create in R_DATA a data object reading the directory tree DIRNAME
+   as a tar archive.  */
+gpg_error_t gpa_tar_data_new_from_dir (gpgme_data_t *r_data,
+                                       const gchar *dirname);
+
+/* Create in R_DATA a data object extracting the tar archive written
+   to it into the directory DESTDIR.  The single top-level directory
+   of the archive is extracted as a new directory named after
+   PLAIN_NAME without the ".tar" suffix; archives with other
+   top-level entries are rejected.  Data not starting with the marker
+   of GPA is written unchanged to the file PLAIN_NAME instead.
+   Existing files and directories are not overwritten.  R_DATA must
+   be released before R_TAR.  */
+gpg_error_t gpa_tar_extract_new (gpa_tar_extract_t *r_tar,
+                                 gpgme_data_t *r_data,
+                                 const gchar *destdir,
+                                 const gchar *plain_name);
+
+/* Check that the archive of TAR is complete.  On success the name of
+   the extracted directory, or the name of the plain file, is stored
+   at R_NAME.  */
+gpg_error_t gpa_tar_extract_finish (gpa_tar_extract_t tar, gchar **r_name);
+
+/* Remove the files and directories created by TAR.  */
+void gpa_tar_extract_remove (gpa_tar_extract_t tar);
+
+/* Release TAR.  */
+void gpa_tar_extract_release (gpa_tar_extract_t tar);
+
+#endif /* TARSTREAM_H */
@@ -0,0 +1,547 @@
+/* uibench.c - Benchmark client for the UI server.
+   Copyright (C) 2026 g10 Code GmbH.
+
+   This file is part of GPA
+
+   GPA is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GPA is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+   License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+/* This program runs the same command sequence from several
+   connections to the UI server concurrently and reports the number of
+   operations per second, the latency of the operations and the
+   number of bytes per second.  It is meant to be used with a
+   throwaway GnuPG home directory:
+
+     $ uibench --setup
+     uibench: created /tmp/uibench-XXXXXX
+     $ GNUPGHOME=/tmp/uibench-XXXXXX gpa --daemon &
+     $ uibench --homedir /tmp/uibench-XXXXXX --op encrypt
+
+   The setup creates a key without passphrase for the user ID
+   "uibench <uibench@example.org>".  Before an encrypt benchmark the
+   recipient is prepared with a PREP_ENCRYPT command, for which GPA
+   may ask to confirm the key; the ENCRYPT commands then use the key
+   remembered by the server and run without interaction.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gpgme.h>
+#include <assuan.h>
+
+#define BENCH_UID     "uibench <uibench@example.org>"
+#define BENCH_MAILBOX "<uibench@example.org>"
+
+
+/* The command line options.  */
+static gchar *opt_homedir;
+static gboolean opt_setup;
+static gchar *opt_op = "encrypt";
+static gint opt_connections = 4;
+static gint opt_count = 100;
+static gint opt_size = 16384;
+
+/* The name of the socket of the UI server.  */
+static const char *socket_name;
+
+static GOptionEntry option_entries[] =
+  {
+    { "homedir", 0, 0, G_OPTION_ARG_FILENAME, &opt_homedir,
+      "Use the GnuPG home directory DIR", "DIR" },
+    { "setup", 0, 0, G_OPTION_ARG_NONE, &opt_setup,
+      "Create the benchmark key and exit", NULL },
+    { "op", 0, 0, G_OPTION_ARG_STRING, &opt_op,
+      "Run the operation OP (encrypt, decrypt or verify)", "OP" },
+    { "connections", 'j', 0, G_OPTION_ARG_INT, &opt_connections,
+      "Use N concurrent connections", "N" },
+    { "count", 'n', 0, G_OPTION_ARG_INT, &opt_count,
+      "Run N operations per connection", "N" },
+    { "size", 's', 0, G_OPTION_ARG_INT, &opt_size,
+      "Use messages of N bytes", "N" },
+    { NULL }
+  };
+
+
+/* The benchmarked operations.  */
+enum bench_op
+  {
+    BENCH_ENCRYPT,
+    BENCH_DECRYPT,
+    BENCH_VERIFY
+  };
+
+/* The state of one connection.  */
+struct bench_conn_s
+{
+  int number;
+  enum bench_op op;
+  /* The data sent to the server.  */
+  const char *input;
+  size_t inputlen;
+  /* The latencies of the operations in microseconds.  */
+  gint64 *latencies;
+  int nops;
+  guint64 nbytes;
+  gpg_error_t err;
+};
+typedef struct bench_conn_s *bench_conn_t;
+
+
+
+/* Create the benchmark key in the current home directory.  */
+static gpg_error_t
+create_key (void)
+{
+  gpg_error_t err;
+  gpgme_ctx_t ctx;
+
+  err = gpgme_new (&ctx);
+  if (err)
+    return err;
+  err = gpgme_op_createkey (ctx, BENCH_UID, "default", 0, 0, NULL,
+                            GPGME_CREATE_NOPASSWD | GPGME_CREATE_FORCE);
+  gpgme_release (ctx);
+  return err;
+}
+
+
+/* Return the benchmark key or NULL if it does not exist.  */
+static gpgme_key_t
+get_key (void)
+{
+  gpgme_ctx_t ctx;
+  gpgme_key_t key = NULL;
+
+  if (gpgme_new (&ctx))
+    return NULL;
+  if (! gpgme_op_keylist_start (ctx, BENCH_MAILBOX, 1))
+    gpgme_op_keylist_next (ctx, &key);
+  gpgme_op_keylist_end (ctx);
+  gpgme_release (ctx);
+  return key;
+}
+
+
+/* Create the data for OP from the plaintext PLAIN of length LEN.
+   Returns a malloced buffer and stores its length at R_LEN.  */
+static char *
+make_input (enum bench_op op, gpgme_key_t key, const char *plain, size_t len,
+            size_t *r_len)
+{
+  gpg_error_t err;
+  gpgme_ctx_t ctx;
+  gpgme_data_t in, out;
+  gpgme_key_t keys[2] = { key, NULL };
+  char *buffer;
+
+  if (op == BENCH_ENCRYPT)
+    {
+      *r_len = len;
+      buffer = g_malloc (len);
+      memcpy (buffer, plain, len);
+      return buffer;
+    }
+
+  err = gpgme_new (&ctx);
+  if (err)
+    goto leave;
+  gpgme_data_new_from_mem (&in, plain, len, 0);
+  gpgme_data_new (&out);
+  if (op == BENCH_DECRYPT)
+    err = gpgme_op_encrypt (ctx, keys, GPGME_ENCRYPT_ALWAYS_TRUST, in, out);
+  else
+    {
+      gpgme_signers_add (ctx, key);
+      err = gpgme_op_sign (ctx, in, out, GPGME_SIG_MODE_NORMAL);
+    }
+  gpgme_data_release (in);
+  gpgme_release (ctx);
+  if (err)
+    {
+      gpgme_data_release (out);
+      goto leave;
+    }
+  buffer = gpgme_data_release_and_get_mem (out, r_len);
+  if (buffer)
+    {
+      char *result = g_malloc (*r_len);
+      memcpy (result, buffer, *r_len);
+      gpgme_free (buffer);
+      return result;
+    }
+  err = gpg_error (GPG_ERR_ENOMEM);
+
+ leave:
+  g_printerr ("uibench: error preparing the input: %s\n",
+              gpg_strerror (err));
+  exit (1);
+}
+
+
+/* Return the file descriptor of a new unlinked temporary file.  */
+static int
+open_tmpfile (void)
+{
+  gchar *fname;
+  int fd;
+
+  fd = g_file_open_tmp ("uibench-XXXXXX", &fname, NULL);
+  if (fd != -1)
+    {
+      g_unlink (fname);
+      g_free (fname);
+    }
+  return fd;
+}
+
+
+/* Write all LEN bytes of BUFFER to FD.  */
+static int
+write_all (int fd, const char *buffer, size_t len)
+{
+  ssize_t n;
+
+  while (len)
+    {
+      n = write (fd, buffer, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return -1;
+      buffer += n;
+      len -= n;
+    }
+  return 0;
+}
+
+
+/* Pass FD to the server as the file descriptor of the command CMD.
+   The server reads respectively writes the file from the start.  */
+static gpg_error_t
+send_fd (assuan_context_t ctx, int fd, const char *cmd)
+{
+  gpg_error_t err;
+
+  if (lseek (fd, 0, SEEK_SET) == (off_t) -1)
+    return gpg_error_from_syserror ();
+  err = assuan_sendfd (ctx, fd);
+  if (! err)
+    err = assuan_transact (ctx, cmd, NULL, NULL, NULL, NULL, NULL, NULL);
+  return err;
+}
+
+
+/* Run one operation on CTX.  */
+static gpg_error_t
+run_op (bench_conn_t conn, assuan_context_t ctx, int infd, int outfd)
+{
+  gpg_error_t err;
+  const char *cmd;
+  off_t size;
+
+  if (ftruncate (outfd, 0))
+    return gpg_error_from_syserror ();
+
+  if (conn->op == BENCH_ENCRYPT)
+    {
+      err = assuan_transact (ctx, "RECIPIENT " BENCH_MAILBOX,
+                             NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        return err;
+      cmd = "ENCRYPT --protocol=OpenPGP";
+    }
+  else if (conn->op == BENCH_DECRYPT)
+    cmd = "DECRYPT --protocol=OpenPGP";
+  else
+    cmd = "VERIFY --protocol=OpenPGP --silent";
+
+  err = send_fd (ctx, infd, "INPUT FD");
+  if (! err)
+    err = send_fd (ctx, outfd, "OUTPUT FD");
+  if (! err)
+    err = assuan_transact (ctx, cmd, NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  size = lseek (outfd, 0, SEEK_END);
+  if (size > 0)
+    conn->nbytes += size;
+  conn->nbytes += conn->inputlen;
+  return 0;
+}
+
+
+/* Let the server select and remember the key for the benchmark
+   recipient before the ENCRYPT commands are run.  */
+static gpg_error_t
+prepare_recipient (void)
+{
+  gpg_error_t err;
+  assuan_context_t ctx = NULL;
+
+  err = assuan_new (&ctx);
+  if (! err)
+    err = assuan_socket_connect (ctx, socket_name, 0, 0);
+  if (! err)
+    err = assuan_transact (ctx, "RECIPIENT " BENCH_MAILBOX,
+                           NULL, NULL, NULL, NULL, NULL, NULL);
+  if (! err)
+    err = assuan_transact (ctx, "PREP_ENCRYPT --protocol=OpenPGP",
+                           NULL, NULL, NULL, NULL, NULL, NULL);
+  assuan_release (ctx);
+  return err;
+}
+
+
+/* The thread function running the operations of one connection.  */
+static gpointer
+run_connection (gpointer data)
+{
+  bench_conn_t conn = data;
+  gpg_error_t err;
+  assuan_context_t ctx = NULL;
+  int infd = -1;
+  int outfd = -1;
+  char *line;
+
+  infd = open_tmpfile ();
+  outfd = open_tmpfile ();
+  if (infd == -1 || outfd == -1
+      || write_all (infd, conn->input, conn->inputlen))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  err = assuan_new (&ctx);
+  if (! err)
+    err = assuan_socket_connect (ctx, socket_name, 0, 0);
+  if (err)
+    goto leave;
+
+  line = g_strdup_printf ("SESSION %d uibench", conn->number + 1);
+  err = assuan_transact (ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  g_free (line);
+  if (err)
+    goto leave;
+
+  for (conn->nops = 0; conn->nops < opt_count; conn->nops++)
+    {
+      gint64 start = g_get_monotonic_time ();
+
+      err = run_op (conn, ctx, infd, outfd);
+      if (err)
+        goto leave;
+      conn->latencies[conn->nops] = g_get_monotonic_time () - start;
+    }
+
+ leave:
+  conn->err = err;
+  assuan_release (ctx);
+  if (infd != -1)
+    close (infd);
+  if (outfd != -1)
+    close (outfd);
+  return NULL;
+}
+
+
+static int
+compare_latencies (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+/* Return the latency at PERCENT percent of the sorted array
+   LATENCIES of length N in milliseconds.  */
+static double
+percentile (gint64 *latencies, int n, int percent)
+{
+  int idx = (n * percent + 99) / 100 - 1;
+
+  if (idx < 0)
+    idx = 0;
+  return latencies[idx] / 1000.0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  enum bench_op op;
+  gpgme_key_t key;
+  char *plain;
+  char *input;
+  size_t inputlen;
+  struct bench_conn_s *conns;
+  GThread **threads;
+  gint64 *latencies;
+  int nlatencies;
+  guint64 nbytes;
+  gint64 start;
+  double seconds;
+  int i;
+
+  context = g_option_context_new ("- benchmark the GPA UI server");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (! g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("uibench: %s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (! strcmp (opt_op, "encrypt"))
+    op = BENCH_ENCRYPT;
+  else if (! strcmp (opt_op, "decrypt"))
+    op = BENCH_DECRYPT;
+  else if (! strcmp (opt_op, "verify"))
+    op = BENCH_VERIFY;
+  else
+    {
+      g_printerr ("uibench: invalid operation `%s'\n", opt_op);
+      return 2;
+    }
+  if (opt_connections < 1 || opt_count < 1 || opt_size < 0)
+    {
+      g_printerr ("uibench: invalid number\n");
+      return 2;
+    }
+
+  if (opt_setup && ! opt_homedir)
+    {
+      opt_homedir = g_dir_make_tmp ("uibench-XXXXXX", &error);
+      if (! opt_homedir)
+        {
+          g_printerr ("uibench: %s\n", error->message);
+          return 1;
+        }
+      g_print ("uibench: created %s\n", opt_homedir);
+    }
+  if (opt_homedir)
+    g_setenv ("GNUPGHOME", opt_homedir, TRUE);
+
+  gpgme_check_version (NULL);
+  assuan_set_gpg_err_source (GPG_ERR_SOURCE_DEFAULT);
+  assuan_sock_init ();
+  socket_name = gpgme_get_dirinfo ("uiserver-socket");
+
+  key = get_key ();
+  if (opt_setup)
+    {
+      gpg_error_t err = 0;
+
+      if (! key)
+        err = create_key ();
+      if (err)
+        {
+          g_printerr ("uibench: error creating the key: %s\n",
+                      gpg_strerror (err));
+          return 1;
+        }
+      return 0;
+    }
+  if (! key)
+    {
+      g_printerr ("uibench: no key for %s - use --setup first\n", BENCH_UID);
+      return 1;
+    }
+
+  plain = g_malloc (opt_size);
+  for (i = 0; i < opt_size; i++)
+    plain[i] = "abcdefghijklmnopqrstuvwxyz\n"[g_random_int_range (0, 27)];
+  input = make_input (op, key, plain, opt_size, &inputlen);
+  g_free (plain);
+  gpgme_key_unref (key);
+
+  if (op == BENCH_ENCRYPT)
+    {
+      gpg_error_t err = prepare_recipient ();
+
+      if (err)
+        {
+          g_printerr ("uibench: error preparing the recipient: %s\n",
+                      gpg_strerror (err));
+          return 1;
+        }
+    }
+
+  conns = g_new0 (struct bench_conn_s, opt_connections);
+  threads = g_new0 (GThread *, opt_connections);
+  start = g_get_monotonic_time ();
+  for (i = 0; i < opt_connections; i++)
+    {
+      conns[i].number = i;
+      conns[i].op = op;
+      conns[i].input = input;
+      conns[i].inputlen = inputlen;
+      conns[i].latencies = g_new0 (gint64, opt_count);
+      threads[i] = g_thread_new ("uibench", run_connection, &conns[i]);
+    }
+
+  latencies = g_new (gint64, opt_connections * opt_count);
+  nlatencies = 0;
+  nbytes = 0;
+  for (i = 0; i < opt_connections; i++)
+    {
+      g_thread_join (threads[i]);
+      if (conns[i].err)
+        g_printerr ("uibench: connection %d failed after %d operations: %s\n",
+                    i + 1, conns[i].nops, gpg_strerror (conns[i].err));
+      memcpy (latencies + nlatencies, conns[i].latencies,
+              conns[i].nops * sizeof *latencies);
+      nlatencies += conns[i].nops;
+      nbytes += conns[i].nbytes;
+      g_free (conns[i].latencies);
+    }
+  seconds = (g_get_monotonic_time () - start) / 1000000.0;
+  g_free (threads);
+  g_free (conns);
+  g_free (input);
+
+  if (! nlatencies)
+    {
+      g_printerr ("uibench: no operation succeeded\n");
+      return 1;
+    }
+
+  qsort (latencies, nlatencies, sizeof *latencies, compare_latencies);
+  printf ("operation:   %s\n"
+          "connections: %d\n"
+          "operations:  %d in %.2f s\n"
+          "ops/s:       %.1f\n"
+          "latency p50: %.2f ms\n"
+          "latency p99: %.2f ms\n"
+          "bytes/s:     %.0f\n",
+          opt_op, opt_connections, nlatencies, seconds,
+          nlatencies / seconds,
+          percentile (latencies, nlatencies, 50),
+          percentile (latencies, nlatencies, 99),
+          nbytes / seconds);
+  g_free (latencies);
+
+  return nlatencies == opt_connections * opt_count ? 0 : 1;
+}
@@ -36,6 +36,9 @@ enum
   PROP_WINDOW,
 };
 
+/* The number of files of a batch shown on a page of their own.  */
+#define MAX_FILE_PAGES 50
+
 static GObjectClass *parent_class = NULL;
 
 static void
@@ -84,6 +87,8 @@ gpa_file_verify_dialog_finalize (GObject *object)
   GpaFileVerifyDialog *dialog = GPA_FILE_VERIFY_DIALOG (object);
 
   g_object_unref (dialog->ctx);
+  if (dialog->summary)
+    g_object_unref (dialog->summary);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -196,6 +201,14 @@ typedef struct
   char *keydesc;
 } SignatureData;
 
+typedef enum
+{
+  SUMMARY_FILE_COLUMN,
+  SUMMARY_STATUS_COLUMN,
+  SUMMARY_DETAILS_COLUMN,
+  SUMMARY_N_COLUMNS
+} SummaryListColumn;
+
 typedef enum
 {
   SIG_KEYID_COLUMN,
@@ -321,6 +334,47 @@ fill_sig_model (GtkListStore *store, gpgme_signature_t sigs,
 }
 
 
+/* Add a line for FILENAME with the signatures SIGS to the summary.
+   The status of the first signature which is not valid is shown.
+   The key is not looked up here to keep large batches fast.  */
+static void
+add_file_to_summary (GpaFileVerifyDialog *dialog, const gchar *filename,
+		     gpgme_signature_t sigs)
+{
+  GtkTreeIter iter;
+  SignatureData data;
+  gpgme_signature_t sig;
+  const gchar *keyid = "";
+  gchar *status;
+
+  for (sig = sigs; sig; sig = sig->next)
+    if (!(sig->summary & GPGME_SIGSUM_VALID))
+      break;
+  if (!sig)
+    sig = sigs;
+
+  if (sig)
+    {
+      memset (&data, 0, sizeof data);
+      data.summary = sig->summary;
+      status = signature_status_label (&data);
+      if (sig->fpr && strlen (sig->fpr) > 8)
+	keyid = sig->fpr + strlen (sig->fpr) - 8;
+    }
+  else
+    status = g_strdup_printf ("<span foreground=\"orange\" weight=\"bold\">"
+			      "%s</span>", _("No signature"));
+
+  gtk_list_store_append (dialog->summary, &iter);
+  gtk_list_store_set (dialog->summary, &iter,
+		      SUMMARY_FILE_COLUMN, filename,
+		      SUMMARY_STATUS_COLUMN, status,
+		      SUMMARY_DETAILS_COLUMN, keyid,
+		      -1);
+  g_free (status);
+}
+
+
 /* Create the list of signatures */
 static GtkWidget *
 signature_list (gpgme_signature_t sigs, gpgme_ctx_t ctx)
@@ -437,9 +491,112 @@ void gpa_file_verify_dialog_add_file (GpaFileVerifyDialog *dialog,
 {
   GtkWidget *page;
 
+  if (dialog->summary)
+    {
+      add_file_to_summary (dialog, filename, sigs);
+      if (dialog->n_file_pages >= MAX_FILE_PAGES)
+	return;
+      dialog->n_file_pages++;
+    }
+
   page = verify_file_page (sigs, signed_file, signature_file,
 			   dialog->ctx->ctx);
 
   gtk_notebook_append_page (GTK_NOTEBOOK (dialog->notebook), page,
 			    gtk_label_new (filename));
 }
+
+
+void
+gpa_file_verify_dialog_set_batch (GpaFileVerifyDialog *dialog)
+{
+  GtkTreeViewColumn *column;
+  GtkCellRenderer *renderer;
+  GtkWidget *vbox;
+  GtkWidget *list;
+  GtkWidget *scrolled;
+
+  g_return_if_fail (GPA_IS_FILE_VERIFY_DIALOG (dialog));
+  if (dialog->summary)
+    return;
+
+  dialog->summary = gtk_list_store_new (SUMMARY_N_COLUMNS, G_TYPE_STRING,
+					G_TYPE_STRING, G_TYPE_STRING);
+
+  vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
+  gtk_container_set_border_width (GTK_CONTAINER (vbox), 5);
+
+  dialog->summary_label = gtk_label_new (NULL);
+  gtk_widget_set_halign (dialog->summary_label, GTK_ALIGN_START);
+  gtk_box_pack_start (GTK_BOX (vbox), dialog->summary_label, FALSE, FALSE, 0);
+
+  list = gtk_tree_view_new_with_model (GTK_TREE_MODEL (dialog->summary));
+  gtk_widget_set_size_request (list, 400, 200);
+
+  renderer = gtk_cell_renderer_text_new ();
+  column = gtk_tree_view_column_new_with_attributes (_("File"), renderer,
+						     "text",
+						     SUMMARY_FILE_COLUMN,
+						     NULL);
+  gtk_tree_view_append_column (GTK_TREE_VIEW (list), column);
+
+  renderer = gtk_cell_renderer_text_new ();
+  column = gtk_tree_view_column_new_with_attributes (_("Status"), renderer,
+						     "markup",
+						     SUMMARY_STATUS_COLUMN,
+						     NULL);
+  gtk_tree_view_append_column (GTK_TREE_VIEW (list), column);
+
+  renderer = gtk_cell_renderer_text_new ();
+  column = gtk_tree_view_column_new_with_attributes (_("Details"), renderer,
+						     "text",
+						     SUMMARY_DETAILS_COLUMN,
+						     NULL);
+  gtk_tree_view_append_column (GTK_TREE_VIEW (list), column);
+
+  scrolled = gtk_scrolled_window_new (NULL, NULL);
+  gtk_scrolled_window_set_shadow_type (GTK_SCROLLED_WINDOW (scrolled),
+                                       GTK_SHADOW_IN);
+  gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled),
+                                  GTK_POLICY_AUTOMATIC,
+                                  GTK_POLICY_AUTOMATIC);
+  gtk_container_add (GTK_CONTAINER (scrolled), list);
+  gtk_box_pack_start (GTK_BOX (vbox), scrolled, TRUE, TRUE, 0);
+
+  gtk_notebook_prepend_page (GTK_NOTEBOOK (dialog->notebook), vbox,
+			     gtk_label_new (_("Summary")));
+}
+
+
+void
+gpa_file_verify_dialog_add_error (GpaFileVerifyDialog *dialog,
+				  const gchar *filename,
+				  gpg_error_t err)
+{
+  GtkTreeIter iter;
+  gchar *status;
+
+  g_return_if_fail (GPA_IS_FILE_VERIFY_DIALOG (dialog));
+  g_return_if_fail (dialog->summary);
+
+  status = g_strdup_printf ("<span foreground=\"red\" weight=\"bold\">"
+			    "%s</span>", _("Error"));
+  gtk_list_store_append (dialog->summary, &iter);
+  gtk_list_store_set (dialog->summary, &iter,
+		      SUMMARY_FILE_COLUMN, filename,
+		      SUMMARY_STATUS_COLUMN, status,
+		      SUMMARY_DETAILS_COLUMN, gpg_strerror (err),
+		      -1);
+  g_free (status);
+}
+
+
+void
+gpa_file_verify_dialog_set_summary (GpaFileVerifyDialog *dialog,
+				    const gchar *text)
+{
+  g_return_if_fail (GPA_IS_FILE_VERIFY_DIALOG (dialog));
+
+  if (dialog->summary_label)
+    gtk_label_set_text (GTK_LABEL (dialog->summary_label), text);
+}
@@ -43,6 +43,12 @@ struct _GpaFileVerifyDialog {
   GtkWidget *notebook;
   /* Context for retrieving signature's keys */
   GpaContext *ctx;
+
+  /* The summary of a batch with one line per file, the label showing
+     the throughput and the number of pages for single files.  */
+  GtkListStore *summary;
+  GtkWidget *summary_label;
+  guint n_file_pages;
 };
 
 struct _GpaFileVerifyDialogClass {
@@ -64,4 +70,17 @@ void gpa_file_verify_dialog_add_file (GpaFileVerifyDialog *dialog,
 				      const gchar *signature_file,
 				      gpgme_signature_t sigs);
 
+/* Add a summary page listing all files of a batch.  Only the first
+   files get a page of their own then.  */
+void gpa_file_verify_dialog_set_batch (GpaFileVerifyDialog *dialog);
+
+/* Report the error ERR for FILENAME in the summary.  */
+void gpa_file_verify_dialog_add_error (GpaFileVerifyDialog *dialog,
+				       const gchar *filename,
+				       gpg_error_t err);
+
+/* Show TEXT at the top of the summary.  */
+void gpa_file_verify_dialog_set_summary (GpaFileVerifyDialog *dialog,
+					 const gchar *text);
+
 #endif